@@ -205,7 +205,7 @@ JsonNode *json_value(char* s, char** tail, GError** error)
             }
             if(s[0]=='-')s++;
             while (g_ascii_isdigit(s[0])) s++;
-            if(s[0]=='.'){// вещественное число
+            if(s[0]=='.' || s[0]=='e' || s[0]=='E'){// вещественное число, 1e-06
                 js = json_new(JSON_FLOAT);
                 js->value.f = g_ascii_strtod(ref, &s);
             } else {// целое число
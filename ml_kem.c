@@ -38,6 +38,10 @@ API:
 * K_PKE_Encrypt()
 * K_PKE_Decrypt()
 
+Пакетный режим (throughput), KECCAK_XN=8 ключей на AVX-512, 4 на AVX2, см. \ref _mlkem_xN:
+* ML_KEM_KeyGen_xN()
+* ML_KEM_Encaps_xN()
+
 -- функции шифрования не предполагается использовать вне процедуры KEM. 
 
 
@@ -52,6 +56,7 @@ API:
 
 тестирование:
 $ gcc -DTEST_NTT -march=native -O3 -o test ml_kem.c shake256.c
+$ gcc -DTEST_BENCH -march=native -O3 -o bench ml_kem.c shake256.c -lm -- замер примитивов, медиана/p99, dudect, см. qnn_bench.h
 $ echo "" | gcc -dM -E - -march=native 
 
 Ряд простых чисел $q=a 2^s +1$, где a-простое число, для которых работает:
@@ -73,6 +78,7 @@ Shoup q=19457 (0x4c01) a= 19 s=10 w=(b*0xd7915fc6uLL)>>30 zeta=89
 2. Обратимость ByteDecode/ByteEncode для 1,2,3,12
 3. Обратимость NTT/iNTT
 4. Обратимость операции шифрования и расшифрования PKE
+5. Совпадение Keccak x8 и SampleNTT_xN со скалярной версией, ML_KEM_Encaps_xN -> K_PKE_Decrypt
 
 A[i,j] = SampleNTT(rho, i,j) 
 s^T \circ A^T \circ A \circ s;
@@ -127,7 +133,11 @@ typedef  int16_t  int16x2_t __attribute__((vector_size(4)));
 typedef uint16_t uint16x8_t  __attribute__((vector_size(16)));
 typedef uint16_t uint16x16_t __attribute__((vector_size(32)));
 typedef uint16_t uint16x32_t __attribute__((vector_size(64)));
+typedef  int16_t  int16x8_t  __attribute__((vector_size(16)));
+typedef  int16_t  int16x16_t __attribute__((vector_size(32)));
 typedef  int16_t  int16x32_t __attribute__((vector_size(64)));
+// выравнивание полиномов uint16x2_t[N/2] под загрузку векторами uint16xVL_t
+#define POLY_ALIGN __attribute__((aligned(64)))
 
 /*! Алгоритм заменяет целочисленное деление на модуль на умножение (mul_hi) и сдвиг. 
 
@@ -430,6 +440,7 @@ void NTT_GS_butterfly_2xVL(uint16x32_t *f_, const uint16x32_t z, const uint16x32
 }
 #elif VL==16
 typedef uint16x16_t uint16xVL_t;
+typedef  int16x16_t  int16xVL_t;
 #define VSET1(x) {x,x,x,x, x,x,x,x, x,x,x,x, x,x,x,x}
 static inline uint16x16_t VROTL(uint16x16_t a, uint16x16_t b){
     return __builtin_shufflevector(a,b, 31, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14);
@@ -551,6 +562,7 @@ void NTT_GS_butterfly_2xVL(uint16x16_t *f_, const uint16x16_t z, const uint16x16
 }
 #elif VL==8
 #define uint16xVL_t uint16x8_t
+#define  int16xVL_t  int16x8_t
 #define VSET1(x) {x,x,x,x, x,x,x,x}
 static inline uint16x8_t VROTL(uint16x8_t a, uint16x8_t b){
     return __builtin_shufflevector(a,b, 15,0,1,2, 3,4,5,6);
@@ -777,6 +789,26 @@ static void poly_sub(uint16x2_t *r_, const uint16x2_t *a_, const uint16x2_t *b_)
         r[i] = VSUBM(a[i], b[i], p);
     }
 }
+/*! \brief Переводит полином из внешнего представления во внутреннее, см. V(), 
+    для всех блоков по 2*VL коэффициентов. В таком виде полином возвращает NTT() */
+static uint16x2_t* poly_V(uint16x2_t *a){
+    for (int off=0; off<N/2; off+=VL)
+        V(a+off);
+    return a;
+}
+/*! \brief Обратное преобразование к poly_V(), используется перед ByteEncode() */
+static uint16x2_t* poly_iV(uint16x2_t *a){
+    uint16_t t[2*VL];
+    uint16_t *f = (uint16_t*)a;
+    for (int off=0; off<N; off+=2*VL){
+        for (int i=0; i<VL; i++){
+            t[2*i  ] = f[off+i];
+            t[2*i+1] = f[off+VL+i];
+        }
+        __builtin_memcpy(f+off, t, sizeof(t));
+    }
+    return a;
+}
 static void poly_mul(uint16x2_t *r, const uint16x2_t *a, const uint16_t *b)
 {
     vec_mulm_u(r, a, b[N-1], N);
@@ -871,7 +903,7 @@ void SampleNTT(uint16_t *a, uint8_t *b, int i, int j){
         d1 = (c>>n) & mask;
         if (d0<Q_PRIME) {
             a[j++] = d0;
-        } else
+        }
         if (d1<Q_PRIME && j<N) {
             a[j++] = d1;
         }
@@ -886,7 +918,7 @@ static uint32_t sum_bits(uint8_t *b, int offs, int eta) {
     return bit_sum;
 }
 static inline uint16_t _subm(uint16_t a, uint16_t b, uint32_t q){
-    return (a-b)%q;
+    return (a+q-b)%q;
 }
 /*! \brief Algorithm 8 SamplePolyCBD_𝜂 (𝐵) -- Sampling from the centered binomial distribution.
 Takes a seed as input and outputs a pseudorandom sample from the distribution D𝜂(𝑅𝑞). */
@@ -966,7 +998,7 @@ else {
 }
 
 
-static uint16_t zeta2[] = {// степени zeta^{2 BitRev(i)+1} mod q
+static uint16_t zeta2[] POLY_ALIGN = {// степени zeta^{2 BitRev(i)+1} mod q
   17, 3312,2761,  568, 583, 2746,2649,  680,
 1637, 1692, 723, 2606,2288, 1041,1100, 2229,
 1409, 1920,2662,  667,3281,   48, 233, 3096,
@@ -984,7 +1016,7 @@ static uint16_t zeta2[] = {// степени zeta^{2 BitRev(i)+1} mod q
 1722, 1607,1212, 2117,1874, 1455,1029, 2300,
 2110, 1219,2935,  394, 885, 2444,2154, 1175,
 };
-static uint16_t wzeta2[]= {// w = (z<<16)/q - коэффициенты для Shoup's multiplication
+static uint16_t wzeta2[] POLY_ALIGN = {// w = (z<<16)/q - коэффициенты для Shoup's multiplication
   334,65201,54354,11181,11477,54058,52149,13386,
 32226,33309,14233,51302,45042,20493,21655,43880,
 27738,37797,52405,13130,64591,  944, 4586,60949,
@@ -1177,12 +1209,12 @@ uint8_t* K_PKE_KeyGen(uint8_t* ek_PKE, uint8_t* dk_PKE, uint8_t* d,
     dv -- размер вектора v
 */
 uint8_t* K_PKE_Decrypt(uint8_t* m, uint8_t* ct, uint8_t* dk_PKE, int k, int du, int dv){
-    uint16x2_t u[N/2], s[N/2], v[N/2], w[N/2] = {0};
+    uint16x2_t u[N/2] POLY_ALIGN, s[N/2] POLY_ALIGN, v[N/2] POLY_ALIGN, w[N/2] POLY_ALIGN = {0};
     for (int i=0; i<k; i++){
         Decompress(ByteDecode((uint16_t*)u,ct+(N*du/8)*i,du), du);
         NTT(u);
         ByteDecode((uint16_t*)s, dk_PKE+(N*12/8)*i, 12);
-        MultiplyNTTs(u, u, V(s), 1);
+        MultiplyNTTs(u, u, poly_V(s), 1);
         poly_add(w, w, u);// операция dot product
     }
     Decompress(ByteDecode((uint16_t*)v,ct+(N*du/8)*k, dv), dv);
@@ -1297,8 +1329,349 @@ uint8_t* ML_KEN_Decaps_internal(uint8_t *ss, uint8_t* ct, uint8_t* dk,  uint8_t
     return ss;
 }
 #endif
+/*! \defgroup _mlkem_xN Пакетный режим ML-KEM: несколько независимых обменов ключами одновременно
+
+    Генерация ключей и инкапсуляция выполняются для KECCAK_XN независимых ключей в lock-step.
+    Хэш-функции SHAKE128/SHAKE256/SHA3 считаются одновременно для всех ключей: состояние Keccak-f[1600]
+    хранится в векторах uint64xXN_t, каждый элемент вектора - отдельное состояние (multi-buffer).
+    На AVX-512 - 8 состояний, на AVX2 - 4 состояния.
+
+    Основное время скалярной реализации уходит на SampleNTT() и PRF(): k^2 и 2k+1 вызовов XOF на ключ.
+    Арифметика полиномов остается прежней, она векторизована внутри полинома.
+
+    API:
+    * shake128_xN(), shake256_xN(), sha3_256_xN(), sha3_512_xN() -- хэш для KECCAK_XN сообщений одинаковой длины
+    * SampleNTT_xN(), PRF_xN() -- пакетные версии SampleNTT() и PRF()
+    * ML_KEM_KeyGen_xN() -- Алгоритм 16 для KECCAK_XN ключей
+    * ML_KEM_Encaps_xN() -- Алгоритм 17 для KECCAK_XN ключей
+ */
+#if defined(__AVX512F__)
+#define KECCAK_XN 8
+#elif defined(__AVX2__)
+#define KECCAK_XN 4
+#else
+#define KECCAK_XN 2
+#endif
+typedef uint64_t uint64xXN_t __attribute__((vector_size(8*KECCAK_XN)));
+
+static const uint64_t keccak_rc[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL,
+};
+// смещения циклического сдвига rho[x+5y]
+static const uint8_t keccak_rho[25] = {
+     0,  1, 62, 28, 27,
+    36, 44,  6, 55, 20,
+     3, 10, 43, 25, 39,
+    41, 45, 15, 21,  8,
+    18,  2, 61, 56, 14,
+};
+static inline uint64xXN_t ROTL64xN(uint64xXN_t x, const int n){
+    return n==0? x: (x<<n)|(x>>(64-n));
+}
+/*! \brief Перестановка Keccak-f[1600] для KECCAK_XN независимых состояний
+    \param A состояние, A[x+5y] - слово (x,y) всех состояний
+ */
+static void KeccakF1600_xN(uint64xXN_t *A){
+    uint64xXN_t B[25], C[5], D;
+    for (int r=0; r<24; r++){
+        // theta
+#pragma GCC unroll 5
+        for (int x=0; x<5; x++)
+            C[x] = A[x]^A[x+5]^A[x+10]^A[x+15]^A[x+20];
+#pragma GCC unroll 5
+        for (int x=0; x<5; x++){
+            D = C[(x+4)%5] ^ ROTL64xN(C[(x+1)%5], 1);
+#pragma GCC unroll 5
+            for (int y=0; y<25; y+=5)
+                A[x+y] ^= D;
+        }
+        // rho, pi
+#pragma GCC unroll 5
+        for (int x=0; x<5; x++)
+#pragma GCC unroll 5
+        for (int y=0; y<5; y++)
+            B[y+5*((2*x+3*y)%5)] = ROTL64xN(A[x+5*y], keccak_rho[x+5*y]);
+        // chi
+#pragma GCC unroll 5
+        for (int y=0; y<25; y+=5)
+#pragma GCC unroll 5
+        for (int x=0; x<5; x++)
+            A[x+y] = B[x+y] ^ (~B[(x+1)%5+y] & B[(x+2)%5+y]);
+        // iota
+        A[0] ^= keccak_rc[r];
+    }
+}
+typedef struct _XOF_ctx_xN XOFxN_ctx_t;
+struct _XOF_ctx_xN {
+    uint64xXN_t S[25];
+    unsigned int rate;// длина блока в байтах
+    unsigned int tlen;// число байт, выданных из текущего блока
+};
+/*! \brief Поглощение сообщений одинаковой длины с дополнением pad10*1
+    \param rate длина блока: 168 - SHAKE128, 136 - SHAKE256 и SHA3-256, 72 - SHA3-512
+    \param pad  суффикс домена: 0x1F - SHAKE, 0x06 - SHA3
+ */
+static void XOF_absorb_xN(XOFxN_ctx_t* ctx, unsigned int rate, uint8_t pad, uint8_t* const data[], size_t len){
+    uint64_t blk[KECCAK_XN][200/8];
+    __builtin_memset(ctx->S, 0, sizeof(ctx->S));
+    ctx->rate = rate;
+    size_t offs = 0;
+    while (1) {
+        size_t n = (len-offs < rate)? len-offs: rate;
+        for (int l=0; l<KECCAK_XN; l++){
+            __builtin_memset(blk[l], 0, rate);
+            __builtin_memcpy(blk[l], data[l]+offs, n);
+            if (n<rate) {
+                ((uint8_t*)blk[l])[n]      ^= pad;
+                ((uint8_t*)blk[l])[rate-1] ^= 0x80;
+            }
+        }
+        for (int w=0; w<rate/8; w++)
+        for (int l=0; l<KECCAK_XN; l++)
+            ctx->S[w][l] ^= blk[l][w];
+        KeccakF1600_xN(ctx->S);
+        offs += n;
+        if (n<rate) break;
+    }
+    ctx->tlen = 0;
+}
+/*! \brief Выдача len байт для каждого состояния */
+static void XOF_squeeze_xN(XOFxN_ctx_t* ctx, uint8_t* const data[], size_t len){
+    uint64_t blk[KECCAK_XN][200/8];
+    size_t offs = 0;
+    while (offs<len){
+        if (ctx->tlen == ctx->rate){
+            KeccakF1600_xN(ctx->S);
+            ctx->tlen = 0;
+        }
+        size_t n = ctx->rate - ctx->tlen;
+        if (n > len-offs) n = len-offs;
+        for (int w=ctx->tlen/8; w<(ctx->tlen+n+7)/8; w++)
+        for (int l=0; l<KECCAK_XN; l++)
+            blk[l][w] = ctx->S[w][l];
+        for (int l=0; l<KECCAK_XN; l++)
+            __builtin_memcpy(data[l]+offs, (uint8_t*)blk[l]+ctx->tlen, n);
+        ctx->tlen += n;
+        offs += n;
+    }
+}
+void shake128_xN(uint8_t* const data[], size_t len, uint8_t* const tag[], int d){
+    XOFxN_ctx_t ctx;
+    XOF_absorb_xN(&ctx, 168, 0x1F, data, len);
+    XOF_squeeze_xN(&ctx, tag, d);
+}
+void shake256_xN(uint8_t* const data[], size_t len, uint8_t* const tag[], int d){
+    XOFxN_ctx_t ctx;
+    XOF_absorb_xN(&ctx, 136, 0x1F, data, len);
+    XOF_squeeze_xN(&ctx, tag, d);
+}
+void sha3_256_xN(uint8_t* const data[], size_t len, uint8_t* const tag[]){
+    XOFxN_ctx_t ctx;
+    XOF_absorb_xN(&ctx, 136, 0x06, data, len);
+    XOF_squeeze_xN(&ctx, tag, 32);
+}
+void sha3_512_xN(uint8_t* const data[], size_t len, uint8_t* const tag[]){
+    XOFxN_ctx_t ctx;
+    XOF_absorb_xN(&ctx, 72, 0x06, data, len);
+    XOF_squeeze_xN(&ctx, tag, 64);
+}
+/*! \brief Выборка коэффициентов из потока XOF, см. Algorithm 7
+    \param j число уже полученных коэффициентов
+    \return число коэффициентов после разбора
+ */
+static int _sample_ntt(uint16_t *a, int j, const uint8_t *c, size_t len){
+    for (size_t i=0; i+3<=len && j<N; i+=3){
+        uint16_t d0 = (c[i  ]   ) | (c[i+1]&0xF)<<8;
+        uint16_t d1 = (c[i+1]>>4) | (c[i+2]    )<<4;
+        if (d0<Q_PRIME) a[j++] = d0;
+        if (d1<Q_PRIME && j<N) a[j++] = d1;
+    }
+    return j;
+}
+/*! \brief Algorithm 7 SampleNTT(𝐵) для KECCAK_XN ключей
+    \param a выходные полиномы, по одному на ключ
+    \param b затравка rho 32 байта для каждого ключа
+    \param i,j индексы элемента матрицы, общие для всех ключей
+ */
+void SampleNTT_xN(uint16_t *a[], uint8_t* const b[], int i, int j){
+    uint8_t seed[KECCAK_XN][34];
+    uint8_t buf [KECCAK_XN][3*168];
+    uint8_t *sp[KECCAK_XN], *bp[KECCAK_XN];
+    int cnt[KECCAK_XN];
+    for (int l=0; l<KECCAK_XN; l++){
+        __builtin_memcpy(seed[l], b[l], 32);
+        seed[l][32] = i;
+        seed[l][33] = j;
+        sp[l] = seed[l];
+        bp[l] = buf[l];
+        cnt[l] = 0;
+    }
+    XOFxN_ctx_t ctx;
+    XOF_absorb_xN(&ctx, 168, 0x1F, sp, 34);
+    size_t len = 3*168;// 3 блока обычно достаточно для N коэффициентов
+    int done;
+    do {
+        XOF_squeeze_xN(&ctx, bp, len);
+        done = 1;
+        for (int l=0; l<KECCAK_XN; l++){
+            cnt[l] = _sample_ntt(a[l], cnt[l], buf[l], len);
+            done = done && (cnt[l]==N);
+        }
+        len = 168;
+    } while (!done);
+}
+/*! \brief Функция генерации псевдослучайного вектора для KECCAK_XN ключей, см. PRF()
+    \param tag выход 64*eta байт для каждого ключа
+    \param s случайный вектор 32 байта для каждого ключа
+ */
+static void PRF_xN(uint8_t* const tag[], uint8_t* const s[], uint8_t i, int eta){
+    uint8_t seed[KECCAK_XN][33];
+    uint8_t *sp[KECCAK_XN];
+    for (int l=0; l<KECCAK_XN; l++){
+        __builtin_memcpy(seed[l], s[l], 32);
+        seed[l][32] = i;
+        sp[l] = seed[l];
+    }
+    shake256_xN(sp, 33, tag, 64*eta);
+}
+/*! \brief Algorithm 16 ML-KEM Key Generation для KECCAK_XN ключей (K-PKE.KeyGen включена)
+
+    \param ek encapsulation key 384*k+32 байта для каждого ключа
+    \param dk decapsulation key 768*k+96 байт = dk_PKE || ek || H(ek) || z
+    \param d,z случайность 32 байта для каждого ключа
+ */
+void ML_KEM_KeyGen_xN(uint8_t* const ek[], uint8_t* const dk[], uint8_t* const d[], uint8_t* const z[],
+        int k, int du, int dv, int eta1, int eta2){
+    uint8_t r[KECCAK_XN][64+1];
+    uint8_t tag[KECCAK_XN][64*3];
+    uint8_t *rp[KECCAK_XN], *rho[KECCAK_XN], *sigma[KECCAK_XN], *tp[KECCAK_XN];
+    uint16x2_t s[KECCAK_XN][4][N/2] POLY_ALIGN;
+    uint16x2_t e[KECCAK_XN][N/2] POLY_ALIGN;
+    uint16x2_t a[KECCAK_XN][N/2] POLY_ALIGN;
+    uint16_t *ap[KECCAK_XN];
+    for (int l=0; l<KECCAK_XN; l++){
+        __builtin_memcpy(r[l], d[l], 32);
+        r[l][32] = k;
+        rp[l] = r[l];
+        tp[l] = tag[l];
+        ap[l] = (uint16_t*)a[l];
+    }
+    sha3_512_xN(rp, 33, rp);// (rho, sigma) = G(d||k)
+    for (int l=0; l<KECCAK_XN; l++){
+        rho[l] = r[l], sigma[l] = r[l]+32;
+    }
+    for (int i=0; i<k; i++){
+        PRF_xN(tp, sigma, i, eta1);
+        for (int l=0; l<KECCAK_XN; l++){
+            SamplePolyCBD((uint16_t*)s[l][i], tag[l], eta1, Q_PRIME);
+            NTT(s[l][i]);
+        }
+    }
+    for (int i=0; i<k; i++){
+        PRF_xN(tp, sigma, i+k, eta1);
+        for (int l=0; l<KECCAK_XN; l++){
+            SamplePolyCBD((uint16_t*)e[l], tag[l], eta1, Q_PRIME);
+            NTT(e[l]);
+        }
+        for (int j=0; j<k; j++){
+            SampleNTT_xN(ap, rho, j, i);// A[i,j]
+            for (int l=0; l<KECCAK_XN; l++){
+                MultiplyNTTs(a[l], poly_V(a[l]), s[l][j], 1);
+                poly_add(e[l], e[l], a[l]);
+            }
+        }
+        for (int l=0; l<KECCAK_XN; l++)
+            ByteEncode(ek[l]+(N*12/8)*i, (uint16_t*)poly_iV(e[l]), 12);
+    }
+    for (int l=0; l<KECCAK_XN; l++){
+        __builtin_memcpy(ek[l]+(N*12/8)*k, rho[l], 32);
+        for (int i=0; i<k; i++)
+            ByteEncode(dk[l]+(N*12/8)*i, (uint16_t*)poly_iV(s[l][i]), 12);
+        __builtin_memcpy(dk[l]+384*k, ek[l], 384*k+32);
+        __builtin_memcpy(dk[l]+768*k+64, z[l], 32);
+        tp[l] = dk[l]+768*k+32;
+    }
+    sha3_256_xN(ek, 384*k+32, tp);// H(ek)
+}
+/*! \brief Algorithm 17 ML-KEM Encapsulation для KECCAK_XN ключей (K-PKE.Encrypt включена)
+
+    \param ss shared secret 32 байта для каждого ключа
+    \param ct ciphertext 32*(k*du+dv) байта
+    \param ek encapsulation key 384*k+32 байта
+    \param m случайность 32 байта
+ */
+void ML_KEM_Encaps_xN(uint8_t* const ss[], uint8_t* const ct[], uint8_t* const ek[], uint8_t* const m[],
+        int k, int du, int dv, int eta1, int eta2){
+    uint8_t mh[KECCAK_XN][64];
+    uint8_t Kr[KECCAK_XN][64];
+    uint8_t tag[KECCAK_XN][64*3];
+    uint8_t *mp[KECCAK_XN], *hp[KECCAK_XN], *kp[KECCAK_XN], *rp[KECCAK_XN], *rho[KECCAK_XN], *tp[KECCAK_XN];
+    uint16x2_t y[KECCAK_XN][4][N/2] POLY_ALIGN;
+    uint16x2_t u[KECCAK_XN][N/2] POLY_ALIGN;
+    uint16x2_t a[KECCAK_XN][N/2] POLY_ALIGN;
+    uint16x2_t e[KECCAK_XN][N/2] POLY_ALIGN;
+    uint16_t *ap[KECCAK_XN];
+    for (int l=0; l<KECCAK_XN; l++){
+        __builtin_memcpy(mh[l], m[l], 32);
+        mp[l] = mh[l];
+        hp[l] = mh[l]+32;
+        kp[l] = Kr[l];
+        rp[l] = Kr[l]+32;
+        rho[l]= ek[l]+384*k;
+        tp[l] = tag[l];
+        ap[l] = (uint16_t*)a[l];
+    }
+    sha3_256_xN(ek, 384*k+32, hp);// H(ek)
+    sha3_512_xN(mp, 64, kp);// (K, r) = G(m||H(ek))
+    for (int i=0; i<k; i++){
+        PRF_xN(tp, rp, i, eta1);
+        for (int l=0; l<KECCAK_XN; l++){
+            SamplePolyCBD((uint16_t*)y[l][i], tag[l], eta1, Q_PRIME);
+            NTT(y[l][i]);
+        }
+    }
+    for (int i=0; i<k; i++){// u = iNTT(A^T∘y) + e1
+        for (int l=0; l<KECCAK_XN; l++)
+            __builtin_memset(u[l], 0, sizeof(u[l]));
+        for (int j=0; j<k; j++){
+            SampleNTT_xN(ap, rho, i, j);// A[j,i]
+            for (int l=0; l<KECCAK_XN; l++){
+                MultiplyNTTs(a[l], poly_V(a[l]), y[l][j], 1);
+                poly_add(u[l], u[l], a[l]);
+            }
+        }
+        PRF_xN(tp, rp, k+i, eta2);
+        for (int l=0; l<KECCAK_XN; l++){
+            SamplePolyCBD((uint16_t*)e[l], tag[l], eta2, Q_PRIME);
+            poly_add(u[l], iNTT(u[l]), e[l]);
+            ByteEncode(ct[l]+(N*du/8)*i, Compress((uint16_t*)u[l], du), du);
+        }
+    }
+    PRF_xN(tp, rp, 2*k, eta2);
+    for (int l=0; l<KECCAK_XN; l++){// v = iNTT(t^T∘y) + e2 + mu
+        __builtin_memset(u[l], 0, sizeof(u[l]));
+        for (int j=0; j<k; j++){
+            ByteDecode((uint16_t*)a[l], ek[l]+(N*12/8)*j, 12);
+            MultiplyNTTs(a[l], poly_V(a[l]), y[l][j], 1);
+            poly_add(u[l], u[l], a[l]);
+        }
+        SamplePolyCBD((uint16_t*)e[l], tag[l], eta2, Q_PRIME);
+        poly_add(u[l], iNTT(u[l]), e[l]);
+        Decompress(ByteDecode((uint16_t*)e[l], m[l], 1), 1);
+        poly_add(u[l], u[l], e[l]);
+        ByteEncode(ct[l]+(N*du/8)*k, Compress((uint16_t*)u[l], dv), dv);
+        __builtin_memcpy(ss[l], Kr[l], 32);
+    }
+}
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 static uint8_t BitRev7(uint8_t x);
 static void v_print(uint16x16_t f, uint16x16_t g){
     for (size_t i = 0; i < 16; i++){
@@ -1571,6 +1944,146 @@ uint32_t ntt_root(uint32_t n, uint32_t q){
     return r;
 #endif
 }
+#if defined(TEST_BENCH)
+#include "qnn_bench.h"
+/*! Замер примитивов ML-KEM: медиана и p99 в тактах на операцию.
+    Ширина вектора uint16xVL_t определяется набором инструкций при сборке:
+$ gcc -DTEST_BENCH -O3 -march=native -o bench ml_kem.c shake256.c -lm            -- AVX-512, VL=32
+$ gcc -DTEST_BENCH -O3 -march=haswell -o bench ml_kem.c shake256.c -lm           -- AVX2, VL=16
+$ gcc -DTEST_BENCH -O3 -march=x86-64-v2 -mavx -o bench ml_kem.c shake256.c -lm   -- SSE4.1, VL=8
+ */
+int main(int argc, char** argv)
+{
+    const unsigned int n_iter = argc>1? atoi(argv[1]): 2000;
+    static const struct { const char* name; int k, eta1, eta2, du, dv; } params[] = {
+        {"ML-KEM-512",  2, 3, 2, 10, 4},
+        {"ML-KEM-768",  3, 2, 2, 10, 4},
+        {"ML-KEM-1024", 4, 2, 2, 11, 5},
+    };
+    printf("ML-KEM bench VL=%d KECCAK_XN=%d, cycles per operation\n", VL, KECCAK_XN);
+    uint16x2_t a[N/2] POLY_ALIGN, b[N/2] POLY_ALIGN;
+    uint8_t buf[64*3+1], seed[34];
+    for (int i=0; i<N/2; i++){
+        a[i] = (uint16x2_t){rand()%Q_PRIME, rand()%Q_PRIME};
+        b[i] = (uint16x2_t){rand()%Q_PRIME, rand()%Q_PRIME};
+    }
+    for (int i=0; i<sizeof(buf); i++) buf[i] = rand();
+    for (int i=0; i<sizeof(seed); i++) seed[i] = rand();
+    struct bench bm;
+    bench_init(&bm, "NTT", n_iter);
+    BENCH_RUN(&bm, NTT(a));
+    bench_report(&bm, N);
+    bm.name = "iNTT";
+    BENCH_RUN(&bm, iNTT(a));
+    bench_report(&bm, N);
+    bm.name = "MultiplyNTTs";
+    BENCH_RUN(&bm, MultiplyNTTs(a, a, b, 1));
+    bench_report(&bm, N);
+    bm.name = "SamplePolyCBD eta=2";
+    BENCH_RUN(&bm, SamplePolyCBD((uint16_t*)a, buf, 2, Q_PRIME));
+    bench_report(&bm, N);
+    bm.name = "SamplePolyCBD eta=3";
+    BENCH_RUN(&bm, SamplePolyCBD((uint16_t*)a, buf, 3, Q_PRIME));
+    bench_report(&bm, N);
+    static const unsigned int dd[] = {1, 4, 5, 10, 11, 12};
+    static const char* enc_name[] = {"ByteEncode d=1", "ByteEncode d=4", "ByteEncode d=5", "ByteEncode d=10", "ByteEncode d=11", "ByteEncode d=12"};
+    static const char* dec_name[] = {"ByteDecode d=1", "ByteDecode d=4", "ByteDecode d=5", "ByteDecode d=10", "ByteDecode d=11", "ByteDecode d=12"};
+    uint8_t enc[N*12/8];
+    for (int i=0; i<sizeof(dd)/sizeof(dd[0]); i++){
+        bm.name = enc_name[i];
+        BENCH_RUN(&bm, ByteEncode(enc, (uint16_t*)b, dd[i]));
+        bench_report(&bm, N);
+        bm.name = dec_name[i];
+        BENCH_RUN(&bm, ByteDecode((uint16_t*)a, enc, dd[i]));
+        bench_report(&bm, N);
+    }
+    bm.name = "SampleNTT";
+    BENCH_RUN(&bm, SampleNTT((uint16_t*)a, seed, 1, 2));
+    bench_report(&bm, N);
+    {
+        uint16_t ax[KECCAK_XN][N];
+        uint16_t *ap[KECCAK_XN];
+        uint8_t  *sp[KECCAK_XN];
+        for (int l=0; l<KECCAK_XN; l++) ap[l] = ax[l], sp[l] = seed;
+        bm.name = "SampleNTT_xN (per poly)";
+        bm.count = KECCAK_XN;
+        BENCH_RUN(&bm, SampleNTT_xN(ap, sp, 1, 2));
+        bench_report(&bm, N);
+        bm.count = 1;
+    }
+    bench_free(&bm);
+
+    static uint8_t ek[KECCAK_XN][384*4+32], dk[KECCAK_XN][768*4+96], ct[KECCAK_XN][32*(4*11+5)];
+    uint8_t d[KECCAK_XN][32], z[KECCAK_XN][32], m[KECCAK_XN][32], ss[KECCAK_XN][32];
+    uint8_t *ekp[KECCAK_XN], *dkp[KECCAK_XN], *ctp[KECCAK_XN], *dp[KECCAK_XN], *zp[KECCAK_XN], *m_p[KECCAK_XN], *ssp[KECCAK_XN];
+    for (int l=0; l<KECCAK_XN; l++){
+        ekp[l] = ek[l], dkp[l] = dk[l], ctp[l] = ct[l];
+        dp[l] = d[l], zp[l] = z[l], m_p[l] = m[l], ssp[l] = ss[l];
+        for (int i=0; i<32; i++)
+            d[l][i] = rand(), z[l][i] = rand(), m[l][i] = rand();
+    }
+    for (int n=0; n<3; n++){
+        int k = params[n].k, du = params[n].du, dv = params[n].dv;
+        int eta1 = params[n].eta1, eta2 = params[n].eta2;
+        char name[64];
+        struct bench bk;
+        bench_init(&bk, name, n_iter/k/4+1);
+        bk.count = KECCAK_XN;
+        snprintf(name, sizeof(name), "%s KeyGen_xN", params[n].name);
+        BENCH_RUN(&bk, ML_KEM_KeyGen_xN(ekp, dkp, dp, zp, k, du, dv, eta1, eta2));
+        bench_report(&bk, 1);
+        snprintf(name, sizeof(name), "%s Encaps_xN", params[n].name);
+        BENCH_RUN(&bk, ML_KEM_Encaps_xN(ssp, ctp, ekp, m_p, k, du, dv, eta1, eta2));
+        bench_report(&bk, 1);
+        bench_free(&bk);
+
+        uint8_t mh[64], Kr[64];
+        bench_init(&bk, name, n_iter);
+        snprintf(name, sizeof(name), "%s K_PKE_Decrypt", params[n].name);
+        BENCH_RUN(&bk, K_PKE_Decrypt(mh, ct[0], dk[0], k, du, dv));
+        bench_report(&bk, 1);
+        __builtin_memcpy(mh+32, dk[0]+768*k+32, 32);
+        snprintf(name, sizeof(name), "%s Decaps", params[n].name);
+        BENCH_RUN(&bk, (K_PKE_Decrypt(mh, ct[0], dk[0], k, du, dv), G(Kr, mh, 64)));
+        bench_report(&bk, 1);
+        bench_free(&bk);
+        /* Постоянство времени расшифрования: класс 0 - фиксированный шифртекст,
+           класс 1 - случайный шифртекст, классы чередуются случайно.
+           Метки классов и шифртексты готовятся до замеров, в цикле замеров 
+           оба класса выполняют одинаковый код */
+        const unsigned int n_dudect = n_iter*10;
+        uint64_t *t[2];
+        unsigned int cnt[2] = {0};
+        t[0] = malloc(n_dudect*sizeof(uint64_t));
+        t[1] = malloc(n_dudect*sizeof(uint64_t));
+        const size_t ct_len = 32*(k*du+dv);
+        uint8_t *cls    = malloc(n_dudect);
+        uint8_t *ct_in  = malloc(n_dudect*ct_len);
+        for (unsigned int i=0; i<n_dudect; i++){
+            cls[i] = rand()&1;
+            uint8_t *cp = ct_in + i*ct_len;
+            if (cls[i]) {
+                for (int j=0; j<ct_len; j++) cp[j] = rand();
+            } else
+                __builtin_memcpy(cp, ct[0], ct_len);
+        }
+        for (unsigned int i=0; i<n_dudect; i++){
+            const int c = cls[i];
+            uint64_t t0 = bench_clock();
+            K_PKE_Decrypt(mh, ct_in + i*ct_len, dk[0], k, du, dv);
+            G(Kr, mh, 64);
+            t[c][cnt[c]++] = bench_clock() - t0;
+        }
+        free(ct_in);
+        free(cls);
+        snprintf(name, sizeof(name), "%s K_PKE_Decrypt+G", params[n].name);
+        bench_dudect(name, t[0], cnt[0], t[1], cnt[1]);
+        free(t[0]);
+        free(t[1]);
+    }
+    return 0;
+}
+#else
 int main(int argc, char** argv)
 {
     uint32_t qm = mod_inverse(Q_PRIME);
@@ -1676,10 +2189,10 @@ int main(int argc, char** argv)
         }
     }
 if (1) {// проверка умножения полиномов
-    uint16x2_t a[N/2] = {0};
-    uint16x2_t b[N/2] = {0}; 
-    uint16x2_t e[N/2] = {0}; 
-    uint16x2_t r[N/2] = {0};
+    uint16x2_t a[N/2] POLY_ALIGN = {0};
+    uint16x2_t b[N/2] POLY_ALIGN = {0}; 
+    uint16x2_t e[N/2] POLY_ALIGN = {0}; 
+    uint16x2_t r[N/2] POLY_ALIGN = {0};
     for (int i=0; i<N/2; i++){
         a[i] = (uint16x2_t){i+5, i+2586};
         b[i] = (uint16x2_t){i+1, i+582};
@@ -1709,6 +2222,112 @@ if (1) {// проверка умножения полиномов
     }
     if (res) printf("NTT mul OK\n");
 }
+if (1) {// проверка пакетного режима ML-KEM: Keccak x8, SampleNTT_xN, KeyGen/Encaps
+    const int XN = KECCAK_XN;
+    uint8_t msg[KECCAK_XN][400], tag[KECCAK_XN][600], ref[600];
+    uint8_t *mp[KECCAK_XN], *tp[KECCAK_XN];
+    for (int l=0; l<XN; l++){
+        for (int i=0; i<400; i++) msg[l][i] = i*7 + l*31 + 1;
+        mp[l] = msg[l], tp[l] = tag[l];
+    }
+    int res = 1;
+    const size_t lens[] = {0, 33, 34, 71, 72, 135, 136, 168, 200, 399};
+    for (int i=0; i<sizeof(lens)/sizeof(lens[0]); i++){
+        size_t len = lens[i];
+        shake128_xN(mp, len, tp, 600);
+        for (int l=0; l<XN; l++){
+            shake128(msg[l], len, ref, 600);
+            res = res && __builtin_memcmp(ref, tag[l], 600)==0;
+        }
+        shake256_xN(mp, len, tp, 300);
+        for (int l=0; l<XN; l++){
+            shake256(msg[l], len, ref, 300);
+            res = res && __builtin_memcmp(ref, tag[l], 300)==0;
+        }
+        sha3_256_xN(mp, len, tp);
+        for (int l=0; l<XN; l++){
+            sha3_256(msg[l], len, ref);
+            res = res && __builtin_memcmp(ref, tag[l], 32)==0;
+        }
+        sha3_512_xN(mp, len, tp);
+        for (int l=0; l<XN; l++){
+            sha3_512(msg[l], len, ref);
+            res = res && __builtin_memcmp(ref, tag[l], 64)==0;
+        }
+    }
+    printf("Keccak x%d %s\n", XN, res?"OK":"fail");
+    uint16_t a[KECCAK_XN][N], b[N];
+    uint16_t *ap[KECCAK_XN];
+    for (int l=0; l<XN; l++) ap[l] = a[l];
+    res = 1;
+    for (int i=0; i<4; i++)
+    for (int j=0; j<4; j++){
+        SampleNTT_xN(ap, mp, i, j);
+        for (int l=0; l<XN; l++){
+            SampleNTT(b, msg[l], i, j);
+            res = res && __builtin_memcmp(a[l], b, sizeof(b))==0;
+        }
+    }
+    printf("SampleNTT x%d %s\n", XN, res?"OK":"fail");
+
+    static const struct { const char* name; int k, eta1, eta2, du, dv; } params[] = {
+        {"ML-KEM-512",  2, 3, 2, 10, 4},
+        {"ML-KEM-768",  3, 2, 2, 10, 4},
+        {"ML-KEM-1024", 4, 2, 2, 11, 5},
+    };
+    static uint8_t ek[KECCAK_XN][384*4+32], dk[KECCAK_XN][768*4+96], ct[KECCAK_XN][32*(4*11+5)];
+    uint8_t d[KECCAK_XN][32], z[KECCAK_XN][32], m[KECCAK_XN][32], ss[KECCAK_XN][32];
+    uint8_t *ekp[KECCAK_XN], *dkp[KECCAK_XN], *ctp[KECCAK_XN], *dp[KECCAK_XN], *zp[KECCAK_XN], *m_p[KECCAK_XN], *ssp[KECCAK_XN];
+    for (int l=0; l<XN; l++){
+        ekp[l] = ek[l], dkp[l] = dk[l], ctp[l] = ct[l];
+        dp[l] = d[l], zp[l] = z[l], m_p[l] = m[l], ssp[l] = ss[l];
+    }
+    for (int n=0; n<3; n++){
+        int k = params[n].k, du = params[n].du, dv = params[n].dv;
+        int eta1 = params[n].eta1, eta2 = params[n].eta2;
+        res = 1;
+        for (int it=0; it<4; it++){
+            for (int l=0; l<XN; l++)
+            for (int i=0; i<32; i++){
+                d[l][i] = rand(), z[l][i] = rand(), m[l][i] = rand();
+            }
+            ML_KEM_KeyGen_xN(ekp, dkp, dp, zp, k, du, dv, eta1, eta2);
+            ML_KEM_Encaps_xN(ssp, ctp, ekp, m_p, k, du, dv, eta1, eta2);
+            for (int l=0; l<XN; l++){// расшифрование: m' = K-PKE.Decrypt(dk, c), K' = G(m'||h)
+                uint8_t mh[64], Kr[64];
+                K_PKE_Decrypt(mh, ct[l], dk[l], k, du, dv);
+                res = res && __builtin_memcmp(mh, m[l], 32)==0;
+                __builtin_memcpy(mh+32, dk[l]+768*k+32, 32);
+                G(Kr, mh, 64);
+                res = res && __builtin_memcmp(Kr, ss[l], 32)==0;
+            }
+        }
+        const int rounds = 200/k;
+        uint64_t t0 = __rdtsc();
+        clock_t c0 = clock();
+        for (int it=0; it<rounds; it++){
+            ML_KEM_KeyGen_xN(ekp, dkp, dp, zp, k, du, dv, eta1, eta2);
+            ML_KEM_Encaps_xN(ssp, ctp, ekp, m_p, k, du, dv, eta1, eta2);
+        }
+        uint64_t t1 = __rdtsc();
+        double sec = (double)(clock() - c0)/CLOCKS_PER_SEC;
+        uint64_t t2 = __rdtsc();
+        for (int it=0; it<rounds; it++)
+        for (int i=0; i<k; i++)
+        for (int j=0; j<k; j++)
+            SampleNTT_xN(ap, mp, i, j);
+        uint64_t t3 = __rdtsc();
+        for (int it=0; it<rounds; it++)
+        for (int l=0; l<XN; l++)
+        for (int i=0; i<k; i++)
+        for (int j=0; j<k; j++)
+            SampleNTT(b, msg[l], i, j);
+        uint64_t t4 = __rdtsc();
+        printf("%-11s x%d %s KeyGen+Encaps %6.0f cycles/key %7.0f keys/s, SampleNTT %5.0f/%5.0f cycles\n",
+            params[n].name, XN, res?"OK":"fail", (double)(t1-t0)/rounds/XN, rounds*XN/sec,
+            (double)(t3-t2)/rounds/XN/(k*k), (double)(t4-t3)/rounds/XN/(k*k));
+    }
+}
 // Проверка операций
     if (1) {// проверка редукции Барретта
         uint32_t p = (13<<8)+1;
@@ -2060,4 +2679,5 @@ uint32_t mwc32_hash(uint64_t h, uint16_t d, uint32_t q, uint32_t a){
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
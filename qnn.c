@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdio.h>
 #include "qnn.h"
 /*! \note Проект изначально был создан под GGML
     Добавлен ряд идей, которые отличаются от оригинальной реализации.
@@ -165,12 +166,72 @@ void ggml_free(struct ggml_context*  ctx){
 }
 
 
-/*! \brief 
+/*! \brief создание пустого графа вычислений
+    \param ctx - контекст, в котором создаются тензоры графа
+    \return граф, узлы добавляются функцией qnn_graph_build_forward_expand()
  */
 struct qnn_cgraph * qnn_graph_new(struct ggml_context * ctx){
-    struct qnn_cgraph * gf = NULL;
+    const int size = QNN_GRAPH_SIZE;
+    struct qnn_cgraph * gf = g_new0(struct qnn_cgraph, 1);
+    gf->size    = size;
+    gf->n_nodes = 0;
+    gf->n_leafs = 0;
+    gf->nodes   = g_new0(struct ggml_tensor *, size);
+    gf->leafs   = g_new0(struct ggml_tensor *, size);
+    gf->visited = g_new0(struct ggml_tensor *, 2*size);
     return gf;
 }
+void qnn_graph_free(struct qnn_cgraph * gf){
+    g_free(gf->visited);
+    g_free(gf->leafs);
+    g_free(gf->nodes);
+    g_free(gf);
+}
+/*! \brief добавить тензор в таблицу посещенных, открытая адресация
+    \return false если тензор уже добавлен в граф
+ */
+static bool _graph_visit(struct qnn_cgraph * gf, const struct ggml_tensor * t){
+    const size_t n = 2*gf->size;
+    size_t i = ((uintptr_t)t >> 4) % n;
+    while (gf->visited[i] != NULL) {
+        if (gf->visited[i] == t) return false;
+        if (++i == n) i = 0;
+    }
+    gf->visited[i] = (struct ggml_tensor *)t;
+    return true;
+}
+/*! \brief обход графа в глубину, узлы добавляются после своих аргументов
+
+    Порядок узлов в таблице gf->nodes является топологическим, вычисления можно
+    выполнять последовательно по таблице.
+ */
+static void _graph_visit_parents(struct qnn_cgraph * gf, struct ggml_tensor * node){
+    if (!_graph_visit(gf, node)) return;
+    for (int i = 0; i < GGML_MAX_SRC; ++i) {
+        if (node->src[i] != NULL)
+            _graph_visit_parents(gf, node->src[i]);
+    }
+    if (node->op == GGML_OP_NONE) {
+        if (gf->n_leafs < gf->size)
+            gf->leafs[gf->n_leafs++] = node;
+    } else {
+        if (gf->n_nodes < gf->size)
+            gf->nodes[gf->n_nodes++] = node;
+    }
+}
+/*! \brief построение графа вычислений от результата к входным тензорам
+    \param gf - граф
+    \param tensor - результат вычислений, помечается флагом GGML_TENSOR_FLAG_OUTPUT
+ */
+void qnn_graph_build_forward_expand(struct qnn_cgraph * gf, struct ggml_tensor * tensor){
+    const int n0 = gf->n_nodes;
+    tensor->flags |= GGML_TENSOR_FLAG_OUTPUT;
+    _graph_visit_parents(gf, tensor);
+    if (gf->n_nodes == gf->size || gf->n_leafs == gf->size)
+        fprintf(stderr, "%s: graph is full, size = %d\n", __func__, gf->size);
+    else if (gf->n_nodes > n0)
+        GGML_ASSERT(gf->nodes[gf->n_nodes - 1] == tensor);
+}
 
 
 
@@ -246,6 +307,8 @@ struct _type_traits type_traits[GGML_TYPE_COUNT] = {
     [GGML_TYPE_F32]     = {.blck_size = 1, .type_size = sizeof(float)},
     [GGML_TYPE_F16]     = {.blck_size = 1, .type_size = sizeof(ggml_fp16_t)},
     [GGML_TYPE_BF16]    = {.blck_size = 1, .type_size = sizeof(ggml_bf16_t)},
+    [GGML_TYPE_BF8]     = {.blck_size = 1, .type_size = sizeof(ggml_bf8_t)},
+    [GGML_TYPE_HF8]     = {.blck_size = 1, .type_size = sizeof(ggml_hf8_t)},
     [GGML_TYPE_Q2_0]    = {.blck_size = QK2_0, .type_size = sizeof(block_q2_0)},
     [GGML_TYPE_Q4_0]    = {.blck_size = QK4_0, .type_size = sizeof(block_q4_0)},
 //    [GGML_TYPE_Q4_1]    = {.blck_size = QK4_1, .type_size = sizeof(block_q4_1)},
@@ -255,7 +318,7 @@ struct _type_traits type_traits[GGML_TYPE_COUNT] = {
     [GGML_TYPE_Q4_K]    = {.blck_size = QK_K, .type_size = sizeof(block_q4_K)},
     [GGML_TYPE_Q5_K]    = {.blck_size = QK_K, .type_size = sizeof(block_q5_K)},
     [GGML_TYPE_Q6_K]    = {.blck_size = QK_K, .type_size = sizeof(block_q6_K)},
-    [GGML_TYPE_Q8_K]    = {.blck_size = QK_K, .type_size = sizeof(block_q8_K)},
+    [GGML_TYPE_Q8_K]    = {.blck_size = Q8K_K, .type_size = sizeof(block_q8_K)},
 };
 
 
@@ -678,6 +678,46 @@ static inline uint8_t ggml_compute_fp32_to_hf8(float s) {
     }
     return si|(ex<<3)|m;
 }
+/*! \brief Converts Intel HF8 (E4M3) to float32
+    s.1111.000 = INF, s.1111.xxx = NaN, обратное преобразование к ggml_compute_fp32_to_hf8
+ */
+static inline float ggml_compute_hf8_to_fp32(ggml_hf8_t h) {
+    union {
+        float f;
+        uint32_t i;
+    } u;
+    const uint32_t si = (uint32_t)(h.bits&0x80u)<<24;
+    const uint32_t ex = (h.bits>>3)&0xf;
+    const uint32_t m  =  h.bits&0x7;
+    if (ex==0xf) {// INF:qNAN
+        u.i = si | 0x7F800000u | (m==0? 0: 0x00400000u|(m<<20));
+    } else
+    if (ex==0) {// denormal m*2^-9
+        u.f = m*(1.0f/512);
+        u.i|= si;
+    } else
+        u.i = si | ((ex+120)<<23) | (m<<20);
+    return u.f;
+}
+/*! \brief Converts FP8 E4M3FN to float32, s.1111.111 = NaN, бесконечностей нет */
+static inline float ggml_compute_fp8_e4m3fn_to_fp32(uint8_t h) {
+    union {
+        float f;
+        uint32_t i;
+    } u;
+    const uint32_t si = (uint32_t)(h&0x80u)<<24;
+    const uint32_t ex = (h>>3)&0xf;
+    const uint32_t m  =  h&0x7;
+    if ((h&0x7f)==0x7f) {// NaN
+        u.i = si | 0x7FC00000u;
+    } else
+    if (ex==0) {// denormal m*2^-9
+        u.f = m*(1.0f/512);
+        u.i|= si;
+    } else
+        u.i = si | ((ex+120)<<23) | (m<<20);
+    return u.f;
+}
 // https://patentimages.storage.googleapis.com/0d/96/d3/1ab325d9d67232/EP4318224A1.pdf
 
 #define GGML_FP32_TO_E8M0(x) (((x)&0x7F800000u)>>23)
@@ -736,7 +776,7 @@ struct gguf_kv {
 #include <stdint.h>
 #define GGML_MAX_DIMS       4 // не хотим 4
 #define GGML_MAX_OP_PARAMS  64// снизить
-#define GGML_MAX_SRC        2 // 4
+#define GGML_MAX_SRC        4 // слитные операции qnn_graph_fuse() используют src[2], src[3]
 #define GGML_MAX_NAME       64
 
 // this tensor...
@@ -988,8 +1028,13 @@ const char * ggml_type_name(enum ggml_type type) {
     return type < GGML_TYPE_COUNT ? GGML_TYPE_NAME[type] /* type_traits[type].type_name */ : "NONE";
 }
 
+/*! \brief выделение объекта в буфере контекста
+    \return NULL если буфер заполнен, данные промежуточных тензоров размещает qnn_graph_plan()
+ */
 static inline
 void * _slice_alloc(struct ggml_context* ctx, size_t size){
+    if (size > ctx->mem_size - ctx->mem_offs)
+        return NULL;
     uint8_t * data = (uint8_t*)ctx->mem_buffer + ctx->mem_offs;
     ctx->mem_offs += size;
     ctx->n_objects++;
@@ -1102,6 +1147,22 @@ int ggml_n_dims(const struct ggml_tensor * tensor) {
         if (tensor->ne[i] > 1) return i + 1;
     return 1;
 }
+static inline
+int64_t ggml_nelements(const struct ggml_tensor * tensor) {
+    return tensor->ne[0]*tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
+}
+static inline
+int64_t ggml_nrows(const struct ggml_tensor * tensor) {
+    return tensor->ne[1]*tensor->ne[2]*tensor->ne[3];
+}
+// размер данных тензора в байтах с учетом шага nb[i], для непрерывных тензоров совпадает с размером массива
+static inline
+size_t ggml_nbytes(const struct ggml_tensor * tensor) {
+    size_t nbytes = tensor->ne[0]*tensor->nb[0]/ggml_blck_size(tensor->type);
+    for (int i = 1; i < GGML_MAX_DIMS; ++i)
+        nbytes += (tensor->ne[i] - 1)*tensor->nb[i];
+    return nbytes;
+}
 
 //static const size_t GGML_TENSOR_SIZE = sizeof(struct ggml_tensor);
 
@@ -1601,10 +1662,16 @@ struct gguf_context {
 
     //uint8_t * padding;
     void * data;
+    void * mapping;      // отображение файла в память, \see GGUF_INIT_MMAP
+    size_t mapping_size; // размер отображения
     HTable_t * htable;// хэш таблица для поиска тензоров
     QTable_t * qt;    // хэш таблица для шаблонов имен
 };
 
+// флаги параметра params в gguf_init_from_file
+#define GGUF_INIT_MMAP     0x1 // отобразить файл в память, info->data указывает в отображение
+#define GGUF_INIT_PREFETCH 0x2 // подсказка ядру MADV_WILLNEED, начать чтение данных заранее
+
 extern uint64_t xxh64(uint64_t hash, uint8_t* data, size_t data_len);
 extern gguf_cxt_t * gguf_init_empty(void);
 extern gguf_cxt_t * gguf_init_from_file(const char * fname, uint32_t params);
@@ -1642,18 +1709,162 @@ const char * gguf_get_key(const struct gguf_context * ctx, int key_id) {
     return ctx->kv[key_id].key.data;
 }
 */
+#define QNN_GRAPH_SIZE 8192 // максимальное число узлов графа по умолчанию
 struct qnn_cgraph {
-//    int size;    // maximum number of nodes/leafs/grads/grad_accs
+    int size;    // maximum number of nodes/leafs
     int n_nodes; // number of nodes currently in use
-//    int n_leafs; // number of leafs currently in use
+    int n_leafs; // number of leafs currently in use
 
     struct ggml_tensor ** nodes;     // tensors with data that can change if the graph is evaluated
+    struct ggml_tensor ** leafs;     // веса и входные тензоры, op = GGML_OP_NONE
+    struct ggml_tensor ** visited;   // хеш таблица посещенных тензоров, размер 2*size
+};
+//!< профиль узла графа: время исполнения и оценка объема работы \see qnn_node_cost()
+struct qnn_node_prof {
+    int64_t t_start, t_end; //!< начало и окончание вычисления узла, нс от начала вычисления графа
+    int64_t flops;          //!< число операций с плавающей точкой
+    int64_t bytes_rd;       //!< объем прочитанных данных аргументов
+    int64_t bytes_wr;       //!< объем записанных данных результата
+};
+//!< план исполнения графа на CPU \see qnn_cpu.c
+struct qnn_cplan {
+    int    n_threads;   //!< число потоков
+    size_t work_size;   //!< размер рабочего буфера на поток
+    size_t shared_size; //!< размер общего буфера узла, следует за буферами потоков
+    void * work_data;   //!< рабочие буферы потоков n_threads*work_size
+    size_t mem_size;    //!< пиковый объем памяти промежуточных тензоров
+    size_t mem_total;   //!< объем без повторного использования памяти
+    int    n_tensors;   //!< число размещенных промежуточных тензоров
+    void * arena;       //!< память промежуточных тензоров
+    size_t arena_size;
+    struct qnn_node_prof * prof; //!< профиль узлов, заполняется при вычислении, \see qnn_graph_profile()
 };
 
 extern struct qnn_cgraph * qnn_graph_new(struct ggml_context * );
+extern void qnn_graph_build_forward_expand(struct qnn_cgraph * gf, struct ggml_tensor * tensor);
+extern void qnn_graph_free(struct qnn_cgraph * gf);
+extern int  qnn_graph_fuse(struct qnn_cgraph * gf);
+extern struct qnn_cplan * qnn_graph_plan(struct qnn_cgraph * gf, int n_threads);
+extern int  qnn_graph_replan(struct qnn_cplan * plan, struct qnn_cgraph * gf);
+extern int  qnn_graph_compute(struct qnn_cgraph * gf, struct qnn_cplan * plan);
+extern void qnn_cplan_free(struct qnn_cplan * plan);
+extern int  qnn_graph_profile(struct qnn_cplan * plan, struct qnn_cgraph * gf);
+extern void qnn_graph_profile_print(const struct qnn_cgraph * gf, const struct qnn_cplan * plan);
+extern int  qnn_graph_profile_trace(const struct qnn_cgraph * gf, const struct qnn_cplan * plan, const char * filename);
+
+/*! \brief оценка объема работы узла: число операций и объем данных
+    
+    Операции считаются по размерностям ne[] результата и аргументов: MUL_MAT - 2*K на элемент результата,
+    поэлементные операции - одна на элемент, нормализация, softmax и функции активации - несколько на элемент.
+    Объем чтения - сумма размеров аргументов, веса и повторно используемые аргументы считаются один раз,
+    как если бы кэш не удерживал их между узлами. Отношение flops/bytes - арифметическая интенсивность узла,
+    по ней узел относится к ограниченным пропускной способностью памяти или вычислениями.
+ */
+static inline void qnn_node_cost(const struct ggml_tensor * node, struct qnn_node_prof * p){
+    const int64_t n = ggml_nelements(node);
+    int64_t flops = 0, rd = 0;
+    for (int j = 0; j < GGML_MAX_SRC; j++)
+        if (node->src[j]) rd += ggml_nbytes(node->src[j]);
+    switch (node->op) {
+    case GGML_OP_MUL_MAT:// src[2] - смещение, src[3] - остаток после слияния
+        flops = 2*node->src[0]->ne[0]*n;
+        if (node->src[2]) flops += n;
+        if (node->src[3]) flops += n;
+        if (node->op_params[0] == GGML_OP_UNARY) flops += 8*n;
+        break;
+    case GGML_OP_FLASH_ATTN_EXT:// Q*K^T и P*V
+        flops = 4*ggml_nelements(node->src[0])*node->src[1]->ne[1];
+        break;
+    case GGML_OP_ADD: case GGML_OP_SUB: case GGML_OP_MUL: case GGML_OP_DIV:
+    case GGML_OP_SQR: case GGML_OP_SQRT: case GGML_OP_SCALE: case GGML_OP_ADD1:
+        flops = n;
+        break;
+    case GGML_OP_NORM: case GGML_OP_RMS_NORM: case GGML_OP_L2_NORM: case GGML_OP_GROUP_NORM:
+        flops = 4*n;
+        if (node->src[1]) flops += n;// слитное умножение на вес
+        if (node->src[2]) flops += n;// и смещение
+        break;
+    case GGML_OP_SOFT_MAX: case GGML_OP_ROPE:
+    case GGML_OP_LOG: case GGML_OP_SIN: case GGML_OP_COS:
+        flops = 5*n;
+        break;
+    case GGML_OP_UNARY:
+        flops = 8*n;
+        break;
+    case GGML_OP_POOL_2D:
+        flops = (int64_t)node->op_params[1]*node->op_params[2]*n;
+        break;
+    default:// копирование и перестановка данных
+        break;
+    }
+    p->flops    = flops;
+    p->bytes_rd = rd;
+    p->bytes_wr = ggml_nbytes(node);
+}
 
 extern struct gguf_tensor_info * gguf_tensor_info(const gguf_cxt_t *ctx, const char *cname, int idx);
 
+//!< наборы инструкций для выбора версии вычислительных ядер во время исполнения
+enum qnn_isa {
+    QNN_ISA_GENERIC,
+    QNN_ISA_AVX2,   //!< AVX2 + FMA
+    QNN_ISA_AVX512, //!< AVX-512 F, BW, VL
+    QNN_ISA_AVX512_VNNI, //!< AVX-512 + VNNI vpdpbusd
+    QNN_ISA_AVX512_BF16, //!< AVX-512 + VNNI + BF16 vcvtneps2bf16
+    QNN_ISA_COUNT
+};
+typedef void (*qnn_dequantize_row_t)(const void * restrict x, float * restrict y, int64_t k);
+//!< s[r + c*bs] = dot(x + r*bx, y + c*by), r < nr, c < nc; веса в блочном формате, активации block_q8_1
+typedef void (*qnn_vec_dot_t)(int64_t n, float * restrict s, size_t bs, const void * restrict x, size_t bx, int nr, const void * restrict y, size_t by, int nc);
+extern int                  qnn_cpu_isa(void);
+extern qnn_dequantize_row_t qnn_dequantize_row(enum ggml_type type);
+extern qnn_dequantize_row_t qnn_dequantize_row_isa(enum ggml_type type, int isa);
+extern qnn_vec_dot_t        qnn_vec_dot_q8_1(enum ggml_type type);
+extern qnn_vec_dot_t        qnn_vec_dot_q8_1_isa(enum ggml_type type, int isa);
+extern void quantize_row_q8_1(const float * restrict x, block_q8_1 * restrict y, int64_t k);
+//!< квантизация строк весов при конвертации модели, см. qnn_safetensors.c
+extern void quantize_row_q8_0_ref(const float * restrict x, block_q8_0 * restrict y, int64_t k);
+extern void quantize_row_q4_K_ref(const float * restrict x, block_q4_K * restrict y, int64_t k);
+extern uint8_t convert_f32_to_f8_e4m3fn(float x, int emax);
+extern void qnn_dequantize_rows(enum ggml_type type, const void * x, size_t bx, float * y, int64_t k, int64_t nr);
+
+//!< пул потоков с перехватом работы, см. qnn_pool.c
+#include "qnn_pool.h"
+extern void qnn_pool_rows(struct qnn_pool * pool, const struct ggml_tensor * t, int64_t grain, qnn_pool_range_fn fn, void * arg);
+
+//!< преобразования строк между форматами с плавающей точкой, побитно совпадают с ggml_compute_*
+enum qnn_convert {
+    QNN_CONVERT_F32_BF16,
+    QNN_CONVERT_BF16_F32,
+    QNN_CONVERT_F32_TF32,
+    QNN_CONVERT_F32_BF8,
+    QNN_CONVERT_F32_HF8,
+    QNN_CONVERT_F16_BF8,
+    QNN_CONVERT_F16_HF8,
+    QNN_CONVERT_F16_E4M3FN,
+    QNN_CONVERT_BF8_F32,
+    QNN_CONVERT_HF8_F32,
+    QNN_CONVERT_E4M3FN_F32,
+    QNN_CONVERT_COUNT
+};
+typedef void (*qnn_convert_row_t)(const void * restrict x, void * restrict y, int64_t n);
+//!< стохастическое округление, случайный байт элемента i определяется парой (seed, i)
+typedef void (*qnn_convert_row_sr_t)(const void * restrict x, void * restrict y, int64_t n, uint32_t seed);
+extern qnn_convert_row_t    qnn_convert_row_isa(enum qnn_convert op, int isa);
+extern qnn_convert_row_sr_t qnn_convert_row_sr_isa(int isa);
+extern void convert_row_f32_to_bf16  (const float * restrict x, ggml_bf16_t * restrict y, int64_t n);
+extern void convert_row_bf16_to_f32  (const ggml_bf16_t * restrict x, float * restrict y, int64_t n);
+extern void convert_row_f32_to_tf32  (const float * restrict x, ggml_tf32_t * restrict y, int64_t n);
+extern void convert_row_f32_to_bf8   (const float * restrict x, uint8_t * restrict y, int64_t n);
+extern void convert_row_f32_to_hf8   (const float * restrict x, uint8_t * restrict y, int64_t n);
+extern void convert_row_f16_to_bf8   (const ggml_half * restrict x, uint8_t * restrict y, int64_t n);
+extern void convert_row_f16_to_bf8_stochastic(const ggml_half * restrict x, uint8_t * restrict y, int64_t n, uint32_t seed);
+extern void convert_row_f16_to_hf8   (const ggml_half * restrict x, uint8_t * restrict y, int64_t n);
+extern void convert_row_f16_to_e4m3fn(const ggml_half * restrict x, uint8_t * restrict y, int64_t n);
+extern void convert_row_bf8_to_f32   (const uint8_t * restrict x, float * restrict y, int64_t n);
+extern void convert_row_hf8_to_f32   (const uint8_t * restrict x, float * restrict y, int64_t n);
+extern void convert_row_e4m3fn_to_f32(const uint8_t * restrict x, float * restrict y, int64_t n);
+
 
 extern struct ggml_context* ggml_init(void * data, size_t size);
 extern void ggml_free(struct ggml_context*);
@@ -0,0 +1,134 @@
+/*! \brief Замер времени выполнения примитивов: медиана, p99 и проверка постоянства времени
+
+    Используется в тестовых блоках TEST_BENCH и TEST_NTT.
+    Время измеряется в тактах TSC (__rdtsc), на других архитектурах в наносекундах (clock_gettime).
+    Перед замером выполняется прогрев BENCH_WARMUP раз, затем каждое из n выполнений
+    замеряется отдельно. Выводится медиана, p99 и минимум, среднее не используется,
+    так как сильно зависит от прерываний и переключения задач.
+
+    Пример:
+    struct bench b;
+    bench_init(&b, "NTT", 1000);
+    BENCH_RUN(&b, NTT(f));
+    bench_report(&b, 1);
+    bench_free(&b);
+
+    Проверка постоянства времени в стиле dudect [Reparaz, Balasch, Verbauwhede 2017]:
+    измерения разбиваются на два класса входных данных (фиксированные и случайные),
+    распределения времени сравниваются t-тестом Уэлча, в том числе после отсечения
+    хвоста распределения по процентилям. |t| > 4.5 означает, что время выполнения
+    зависит от данных.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#ifndef BENCH_WARMUP
+#define BENCH_WARMUP 16
+#endif
+
+static inline uint64_t bench_clock(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000uLL + ts.tv_nsec;
+#endif
+}
+struct bench {
+    const char* name;
+    uint64_t *t;    // замеры
+    unsigned int n; // число замеров
+    unsigned int count; // число операций за один замер, для пересчета на операцию
+};
+static inline void bench_init(struct bench *b, const char* name, unsigned int n){
+    b->name = name;
+    b->t = malloc(n*sizeof(uint64_t));
+    b->n = n;
+    b->count = 1;
+}
+static inline void bench_free(struct bench *b){
+    free(b->t);
+    b->t = NULL;
+}
+//! Прогрев и n отдельных замеров выражения stmt
+#define BENCH_RUN(b, stmt) do { \
+    for (int _w=0; _w<BENCH_WARMUP; _w++) { stmt; } \
+    for (unsigned int _i=0; _i<(b)->n; _i++) { \
+        uint64_t _t0 = bench_clock(); \
+        stmt; \
+        (b)->t[_i] = bench_clock() - _t0; \
+    } \
+} while(0)
+
+static int _bench_cmp(const void* a, const void* b){
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x>y) - (x<y);
+}
+/*! \brief Процентиль p (0..100) по отсортированным замерам */
+static inline uint64_t bench_percentile(const uint64_t *t, unsigned int n, double p){
+    unsigned int i = (unsigned int)(p*(n-1)/100.0 + 0.5);
+    return t[i<n? i: n-1];
+}
+/*! \brief Вывод медианы, p99 и минимума
+    \param scale число единиц работы за одну операцию (байт, коэффициентов),
+    в конце строки выводится время на единицу
+    \return медиана на операцию
+ */
+static inline double bench_report(struct bench *b, unsigned int scale){
+    qsort(b->t, b->n, sizeof(uint64_t), _bench_cmp);
+    double c = b->count;
+    double med = bench_percentile(b->t, b->n, 50)/c;
+    double p99 = bench_percentile(b->t, b->n, 99)/c;
+    double min = b->t[0]/c;
+    printf("%-28s median %9.0f p99 %9.0f min %9.0f", b->name, med, p99, min);
+    if (scale>1) printf(" | %6.2f /unit", med/scale);
+    printf("\n");
+    return med;
+}
+/*! \brief t-тест Уэлча для двух классов замеров с отсечением по процентилям
+    \param t0,t1 замеры для фиксированных и случайных входных данных
+    \return максимальное значение |t| по всем порогам отсечения
+ */
+static inline double bench_dudect(const char* name, uint64_t *t0, unsigned int n0, uint64_t *t1, unsigned int n1){
+    static const double crop[] = {100, 99, 95, 90, 75, 50};
+    uint64_t *s = malloc((n0+n1)*sizeof(uint64_t));
+    for (unsigned int i=0; i<n0; i++) s[i]    = t0[i];
+    for (unsigned int i=0; i<n1; i++) s[n0+i] = t1[i];
+    qsort(s, n0+n1, sizeof(uint64_t), _bench_cmp);
+    double t_max = 0;
+    for (int k=0; k<sizeof(crop)/sizeof(crop[0]); k++){
+        uint64_t th = bench_percentile(s, n0+n1, crop[k]);
+        double m[2] = {0}, m2[2] = {0}, cnt[2] = {0};
+        for (int c=0; c<2; c++){
+            const uint64_t *x = c? t1: t0;
+            unsigned int n = c? n1: n0;
+            for (unsigned int i=0; i<n; i++){// алгоритм Уэлфорда
+                if (x[i]>th) continue;
+                cnt[c] += 1;
+                double d = x[i] - m[c];
+                m[c] += d/cnt[c];
+                m2[c] += d*(x[i] - m[c]);
+            }
+        }
+        if (cnt[0]<2 || cnt[1]<2) continue;
+        double v = m2[0]/(cnt[0]-1)/cnt[0] + m2[1]/(cnt[1]-1)/cnt[1];
+        double t = v>0? fabs(m[0]-m[1])/sqrt(v): 0;
+        if (t>t_max) t_max = t;
+    }
+    free(s);
+    printf("%-28s dudect max|t| = %6.2f %s\n", name, t_max, t_max>4.5? "время зависит от данных": "ok");
+    return t_max;
+}
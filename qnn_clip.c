@@ -206,7 +206,7 @@ int clip_vision_tensors(clip_ctx_t* ctx_clip, tensor_weight_t *infos, int n_tens
 /*! \brief формирование графа вычислений для классификации изображений 
     \param ctx - контекст визуальной части модели
     \param img_batch - количество изображений в серии, для которых формируется граф
-    \return указатель на граф, в форме таблицы
+    \return указатель на граф, в форме таблицы, исполняется qnn_graph_plan() и qnn_graph_compute() \see qnn_cpu.c
 
     \note Граф вычислений SigLIP составляется для одного изображения. 
 
@@ -250,7 +250,7 @@ struct qnn_cgraph * clip_image_build_graph_siglip(clip_ctx_t * ctx, int img_batc
     struct ggml_tensor * inp_raw = ggml_tensor_new(ctx0, GGML_TYPE_F32, (size_t[4]){image_size_width, image_size_height, 3, 1});
     ggml_set_name (ctx0, inp_raw, "inp_raw");
     inp_raw->flags|=GGML_TENSOR_FLAG_INPUT;
-return gf;
+
     struct ggml_tensor * inp = ggml_conv_2d(ctx0, _MODEL(patch_embeddings_0), inp_raw, patch_size, patch_size, 0, 0, 1, 1);
     inp = ggml_reshape_2d(ctx0, inp, num_patches, hidden_size);
     inp = ggml_cont(ctx0, ggml_transpose(ctx0, inp));
@@ -365,7 +365,9 @@ return gf;
     }
 
     // build the graph
-    //ggml_build_forward_expand(gf, embeddings);
+    qnn_graph_build_forward_expand(gf, embeddings);
+    // norm -> mul -> add и mul_mat -> add -> gelu -> add сворачиваются в слитные узлы
+    qnn_graph_fuse(gf);
 
     ggml_free(ctx0);
 
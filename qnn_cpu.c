@@ -0,0 +1,1436 @@
+/*! \file qnn_cpu.c
+    \brief Исполнение графа тензорных операций на CPU
+
+Сборка и тестирование
+    $ gcc -DTEST_CPU -O3 -march=native -o test qnn_cpu.c qnn.c qnn_gguf.c qnn_pool.c qnn_png.c xxh64.c quarks.c `pkgconf --cflags --libs glib-2.0` -lz -lpng -lpthread -lm
+
+Граф строится шаблонами операций qnn.h (ggml_mul_mat, ggml_norm, ggml_soft_max_ext ...) и упорядочивается
+функцией qnn_graph_build_forward_expand(). Перед планированием граф может быть свернут функцией qnn_graph_fuse():
+цепочки norm*w + b и mul_mat + b, act, + residual заменяются слитными узлами, промежуточные активации 
+не записываются в память. Исполнение выполняется в два этапа:
+
+1. qnn_graph_plan() - распределение памяти под промежуточные тензоры. Представления (reshape, view, permute, transpose)
+   ссылаются на данные источника и не вычисляются. По интервалам жизни тензорам назначаются смещения 
+   в одной арене, память тензора используется следующими узлами после того, как вычислен последний потребитель.
+   Пиковый объем арены определяется шириной графа, а не числом слоев.
+2. qnn_graph_compute() - вычисление узлов в топологическом порядке потоками общего пула (qnn_pool.c). Строки результата
+   делятся на задачи, поток, закончивший свою долю, перехватывает задачи других; между узлами - барьер пула.
+   Операции с подготовкой (MUL_MAT) выполняются в две фазы INIT и COMPUTE, как в ранних версиях ggml.
+
+Поддерживаемые типы данных: F32, F16, BF16 - для всех операций, Q8_0, Q4_K и Q8_K - для весов в MUL_MAT.
+Квантованные веса не распаковываются: активации квантуются в Q8_1, произведение считается в целых числах.
+
+Профилирование: qnn_graph_profile() включает замер времени узлов, qnn_graph_profile_print() выводит листинг
+со свернутыми повторами слоев, GFLOP/s и GB/s по узлам и операциям, qnn_graph_profile_trace() - трассу Chrome JSON.
+ */
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "qnn.h"
+
+typedef float float32x16_t __attribute__((__vector_size__(64)));
+
+enum qnn_task_type {
+    QNN_TASK_INIT,      //!< подготовка аргументов, например преобразование типа
+    QNN_TASK_COMPUTE,   //!< вычисление строк результата
+};
+struct qnn_compute_params {
+    enum qnn_task_type type;
+    int ith, nth;       //!< номер потока и число потоков
+    size_t wsize;       //!< размер рабочего буфера потока
+    void * wdata;       //!< рабочий буфер потока
+    void * shared;      //!< общий буфер узла, заполняется на фазе INIT
+    struct qnn_pool * pool; //!< пул, деление строк результата с перехватом работы
+};
+
+#define QNN_MEM_ALIGN 64
+#define QNN_MM_BLCK   8     // число строк весов, которые распаковываются в рабочий буфер за один проход
+#define QNN_MM_COLS   64    // ширина полосы столбцов src1 для квантованного MUL_MAT
+
+// --- Преобразование типов ---
+static inline float _get_f32(enum ggml_type type, const void * p){
+    switch (type) {
+    case GGML_TYPE_F16:  return GGML_FP16_TO_FP32(((const ggml_fp16_t*)p)->hf);
+    case GGML_TYPE_BF16: return GGML_BF16_TO_FP32(*(const ggml_bf16_t*)p);
+    case GGML_TYPE_I32:  return *(const int32_t*)p;
+    default:             return *(const float*)p;
+    }
+}
+static inline void _set_f32(enum ggml_type type, void * p, float v){
+    switch (type) {
+    case GGML_TYPE_F16:  ((ggml_fp16_t*)p)->hf = (_Float16)v; break;
+    case GGML_TYPE_BF16: *(ggml_bf16_t*)p = GGML_FP32_TO_BF16(v); break;
+    case GGML_TYPE_I32:  *(int32_t*)p = (int32_t)v; break;
+    default:             *(float*)p = v; break;
+    }
+}
+/*! \brief распаковка строки весов в F32
+    \return false если тип не поддерживается
+ */
+static bool _row_to_f32(enum ggml_type type, const void * src, float * dst, int64_t n){
+    switch (type) {
+    case GGML_TYPE_F32:
+        __builtin_memcpy(dst, src, n*sizeof(float));
+        break;
+    case GGML_TYPE_F16: {
+        const ggml_fp16_t * x = src;
+        for (int64_t i = 0; i < n; i++) dst[i] = GGML_FP16_TO_FP32(x[i].hf);
+    } break;
+    case GGML_TYPE_BF16:
+        convert_row_bf16_to_f32(src, dst, n);
+        break;
+    case GGML_TYPE_BF8:
+        convert_row_bf8_to_f32(src, dst, n);
+        break;
+    case GGML_TYPE_HF8:
+        convert_row_hf8_to_f32(src, dst, n);
+        break;
+    case GGML_TYPE_Q8_0:
+    case GGML_TYPE_Q4_K:
+    case GGML_TYPE_Q8_K:
+        qnn_dequantize_row(type)(src, dst, n);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+static float _vec_dot_f32(const float * restrict a, const float * restrict b, int64_t n){
+    float32x16_t s0 = {0}, s1 = {0};
+    int64_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        float32x16_t a0, a1, b0, b1;
+        __builtin_memcpy(&a0, a+i,    sizeof(a0)); __builtin_memcpy(&b0, b+i,    sizeof(b0));
+        __builtin_memcpy(&a1, a+i+16, sizeof(a1)); __builtin_memcpy(&b1, b+i+16, sizeof(b1));
+        s0 += a0*b0;
+        s1 += a1*b1;
+    }
+    s0 += s1;
+    float sum = 0;
+    for (int k = 0; k < 16; k++) sum += s0[k];
+    for (; i < n; i++) sum += a[i]*b[i];
+    return sum;
+}
+// индекс строки -> координаты i1,i2,i3
+static inline void _row_index(const struct ggml_tensor * t, int64_t ir, int64_t * i1, int64_t * i2, int64_t * i3){
+    *i1 = ir % t->ne[1]; ir /= t->ne[1];
+    *i2 = ir % t->ne[2];
+    *i3 = ir / t->ne[2];
+}
+static inline void * _ptr(const struct ggml_tensor * t, int64_t i0, int64_t i1, int64_t i2, int64_t i3){
+    return (uint8_t*)t->data + i0*t->nb[0] + i1*t->nb[1] + i2*t->nb[2] + i3*t->nb[3];
+}
+// деление строк между потоками
+static inline void _split(int64_t nr, const struct qnn_compute_params * params, int64_t * ir0, int64_t * ir1){
+    const int64_t dr = (nr + params->nth - 1)/params->nth;
+    *ir0 = MIN(nr, dr*params->ith);
+    *ir1 = MIN(nr, *ir0 + dr);
+}
+/*! \brief деление строк результата на задачи: поток начинает со своей доли, затем перехватывает 
+    задачи других потоков (\see qnn_pool_rows_next). Размер задачи - часть доли потока */
+#define QNN_ROWS_TASKS 4 // задач на поток
+static inline int64_t _rows_grain(int64_t nr, int nth){
+    return MAX(1, nr/(nth*QNN_ROWS_TASKS));
+}
+static inline void _rows_begin(const struct qnn_compute_params * params, int64_t nr){
+    const int64_t g = _rows_grain(nr, params->nth);
+    qnn_pool_rows_begin(params->pool, params->ith, (nr + g - 1)/g);
+}
+static inline bool _rows_next(const struct qnn_compute_params * params, int64_t nr, int64_t * ir0, int64_t * ir1){
+    const int64_t g = _rows_grain(nr, params->nth);
+    const int64_t t = qnn_pool_rows_next(params->pool, params->ith);
+    if (t < 0) return false;
+    *ir0 = t*g;
+    *ir1 = MIN(nr, *ir0 + g);
+    return true;
+}
+static inline bool _is_view_op(enum ggml_op op){
+    return op == GGML_OP_RESHAPE || op == GGML_OP_VIEW || op == GGML_OP_PERMUTE || op == GGML_OP_TRANSPOSE;
+}
+
+// --- Операции ---
+/*! \brief копирование с преобразованием типа: DUP, CONT, CPY
+    Если форма результата отличается от формы источника (ggml_cont_4d), элементы копируются в порядке обхода источника.
+ */
+static void _compute_dup(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const int64_t nr = ggml_nrows(dst);
+    _rows_begin(params, nr);
+    const bool same_shape = ggml_are_same_shape(src0, dst);
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        int64_t i1, i2, i3;
+        _row_index(dst, ir, &i1, &i2, &i3);
+        if (same_shape) {
+            for (int64_t i0 = 0; i0 < dst->ne[0]; i0++)
+                _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), _get_f32(src0->type, _ptr(src0, i0, i1, i2, i3)));
+        } else {
+            int64_t k = ir*dst->ne[0];// линейный индекс элемента
+            for (int64_t i0 = 0; i0 < dst->ne[0]; i0++, k++) {
+                int64_t j = k;
+                const int64_t j0 = j % src0->ne[0]; j /= src0->ne[0];
+                const int64_t j1 = j % src0->ne[1]; j /= src0->ne[1];
+                const int64_t j2 = j % src0->ne[2];
+                const int64_t j3 = j / src0->ne[2];
+                _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), _get_f32(src0->type, _ptr(src0, j0, j1, j2, j3)));
+            }
+        }
+    }
+}
+/*! \brief поэлементные бинарные операции с повторением второго аргумента: ADD, SUB, MUL, DIV */
+static void _compute_binary(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const int64_t nr = ggml_nrows(dst);
+    _rows_begin(params, nr);
+    const bool is_f32 = dst->type == GGML_TYPE_F32 && src0->type == GGML_TYPE_F32 && src1->type == GGML_TYPE_F32
+                     && src0->nb[0] == sizeof(float) && src1->nb[0] == sizeof(float) && src1->ne[0] == dst->ne[0];
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        int64_t i1, i2, i3;
+        _row_index(dst, ir, &i1, &i2, &i3);
+        const int64_t j1 = i1 % src1->ne[1], j2 = i2 % src1->ne[2], j3 = i3 % src1->ne[3];
+        if (is_f32) {
+            float * d = _ptr(dst, 0, i1, i2, i3);
+            const float * a = _ptr(src0, 0, i1, i2, i3);
+            const float * b = _ptr(src1, 0, j1, j2, j3);
+            const int64_t n = dst->ne[0];
+            switch (dst->op) {
+            case GGML_OP_ADD: for (int64_t i = 0; i < n; i++) d[i] = a[i] + b[i]; break;
+            case GGML_OP_SUB: for (int64_t i = 0; i < n; i++) d[i] = a[i] - b[i]; break;
+            case GGML_OP_MUL: for (int64_t i = 0; i < n; i++) d[i] = a[i] * b[i]; break;
+            case GGML_OP_DIV: for (int64_t i = 0; i < n; i++) d[i] = a[i] / b[i]; break;
+            default: break;
+            }
+            continue;
+        }
+        for (int64_t i0 = 0; i0 < dst->ne[0]; i0++) {
+            const float a = _get_f32(src0->type, _ptr(src0, i0, i1, i2, i3));
+            const float b = _get_f32(src1->type, _ptr(src1, i0 % src1->ne[0], j1, j2, j3));
+            float v;
+            switch (dst->op) {
+            case GGML_OP_ADD: v = a + b; break;
+            case GGML_OP_SUB: v = a - b; break;
+            case GGML_OP_MUL: v = a * b; break;
+            default:          v = a / b; break;
+            }
+            _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), v);
+        }
+    }
+}
+#define GELU_COEF_A     0.044715f
+#define GELU_QUICK_COEF -1.702f
+#define SQRT_2_OVER_PI  0.79788456080286535587989211986876f
+static inline float _unary(enum ggml_op op, int32_t uop, float x, float param){
+    if (op == GGML_OP_SQR)   return x*x;
+    if (op == GGML_OP_SQRT)  return sqrtf(x);
+    if (op == GGML_OP_LOG)   return logf(x);
+    if (op == GGML_OP_SIN)   return sinf(x);
+    if (op == GGML_OP_COS)   return cosf(x);
+    if (op == GGML_OP_SCALE) return x*param;
+    switch (uop) {
+    case GGML_UNARY_OP_ABS:     return fabsf(x);
+    case GGML_UNARY_OP_SGN:     return (x > 0.f) ? 1.f : ((x < 0.f) ? -1.f : 0.f);
+    case GGML_UNARY_OP_NEG:     return -x;
+    case GGML_UNARY_OP_STEP:    return (x > 0.f) ? 1.f : 0.f;
+    case GGML_UNARY_OP_TANH:    return tanhf(x);
+    case GGML_UNARY_OP_ELU:     return (x > 0.f) ? x : expm1f(x);
+    case GGML_UNARY_OP_RELU:    return (x > 0.f) ? x : 0.f;
+    case GGML_UNARY_OP_SIGMOID: return 1.f/(1.f + expf(-x));
+    case GGML_UNARY_OP_GELU:    // 0.5*x*(1 + tanh(u)) = x*sigmoid(2u)
+        return x/(1.0f + expf(-2.0f*SQRT_2_OVER_PI*x*(1.0f + GELU_COEF_A*x*x)));
+    case GGML_UNARY_OP_GELU_QUICK: return x*(1.0f/(1.0f + expf(GELU_QUICK_COEF*x)));
+    case GGML_UNARY_OP_SILU:    return x/(1.0f + expf(-x));
+    case GGML_UNARY_OP_HARDSWISH:   return x*fminf(1.0f, fmaxf(0.0f, (x + 3.0f)/6.0f));
+    case GGML_UNARY_OP_HARDSIGMOID: return fminf(1.0f, fmaxf(0.0f, (x + 3.0f)/6.0f));
+    case GGML_UNARY_OP_EXP:     return expf(x);
+    default:                    return x;
+    }
+}
+/*! \brief унарные операции: SQR, SQRT, LOG, SIN, COS, SCALE, UNARY */
+static void _compute_unary(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const int32_t uop  = dst->op_params[0];
+    float param;
+    __builtin_memcpy(&param, dst->op_params, sizeof(float));
+    const int64_t nr = ggml_nrows(dst);
+    _rows_begin(params, nr);
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        int64_t i1, i2, i3;
+        _row_index(dst, ir, &i1, &i2, &i3);
+        for (int64_t i0 = 0; i0 < dst->ne[0]; i0++) {
+            const float x = _get_f32(src0->type, _ptr(src0, i0, i1, i2, i3));
+            _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), _unary(dst->op, uop, x, param));
+        }
+    }
+}
+/*! \brief нормализация строк: NORM (mean, variance), RMS_NORM, L2_NORM
+    Слитная операция: src[1] - множитель, src[2] - смещение, если задано; повторяются по строкам.
+ */
+static void _compute_norm(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    float eps;
+    __builtin_memcpy(&eps, dst->op_params, sizeof(float));
+    const int64_t n = dst->ne[0];
+    float * x = params->wdata;
+    const int64_t nr = ggml_nrows(dst);
+    _rows_begin(params, nr);
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        int64_t i1, i2, i3;
+        _row_index(dst, ir, &i1, &i2, &i3);
+        for (int64_t i0 = 0; i0 < n; i0++)
+            x[i0] = _get_f32(src0->type, _ptr(src0, i0, i1, i2, i3));
+        double sum = 0, sum2 = 0;
+        for (int64_t i0 = 0; i0 < n; i0++) {
+            sum  += x[i0];
+            sum2 += (double)x[i0]*x[i0];
+        }
+        float mean = 0, scale;
+        switch (dst->op) {
+        case GGML_OP_NORM:
+            mean  = sum/n;
+            scale = 1.0f/sqrtf(fmaxf(sum2/n - (double)mean*mean, 0.0) + eps);
+            break;
+        case GGML_OP_RMS_NORM:
+            scale = 1.0f/sqrtf(sum2/n + eps);
+            break;
+        default:// L2_NORM
+            scale = 1.0f/fmaxf(sqrtf(sum2), eps);
+            break;
+        }
+        if (dst->src[1]) {// norm(x)*w + b, \see qnn_graph_fuse()
+            const struct ggml_tensor * w = dst->src[1], * b = dst->src[2];
+            const float * wr = _ptr(w, 0, i1 % w->ne[1], i2 % w->ne[2], i3 % w->ne[3]);
+            const float * br = b ? _ptr(b, 0, i1 % b->ne[1], i2 % b->ne[2], i3 % b->ne[3]) : NULL;
+            float * y = _ptr(dst, 0, i1, i2, i3);
+            for (int64_t i0 = 0; i0 < n; i0++)
+                y[i0] = (x[i0] - mean)*scale*wr[i0] + (br ? br[i0] : 0.0f);
+            continue;
+        }
+        for (int64_t i0 = 0; i0 < n; i0++)
+            _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), (x[i0] - mean)*scale);
+    }
+}
+/*! \brief SOFT_MAX(a*scale + mask*slope), slope - коэффициент ALiBi при max_bias > 0 */
+static void _compute_soft_max(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * mask = dst->src[1];
+    float scale, max_bias;
+    __builtin_memcpy(&scale,    (const float*)dst->op_params + 0, sizeof(float));
+    __builtin_memcpy(&max_bias, (const float*)dst->op_params + 1, sizeof(float));
+    const int64_t n = dst->ne[0];
+    const uint32_t n_head      = src0->ne[2];
+    const uint32_t n_head_log2 = 1u << (uint32_t)floorf(log2f(n_head));
+    const float m0 = powf(2.0f, -(max_bias       )/n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias/2.0f)/n_head_log2);
+    float * x = params->wdata;
+    const int64_t nr = ggml_nrows(dst);
+    _rows_begin(params, nr);
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        int64_t i1, i2, i3;
+        _row_index(dst, ir, &i1, &i2, &i3);
+        const uint32_t h = i2;
+        const float slope = (max_bias > 0.0f) ? (h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1)) : 1.0f;
+        float max = -INFINITY;
+        for (int64_t i0 = 0; i0 < n; i0++) {
+            float v = _get_f32(src0->type, _ptr(src0, i0, i1, i2, i3))*scale;
+            if (mask) v += slope*_get_f32(mask->type, _ptr(mask, i0, i1 % mask->ne[1], 0, 0));
+            x[i0] = v;
+            if (v > max) max = v;
+        }
+        double sum = 0;
+        for (int64_t i0 = 0; i0 < n; i0++) {
+            x[i0] = (x[i0] == -INFINITY) ? 0.0f : expf(x[i0] - max);
+            sum += x[i0];
+        }
+        const float isum = sum > 0 ? 1.0/sum : 0.0f;
+        for (int64_t i0 = 0; i0 < n; i0++)
+            _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), x[i0]*isum);
+    }
+}
+/*! \brief запись n значений строки результата MUL_MAT с позиции i0
+    Слитные операции: act(v + src[2]) + src[3], \see qnn_graph_fuse()
+ */
+static inline void _mul_mat_store(struct ggml_tensor * dst, const float * v, int64_t i0, int64_t n, int64_t i1, int64_t i2, int64_t i3){
+    const struct ggml_tensor * bias = dst->src[2], * res = dst->src[3];
+    float * d = _ptr(dst, i0, i1, i2, i3);
+    if (bias == NULL && res == NULL && dst->op_params[0] == GGML_OP_NONE) {
+        for (int64_t k = 0; k < n; k++) d[k] = v[k];
+        return;
+    }
+    const float * b = bias ? _ptr(bias, i0, i1 % bias->ne[1], i2 % bias->ne[2], i3 % bias->ne[3]) : NULL;
+    const float * r = res  ? _ptr(res,  i0, i1 % res->ne[1],  i2 % res->ne[2],  i3 % res->ne[3])  : NULL;
+    const int32_t uop = dst->op_params[0] == GGML_OP_UNARY ? dst->op_params[1] : -1;
+    for (int64_t k = 0; k < n; k++) {
+        float x = v[k];
+        if (b) x += b[k];
+        if (uop >= 0) x = _unary(GGML_OP_UNARY, uop, x, 0.0f);
+        if (r) x += r[k];
+        d[k] = x;
+    }
+}
+/*! \brief MUL_MAT: dst[i1,j] = dot(src0[:,i1], src1[:,j])
+
+    src0 - веса F32, F16, BF16, Q8_0, Q4_K, строки распаковываются блоками по QNN_MM_BLCK в рабочий буфер потока.
+    src1 - активации, на фазе INIT приводятся к непрерывному F32 в общем буфере узла.
+    Измерения 2,3 src0 повторяются по измерениям src1 (broadcast).
+    Слитные операции src[2], src[3] и активация применяются при записи результата.
+ */
+static void _compute_mul_mat(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const int64_t ne00 = src0->ne[0];
+    const int64_t ne01 = src0->ne[1];
+    const int64_t nr1  = ggml_nrows(src1);
+    float * b = params->shared;
+    if (params->type == QNN_TASK_INIT) {
+        int64_t ir0, ir1;
+        _split(nr1, params, &ir0, &ir1);
+        for (int64_t ir = ir0; ir < ir1; ir++) {
+            int64_t j1, j2, j3;
+            _row_index(src1, ir, &j1, &j2, &j3);
+            for (int64_t i0 = 0; i0 < ne00; i0++)
+                b[ir*ne00 + i0] = _get_f32(src1->type, _ptr(src1, i0, j1, j2, j3));
+        }
+        return;
+    }
+    const int64_t r2 = src1->ne[2]/src0->ne[2];
+    const int64_t r3 = src1->ne[3]/src0->ne[3];
+    // делим между потоками строки весов по всем подматрицам
+    const int64_t nr0 = ne01*src1->ne[2]*src1->ne[3];
+    const int64_t nblk = (nr0 + QNN_MM_BLCK - 1)/QNN_MM_BLCK;
+    _rows_begin(params, nblk);
+    float * a = params->wdata;
+    for (int64_t ib0, ib1; _rows_next(params, nblk, &ib0, &ib1); )
+    for (int64_t ir = ib0*QNN_MM_BLCK, ir1 = MIN(nr0, ib1*QNN_MM_BLCK); ir < ir1; ) {
+        const int64_t i01 = ir % ne01;
+        const int64_t i12 = (ir/ne01) % src1->ne[2];
+        const int64_t i13 =  ir/ne01/src1->ne[2];
+        const int64_t nb  = MIN(MIN(QNN_MM_BLCK, ne01 - i01), ir1 - ir);
+        for (int64_t k = 0; k < nb; k++)
+            _row_to_f32(src0->type, _ptr(src0, 0, i01 + k, i12/r2, i13/r3), a + k*ne00, ne00);
+        for (int64_t i11 = 0; i11 < src1->ne[1]; i11++) {
+            const float * bj = b + ((i13*src1->ne[2] + i12)*src1->ne[1] + i11)*ne00;
+            float v[QNN_MM_BLCK];
+            for (int64_t k = 0; k < nb; k++)
+                v[k] = _vec_dot_f32(a + k*ne00, bj, ne00);
+            _mul_mat_store(dst, v, i01, nb, i11, i12, i13);
+        }
+        ir += nb;
+    }
+}
+/*! \brief ядро MUL_MAT без распаковки весов, NULL если веса распаковываются в F32 */
+static qnn_vec_dot_t _mul_mat_vec_dot(const struct ggml_tensor * node){
+    const struct ggml_tensor * src0 = node->src[0];
+    qnn_vec_dot_t vec_dot = qnn_vec_dot_q8_1(src0->type);
+    if (vec_dot == NULL || src0->ne[0] % QK8_1 != 0 || src0->ne[0] % ggml_blck_size(src0->type) != 0)
+        return NULL;
+    return vec_dot;
+}
+/*! \brief MUL_MAT с квантованными весами Q8_0, Q4_K, Q8_K
+    
+    На фазе INIT строки src1 квантуются в блоки Q8_1 в общем буфере. На фазе COMPUTE скалярные 
+    произведения считаются целочисленно по блокам весов (vpdpbusd), см. qnn_vec_dot_q8_1().
+    Столбцы результата обрабатываются полосами по QNN_MM_COLS, чтобы активации полосы оставались 
+    в кеше, пока по ним проходят блоки строк весов задачи. Ядро получает блок строк и всю полосу 
+    столбцов, распакованный блок весов используется для нескольких столбцов.
+ */
+static void _compute_mul_mat_q8(const struct qnn_compute_params * params, struct ggml_tensor * dst, qnn_vec_dot_t vec_dot){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const int64_t ne00 = src0->ne[0];
+    const int64_t ne01 = src0->ne[1];
+    const int64_t nbq  = ne00/QK8_1;
+    block_q8_1 * b = params->shared;
+    if (params->type == QNN_TASK_INIT) {
+        float * row = params->wdata;
+        int64_t ir0, ir1;
+        _split(ggml_nrows(src1), params, &ir0, &ir1);
+        for (int64_t ir = ir0; ir < ir1; ir++) {
+            int64_t j1, j2, j3;
+            _row_index(src1, ir, &j1, &j2, &j3);
+            const float * x = _ptr(src1, 0, j1, j2, j3);
+            if (src1->type != GGML_TYPE_F32 || src1->nb[0] != sizeof(float)) {
+                for (int64_t i0 = 0; i0 < ne00; i0++)
+                    row[i0] = _get_f32(src1->type, _ptr(src1, i0, j1, j2, j3));
+                x = row;
+            }
+            quantize_row_q8_1(x, b + ir*nbq, ne00);
+        }
+        return;
+    }
+    const int64_t r2 = src1->ne[2]/src0->ne[2];
+    const int64_t r3 = src1->ne[3]/src0->ne[3];
+    const int64_t nr0 = ne01*src1->ne[2]*src1->ne[3];
+    const int64_t nblk = (nr0 + QNN_MM_BLCK - 1)/QNN_MM_BLCK;
+    _rows_begin(params, nblk);
+    float s[QNN_MM_COLS][QNN_MM_BLCK];
+    // задача - диапазон блоков строк весов, по нему проходят все полосы столбцов
+    for (int64_t ib0, ib1; _rows_next(params, nblk, &ib0, &ib1); ) {
+        const int64_t ir0 = ib0*QNN_MM_BLCK, ir1 = MIN(nr0, ib1*QNN_MM_BLCK);
+        for (int64_t jc = 0; jc < src1->ne[1]; jc += QNN_MM_COLS)
+        for (int64_t ir = ir0; ir < ir1; ) {
+            const int64_t i01 = ir % ne01;
+            const int64_t i12 = (ir/ne01) % src1->ne[2];
+            const int64_t i13 =  ir/ne01/src1->ne[2];
+            const int64_t nb  = MIN(MIN(QNN_MM_BLCK, ne01 - i01), ir1 - ir);
+            const int64_t nc  = MIN(QNN_MM_COLS, src1->ne[1] - jc);
+            const void * x = _ptr(src0, 0, i01, i12/r2, i13/r3);
+            vec_dot(ne00, s[0], QNN_MM_BLCK, x, src0->nb[1], nb, 
+                    b + ((i13*src1->ne[2] + i12)*src1->ne[1] + jc)*nbq, nbq*sizeof(block_q8_1), nc);
+            for (int64_t c = 0; c < nc; c++)
+                _mul_mat_store(dst, s[c], i01, nb, jc + c, i12, i13);
+            ir += nb;
+        }
+    }
+}
+/*! \brief IM2COL: [N, IC, IH, IW] => [N, OH, OW, IC*KH*KW] \see ggml_im2col() */
+static void _compute_im2col(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];// kernel
+    const struct ggml_tensor * src1 = dst->src[1];// data
+    const int32_t s0 = dst->op_params[0], s1 = dst->op_params[1];
+    const int32_t p0 = dst->op_params[2], p1 = dst->op_params[3];
+    const int32_t d0 = dst->op_params[4], d1 = dst->op_params[5];
+    const bool is_2D = dst->op_params[6] == 1;
+
+    const int64_t KW = src0->ne[0];
+    const int64_t KH = is_2D ? src0->ne[1] : 1;
+    const int64_t IC = is_2D ? src1->ne[2] : src1->ne[1];
+    const int64_t IW = src1->ne[0];
+    const int64_t IH = is_2D ? src1->ne[1] : 1;
+    const int64_t OW = dst->ne[1];
+    const int64_t OH = is_2D ? dst->ne[2] : 1;
+    const int64_t N  = is_2D ? dst->ne[3] : dst->ne[2];
+    const int64_t nr = N*OH*OW;
+    _rows_begin(params, nr);
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        const int64_t iow = ir % OW;
+        const int64_t ioh = (ir/OW) % OH;
+        const int64_t in  = ir/OW/OH;
+        uint8_t * row = is_2D ? _ptr(dst, 0, iow, ioh, in) : _ptr(dst, 0, iow, in, 0);
+        for (int64_t iic = 0; iic < IC; iic++)
+        for (int64_t ikh = 0; ikh < KH; ikh++)
+        for (int64_t ikw = 0; ikw < KW; ikw++) {
+            const int64_t iiw = iow*s0 + ikw*d0 - p0;
+            const int64_t iih = ioh*s1 + ikh*d1 - p1;
+            float v = 0.0f;
+            if (iih >= 0 && iih < IH && iiw >= 0 && iiw < IW)
+                v = is_2D ? _get_f32(src1->type, _ptr(src1, iiw, iih, iic, in))
+                          : _get_f32(src1->type, _ptr(src1, iiw, iic, in, 0));
+            _set_f32(dst->type, row + ((iic*KH + ikh)*KW + ikw)*dst->nb[0], v);
+        }
+    }
+}
+/*! \brief POOL_2D: max или avg по окну k0 x k1 */
+static void _compute_pool_2d(const struct qnn_compute_params * params, struct ggml_tensor * dst){
+    const struct ggml_tensor * src0 = dst->src[0];
+    const int32_t op = dst->op_params[0];
+    const int32_t k0 = dst->op_params[1], k1 = dst->op_params[2];
+    const int32_t s0 = dst->op_params[3], s1 = dst->op_params[4];
+    const int32_t p0 = dst->op_params[5], p1 = dst->op_params[6];
+    const int64_t nr = ggml_nrows(dst);
+    _rows_begin(params, nr);
+    for (int64_t ir0, ir1; _rows_next(params, nr, &ir0, &ir1); )
+    for (int64_t ir = ir0; ir < ir1; ir++) {
+        int64_t i1, i2, i3;
+        _row_index(dst, ir, &i1, &i2, &i3);
+        for (int64_t i0 = 0; i0 < dst->ne[0]; i0++) {
+            float v = (op == GGML_OP_POOL_MAX) ? -INFINITY : 0.0f;
+            for (int32_t ky = 0; ky < k1; ky++) {
+                const int64_t iy = i1*s1 + ky - p1;
+                if (iy < 0 || iy >= (int64_t)src0->ne[1]) continue;
+                for (int32_t kx = 0; kx < k0; kx++) {
+                    const int64_t ix = i0*s0 + kx - p0;
+                    if (ix < 0 || ix >= (int64_t)src0->ne[0]) continue;
+                    const float x = _get_f32(src0->type, _ptr(src0, ix, iy, i2, i3));
+                    if (op == GGML_OP_POOL_MAX) { if (x > v) v = x; }
+                    else v += x;
+                }
+            }
+            if (op == GGML_OP_POOL_AVG) v /= (float)(k0*k1);
+            _set_f32(dst->type, _ptr(dst, i0, i1, i2, i3), v);
+        }
+    }
+}
+static bool _compute_has_init(const struct ggml_tensor * node){
+    return node->op == GGML_OP_MUL_MAT;
+}
+static void _compute_forward(const struct qnn_compute_params * params, struct ggml_tensor * node){
+    switch (node->op) {
+    case GGML_OP_DUP:
+    case GGML_OP_CPY:
+    case GGML_OP_CONT:      _compute_dup     (params, node); break;
+    case GGML_OP_ADD:
+    case GGML_OP_SUB:
+    case GGML_OP_MUL:
+    case GGML_OP_DIV:       _compute_binary  (params, node); break;
+    case GGML_OP_SQR:
+    case GGML_OP_SQRT:
+    case GGML_OP_LOG:
+    case GGML_OP_SIN:
+    case GGML_OP_COS:
+    case GGML_OP_SCALE:
+    case GGML_OP_UNARY:     _compute_unary   (params, node); break;
+    case GGML_OP_NORM:
+    case GGML_OP_RMS_NORM:
+    case GGML_OP_L2_NORM:   _compute_norm    (params, node); break;
+    case GGML_OP_SOFT_MAX:  _compute_soft_max(params, node); break;
+    case GGML_OP_MUL_MAT: {
+        qnn_vec_dot_t vec_dot = _mul_mat_vec_dot(node);
+        if (vec_dot) _compute_mul_mat_q8(params, node, vec_dot);
+        else         _compute_mul_mat   (params, node);
+    } break;
+    case GGML_OP_IM2COL:    _compute_im2col  (params, node); break;
+    case GGML_OP_POOL_2D:   _compute_pool_2d (params, node); break;
+    default:
+        break;
+    }
+}
+static bool _compute_supported(const struct ggml_tensor * node){
+    if ((node->op == GGML_OP_NORM || node->op == GGML_OP_RMS_NORM) && node->src[1] && node->type != GGML_TYPE_F32)
+        return false;
+    switch (node->op) {
+    case GGML_OP_DUP: case GGML_OP_CPY: case GGML_OP_CONT:
+    case GGML_OP_ADD: case GGML_OP_SUB: case GGML_OP_MUL: case GGML_OP_DIV:
+    case GGML_OP_SQR: case GGML_OP_SQRT: case GGML_OP_LOG: case GGML_OP_SIN: case GGML_OP_COS:
+    case GGML_OP_SCALE: case GGML_OP_UNARY:
+    case GGML_OP_NORM: case GGML_OP_RMS_NORM: case GGML_OP_L2_NORM:
+    case GGML_OP_SOFT_MAX: case GGML_OP_IM2COL: case GGML_OP_POOL_2D:
+        return true;
+    case GGML_OP_MUL_MAT:
+        switch (node->src[0]->type) {
+        case GGML_TYPE_F32: case GGML_TYPE_F16: case GGML_TYPE_BF16:
+        case GGML_TYPE_Q8_0: case GGML_TYPE_Q4_K: case GGML_TYPE_Q8_K:
+            return node->src[0]->nb[0] == ggml_type_size(node->src[0]->type);
+        default:
+            return false;
+        }
+    default:
+        return _is_view_op(node->op);
+    }
+}
+
+// --- Планирование памяти ---
+// тензор, которому принадлежат данные представления
+static struct ggml_tensor * _view_base(struct ggml_tensor * t){
+    while (_is_view_op(t->op)) t = t->src[0];
+    return t;
+}
+//!< таблица индексов узлов, открытая адресация
+struct _node_map {
+    struct ggml_tensor ** keys;
+    int * vals;
+    size_t size;
+};
+static int _node_index(const struct _node_map * map, const struct ggml_tensor * t){
+    size_t i = ((uintptr_t)t >> 4) % map->size;
+    while (map->keys[i] != NULL) {
+        if (map->keys[i] == t) return map->vals[i];
+        if (++i == map->size) i = 0;
+    }
+    return -1;
+}
+static void _node_map_insert(struct _node_map * map, struct ggml_tensor * t, int idx){
+    size_t i = ((uintptr_t)t >> 4) % map->size;
+    while (map->keys[i] != NULL)
+        if (++i == map->size) i = 0;
+    map->keys[i] = t;
+    map->vals[i] = idx;
+}
+// --- Слияние операций ---
+//!< второй аргумент поэлементной операции, повторяется по строкам результата t
+static bool _fuse_operand(const struct ggml_tensor * t, const struct ggml_tensor * a){
+    if (a->type != GGML_TYPE_F32 || a->nb[0] != sizeof(float) || a->ne[0] != t->ne[0])
+        return false;
+    for (int k = 1; k < GGML_MAX_DIMS; k++)
+        if (t->ne[k] % a->ne[k] != 0) return false;
+    return true;
+}
+/*! \brief следующее звено цепочки: единственный потребитель узла i с операцией op
+    \param other - второй аргумент бинарной операции, NULL для унарной
+    \return индекс потребителя или -1
+ */
+static int _fuse_next(const struct qnn_cgraph * gf, const int * n_uses, const int * consumer, int i,
+        enum ggml_op op, struct ggml_tensor ** other){
+    const struct ggml_tensor * t = gf->nodes[i];
+    if (n_uses[i] != 1 || (t->flags & GGML_TENSOR_FLAG_OUTPUT)) return -1;
+    const int j = consumer[i];
+    struct ggml_tensor * c = gf->nodes[j];
+    if (c->op != op || c->type != GGML_TYPE_F32 || !ggml_are_same_shape(c, t)) return -1;
+    if (other == NULL) return j;
+    struct ggml_tensor * a = (c->src[0] == t) ? c->src[1] : c->src[0];
+    if (a == NULL || !_fuse_operand(c, a)) return -1;
+    *other = a;
+    return j;
+}
+/*! \brief слияние цепочек поэлементных операций с предшествующим узлом
+    \param gf - граф, построенный qnn_graph_build_forward_expand()
+    \return число слитых цепочек
+
+    Шаблоны (все тензоры F32, промежуточные результаты имеют единственного потребителя):
+    - norm(x)*w [+ b]                 => NORM, RMS_NORM: src[1] = w, src[2] = b
+    - mul_mat(a,x) [+ b] [act] [+ r]  => MUL_MAT: src[2] = b, src[3] = r, op_params = {GGML_OP_UNARY, act}
+    
+    Узел-результат цепочки сохраняется и становится слитым узлом, поэтому ссылки потребителей 
+    остаются действительными. Промежуточные узлы удаляются из графа, активации читаются из памяти один раз.
+ */
+int qnn_graph_fuse(struct qnn_cgraph * gf){
+    const int n = gf->n_nodes;
+    int * n_uses   = g_new0(int, n);
+    int * consumer = g_new0(int, n);
+    uint8_t * removed = g_new0(uint8_t, n);
+    struct _node_map map = {.size = 2*n + 1};
+    map.keys = g_new0(struct ggml_tensor *, map.size);
+    map.vals = g_new0(int, map.size);
+    for (int i = 0; i < n; i++) {
+        struct ggml_tensor * node = gf->nodes[i];
+        _node_map_insert(&map, node, i);
+        for (int k = 0; k < GGML_MAX_SRC; k++) {
+            if (node->src[k] == NULL) continue;
+            int j = _node_index(&map, node->src[k]);
+            if (j >= 0) {
+                n_uses[j]++;
+                consumer[j] = i;
+            }
+        }
+    }
+    int n_fused = 0;
+    for (int i = 0; i < n; i++) {
+        struct ggml_tensor * node = gf->nodes[i];
+        if (removed[i] || node->type != GGML_TYPE_F32) continue;
+        int chain[4], len = 0, j;
+        chain[len++] = i;
+        if ((node->op == GGML_OP_NORM || node->op == GGML_OP_RMS_NORM) && node->src[1] == NULL) {
+            struct ggml_tensor * w = NULL, * b = NULL;
+            if ((j = _fuse_next(gf, n_uses, consumer, i, GGML_OP_MUL, &w)) < 0) continue;
+            chain[len++] = j;
+            if ((j = _fuse_next(gf, n_uses, consumer, j, GGML_OP_ADD, &b)) >= 0) chain[len++] = j;
+            struct ggml_tensor * t = gf->nodes[chain[len - 1]];
+            t->op = node->op;
+            __builtin_memcpy(t->op_params, node->op_params, sizeof(t->op_params));
+            t->src[0] = node->src[0];
+            t->src[1] = w;
+            t->src[2] = b;
+            t->src[3] = NULL;
+        } else if (node->op == GGML_OP_MUL_MAT && node->src[2] == NULL && node->op_params[0] == GGML_OP_NONE) {
+            struct ggml_tensor * bias = NULL, * res = NULL;
+            int32_t act = -1;
+            if ((j = _fuse_next(gf, n_uses, consumer, chain[len - 1], GGML_OP_ADD, &bias)) >= 0) chain[len++] = j;
+            if ((j = _fuse_next(gf, n_uses, consumer, chain[len - 1], GGML_OP_UNARY, NULL)) >= 0) {
+                act = gf->nodes[j]->op_params[0];
+                chain[len++] = j;
+            }
+            if (len > 1 && (j = _fuse_next(gf, n_uses, consumer, chain[len - 1], GGML_OP_ADD, &res)) >= 0) chain[len++] = j;
+            if (len == 1) continue;
+            struct ggml_tensor * t = gf->nodes[chain[len - 1]];
+            t->op = GGML_OP_MUL_MAT;
+            __builtin_memset(t->op_params, 0, sizeof(t->op_params));
+            if (act >= 0) {
+                t->op_params[0] = GGML_OP_UNARY;
+                t->op_params[1] = act;
+            }
+            t->src[0] = node->src[0];
+            t->src[1] = node->src[1];
+            t->src[2] = bias;
+            t->src[3] = res;
+        } else
+            continue;
+        for (int k = 0; k < len - 1; k++)
+            removed[chain[k]] = 1;
+        n_fused++;
+    }
+    int m = 0;
+    for (int i = 0; i < n; i++)
+        if (!removed[i]) gf->nodes[m++] = gf->nodes[i];
+    gf->n_nodes = m;
+    g_free(map.vals);
+    g_free(map.keys);
+    g_free(removed);
+    g_free(consumer);
+    g_free(n_uses);
+    return n_fused;
+}
+// --- Размещение в арене ---
+//!< интервал жизни промежуточного тензора и смещение в арене
+struct _mem_block {
+    int    node;        //!< индекс узла
+    int    first, last; //!< узел, который вычисляет тензор, и последний потребитель
+    size_t size;
+    size_t offs;
+};
+static int _mem_block_cmp(const void * a, const void * b){
+    const struct _mem_block * x = a, * y = b;
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+    return x->first - y->first;
+}
+/*! \brief назначение смещений в арене, жадный алгоритм по убыванию размера
+    
+    Тензоры размещаются от большего к меньшему. Для очередного тензора рассматриваются уже размещенные,
+    интервалы жизни которых пересекаются с его интервалом, и выбирается наименьший подходящий зазор
+    между ними, иначе тензор размещается выше всех. \see Pisarchyk, Lee "Efficient Memory Management 
+    for Deep Neural Net Inference", Greedy by Size.
+    \return пиковый объем арены
+ */
+static size_t _mem_assign(struct _mem_block * blk, int n){
+    qsort(blk, n, sizeof(struct _mem_block), _mem_block_cmp);
+    int * order = g_new(int, n);// размещенные блоки по возрастанию смещения
+    size_t peak = 0;
+    for (int i = 0; i < n; i++) {
+        size_t prev = 0, best = SIZE_MAX, best_gap = SIZE_MAX;
+        int pos = 0;
+        for (int k = 0; k < i; k++) {
+            const struct _mem_block * p = &blk[order[k]];
+            if (p->last < blk[i].first || p->first > blk[i].last) continue;
+            if (p->offs >= prev && p->offs - prev >= blk[i].size && p->offs - prev < best_gap) {
+                best = prev;
+                best_gap = p->offs - prev;
+            }
+            prev = MAX(prev, p->offs + p->size);
+        }
+        blk[i].offs = best != SIZE_MAX ? best : prev;
+        while (pos < i && blk[order[pos]].offs <= blk[i].offs) pos++;
+        __builtin_memmove(order + pos + 1, order + pos, (i - pos)*sizeof(int));
+        order[pos] = i;
+        peak = MAX(peak, blk[i].offs + blk[i].size);
+    }
+    g_free(order);
+    return peak;
+}
+static int _graph_check(const struct qnn_cgraph * gf){
+    for (int i = 0; i < gf->n_leafs; i++) {
+        if (gf->leafs[i]->data == NULL && !(gf->leafs[i]->flags & GGML_TENSOR_FLAG_INPUT)) {
+            fprintf(stderr, "%s: leaf %d has no data\n", __func__, i);
+            return -1;
+        }
+    }
+    for (int i = 0; i < gf->n_nodes; i++) {
+        if (!_compute_supported(gf->nodes[i])) {
+            fprintf(stderr, "%s: node %d op=%d type=%d is not supported\n", __func__, i, gf->nodes[i]->op,
+                gf->nodes[i]->src[0]? gf->nodes[i]->src[0]->type: -1);
+            return -1;
+        }
+    }
+    return 0;
+}
+//!< размер рабочих буферов потоков и общего буфера узла, буфер увеличивается при необходимости
+static void _plan_work(struct qnn_cplan * plan, const struct qnn_cgraph * gf){
+    const size_t capacity = plan->work_size*plan->n_threads + plan->shared_size;
+    size_t work_size = 0, shared_size = 0;
+    for (int i = 0; i < gf->n_nodes; i++) {
+        const struct ggml_tensor * node = gf->nodes[i];
+        size_t ws = 0;
+        switch (node->op) {
+        case GGML_OP_MUL_MAT:
+            ws = QNN_MM_BLCK*node->src[0]->ne[0]*sizeof(float);
+            if (_mul_mat_vec_dot(node))
+                shared_size = MAX(shared_size, ggml_nelements(node->src[1])/QK8_1*sizeof(block_q8_1));
+            else
+                shared_size = MAX(shared_size, ggml_nelements(node->src[1])*sizeof(float));
+            break;
+        case GGML_OP_NORM: case GGML_OP_RMS_NORM: case GGML_OP_L2_NORM:
+        case GGML_OP_SOFT_MAX:  ws = node->ne[0]*sizeof(float); break;
+        default: break;
+        }
+        if (ws > work_size) work_size = ws;
+    }
+    // рабочие буферы потоков, за ними общий буфер узла
+    plan->work_size   = (work_size   + QNN_MEM_ALIGN - 1) & ~(size_t)(QNN_MEM_ALIGN - 1);
+    plan->shared_size = (shared_size + QNN_MEM_ALIGN - 1) & ~(size_t)(QNN_MEM_ALIGN - 1);
+    const size_t size = plan->work_size*plan->n_threads + plan->shared_size;
+    if (size > capacity || (plan->work_data == NULL && size > 0)) {
+        if (plan->work_data) _aligned_free(plan->work_data);
+        plan->work_data = _aligned_malloc(size, QNN_MEM_ALIGN);
+    }
+}
+/*! \brief размещение промежуточных тензоров в одной арене по интервалам жизни
+    
+    Тензор живет от узла, который его вычисляет, до последнего потребителя, включая потребителей 
+    его представлений. Тензоры с флагом GGML_TENSOR_FLAG_OUTPUT живут до конца графа.
+    Тензоры, данные которых назначены снаружи, не размещаются. Данные, которые указывают в арену плана,
+    считаются назначенными планом и размещаются заново, поэтому план можно применить к новому графу.
+ */
+static int _plan_memory(struct qnn_cplan * plan, struct qnn_cgraph * gf){
+    uint8_t * arena = plan->arena;
+    struct _node_map map = {.size = 2*gf->n_nodes + 1};
+    map.keys = g_new0(struct ggml_tensor *, map.size);
+    map.vals = g_new0(int, map.size);
+    int * blk_id = g_new(int, gf->n_nodes);
+    struct _mem_block * blk = g_new(struct _mem_block, gf->n_nodes);
+    int n_blk = 0;
+    size_t total = 0;
+    for (int i = 0; i < gf->n_nodes; i++) {
+        struct ggml_tensor * node = gf->nodes[i];
+        _node_map_insert(&map, node, i);
+        blk_id[i] = -1;
+        for (int k = 0; k < GGML_MAX_SRC; k++) {
+            if (node->src[k] == NULL) continue;
+            int j = _node_index(&map, _view_base(node->src[k]));
+            if (j >= 0 && blk_id[j] >= 0) blk[blk_id[j]].last = i;
+        }
+        if (_is_view_op(node->op)) continue;
+        if (node->data != NULL && !(arena && (uint8_t*)node->data >= arena 
+                                          && (uint8_t*)node->data <  arena + plan->arena_size))
+            continue;
+        const size_t size = (ggml_nbytes(node) + QNN_MEM_ALIGN - 1) & ~(size_t)(QNN_MEM_ALIGN - 1);
+        blk_id[i] = n_blk;
+        blk[n_blk++] = (struct _mem_block){.node = i, .first = i, .last = i, .size = size};
+        total += size;
+    }
+    for (int i = 0; i < n_blk; i++)
+        if (gf->nodes[blk[i].node]->flags & GGML_TENSOR_FLAG_OUTPUT)
+            blk[i].last = gf->n_nodes;
+    const size_t peak = _mem_assign(blk, n_blk);
+    int res = 0;
+    if (peak > plan->arena_size) {// данные прежней арены больше не используются
+        if (plan->arena) _aligned_free(plan->arena);
+        plan->arena = _aligned_malloc(peak, QNN_MEM_ALIGN);
+        plan->arena_size = plan->arena ? peak : 0;
+        if (plan->arena == NULL) {
+            fprintf(stderr, "%s: failed to allocate %zu bytes\n", __func__, peak);
+            res = -1;
+        }
+    }
+    if (res == 0) {
+        for (int i = 0; i < n_blk; i++)
+            gf->nodes[blk[i].node]->data = (uint8_t*)plan->arena + blk[i].offs;
+        for (int i = 0; i < gf->n_nodes; i++) {// представления ссылаются на данные источника
+            struct ggml_tensor * node = gf->nodes[i];
+            if (!_is_view_op(node->op)) continue;
+            size_t offs = 0;
+            if (node->op == GGML_OP_VIEW) __builtin_memcpy(&offs, node->op_params, sizeof(size_t));
+            node->data = (uint8_t*)node->src[0]->data + offs;
+        }
+        plan->mem_size  = peak;
+        plan->mem_total = total;
+        plan->n_tensors = n_blk;
+    }
+    g_free(blk);
+    g_free(blk_id);
+    g_free(map.vals);
+    g_free(map.keys);
+    return res;
+}
+/*! \brief план исполнения: проверка операций, размещение промежуточных тензоров, рабочие буферы потоков
+    \param gf - граф, построенный qnn_graph_build_forward_expand()
+    \param n_threads - число потоков
+    \return план или NULL, если граф содержит неподдерживаемые операции или листья без данных
+
+    Данные листьев (веса и входы) должны быть назначены до вызова.
+    Промежуточные тензоры размещаются в одной арене, память тензора используется повторно после 
+    его последнего потребителя, кроме узлов с флагом GGML_TENSOR_FLAG_OUTPUT. Пиковый объем арены 
+    plan->mem_size, без повторного использования потребовалось бы plan->mem_total.
+ */
+struct qnn_cplan * qnn_graph_plan(struct qnn_cgraph * gf, int n_threads){
+    if (_graph_check(gf) != 0) return NULL;
+    struct qnn_cplan * plan = g_new0(struct qnn_cplan, 1);
+    plan->n_threads = n_threads < 1 ? 1 : n_threads;
+    _plan_work(plan, gf);
+    if (_plan_memory(plan, gf) != 0) {
+        qnn_cplan_free(plan);
+        return NULL;
+    }
+    return plan;
+}
+/*! \brief применить план к новому графу, например с другим числом токенов
+    \return 0 при успехе
+
+    Арена и рабочие буферы увеличиваются, если новому графу требуется больше памяти. Данные промежуточных 
+    тензоров прежнего графа, размещенные в арене, после вызова недействительны.
+ */
+int qnn_graph_replan(struct qnn_cplan * plan, struct qnn_cgraph * gf){
+    if (_graph_check(gf) != 0) return -1;
+    _plan_work(plan, gf);
+    if (plan->prof) qnn_graph_profile(plan, gf);
+    return _plan_memory(plan, gf);
+}
+void qnn_cplan_free(struct qnn_cplan * plan){
+    if (plan->arena) _aligned_free(plan->arena);
+    if (plan->work_data) _aligned_free(plan->work_data);
+    g_free(plan->prof);
+    g_free(plan);
+}
+
+// --- Потоки ---
+struct _compute_state {
+    struct qnn_cgraph * gf;
+    struct qnn_cplan  * plan;
+    struct qnn_pool   * pool;
+    int64_t t0;         //!< начало вычисления графа, нс
+};
+static inline int64_t _time_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+static void _graph_compute_thread(void * data, int ith, int nth){
+    struct _compute_state * state = data;
+    struct qnn_cplan * plan = state->plan;
+    struct qnn_compute_params params = {
+        .ith   = ith,
+        .nth   = nth,
+        .wsize = plan->work_size,
+        .wdata = (uint8_t*)plan->work_data + ith*plan->work_size,
+        .shared= (uint8_t*)plan->work_data + plan->n_threads*plan->work_size,
+        .pool  = state->pool,
+    };
+    struct qnn_node_prof * prof = ith == 0 ? plan->prof : NULL;// время узла замеряет поток 0 между барьерами
+    for (int i = 0; i < state->gf->n_nodes; i++) {
+        struct ggml_tensor * node = state->gf->nodes[i];
+        if (_is_view_op(node->op)) continue;
+        if (prof) prof[i].t_start = _time_ns() - state->t0;
+        if (_compute_has_init(node)) {
+            params.type = QNN_TASK_INIT;
+            _compute_forward(&params, node);
+            qnn_pool_barrier(state->pool);
+        }
+        params.type = QNN_TASK_COMPUTE;
+        _compute_forward(&params, node);
+        qnn_pool_barrier(state->pool);
+        if (prof) prof[i].t_end = _time_ns() - state->t0;
+    }
+}
+/*! \brief вычисление графа
+    \param gf - граф
+    \param plan - план исполнения qnn_graph_plan(), может использоваться повторно для новых входных данных
+    \return 0 при успехе
+
+    Узлы вычисляются потоками общего пула qnn_pool_default(), число потоков plan->n_threads 
+    ограничивается размером пула. Между узлами потоки синхронизируются барьером пула.
+    Если включено профилирование qnn_graph_profile(), в plan->prof записывается время каждого узла.
+ */
+int qnn_graph_compute(struct qnn_cgraph * gf, struct qnn_cplan * plan){
+    struct _compute_state state = {.gf = gf, .plan = plan, .pool = qnn_pool_default(), .t0 = _time_ns()};
+    qnn_pool_run(state.pool, plan->n_threads, _graph_compute_thread, &state);
+    return 0;
+}
+
+// --- Профилирование ---
+/*! \brief включить профилирование узлов графа
+    \return 0 при успехе
+
+    Выделяет plan->prof по числу узлов и заполняет оценку числа операций и объема данных qnn_node_cost().
+    Время узлов записывается при каждом вызове qnn_graph_compute(). Профиль пересчитывается в qnn_graph_replan(),
+    поэтому профилирование включается после qnn_graph_fuse().
+ */
+int qnn_graph_profile(struct qnn_cplan * plan, struct qnn_cgraph * gf){
+    plan->prof = g_renew(struct qnn_node_prof, plan->prof, gf->n_nodes);
+    for (int i = 0; i < gf->n_nodes; i++) {
+        struct qnn_node_prof * p = plan->prof + i;
+        __builtin_memset(p, 0, sizeof(*p));
+        if (!_is_view_op(gf->nodes[i]->op)) qnn_node_cost(gf->nodes[i], p);
+    }
+    return 0;
+}
+static const char * _op_name(const struct ggml_tensor * node){
+    static const char * unary[GGML_UNARY_OP_COUNT] = {
+        [GGML_UNARY_OP_TANH] = "tanh", [GGML_UNARY_OP_RELU] = "relu", [GGML_UNARY_OP_SIGMOID] = "sigmoid",
+        [GGML_UNARY_OP_GELU] = "gelu", [GGML_UNARY_OP_GELU_QUICK] = "gelu_quick", [GGML_UNARY_OP_SILU] = "silu",
+        [GGML_UNARY_OP_EXP]  = "exp",
+    };
+    switch (node->op) {
+    case GGML_OP_DUP:       return "dup";
+    case GGML_OP_CPY:       return "cpy";
+    case GGML_OP_CONT:      return "cont";
+    case GGML_OP_ADD:       return "add";
+    case GGML_OP_SUB:       return "sub";
+    case GGML_OP_MUL:       return "mul";
+    case GGML_OP_DIV:       return "div";
+    case GGML_OP_SQR:       return "sqr";
+    case GGML_OP_SQRT:      return "sqrt";
+    case GGML_OP_LOG:       return "log";
+    case GGML_OP_SIN:       return "sin";
+    case GGML_OP_COS:       return "cos";
+    case GGML_OP_SCALE:     return "scale";
+    case GGML_OP_NORM:      return node->src[1] ? "norm_w" : "norm";
+    case GGML_OP_RMS_NORM:  return node->src[1] ? "rms_norm_w" : "rms_norm";
+    case GGML_OP_L2_NORM:   return "l2_norm";
+    case GGML_OP_SOFT_MAX:  return "soft_max";
+    case GGML_OP_MUL_MAT:   return node->src[2] || node->src[3] || node->op_params[0] == GGML_OP_UNARY ? "mul_mat_f" : "mul_mat";
+    case GGML_OP_IM2COL:    return "im2col";
+    case GGML_OP_POOL_2D:   return "pool_2d";
+    case GGML_OP_UNARY: {
+        const int32_t uop = node->op_params[0];
+        return uop >= 0 && uop < GGML_UNARY_OP_COUNT && unary[uop] ? unary[uop] : "unary";
+    }
+    default:                return "op";
+    }
+}
+/*! \brief узлы одинаковы по операции, типу и размерностям результата и аргументов */
+static int _node_same(const struct ggml_tensor * a, const struct ggml_tensor * b){
+    if (a->op != b->op || a->type != b->type) return 0;
+    for (int d = 0; d < GGML_MAX_DIMS; d++)
+        if (a->ne[d] != b->ne[d]) return 0;
+    for (int j = 0; j < GGML_MAX_SRC; j++) {
+        const struct ggml_tensor * s0 = a->src[j], * s1 = b->src[j];
+        if ((s0 == NULL) != (s1 == NULL)) return 0;
+        if (s0 && (s0->type != s1->type || s0->ne[0] != s1->ne[0] || s0->ne[1] != s1->ne[1])) return 0;
+    }
+    return 1;
+}
+/*! \brief выделение повторяющегося блока слоев
+    \param begin - начало первого повтора
+    \param len - длина блока
+    \return число повторов, 0 - повторов нет
+
+    Из пар (начало, период) выбирается та, что покрывает больше узлов, при равном покрытии - с меньшим периодом,
+    т.е. один слой, а не группа слоев. Начало блока ищется среди первых 64 узлов.
+ */
+static int _graph_repeat(const struct qnn_cgraph * gf, int * begin, int * len){
+    const int n = gf->n_nodes;
+    int best = 0;
+    *begin = 0; *len = 0;
+    for (int b = 0; b < MIN(64, n); b++)
+    for (int p = 2; b + 2*p <= n; p++) {
+        int k = b;
+        while (k + p < n && _node_same(gf->nodes[k], gf->nodes[k + p])) k++;
+        const int r = (k - b)/p + 1;
+        if (r >= 2 && r*p > best) {
+            best = r*p; *begin = b; *len = p;
+        }
+    }
+    return best ? best / *len : 0;
+}
+static void _prof_line(const char * pfx, int i, const struct ggml_tensor * node, const struct qnn_node_prof * p, 
+        int count, double total){
+    const double dt = (p->t_end - p->t_start)*1e-9;
+    const int64_t bytes = p->bytes_rd + p->bytes_wr;
+    printf("%s%4d: [%5zu,%5zu,%5zu] %-10.10s %-5.5s", pfx, i, node->ne[0], node->ne[1], node->ne[2], 
+        _op_name(node), ggml_type_name(node->type));
+    if (count > 1) printf(" x%-3d", count); else printf("     ");
+    printf(" %9.1f us %5.1f%% %8.2f GFLOP/s %7.2f GB/s %6.1f flop/B\n", dt*1e6, total > 0 ? 100.0*dt/total : 0.0,
+        dt > 0 ? p->flops/dt*1e-9 : 0.0, dt > 0 ? bytes/dt*1e-9 : 0.0, bytes ? (double)p->flops/bytes : 0.0);
+}
+/*! \brief вывод профиля графа в виде листинга узлов
+    
+    Повторяющиеся слои сворачиваются: для узлов блока выводится сумма по всем повторам (xN), 
+    узлы до и после блока выводятся отдельно. В конце - сводка по типам операций, 
+    по отношению flop/B и достигнутой пропускной способности видно, какие операции ограничены памятью.
+ */
+void qnn_graph_profile_print(const struct qnn_cgraph * gf, const struct qnn_cplan * plan){
+    const struct qnn_node_prof * prof = plan->prof;
+    if (prof == NULL) return;
+    int begin, len;
+    const int n_rep = _graph_repeat(gf, &begin, &len);
+    const int end = begin + n_rep*len;
+    double total = 0;
+    int64_t flops = 0, bytes = 0;
+    for (int i = 0; i < gf->n_nodes; i++) {
+        total += (prof[i].t_end - prof[i].t_start)*1e-9;
+        flops += prof[i].flops;
+        bytes += prof[i].bytes_rd + prof[i].bytes_wr;
+    }
+    printf("=== PROFILE === nodes %d, threads %d, %.3f ms, %.3f GFLOP, %.3f GB\n", gf->n_nodes, plan->n_threads, 
+        total*1e3, flops*1e-9, bytes*1e-9);
+    struct _op_sum {const struct ggml_tensor * node; struct qnn_node_prof p; int count;} sum[32];
+    int n_sum = 0;
+    for (int i = 0; i < gf->n_nodes; i++) {
+        const struct ggml_tensor * node = gf->nodes[i];
+        if (_is_view_op(node->op)) continue;
+        const char * name = _op_name(node);
+        int k;
+        for (k = 0; k < n_sum && _op_name(sum[k].node) != name; k++);
+        if (k == n_sum && n_sum < 32) sum[n_sum++] = (struct _op_sum){.node = node};
+        if (k < n_sum) {
+            sum[k].p.t_end   += prof[i].t_end - prof[i].t_start;
+            sum[k].p.flops   += prof[i].flops;
+            sum[k].p.bytes_rd += prof[i].bytes_rd;
+            sum[k].p.bytes_wr += prof[i].bytes_wr;
+            sum[k].count++;
+        }
+        if (i >= begin + len && i < end) continue;// повторы блока учтены в первом
+        if (i == begin && n_rep > 0) printf("--- repeat %d x %d nodes ---\n", n_rep, len);
+        if (i >= begin && i < begin + len && n_rep > 0) {
+            struct qnn_node_prof p = {0};
+            for (int r = 0; r < n_rep; r++) {
+                const struct qnn_node_prof * q = prof + i + r*len;
+                p.t_end += q->t_end - q->t_start;
+                p.flops += q->flops;
+                p.bytes_rd += q->bytes_rd;
+                p.bytes_wr += q->bytes_wr;
+            }
+            _prof_line(" - ", i, node, &p, n_rep, total);
+            if (i == begin + len - 1) printf("---------------------------------\n");
+        } else
+            _prof_line(" - ", i, node, prof + i, 1, total);
+    }
+    printf("=== PROFILE BY OP ===\n");
+    for (int k = 0; k < n_sum; k++) {// сортировка по времени
+        for (int j = k + 1; j < n_sum; j++)
+            if (sum[j].p.t_end > sum[k].p.t_end) {
+                struct _op_sum t = sum[k]; sum[k] = sum[j]; sum[j] = t;
+            }
+        const struct qnn_node_prof * p = &sum[k].p;
+        const double dt = p->t_end*1e-9;
+        const int64_t b = p->bytes_rd + p->bytes_wr;
+        printf(" %-10.10s x%-4d %9.3f ms %5.1f%% %8.2f GFLOP/s %7.2f GB/s %6.1f flop/B\n", _op_name(sum[k].node), sum[k].count, 
+            dt*1e3, total > 0 ? 100.0*dt/total : 0.0, dt > 0 ? p->flops/dt*1e-9 : 0.0, dt > 0 ? b/dt*1e-9 : 0.0, 
+            b ? (double)p->flops/b : 0.0);
+    }
+}
+/*! \brief экспорт профиля в формате Chrome trace (chrome://tracing, Perfetto)
+    \param filename - имя файла JSON
+    \return 0 при успехе
+
+    Каждый узел - событие "X" в потоке 0, в args - номер узла, размерности, тип, flops и объем данных.
+    Повторы блока слоев выводятся событиями "layer N" в потоке 1, чтобы узлы группировались по слоям.
+ */
+int qnn_graph_profile_trace(const struct qnn_cgraph * gf, const struct qnn_cplan * plan, const char * filename){
+    const struct qnn_node_prof * prof = plan->prof;
+    if (prof == NULL) return -1;
+    FILE * fp = fopen(filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: cannot open '%s'\n", __func__, filename);
+        return -1;
+    }
+    int begin, len;
+    const int n_rep = _graph_repeat(gf, &begin, &len);
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"nodes\"}},\n");
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"layers\"}}");
+    for (int r = 0; r < n_rep; r++) {// представления не вычисляются, время слоя - по вычисленным узлам
+        int64_t ts = INT64_MAX, te = 0;
+        for (int i = begin + r*len; i < begin + (r + 1)*len; i++) {
+            if (_is_view_op(gf->nodes[i]->op)) continue;
+            if (prof[i].t_start < ts) ts = prof[i].t_start;
+            if (prof[i].t_end   > te) te = prof[i].t_end;
+        }
+        if (te == 0) continue;
+        fprintf(fp, ",\n{\"name\":\"layer %d\",\"ph\":\"X\",\"pid\":0,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}", r, 
+            ts*1e-3, (te - ts)*1e-3);
+    }
+    for (int i = 0; i < gf->n_nodes; i++) {
+        const struct ggml_tensor * node = gf->nodes[i];
+        if (_is_view_op(node->op)) continue;
+        const struct qnn_node_prof * p = prof + i;
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"node\":%d,\"ne\":[%zu,%zu,%zu,%zu],\"flops\":%" PRId64 ",\"bytes_rd\":%" PRId64 ",\"bytes_wr\":%" PRId64 "}}",
+            _op_name(node), ggml_type_name(node->type), p->t_start*1e-3, (p->t_end - p->t_start)*1e-3, 
+            i, node->ne[0], node->ne[1], node->ne[2], node->ne[3], p->flops, p->bytes_rd, p->bytes_wr);
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(fp);
+    return 0;
+}
+
+#ifdef TEST_CPU
+#include <time.h>
+/*! Проверка: блок трансформера на случайных весах, сравнение с наивным вычислением */
+static void _rand_f32(float * x, size_t n, uint32_t * seed){
+    for (size_t i = 0; i < n; i++) {
+        *seed = *seed*1664525u + 1013904223u;
+        x[i] = ((int32_t)*seed)*(1.0f/2147483648.0f);
+    }
+}
+int main(int argc, char** argv){
+    const int n_embd = 256, n_tokens = 64, n_ff = 1024;
+    const int n_threads = argc > 1 ? atoi(argv[1]) : 4;
+    uint32_t seed = 1;
+    struct ggml_context * ctx = ggml_init(NULL, 0);
+    struct ggml_tensor * inp  = ggml_tensor_new(ctx, GGML_TYPE_F32,  (size_t[4]){n_embd, n_tokens, 1, 1});
+    struct ggml_tensor * w_i  = ggml_tensor_new(ctx, GGML_TYPE_F16,  (size_t[4]){n_embd, n_ff, 1, 1});
+    struct ggml_tensor * w_o  = ggml_tensor_new(ctx, GGML_TYPE_BF16, (size_t[4]){n_ff, n_embd, 1, 1});
+    struct ggml_tensor * ln_w = ggml_tensor_new(ctx, GGML_TYPE_F32,  (size_t[4]){n_embd, 1, 1, 1});
+    inp->flags |= GGML_TENSOR_FLAG_INPUT;
+    float * x   = malloc(sizeof(float)*n_embd*n_tokens);
+    float * wi  = malloc(sizeof(float)*n_embd*n_ff);
+    float * wo  = malloc(sizeof(float)*n_embd*n_ff);
+    float * lnw = malloc(sizeof(float)*n_embd);
+    _rand_f32(x,   n_embd*n_tokens, &seed);
+    _rand_f32(wi,  n_embd*n_ff, &seed);
+    _rand_f32(wo,  n_embd*n_ff, &seed);
+    _rand_f32(lnw, n_embd, &seed);
+    ggml_fp16_t * wi16 = malloc(sizeof(ggml_fp16_t)*n_embd*n_ff);
+    ggml_bf16_t * wo16 = malloc(sizeof(ggml_bf16_t)*n_embd*n_ff);
+    for (int i = 0; i < n_embd*n_ff; i++) {
+        wi16[i].hf = (_Float16)wi[i];  wi[i] = GGML_FP16_TO_FP32(wi16[i].hf);
+        wo16[i] = GGML_FP32_TO_BF16(wo[i]); wo[i] = GGML_BF16_TO_FP32(wo16[i]);
+    }
+    inp->data = x; w_i->data = wi16; w_o->data = wo16; ln_w->data = lnw;
+
+    struct ggml_tensor * cur = ggml_norm(ctx, inp, 1e-6f);
+    cur = ggml_mul(ctx, cur, ln_w);
+    cur = ggml_mul_mat(ctx, w_i, cur);
+    cur = ggml_gelu(ctx, cur);
+    cur = ggml_mul_mat(ctx, w_o, cur);
+    cur = ggml_add(ctx, cur, inp);
+    cur = ggml_soft_max_ext(ctx, cur, NULL, 0.125f, 0.0f);
+
+    struct qnn_cgraph * gf = qnn_graph_new(ctx);
+    qnn_graph_build_forward_expand(gf, cur);
+    struct qnn_cplan * plan = qnn_graph_plan(gf, n_threads);
+    if (plan == NULL) return 1;
+    printf("nodes %d leafs %d tensors %d mem %zu kB, no reuse %zu kB\n", gf->n_nodes, gf->n_leafs, 
+        plan->n_tensors, plan->mem_size/1024, plan->mem_total/1024);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    qnn_graph_compute(gf, plan);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+    double flops = 2.0*2*n_embd*n_ff*n_tokens;
+    printf("compute %d threads: %.3f ms %.2f GFLOP/s\n", n_threads, dt*1e3, flops/dt*1e-9);
+    // наивное вычисление
+    float * h  = malloc(sizeof(float)*n_ff*n_tokens);
+    float * y  = malloc(sizeof(float)*n_embd);
+    float max_err = 0;
+    for (int t = 0; t < n_tokens; t++) {
+        float * xt = x + t*n_embd, n[n_embd];
+        double s = 0, s2 = 0;
+        for (int i = 0; i < n_embd; i++) { s += xt[i]; s2 += (double)xt[i]*xt[i]; }
+        float mean = s/n_embd, is = 1.0f/sqrtf(s2/n_embd - mean*mean + 1e-6f);
+        for (int i = 0; i < n_embd; i++) n[i] = (xt[i] - mean)*is*lnw[i];
+        for (int j = 0; j < n_ff; j++) {
+            float v = 0;
+            for (int i = 0; i < n_embd; i++) v += wi[j*n_embd + i]*n[i];
+            h[t*n_ff + j] = 0.5f*v*(1.0f + tanhf(SQRT_2_OVER_PI*v*(1.0f + GELU_COEF_A*v*v)));
+        }
+        float max = -INFINITY; double sum = 0;
+        for (int j = 0; j < n_embd; j++) {
+            float v = 0;
+            for (int i = 0; i < n_ff; i++) v += wo[j*n_ff + i]*h[t*n_ff + i];
+            y[j] = (v + xt[j])*0.125f;
+            if (y[j] > max) max = y[j];
+        }
+        for (int j = 0; j < n_embd; j++) { y[j] = expf(y[j] - max); sum += y[j]; }
+        for (int j = 0; j < n_embd; j++) {
+            float e = fabsf(y[j]/sum - ((float*)cur->data)[t*n_embd + j]);
+            if (e > max_err) max_err = e;
+        }
+    }
+    printf("max error %g %s\n", max_err, max_err < 1e-5f ? "ok" : "fail");
+    int fail = !(max_err < 1e-5f);
+    // глубокий граф со смещениями: пиковая память не должна расти с числом слоев, план применяется повторно;
+    // вычисление до и после слияния операций qnn_graph_fuse()
+    const int n_layer = 27;
+    const size_t mem_1 = plan->mem_size;
+    float * lnb = malloc(sizeof(float)*n_embd);
+    float * bi  = malloc(sizeof(float)*n_ff);
+    float * bo  = malloc(sizeof(float)*n_embd);
+    _rand_f32(lnb, n_embd, &seed);
+    _rand_f32(bi,  n_ff,   &seed);
+    _rand_f32(bo,  n_embd, &seed);
+    struct ggml_tensor * ln_b = ggml_tensor_new(ctx, GGML_TYPE_F32, (size_t[4]){n_embd, 1, 1, 1});
+    struct ggml_tensor * b_i  = ggml_tensor_new(ctx, GGML_TYPE_F32, (size_t[4]){n_ff,   1, 1, 1});
+    struct ggml_tensor * b_o  = ggml_tensor_new(ctx, GGML_TYPE_F32, (size_t[4]){n_embd, 1, 1, 1});
+    ln_b->data = lnb; b_i->data = bi; b_o->data = bo;
+    struct qnn_cgraph * gl = qnn_graph_new(ctx);
+    cur = inp;
+    for (int l = 0; l < n_layer; l++) {
+        struct ggml_tensor * t = ggml_norm(ctx, cur, 1e-6f);
+        t = ggml_add(ctx, ggml_mul(ctx, t, ln_w), ln_b);
+        t = ggml_gelu(ctx, ggml_add(ctx, ggml_mul_mat(ctx, w_i, t), b_i));
+        cur = ggml_add(ctx, cur, ggml_add(ctx, ggml_mul_mat(ctx, w_o, t), b_o));
+    }
+    qnn_graph_build_forward_expand(gl, cur);
+    float * xr = malloc(sizeof(float)*n_embd*n_tokens);
+    __builtin_memcpy(xr, x, sizeof(float)*n_embd*n_tokens);
+    for (int l = 0; l < n_layer; l++) 
+    for (int t = 0; t < n_tokens; t++) {
+        float * xt = xr + t*n_embd, n[n_embd];
+        double s = 0, s2 = 0;
+        for (int i = 0; i < n_embd; i++) { s += xt[i]; s2 += (double)xt[i]*xt[i]; }
+        float mean = s/n_embd, is = 1.0f/sqrtf(s2/n_embd - mean*mean + 1e-6f);
+        for (int i = 0; i < n_embd; i++) n[i] = (xt[i] - mean)*is*lnw[i] + lnb[i];
+        for (int j = 0; j < n_ff; j++) {
+            float v = bi[j];
+            for (int i = 0; i < n_embd; i++) v += wi[j*n_embd + i]*n[i];
+            h[j] = 0.5f*v*(1.0f + tanhf(SQRT_2_OVER_PI*v*(1.0f + GELU_COEF_A*v*v)));
+        }
+        for (int j = 0; j < n_embd; j++) {
+            float v = bo[j];
+            for (int i = 0; i < n_ff; i++) v += wo[j*n_ff + i]*h[i];
+            xt[j] += v;
+        }
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        const int n_fused = pass ? qnn_graph_fuse(gl) : 0;
+        if (qnn_graph_replan(plan, gl) != 0) return 1;
+        qnn_graph_compute(gl, plan);// прогрев
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        qnn_graph_compute(gl, plan);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+        double err = 0, norm = 0;
+        for (int i = 0; i < n_embd*n_tokens; i++) {
+            double e = xr[i] - ((float*)cur->data)[i];
+            err += e*e; norm += (double)xr[i]*xr[i];
+        }
+        err = sqrt(err/norm);
+        printf("layers %d fused %3d nodes %3d: %.3f ms, mem %zu kB, no reuse %zu kB, rel.err %.2e %s\n", n_layer, n_fused, 
+            gl->n_nodes, dt*1e3, plan->mem_size/1024, plan->mem_total/1024, err, err < 1e-4 && plan->mem_size <= 2*mem_1 ? "ok" : "fail");
+        fail |= !(err < 1e-4) || plan->mem_size > 2*mem_1;
+    }
+    // профиль слитного графа: листинг со свернутыми слоями и трасса для chrome://tracing
+    qnn_graph_profile(plan, gl);
+    qnn_graph_compute(gl, plan);
+    qnn_graph_profile_print(gl, plan);
+    qnn_graph_profile_trace(gl, plan, "qnn_trace.json");
+    free(xr); free(lnb); free(bi); free(bo);
+    qnn_graph_free(gl);
+    qnn_cplan_free(plan);
+    qnn_graph_free(gf);
+    // квантованные веса: GEMV (1 токен) и GEMM (64 токена) без распаковки в F32
+    const enum ggml_type qtypes[] = {GGML_TYPE_Q8_0, GGML_TYPE_Q4_K, GGML_TYPE_Q8_K};
+    const int K = 4096, N = 4096;
+    for (int t = 0; t < sizeof(qtypes)/sizeof(qtypes[0]); t++)
+    for (int n_tok = 1; n_tok <= 64; n_tok *= 64) {
+        const enum ggml_type qt = qtypes[t];
+        const size_t row_size = K/ggml_blck_size(qt)*ggml_type_size(qt);
+        uint8_t * wq = malloc(row_size*N);
+        float   * wf = malloc(sizeof(float)*K*N);
+        float   * xa = malloc(sizeof(float)*K*n_tok);
+        for (size_t i = 0; i < row_size*N; i += 4) {
+            seed = seed*1664525u + 1013904223u;
+            __builtin_memcpy(wq + i, &seed, 4);
+        }
+        for (int r = 0; r < N; r++) {// шкалы блоков F16 в диапазоне [2^-8, 2^-7)
+            for (size_t o = 0; o < row_size; o += ggml_type_size(qt)) {
+                uint8_t * blk = wq + r*row_size + o;
+                ggml_half d = (ggml_half)ldexpf(1.0f + (blk[4]&127)/128.0f, -8);
+                switch (qt) {
+                case GGML_TYPE_Q8_K: ((block_q8_K*)blk)->d = d; break;
+                case GGML_TYPE_Q4_K: ((block_q4_K*)blk)->d = d; ((block_q4_K*)blk)->dmin = d; break;
+                default: ((block_q8_0*)blk)->d = d; break;
+                }
+            }
+            qnn_dequantize_row(qt)(wq + r*row_size, wf + (size_t)r*K, K);
+        }
+        _rand_f32(xa, K*n_tok, &seed);
+        struct ggml_tensor * w = ggml_tensor_new(ctx, qt, (size_t[4]){K, N, 1, 1});
+        struct ggml_tensor * a = ggml_tensor_new(ctx, GGML_TYPE_F32, (size_t[4]){K, n_tok, 1, 1});
+        w->data = wq; a->data = xa;
+        struct ggml_tensor * y = ggml_mul_mat(ctx, w, a);
+        gf = qnn_graph_new(ctx);
+        qnn_graph_build_forward_expand(gf, y);
+        plan = qnn_graph_plan(gf, n_threads);
+        if (plan == NULL) return 1;
+        const int n_iter = n_tok == 1 ? 20 : 2;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int it = 0; it < n_iter; it++)
+            qnn_graph_compute(gf, plan);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        dt = ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9)/n_iter;
+        double err = 0, norm = 0;
+        for (int j = 0; j < n_tok; j++)
+        for (int i = 0; i < N; i++) {
+            double v = 0;
+            for (int k = 0; k < K; k++) v += (double)wf[(size_t)i*K + k]*xa[j*K + k];
+            double e = v - ((float*)y->data)[j*N + i];
+            err += e*e; norm += v*v;
+        }
+        err = sqrt(err/norm);// относительная ошибка квантования активаций
+        fail += err > 1e-2;
+        printf("mul_mat %-4s %4d x %4d x %2d: %7.3f ms %6.2f GFLOP/s %6.2f GB/s rel.err %.2e %s\n", ggml_type_name(qt),
+            N, K, n_tok, dt*1e3, 2.0*N*K*n_tok/dt*1e-9, (double)row_size*N/dt*1e-9, err, err <= 1e-2 ? "ok" : "fail");
+        qnn_cplan_free(plan);
+        qnn_graph_free(gf);
+        free(wq); free(wf); free(xa);
+    }
+    return fail != 0;
+}
+#endif
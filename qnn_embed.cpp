@@ -5,6 +5,11 @@
 3. Выделение опорных кадров при анализе фрагментов: статических, в начале и в конце фрагмента - возвращает опорный кадр. 
 4. Сравнение двух фрагментов (сшивание, сравнивается последний кадр первого фрагмента и первый кадр второго фрагмента).
 
+Видео .ts и .mp4 обрабатывается конвейером из трех потоков: разбор и декодирование (FFmpeg libavformat, libavcodec),
+масштабирование bicubic() и подготовка кадра, кодирование и сравнение кадров. Потоки связаны ограниченными
+очередями без блокировок, кадры берутся из заранее выделенного набора и возвращаются декодеру по обратной очереди.
+Сборка vlm дополнительно требует qnn_pool.c, qnn_embed_ops.c, bicubic.c и `-lavformat -lavcodec -lswscale -lavutil`.
+
 ```sh
 pacman -S mingw64/mingw-w64-x86_64-opencv
 ```
@@ -20,6 +25,7 @@ CUDA_VISIBLE_DEVICES=0 ./vlm.exe -m models/mmproj-InternVL3-14B-Instruct-Q8_0.gg
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "qnn_embed.h"
 
@@ -28,18 +34,37 @@ CUDA_VISIBLE_DEVICES=0 ./vlm.exe -m models/mmproj-InternVL3-14B-Instruct-Q8_0.gg
 //#define STB_IMAGE_IMPLEMENTATION -- в одном из мест должна быть указана 
 #include "stb_image.h"
 
-#define N_EMBED_LEN 2
+extern "C" {// qnn.h не собирается в C++, пул потоков объявлен отдельно
+#include "qnn_pool.h"
+void bicubic(uint8_t *src, uint8_t *dst, uint32_t ne00, uint32_t ne01, uint32_t stride,
+    uint32_t ne0, uint32_t ne1, uint32_t nb1, int n_channels);
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+#include <glib.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define N_EMBED_LEN 2  // длина кольца по умолчанию, \see qnn_embed_window()
 struct _qnn_embedding_ctx {
     struct clip_ctx * ctx_v;//!< контекст визуальной части CLIP Vision Encoder
     int32_t n_threads;      //!< максимальное число потоков на CPU 
     int32_t n_mmproj_embd;  //!< размерность модели
     int32_t n_output_tokens;//!< Число токенов на выходе n_mmproj_embd*n_output_tokens = число элементов в эмбединг векторе
-    int32_t n_embed_len;    //!< число векторов в наборе
+    int32_t n_embed_len;    //!< число векторов в кольце
     int32_t t_encode_us;    //!< время кодирования в микросекундах
     int32_t t_process_us;   //!< время обработки   в микросекундах
-    int32_t pos;    //!< позиция записи 
-
-    float * embd_vector[N_EMBED_LEN];
+    int32_t pos;    //!< позиция записи, номер текущего вектора в кольце
+    int32_t n_window;       //!< число векторов кольца, учтенных в оконной статистике
+    size_t  n_frame;        //!< длина вектора кадра, float
+
+    float   * embd_ring;    //!< кольцо n_embed_len векторов по n_frame, выделяется один раз
+    uint8_t * embd_used;    //!< вектор кольца учтен в оконной статистике
+    double  * win_sum;      //!< сумма векторов окна
+    double  * win_sum2;     //!< сумма квадратов векторов окна
     float * embd_mean;
 //    int n_mmproj_embd = llama_model_n_embd(model);
 //    int n_pos_per_embd = mtmd_decode_use_mrope(ctx) ? 4 : 1;
@@ -51,8 +76,16 @@ int32_t qnn_embed_time(qnn_embed_t* mctx){
 int32_t qnn_embed_process_time(qnn_embed_t* mctx){
     return mctx->t_process_us;
 }
+/*! \brief индекс в кольце вектора, записанного idx кадров назад */
+static inline int _embed_index(const qnn_embed_t* mctx, int idx){
+    int i = (mctx->pos - idx) % mctx->n_embed_len;
+    return i<0? i + mctx->n_embed_len: i;
+}
+static inline float* _embed_slot(const qnn_embed_t* mctx, int idx){
+    return mctx->embd_ring + _embed_index(mctx, idx)*mctx->n_frame;
+}
 float* qnn_embed_get(qnn_embed_t* mctx, int idx){
-    return (idx< mctx->n_embed_len)? mctx->embd_vector[idx]: nullptr;
+    return (idx>=0 && idx< mctx->n_embed_len)? _embed_slot(mctx, idx): nullptr;
 }
 int32_t qnn_embed_n_mmproj (qnn_embed_t* mctx){
     return mctx->n_mmproj_embd;
@@ -63,26 +96,131 @@ int32_t qnn_embed_n_tokens (qnn_embed_t* mctx){
 int qnn_embed_len (qnn_embed_t* mctx){
     return mctx->n_output_tokens*mctx->n_mmproj_embd;
 }
+/*! \brief размер эмбеддинга кадра в буфере пакетного кодирования, число float \see qnn_embed_images() */
+int32_t qnn_embed_frame_len(qnn_embed_t* mctx){
+    return clip_embd_nbytes(mctx->ctx_v)/sizeof(float);
+}
+/*! \brief число токенов подготовленного кадра или -1, если эмбеддинг не помещается в qnn_embed_frame_len() float
+
+    clip_embd_nbytes() рассчитан на размер входа кодировщика, при динамическом разрешении
+    clip_n_output_tokens() кадра может быть больше, кодирование записало бы эмбеддинг за границу буфера.
+ */
+static int _embed_tokens(qnn_embed_t* mctx, struct clip_image_f32_batch* img_batch){
+    struct clip_image_f32 * img_f32 = clip_image_f32_get_img(img_batch, 0);
+    if (img_f32 == NULL) return -1;
+    const int n_tokens = clip_n_output_tokens(mctx->ctx_v, img_f32);
+    const size_t len = qnn_embed_frame_len(mctx);
+    if ((size_t)n_tokens*mctx->n_mmproj_embd > len) {
+        fprintf(stderr, "%s: %d tokens exceed frame length %zu\n", __func__, n_tokens, len);
+        return -1;
+    }
+    return n_tokens;
+}
 // semantic similarity [0,1]
 float qnn_embed_ssim  (qnn_embed_t* mctx, int offs){
     unsigned n = mctx->n_output_tokens*mctx->n_mmproj_embd;
-    int i = 0;
-    float* u = mctx->embd_vector[i];
-    float* v = mctx->embd_vector[(i+offs)%N_EMBED_LEN];
-    if (u==NULL || v==NULL) return 0.f;
-
-//    qnn_embed_sub (u, m, )
-
+    float* u = _embed_slot(mctx, 0);
+    float* v = _embed_slot(mctx, offs);
     return qnn_embed_similarity_cos(u, v, n);
 }
 float qnn_embed_dist  (qnn_embed_t* mctx, int offs){
     unsigned n = mctx->n_output_tokens*mctx->n_mmproj_embd;
-    int i = 0;
-    float* u = mctx->embd_vector[i];
-    float* v = mctx->embd_vector[(i+offs)%N_EMBED_LEN];
-    if (u==NULL || v==NULL) return 0.f;
+    float* u = _embed_slot(mctx, 0);
+    float* v = _embed_slot(mctx, offs);
     return qnn_embed_distance(u, v, n);
 }
+/*! \brief длина кольца векторов и окна статистики
+    \param n_len - число кадров, для выделения сцен по времени 32..256
+    \return длина кольца или -1, если не хватает памяти
+
+    Память под кольцо n_len*qnn_embed_frame_len() float и сумма, сумма квадратов окна выделяются здесь,
+    при кодировании кадров выделения памяти нет. Предыдущие векторы и статистика сбрасываются.
+ */
+int qnn_embed_window(qnn_embed_t* mctx, int n_len){
+    if (n_len < 2) n_len = 2;
+    float   * ring = (float *)  malloc(n_len*mctx->n_frame*sizeof(float));
+    uint8_t * used = (uint8_t *)calloc(n_len, sizeof(uint8_t));
+    double  * sum  = (double *) calloc(2*mctx->n_frame, sizeof(double));
+    if (ring==NULL || used==NULL || sum==NULL) {
+        fprintf(stderr, "%s: cannot allocate %d frames\n", __func__, n_len);
+        free(ring); free(used); free(sum);
+        return -1;
+    }
+    __builtin_bzero(ring, n_len*mctx->n_frame*sizeof(float));
+    free(mctx->embd_ring);
+    free(mctx->embd_used);
+    free(mctx->win_sum);
+    mctx->embd_ring = ring;
+    mctx->embd_used = used;
+    mctx->win_sum   = sum;
+    mctx->win_sum2  = sum + mctx->n_frame;
+    mctx->n_embed_len = n_len;
+    mctx->n_window = 0;
+    mctx->pos = 0;
+    return n_len;
+}
+/*! \brief освободить текущий вектор кольца для записи, вектор исключается из оконной статистики */
+static float* _embed_begin(qnn_embed_t* mctx){
+    const int i = _embed_index(mctx, 0);
+    float * v = mctx->embd_ring + i*mctx->n_frame;
+    if (mctx->embd_used[i]) {
+        mctx->embd_used[i] = 0;
+        if (--mctx->n_window == 0) {// сброс накопленной ошибки округления
+            __builtin_bzero(mctx->win_sum, 2*mctx->n_frame*sizeof(double));
+        } else {
+            double * s = mctx->win_sum, * s2 = mctx->win_sum2;
+            for (size_t j=0; j<mctx->n_frame; j++) {
+                s [j] -= v[j];
+                s2[j] -= (double)v[j]*v[j];
+            }
+        }
+    }
+    return v;
+}
+/*! \brief добавить закодированный текущий вектор в оконную статистику, O(n_frame) */
+static void _embed_commit(qnn_embed_t* mctx){
+    const int i = _embed_index(mctx, 0);
+    const float * v = mctx->embd_ring + i*mctx->n_frame;
+    double * s = mctx->win_sum, * s2 = mctx->win_sum2;
+    for (size_t j=0; j<mctx->n_frame; j++) {
+        s [j] += v[j];
+        s2[j] += (double)v[j]*v[j];
+    }
+    mctx->embd_used[i] = 1;
+    mctx->n_window++;
+}
+/*! \brief среднее и дисперсия векторов кадров в окне
+    \param mean, var - n_frame float или NULL
+    \return число кадров в окне
+ */
+int qnn_embed_window_stat(qnn_embed_t* mctx, float* mean, float* var){
+    const int n = mctx->n_window;
+    if (n==0) return 0;
+    const double * s = mctx->win_sum, * s2 = mctx->win_sum2;
+    for (size_t j=0; j<mctx->n_frame; j++) {
+        double m = s[j]/n;
+        if (mean) mean[j] = m;
+        if (var ) {
+            double d = s2[j]/n - m*m;
+            var[j] = d>0? d: 0;
+        }
+    }
+    return n;
+}
+/*! \brief схожесть текущего кадра со средним по окну, косинусная мера, O(n_frame) */
+float qnn_embed_window_ssim(qnn_embed_t* mctx){
+    if (mctx->n_window==0) return 0.f;
+    const float * v = _embed_slot(mctx, 0);
+    const double * s = mctx->win_sum;
+    const size_t n = (size_t)mctx->n_output_tokens*mctx->n_mmproj_embd;
+    double uv = 0, uu = 0, vv = 0;
+    for (size_t j=0; j<n; j++) {
+        uv += s[j]*v[j];
+        uu += s[j]*s[j];
+        vv += (double)v[j]*v[j];
+    }
+    return (uu>0 && vv>0)? uv/sqrt(uu*vv): 0.f;
+}
 
 qnn_embed_t* qnn_embed_init(const char * fname, int flags)
 {
@@ -100,42 +238,35 @@ qnn_embed_t* qnn_embed_init(const char * fname, int flags)
     mctx->n_threads = 511;
     mctx->n_mmproj_embd = clip_n_mmproj_embd(mctx->ctx_v);
     mctx->n_output_tokens=0;
-    mctx->n_embed_len = N_EMBED_LEN;
-    mctx->pos = 0;
-    for (int i=0; i< N_EMBED_LEN; i++)
-        mctx->embd_vector[i] = NULL;
+    mctx->n_frame = qnn_embed_frame_len(mctx);
+    mctx->embd_ring = NULL;
+    mctx->embd_used = NULL;
+    mctx->win_sum   = NULL;
     mctx->embd_mean = (float*)malloc(sizeof(float)*mctx->n_mmproj_embd);
     __builtin_bzero(mctx->embd_mean, sizeof(float)*mctx->n_mmproj_embd);
+    if (qnn_embed_window(mctx, N_EMBED_LEN)<0) {
+        qnn_embed_free(mctx);
+        return NULL;
+    }
     return mctx;
 }
 void qnn_embed_free(qnn_embed_t* mctx){
-    for (int i=0; i<N_EMBED_LEN; i++){
-        if (mctx->embd_vector[i]!=NULL) 
-            free(mctx->embd_vector[i]);
-    }
+    free(mctx->embd_ring);
+    free(mctx->embd_used);
+    free(mctx->win_sum);
+    free(mctx->embd_mean);
     clip_free(mctx->ctx_v);
     free(mctx);
 }
 /*! \brief вытолкать наружу результат предыдущей операции `_rotate`
  */
 static int qnn_embed_pop(qnn_embed_t* mctx) {
-    float* prev = mctx->embd_vector[0];
-    for (int i = 1; i<N_EMBED_LEN;i++ ){
-        mctx->embd_vector[i-1] = mctx->embd_vector[i];
-    }
-    mctx->embd_vector[N_EMBED_LEN-1] = prev;
-    mctx->pos --;
-
+    mctx->pos = _embed_index(mctx, 1);
     return 0;
 }
+/*! \brief сдвиг кольца, текущим становится самый старый вектор, он перезаписывается следующим кадром */
 int qnn_embed_rotate(qnn_embed_t* mctx) {
-    struct clip_ctx * ctx_clip = mctx->ctx_v;
-    mctx->pos ++;
-    float* prev = mctx->embd_vector[N_EMBED_LEN-1];
-    for (int i = N_EMBED_LEN; --i>0; ){
-        mctx->embd_vector[i] = mctx->embd_vector[i-1];
-    }
-    mctx->embd_vector[0] = prev;
+    mctx->pos = _embed_index(mctx, -1);
     return 0;
 }
 static bool qnn_embed_image_batch(qnn_embed_t* mctx, struct clip_image_u8 *img){
@@ -145,29 +276,20 @@ static bool qnn_embed_image_batch(qnn_embed_t* mctx, struct clip_image_u8 *img){
     clip_image_preprocess(ctx_clip, img, img_batch);
     int64_t t1_1 = ggml_time_us();
     mctx->t_process_us = t1_1 - t0_1;
-    bool ok = false;
-    struct clip_image_f32 * img_f32 = clip_image_f32_get_img(img_batch, 0);
-    mctx->n_output_tokens = clip_n_output_tokens(ctx_clip, img_f32);
-    int idx = 0;
-    //int idx = qnn_embed_rotate(mctx);
-
-
-    if (mctx->embd_vector[0]==NULL){
-        int size = clip_embd_nbytes(ctx_clip);
-        mctx->embd_vector[0] = (float*)malloc(size);
-    }
-
-    float * v = mctx->embd_vector[idx];
+    const int n_tokens = _embed_tokens(mctx, img_batch);
+    float * v = _embed_begin(mctx);
     int64_t t0 = ggml_time_us();
-    ok = clip_image_batch_encode(ctx_clip, mctx->n_threads, img_batch, v);
+    bool ok = n_tokens > 0 && clip_image_batch_encode(ctx_clip, mctx->n_threads, img_batch, v);
     int64_t t1 = ggml_time_us();
     mctx->t_encode_us = t1 - t0;
-
-    float* m = mctx->embd_mean;
-    unsigned n = mctx->n_output_tokens;
-    unsigned k = mctx->n_mmproj_embd;
-    qnn_embed_mean(m, v,    mctx->n_output_tokens, k);
-    qnn_embed_sub (v, v, m, mctx->n_output_tokens, k);
+    if (ok) {
+        mctx->n_output_tokens = n_tokens;
+        float* m = mctx->embd_mean;
+        unsigned k = mctx->n_mmproj_embd;
+        qnn_embed_mean(m, v,    mctx->n_output_tokens, k);
+        qnn_embed_sub (v, v, m, mctx->n_output_tokens, k);
+        _embed_commit(mctx);
+    }
 
     clip_image_f32_batch_free(img_batch);
     clip_image_u8_free(img);
@@ -195,6 +317,379 @@ bool qnn_embed_image_from_bytes(qnn_embed_t* mctx, const uint8_t* data, size_t d
     return ok;
 }
 
+// --- Пакетное кодирование кадров ---
+#define EMBED_GROUP 16  // кадров, подготавливаемых в пуле за один проход, \see _embed_images()
+struct _embed_batch {
+    qnn_embed_t * mctx;
+    const uint8_t * const * rgb_pixels; //!< кадры RGB в памяти
+    const int * nx;
+    const int * ny;
+    const char * const * fnames;        //!< или файлы JPG, PNG
+    struct clip_image_f32_batch ** img_batch; //!< подготовленные кадры группы
+    int first;                          //!< номер первого кадра группы
+};
+/*! \brief разбор и подготовка кадров группы [i0, i1) в потоке пула */
+static void _embed_preprocess(void * arg, int64_t i0, int64_t i1, int ith){
+    struct _embed_batch * eb = (struct _embed_batch *)arg;
+    struct clip_ctx * ctx_clip = eb->mctx->ctx_v;
+    for (int64_t i = i0; i < i1; i++) {
+        const int64_t f = eb->first + i;
+        struct clip_image_u8 * img = clip_image_u8_init();
+        bool ok = true;
+        if (eb->fnames != NULL) {
+            int nx, ny, nc;
+            unsigned char * rgb_pixels = stbi_load(eb->fnames[f], &nx, &ny, &nc, 3);
+            if (rgb_pixels != NULL) {
+                clip_build_img_from_pixels(rgb_pixels, nx, ny, img);
+                stbi_image_free(rgb_pixels);
+            } else
+                ok = false;
+        } else
+            clip_build_img_from_pixels(eb->rgb_pixels[f], eb->nx[f], eb->ny[f], img);
+        if (ok) {
+            eb->img_batch[i] = clip_image_f32_batch_init();
+            clip_image_preprocess(ctx_clip, img, eb->img_batch[i]);
+        }
+        clip_image_u8_free(img);
+    }
+}
+/*! \brief подготовка кадров в пуле потоков и кодирование в буфер embd
+    \return число закодированных кадров
+
+    Кодировщик clip обрабатывает пакет из одного изображения, поэтому кадры кодируются подряд,
+    а подготовка (разбор JPEG, масштабирование, нормализация) выполняется параллельно группами по EMBED_GROUP
+    кадров, память под подготовленные кадры не зависит от размера пакета.
+ */
+static int _embed_images(struct _embed_batch * eb, int n_frames, float * embd, int32_t * t_encode_us){
+    qnn_embed_t * mctx = eb->mctx;
+    struct clip_ctx * ctx_clip = mctx->ctx_v;
+    const size_t len = qnn_embed_frame_len(mctx);
+    struct clip_image_f32_batch * img_batch[EMBED_GROUP] = {NULL};
+    eb->img_batch = img_batch;
+    int64_t t_process = 0, t_encode = 0;
+    int n_ok = 0;
+    for (int i0 = 0; i0 < n_frames; i0 += EMBED_GROUP) {
+        const int m = n_frames - i0 < EMBED_GROUP ? n_frames - i0 : EMBED_GROUP;
+        eb->first = i0;
+        int64_t t0 = ggml_time_us();
+        qnn_pool_parallel_for(qnn_pool_default(), m, 1, _embed_preprocess, eb);
+        int64_t t1 = ggml_time_us();
+        t_process += t1 - t0;
+        for (int j = 0; j < m; j++) {
+            float * v = embd + (size_t)(i0 + j)*len;
+            int64_t te = ggml_time_us();
+            const int n_tokens = img_batch[j] != NULL ? _embed_tokens(mctx, img_batch[j]) : -1;
+            bool ok = n_tokens > 0 && clip_image_batch_encode(ctx_clip, mctx->n_threads, img_batch[j], v);
+            if (ok) {
+                mctx->n_output_tokens = n_tokens;
+                const unsigned k = mctx->n_mmproj_embd;
+                qnn_embed_mean(mctx->embd_mean, v,    mctx->n_output_tokens, k);
+                qnn_embed_sub (v, v, mctx->embd_mean, mctx->n_output_tokens, k);
+                n_ok++;
+            } else
+                __builtin_bzero(v, len*sizeof(float));
+            if (t_encode_us) t_encode_us[i0 + j] = ggml_time_us() - te;
+            if (img_batch[j]) clip_image_f32_batch_free(img_batch[j]);
+            img_batch[j] = NULL;
+        }
+        t_encode += ggml_time_us() - t1;
+    }
+    eb->img_batch = NULL;
+    // время на кадр с учетом параллельной подготовки
+    mctx->t_process_us = n_frames? t_process/n_frames: 0;
+    mctx->t_encode_us  = n_frames? t_encode/n_frames: 0;
+    return n_ok;
+}
+/*! \brief Пакетное кодирование кадров RGB nc=3 из памяти
+    \param embd - буфер n_frames*qnn_embed_frame_len() float, эмбеддинг кадра i с позиции i*qnn_embed_frame_len()
+    \param t_encode_us - время кодирования каждого кадра или NULL
+    \return число закодированных кадров, эмбеддинги незакодированных заполняются нулями
+
+    qnn_embed_time() и qnn_embed_process_time() после вызова возвращают время на кадр, усредненное по пакету.
+ */
+int qnn_embed_images(qnn_embed_t* mctx, const uint8_t* const* rgb_pixels, const int* nx, const int* ny, int n_frames,
+        float* embd, int32_t* t_encode_us){
+    struct _embed_batch eb = {mctx, rgb_pixels, nx, ny, NULL, NULL};
+    return _embed_images(&eb, n_frames, embd, t_encode_us);
+}
+/*! \brief Пакетное кодирование кадров из файлов JPG или PNG, разбор файлов выполняется в пуле потоков */
+int qnn_embed_images_from_files(qnn_embed_t* mctx, const char* const* fnames, int n_frames, float* embd, int32_t* t_encode_us){
+    struct _embed_batch eb = {mctx, NULL, NULL, NULL, fnames, NULL};
+    return _embed_images(&eb, n_frames, embd, t_encode_us);
+}
+
+// --- Конвейер MPEG-TS: декодирование -> подготовка -> кодирование ---
+#define TS_QUEUE_LEN  8         // емкость очереди между стадиями конвейера
+#define TS_FRAMES     TS_QUEUE_LEN // кадров в обороте, все помещаются в очередь возврата
+#define TS_STEP_US    500000    // интервал между кодируемыми кадрами, мкс
+#define SCENE_SS_MIN  0.80f     // схожесть с предыдущим кадром ниже порога - граница сцены
+#define TS_SPIN       256       // попыток с уступкой процессора до ожидания на cond
+
+/*! \brief очередь одного писателя и одного читателя без блокировок
+
+    Индексы head и tail растут непрерывно, элемент - slot[index % TS_QUEUE_LEN]. Писатель изменяет только tail,
+    читатель только head. При пустой или полной очереди поток TS_SPIN раз уступает процессор, затем засыпает на cond,
+    противоположная сторона будит его, если n_sleep не ноль. Кодирование кадра длится десятки миллисекунд,
+    поэтому ожидающие декодер и подготовка большую часть времени спят.
+ */
+struct _spsc {
+    void * slot[TS_QUEUE_LEN];
+    alignas(64) std::atomic<unsigned> head;
+    alignas(64) std::atomic<unsigned> tail;
+    alignas(64) std::atomic<int> n_sleep;   //!< ожидающие на cond
+    std::mutex lock;
+    std::condition_variable cond;
+};
+template <typename Ready>
+static void _spsc_wait(struct _spsc * q, Ready ready){
+    for (int i = 0; i < TS_SPIN; i++) {
+        if (ready()) return;
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lk(q->lock);
+    q->n_sleep.fetch_add(1);// seq_cst: изменение индекса другой стороной видно после этой записи, или она увидит n_sleep
+    q->cond.wait(lk, ready);
+    q->n_sleep.fetch_sub(1, std::memory_order_relaxed);
+}
+static void _spsc_wake(struct _spsc * q){
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (q->n_sleep.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lk(q->lock);// ожидающий либо еще не проверил условие, либо уже в wait
+        q->cond.notify_all();
+    }
+}
+static void _spsc_push(struct _spsc * q, void * item){
+    unsigned t = q->tail.load(std::memory_order_relaxed);
+    _spsc_wait(q, [q, t]{ return t - q->head.load(std::memory_order_acquire) != TS_QUEUE_LEN; });
+    q->slot[t % TS_QUEUE_LEN] = item;
+    q->tail.store(t + 1, std::memory_order_release);
+    _spsc_wake(q);
+}
+static void * _spsc_pop(struct _spsc * q){
+    unsigned h = q->head.load(std::memory_order_relaxed);
+    _spsc_wait(q, [q, h]{ return q->tail.load(std::memory_order_acquire) != h; });
+    void * item = q->slot[h % TS_QUEUE_LEN];
+    q->head.store(h + 1, std::memory_order_release);
+    _spsc_wake(q);
+    return item;
+}
+struct _ts_frame {
+    int64_t pts_us;     //!< время кадра от начала потока, мкс
+    int     nx, ny;     //!< размер декодированного кадра
+    uint8_t * rgb;      //!< декодированный кадр RGB
+    uint8_t * rgb_enc;  //!< кадр, масштабированный к размеру входа кодировщика
+    struct clip_image_f32_batch * img_batch;
+};
+struct _ts_pipe {
+    qnn_embed_t * mctx;
+    const char  * fname;
+    int image_size;         //!< размер входа кодировщика
+    struct _spsc decoded;   //!< декодер -> подготовка
+    struct _spsc ready;     //!< подготовка -> кодировщик
+    struct _spsc spare;     //!< кодировщик -> декодер, возврат кадров
+    struct _ts_frame frames[TS_FRAMES];
+    int64_t duration_us;    //!< длительность потока, заполняет декодер
+};
+/*! \brief поток разбора и декодирования, кадры с интервалом TS_STEP_US преобразуются в RGB
+    Конец потока - NULL в очереди decoded.
+ */
+static void _ts_decode(struct _ts_pipe * tp){
+    AVFormatContext * fmt = NULL;
+    AVCodecContext  * dec = NULL;
+    struct SwsContext * sws = NULL;
+    AVPacket * pkt = av_packet_alloc();
+    AVFrame  * frm = av_frame_alloc();
+    const AVCodec * codec = NULL;
+    int vs = -1;
+    if (avformat_open_input(&fmt, tp->fname, NULL, NULL) == 0 && avformat_find_stream_info(fmt, NULL) >= 0)
+        vs = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (vs >= 0) {
+        dec = avcodec_alloc_context3(codec);
+        avcodec_parameters_to_context(dec, fmt->streams[vs]->codecpar);
+        dec->thread_count = 0;// по числу процессоров
+        if (avcodec_open2(dec, codec, NULL) < 0) vs = -1;
+    }
+    if (vs < 0) fprintf(stderr, "%s: cannot decode '%s'\n", __func__, tp->fname);
+    const AVRational tb = vs >= 0 ? fmt->streams[vs]->time_base : AVRational{1, 1000000};
+    const int64_t start = (vs >= 0 && fmt->streams[vs]->start_time != AV_NOPTS_VALUE) ? fmt->streams[vs]->start_time : 0;
+    int64_t next_us = 0;
+    bool eof = (vs < 0);
+    while (!eof) {
+        int res = av_read_frame(fmt, pkt);
+        if (res < 0) {
+            avcodec_send_packet(dec, NULL);// сброс буферизованных кадров декодера
+            eof = true;
+        } else if (pkt->stream_index == vs)
+            avcodec_send_packet(dec, pkt);
+        av_packet_unref(pkt);
+        while (avcodec_receive_frame(dec, frm) == 0) {
+            if (frm->best_effort_timestamp == AV_NOPTS_VALUE) continue;// время кадра неизвестно
+            int64_t pts_us = av_rescale_q(frm->best_effort_timestamp - start, tb, AVRational{1, 1000000});
+            if (pts_us > tp->duration_us) tp->duration_us = pts_us;
+            if (pts_us < next_us || frm->width < 4 || frm->height < 4) continue;
+            next_us = pts_us + TS_STEP_US;
+            struct _ts_frame * f = (struct _ts_frame *)_spsc_pop(&tp->spare);
+            if (f->nx != frm->width || f->ny != frm->height) {
+                f->nx = frm->width; f->ny = frm->height;
+                f->rgb = (uint8_t *)realloc(f->rgb, (size_t)f->nx*f->ny*3);
+            }
+            sws = sws_getCachedContext(sws, f->nx, f->ny, (enum AVPixelFormat)frm->format, 
+                f->nx, f->ny, AV_PIX_FMT_RGB24, SWS_POINT, NULL, NULL, NULL);
+            uint8_t * dst[4] = {f->rgb, NULL, NULL, NULL};
+            int dst_stride[4] = {3*f->nx, 0, 0, 0};
+            sws_scale(sws, frm->data, frm->linesize, 0, f->ny, dst, dst_stride);
+            f->pts_us = pts_us;
+            _spsc_push(&tp->decoded, f);
+        }
+    }
+    _spsc_push(&tp->decoded, NULL);
+    sws_freeContext(sws);
+    av_frame_free(&frm);
+    av_packet_free(&pkt);
+    avcodec_free_context(&dec);
+    avformat_close_input(&fmt);
+}
+/*! \brief поток подготовки: масштабирование bicubic() к квадрату входа кодировщика и нормализация clip */
+static void _ts_preprocess(struct _ts_pipe * tp){
+    struct clip_ctx * ctx_clip = tp->mctx->ctx_v;
+    const int n = tp->image_size;
+    struct _ts_frame * f;
+    while ((f = (struct _ts_frame *)_spsc_pop(&tp->decoded)) != NULL) {
+        bicubic(f->rgb, f->rgb_enc, f->nx, f->ny, 3*f->nx, n, n, 3*n, 3);
+        struct clip_image_u8 * img = clip_image_u8_init();
+        clip_build_img_from_pixels(f->rgb_enc, n, n, img);
+        f->img_batch = clip_image_f32_batch_init();
+        clip_image_preprocess(ctx_clip, img, f->img_batch);
+        clip_image_u8_free(img);
+        _spsc_push(&tp->ready, f);
+    }
+    _spsc_push(&tp->ready, NULL);
+}
+typedef void (*_ts_frame_fn)(void * user, qnn_embed_t * mctx, int64_t pts_us, float ss);
+/*! \brief конвейер: декодирование и подготовка в отдельных потоках, кодирование в вызывающем потоке
+    \param fn - вызывается для каждого закодированного кадра, эмбеддинг кадра - qnn_embed_get(mctx, 0),
+    ss - схожесть с предыдущим кадром
+    \return длительность потока, мкс
+ */
+static int64_t _ts_pipeline(qnn_embed_t * mctx, const char * fname, _ts_frame_fn fn, void * user){
+    struct clip_ctx * ctx_clip = mctx->ctx_v;
+    struct _ts_pipe * tp = new _ts_pipe();
+    tp->mctx  = mctx;
+    tp->fname = fname;
+    tp->image_size = clip_get_image_size(ctx_clip);
+    for (int i = 0; i < TS_FRAMES; i++) {
+        tp->frames[i].rgb_enc = (uint8_t *)malloc((size_t)tp->image_size*tp->image_size*3);
+        _spsc_push(&tp->spare, &tp->frames[i]);
+    }
+    std::thread t_decode(_ts_decode, tp);
+    std::thread t_prep(_ts_preprocess, tp);
+    int n_frames = 0;
+    int64_t t_encode = 0;
+    struct _ts_frame * f;
+    while ((f = (struct _ts_frame *)_spsc_pop(&tp->ready)) != NULL) {
+        qnn_embed_rotate(mctx);
+        float * v = _embed_begin(mctx);
+        const int n_tokens = _embed_tokens(mctx, f->img_batch);
+        int64_t t0 = ggml_time_us();
+        bool ok = n_tokens > 0 && clip_image_batch_encode(ctx_clip, mctx->n_threads, f->img_batch, v);
+        t_encode += ggml_time_us() - t0;
+        if (ok) {
+            mctx->n_output_tokens = n_tokens;
+            const unsigned k = mctx->n_mmproj_embd;
+            qnn_embed_mean(mctx->embd_mean, v,    mctx->n_output_tokens, k);
+            qnn_embed_sub (v, v, mctx->embd_mean, mctx->n_output_tokens, k);
+            _embed_commit(mctx);
+            fn(user, mctx, f->pts_us, n_frames ? qnn_embed_ssim(mctx, 1) : 0.f);
+            n_frames++;
+        } else
+            qnn_embed_pop(mctx);
+        clip_image_f32_batch_free(f->img_batch);
+        f->img_batch = NULL;
+        _spsc_push(&tp->spare, f);
+    }
+    t_decode.join();
+    t_prep.join();
+    mctx->t_encode_us = n_frames ? t_encode/n_frames : 0;
+    int64_t duration = tp->duration_us;
+    for (int i = 0; i < TS_FRAMES; i++) {
+        free(tp->frames[i].rgb);
+        free(tp->frames[i].rgb_enc);
+    }
+    delete tp;
+    return duration;
+}
+// --- Выделение сцен ---
+struct _ts_scenes {
+    uint64_t unix_usec;     //!< время начала файла
+    GSList * list;
+    qnn_scene_t * scene;    //!< текущая сцена
+};
+static void _ts_scene_frame(void * user, qnn_embed_t * mctx, int64_t pts_us, float ss){
+    struct _ts_scenes * ts = (struct _ts_scenes *)user;
+    qnn_scene_t * sc = ts->scene;
+    if (sc == NULL || ss < SCENE_SS_MIN) {// новая сцена, опорный кадр - первый
+        sc = g_new0(qnn_scene_t, 1);
+        sc->pos_frame = ts->unix_usec + pts_us;
+        sc->argmax    = ts->unix_usec + pts_us;
+        sc->ss_min    = ss;
+        sc->ss_max    = ss;
+        sc->type      = ts->scene ? "cut" : "start";
+        ts->list  = g_slist_prepend(ts->list, sc);
+        ts->scene = sc;
+    } else if (ss > sc->ss_max) {// опорный кадр - наиболее статичный, схожий с предыдущим
+        sc->ss_max = ss;
+        sc->argmax = ts->unix_usec + pts_us;
+    }
+    sc->duration = ts->unix_usec + pts_us - sc->pos_frame;
+}
+/*! \brief выделение сцен в видео .ts или .mp4
+    \param unix_usec - время начала файла, добавляется к меткам времени кадров
+    \param scenes - список qnn_scene_t в порядке времени, освобождается qnn_scene_free()
+    \return длительность видео, мкс
+
+    Кодируется один кадр за TS_STEP_US, граница сцены - схожесть с предыдущим кадром ниже SCENE_SS_MIN.
+ */
+uint64_t qnn_embed_mpeg2ts(qnn_embed_t * emctx, const char* fname, uint64_t unix_usec, struct _GSList** scenes){
+    struct _ts_scenes ts = {unix_usec, NULL, NULL};
+    int64_t duration = _ts_pipeline(emctx, fname, _ts_scene_frame, &ts);
+    if (scenes) *scenes = g_slist_reverse(ts.list);
+    else qnn_scene_free(ts.list);
+    return duration;
+}
+void qnn_scene_free(struct _GSList* scenes){
+    g_slist_free_full(scenes, g_free);
+}
+// --- Поиск кадра ---
+struct _ts_search {
+    const float * ref;      //!< эмбеддинг образца
+    unsigned n;
+    float   ss_max;
+    int64_t pts_us;
+};
+static void _ts_search_frame(void * user, qnn_embed_t * mctx, int64_t pts_us, float ss){
+    struct _ts_search * sr = (struct _ts_search *)user;
+    float s = qnn_embed_similarity_cos(sr->ref, qnn_embed_get(mctx, 0), sr->n);
+    if (s > sr->ss_max) {
+        sr->ss_max = s;
+        sr->pts_us = pts_us;
+    }
+}
+/*! \brief поиск в видео кадра, наиболее схожего с последним закодированным изображением
+    \param unix_usec - время начала файла
+    \return unix_usec + время найденного кадра от начала файла, мкс
+ */
+uint64_t qnn_embed_mpeg2ts_at(qnn_embed_t * emctx, const char* fname, uint64_t unix_usec){
+    const float * v = qnn_embed_get(emctx, 0);
+    if (v == NULL) return unix_usec;
+    struct _ts_search sr = {NULL, (unsigned)qnn_embed_len(emctx), -1.f, 0};
+    float * ref = (float *)malloc(sr.n*sizeof(float));
+    __builtin_memcpy(ref, v, sr.n*sizeof(float));
+    sr.ref = ref;
+    _ts_pipeline(emctx, fname, _ts_search_frame, &sr);
+    free(ref);
+    return unix_usec + sr.pts_us;
+}
+
 //#include "common.h"
 #include "llama.h"
 static void _log_callback(enum ggml_log_level level, const char * text, void * user_data) {
@@ -239,6 +734,7 @@ struct _MainOptions {
     int verbose;		//!< выводить информацию о прогрессе
 	int version;		//!< выводить информацию о версии программы
 	int overwrite;		//!< перезаписывать выходной файл
+	int window;			//!< длина окна статистики, кадров
 };
 MainOptions options = {NULL};
 static GOptionEntry entries[] =
@@ -247,6 +743,7 @@ static GOptionEntry entries[] =
   { "model", 	'm', 0, G_OPTION_ARG_FILENAME, &options.model, 		 "model  `filename`", "*.gguf" },
   { "log",  	'l', 0, G_OPTION_ARG_FILENAME, &options.log_file,    "log    `filename`", "*.jsonl"},
   { "overwrite",'O', 0, G_OPTION_ARG_NONE,	 &options.overwrite, "overwrite output", NULL },
+  { "window", 	'w', 0, G_OPTION_ARG_INT,	 &options.window, 	 "statistics window, frames", "32..256" },
   { "verbose", 	'v', 0, G_OPTION_ARG_NONE,	 &options.verbose, 	 "Be verbose", 	 NULL },
   { "version", 	'V', 0, G_OPTION_ARG_NONE,	 &options.version, 	 "program info", NULL },
   { NULL }
@@ -305,7 +802,29 @@ int main(int argc, char** argv)
     const char* embed_model_name = options.model;//argv[1];
     qnn_embed_t * mctx = qnn_embed_init(embed_model_name, 0);
     if (mctx==NULL) return -2;
+    if (options.window>0) qnn_embed_window(mctx, options.window);
     int n_mmproj = qnn_embed_n_mmproj(mctx); // this should be equal to the embedding dimension of the text model
+    {// пакетное кодирование всех кадров JPG из командной строки
+        const char ** fnames = (const char **)malloc(argc*sizeof(char*));
+        int n_frames = 0;
+        for (int i = 1; i<argc; i++)
+            if (g_str_has_suffix(argv[i], ".jpg") && g_file_test(argv[i], G_FILE_TEST_IS_REGULAR))
+                fnames[n_frames++] = argv[i];
+        if (n_frames > 1) {
+            const int len = qnn_embed_frame_len(mctx);
+            float   * embd = (float *)malloc((size_t)n_frames*len*sizeof(float));
+            int32_t * t_us = (int32_t *)malloc(n_frames*sizeof(int32_t));
+            int n_ok = qnn_embed_images_from_files(mctx, fnames, n_frames, embd, t_us);
+            const unsigned n = qnn_embed_n_tokens(mctx)*n_mmproj;
+            for (int i = 0; i<n_frames; i++)
+                fprintf(stdout, "batch %s: ss = %1.4f, time %1.1f ms\n", fnames[i], 
+                    i? qnn_embed_similarity_cos(embd + (size_t)i*len, embd + (size_t)(i-1)*len, n): 1.0f, t_us[i]/1000.0);
+            fprintf(stdout, "batch %d/%d frames: encode %1.1f ms/frame, preprocess %1.1f ms/frame\n", n_ok, n_frames,
+                qnn_embed_time(mctx)/1000.0, qnn_embed_process_time(mctx)/1000.0);
+            free(embd); free(t_us);
+        }
+        free(fnames);
+    }
 
     for (int i = 1; i<argc; i++) {
         char* img_file = argv[i];
@@ -319,12 +838,21 @@ int main(int argc, char** argv)
             int  t  = qnn_embed_time(mctx);
             float ss= qnn_embed_ssim(mctx, 1);
             float ds= qnn_embed_dist(mctx, 1); // сделать luminance маску размером n_tok!
-            fprintf(stdout, "file %s: %s, %1.4f, ds = %1.4f, time %1.1f ms/%d tokens\n", img_file, ok?"ok":"fail", ss, ds, (double)t/1000, n_tok);
+            float ws= qnn_embed_window_ssim(mctx);
+            fprintf(stdout, "file %s: %s, %1.4f, ds = %1.4f, window %1.4f, time %1.1f ms/%d tokens\n", img_file, ok?"ok":"fail", ss, ds, ws, (double)t/1000, n_tok);
         } else 
         if (g_str_has_suffix(img_file, ".ts")
         ||  g_str_has_suffix(img_file, ".mp4")){
             // файл содержит метку времени, надо найти привязку
-            qnn_embed_mpeg2ts(mctx, img_file);
+            GSList * scenes = NULL;
+            uint64_t duration = qnn_embed_mpeg2ts(mctx, img_file, 0, &scenes);
+            fprintf(stdout, "file %s: %1.1f s, encode %1.1f ms/frame\n", img_file, duration*1e-6, qnn_embed_time(mctx)/1000.0);
+            for (GSList * l = scenes; l != NULL; l = l->next) {
+                qnn_scene_t * sc = (qnn_scene_t *)l->data;
+                fprintf(stdout, " scene %8.3f s +%7.3f s ref %8.3f s ss %1.4f..%1.4f %s\n", sc->pos_frame*1e-6, sc->duration*1e-6,
+                    sc->argmax*1e-6, sc->ss_min, sc->ss_max, sc->type);
+            }
+            qnn_scene_free(scenes);
         }
 
     }
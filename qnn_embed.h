@@ -45,9 +45,21 @@ struct mtmd_ctx * qnn_llama_init  (struct mtmd_ctx* mctx, struct mtmd_params* op
      void qnn_embed_sum     (      float* r, const float* v, unsigned n, unsigned k);
      void qnn_embed_sub     (      float* r, const float *a, const float *b, unsigned n, unsigned k);
      void qnn_embed_mean    (      float* r, const float* v, unsigned n, unsigned k);
+      int qnn_embed_ops_isa (int isa);
+// индекс поиска ближайших соседей по эмбеддингам кадров, \see qnn_embed_index.c
+    typedef struct _qnn_embed_index qnn_embed_index_t;
+    enum { QNN_INDEX_F32, QNN_INDEX_Q8_0, QNN_INDEX_F8 };
+qnn_embed_index_t* qnn_embed_index_new (int type, unsigned dim, unsigned n_list);
+      int qnn_embed_index_add   (qnn_embed_index_t* ix, const float* x, const uint64_t* ids, size_t n);
+      int qnn_embed_index_search(const qnn_embed_index_t* ix, const float* q, int k, int n_probe, uint64_t* ids, float* score);
+   size_t qnn_embed_index_len   (const qnn_embed_index_t* ix);
+      int qnn_embed_index_save  (const qnn_embed_index_t* ix, const char* fname);
+qnn_embed_index_t* qnn_embed_index_load(const char* fname);
+     void qnn_embed_index_free  (qnn_embed_index_t* ix);
 
      //  float qnn_embed_batch_norm(    float* r, const float* v, unsigned n, unsigned k);
 
+    struct _GSList;
     typedef struct _qnn_embedding_ctx qnn_embed_t;
     typedef struct _qnn_scene qnn_scene_t;
     struct _qnn_scene {
@@ -64,6 +76,10 @@ struct mtmd_ctx * qnn_llama_init  (struct mtmd_ctx* mctx, struct mtmd_params* op
     bool qnn_embed_text (qnn_embed_t* mctx, const char* text, size_t mlen);
     bool qnn_embed_image(qnn_embed_t* mctx, const uint8_t* rgb_pixels, int nx, int ny);
     bool qnn_embed_image_from_bytes(qnn_embed_t* mctx, const uint8_t* data, size_t data_len);
+     int qnn_embed_images(qnn_embed_t* mctx, const uint8_t* const* rgb_pixels, const int* nx, const int* ny, int n_frames,
+                float* embd, int32_t* t_encode_us);
+     int qnn_embed_images_from_files(qnn_embed_t* mctx, const char* const* fnames, int n_frames, float* embd, int32_t* t_encode_us);
+ int32_t qnn_embed_frame_len(qnn_embed_t* mctx);
 uint64_t qnn_embed_mpeg2ts   (qnn_embed_t * emctx, const char* fname, uint64_t unix_usec, struct _GSList** scene);
 uint64_t qnn_embed_mpeg2ts_at(qnn_embed_t * emctx, const char* fname, uint64_t unix_usec);
     void qnn_embed_free (qnn_embed_t* mctx);
@@ -74,6 +90,9 @@ uint64_t qnn_embed_mpeg2ts_at(qnn_embed_t * emctx, const char* fname, uint64_t u
  int32_t qnn_embed_n_tokens (qnn_embed_t* mctx);
  int32_t qnn_embed_n_mmproj (qnn_embed_t* mctx);
      int qnn_embed_rotate   (qnn_embed_t* mctx);
+     int qnn_embed_window   (qnn_embed_t* mctx, int n_len);
+     int qnn_embed_window_stat(qnn_embed_t* mctx, float* mean, float* var);
+   float qnn_embed_window_ssim(qnn_embed_t* mctx);
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,817 @@
+/*! \file qnn_embed_index.c
+    \brief Индекс приближенного поиска ближайших соседей (ANN) по эмбеддингам кадров, \see qnn_embed.h
+
+Сборка и тестирование
+    $ gcc -DTEST_EMBED_INDEX -O3 -march=native -o test qnn_embed_index.c qnn_embed_ops.c qnn_gguf.c qnn_pool.c \
+        json.c quarks.c xxh64.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
+    $ ./test 100000 256
+
+Поиск "момент в записи, похожий на кадр X" сравнивает запрос не со всеми кадрами, а с частью.
+Индекс инвертированных списков IVF: векторы разбиты на n_list кластеров сферическим k-means (Lloyd),
+поиск просматривает n_probe кластеров с ближайшими центроидами, остальные пропускаются.
+Мера - косинусная схожесть, векторы нормируются при добавлении и сравниваются скалярным произведением.
+
+Хранение векторов (тип индекса):
+* QNN_INDEX_F32  - без сжатия;
+* QNN_INDEX_Q8_0 - блоки по QK8_0 чисел int8 с множителем F16, quantize_row_q8_0_ref(), в 3.8 раза меньше F32;
+* QNN_INDEX_F8   - FP8 E4M3FN с множителем F32 на вектор, convert_f32_to_f8_e4m3fn(), в 4 раза меньше F32.
+Размерность дополняется нулями до кратной QK8_0.
+
+Формат файла допускает отображение в память без разбора: заголовок, центроиды F32, смещения списков,
+идентификаторы и векторы, упорядоченные по спискам. Каждый раздел выровнен на INDEX_ALIGN байт.
+Индекс, загруженный из файла, используется для поиска без копирования, страницы подгружаются по обращению.
+Первое добавление копирует списки в память, отображение файла при этом освобождается.
+
+Векторы дописываются в конец списка ближайшего центроида, память списка растет вдвое.
+Пока векторов меньше n_list, центроиды не обучены: индекс из одного списка с нулевым центроидом.
+Центроиды обучаются, когда векторов не меньше n_list, и переобучаются при росте индекса в INDEX_RETRAIN раз,
+пока выборка меньше INDEX_TRAIN. При переобучении строки переносятся в новые списки без перекодирования.
+
+Поиск по одному запросу распределяется по потокам qnn_pool: строки просматриваемых списков делятся
+на диапазоны, у каждого потока своя куча k лучших, кучи объединяются в конце.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include "qnn.h"
+#include "qnn_embed.h"
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#define INDEX_MAGIC     "QNNIVF01"
+#define INDEX_ALIGN     64      // выравнивание разделов файла
+#define INDEX_TRAIN     16384   // векторов в выборке для k-means
+#define INDEX_RETRAIN   4       // рост индекса до переобучения центроидов
+#define INDEX_ITER      8       // итераций k-means
+#define INDEX_CHUNK     4096    // векторов в порции при добавлении
+#define INDEX_GRAIN     64      // строк в задаче пула при поиске
+#define F8_E4M3FN_MAX   448.0f  // максимальное значение E4M3FN
+
+//!< заголовок файла, поля в порядке little-endian
+struct _index_header {
+    char     magic[8];
+    uint32_t type;      //!< QNN_INDEX_F32, QNN_INDEX_Q8_0, QNN_INDEX_F8
+    uint32_t dim;       //!< размерность векторов
+    uint32_t dim_pad;   //!< размерность, дополненная до кратной QK8_0
+    uint32_t n_list;    //!< число кластеров, 1 - центроиды не обучены
+    uint32_t n_list_max;//!< заданное число кластеров, \see qnn_embed_index_new()
+    uint32_t reserved;
+    uint64_t n_vec;     //!< число векторов
+    uint64_t n_trained; //!< число векторов при обучении центроидов, 0 - не обучены
+    uint64_t row_size;  //!< байт на вектор
+    uint64_t offs_centroids;//!< смещения разделов от начала файла
+    uint64_t offs_lists;
+    uint64_t offs_ids;
+    uint64_t offs_data;
+};
+//!< список кластера: идентификаторы (метки времени кадров) и векторы
+struct _index_list {
+    uint64_t n;
+    uint64_t n_alloc;
+    uint64_t * ids;
+    uint8_t  * data;    //!< n*row_size
+};
+struct _qnn_embed_index {
+    struct _index_header h;
+    float * centroids;          //!< n_list*dim_pad, нормированы
+    struct _index_list * list;  //!< n_list списков, у загруженного индекса - в отображении файла
+    void * mapping;             //!< отображение файла, NULL для индекса в памяти
+    size_t mapping_size;
+};
+
+static float _f8_lut[256];// E4M3FN -> F32
+static pthread_once_t _f8_lut_once = PTHREAD_ONCE_INIT;
+static void _index_lut_build(){
+    for (int i=0; i<256; i++)
+        _f8_lut[i] = ggml_compute_fp8_e4m3fn_to_fp32(i);
+}
+static void _index_lut_init(){
+    pthread_once(&_f8_lut_once, _index_lut_build);
+}
+static size_t _index_row_size(uint32_t type, uint32_t dim_pad){
+    switch (type){
+    case QNN_INDEX_Q8_0: return dim_pad/QK8_0*sizeof(block_q8_0);
+    case QNN_INDEX_F8:   return sizeof(float) + dim_pad;
+    default:             return dim_pad*sizeof(float);
+    }
+}
+static inline uint64_t _align(uint64_t offs){
+    return (offs + INDEX_ALIGN-1) & ~(uint64_t)(INDEX_ALIGN-1);
+}
+/*! \brief нормированная копия вектора, дополненная нулями до dim_pad */
+static void _index_normalize(float* r, const float* x, uint32_t dim, uint32_t dim_pad){
+    qnn_embed_l2normalize(r, x, dim);
+    for (uint32_t j=dim; j<dim_pad; j++) r[j] = 0.f;
+}
+static void _index_encode(const struct _index_header* h, const float* x, uint8_t* row){
+    const uint32_t n = h->dim_pad;
+    switch (h->type){
+    case QNN_INDEX_Q8_0:
+        quantize_row_q8_0_ref(x, (block_q8_0*)row, n);
+        break;
+    case QNN_INDEX_F8: {
+        float amax = 0.f;
+        for (uint32_t j=0; j<n; j++) amax = fmaxf(amax, fabsf(x[j]));
+        const float d  = amax/F8_E4M3FN_MAX;
+        const float id = d? 1.0f/d: 0.f;
+        __builtin_memcpy(row, &d, sizeof(float));
+        uint8_t* q = row + sizeof(float);
+        for (uint32_t j=0; j<n; j++)
+            q[j] = convert_f32_to_f8_e4m3fn(x[j]*id, 0);
+    } break;
+    default:
+        __builtin_memcpy(row, x, n*sizeof(float));
+        break;
+    }
+}
+/*! \brief обратное преобразование вектора индекса в F32 для обучения центроидов */
+static void _index_decode(const struct _index_header* h, const uint8_t* row, float* x){
+    const uint32_t n = h->dim_pad;
+    switch (h->type){
+    case QNN_INDEX_Q8_0: {
+        const block_q8_0* b = (const block_q8_0*)row;
+        for (uint32_t i=0; i<n/QK8_0; i++, x+=QK8_0) {
+            const float d = GGML_FP16_TO_FP32(b[i].d);
+            for (int j=0; j<QK8_0; j++) x[j] = d*b[i].qs[j];
+        }
+    } break;
+    case QNN_INDEX_F8: {
+        float d;
+        __builtin_memcpy(&d, row, sizeof(float));
+        const uint8_t* q = row + sizeof(float);
+        for (uint32_t j=0; j<n; j++) x[j] = d*_f8_lut[q[j]];
+    } break;
+    default:
+        __builtin_memcpy(x, row, n*sizeof(float));
+        break;
+    }
+}
+/*! \brief скалярное произведение запроса F32 и вектора индекса */
+static float _index_score(const struct _index_header* h, const float* q, const uint8_t* row){
+    const uint32_t n = h->dim_pad;
+    switch (h->type){
+    case QNN_INDEX_Q8_0: {
+        const block_q8_0* b = (const block_q8_0*)row;
+        float s = 0.f;
+        for (uint32_t i=0; i<n/QK8_0; i++, q+=QK8_0) {
+            float sb = 0.f;
+            for (int j=0; j<QK8_0; j++) sb += q[j]*b[i].qs[j];
+            s += sb*GGML_FP16_TO_FP32(b[i].d);
+        }
+        return s;
+    }
+    case QNN_INDEX_F8: {
+        float d;
+        __builtin_memcpy(&d, row, sizeof(float));
+        const uint8_t* x = row + sizeof(float);
+        float s = 0.f;
+        for (uint32_t j=0; j<n; j++) s += q[j]*_f8_lut[x[j]];
+        return s*d;
+    }
+    default:
+        return qnn_embed_dot(q, (const float*)row, n);
+    }
+}
+/*! \brief добавление строки в конец списка, память растет вдвое
+    \return false, если не хватает памяти
+ */
+static bool _index_list_append(struct _index_list* l, uint64_t id, const uint8_t* row, size_t row_size){
+    if (l->n == l->n_alloc) {
+        const uint64_t n_alloc = l->n_alloc? 2*l->n_alloc: 16;
+        uint64_t * ids = realloc(l->ids, n_alloc*sizeof(uint64_t));
+        if (ids==NULL) return false;
+        l->ids = ids;
+        uint8_t * data = realloc(l->data, n_alloc*row_size);
+        if (data==NULL) return false;
+        l->data = data;
+        l->n_alloc = n_alloc;
+    }
+    l->ids[l->n] = id;
+    __builtin_memcpy(l->data + l->n*row_size, row, row_size);
+    l->n++;
+    return true;
+}
+static void _index_lists_free(struct _index_list* list, uint32_t n_list){
+    if (list==NULL) return;
+    for (uint32_t c=0; c<n_list; c++) {
+        free(list[c].ids);
+        free(list[c].data);
+    }
+    free(list);
+}
+// --- Кластеры ---
+struct _index_assign {
+    const float * c;    //!< центроиды
+    const float * x;    //!< нормированные векторы
+    uint32_t n_list, dim_pad;
+    int32_t * assign;   //!< номер ближайшего центроида
+};
+static void _index_assign_range(void * arg, int64_t i0, int64_t i1, int ith){
+    struct _index_assign * a = arg;
+    for (int64_t i=i0; i<i1; i++) {
+        const float * x = a->x + i*a->dim_pad;
+        float s_max = -INFINITY;
+        int32_t c_max = 0;
+        for (uint32_t c=0; c<a->n_list; c++) {
+            float s = qnn_embed_dot(x, a->c + (size_t)c*a->dim_pad, a->dim_pad);
+            if (s > s_max) { s_max = s; c_max = c; }
+        }
+        a->assign[i] = c_max;
+    }
+}
+static void _index_assign(const qnn_embed_index_t* ix, const float* x, size_t n, int32_t* assign){
+    struct _index_assign a = {ix->centroids, x, ix->h.n_list, ix->h.dim_pad, assign};
+    qnn_pool_parallel_for(qnn_pool_default(), n, 16, _index_assign_range, &a);
+}
+/*! \brief сферический k-means по выборке xs из n_s векторов, начальные центроиды - векторы выборки с шагом
+    \return новые центроиды, n_list = min(n_list_max, n_s), или NULL
+ */
+static float* _index_train(const struct _index_header* h, const float* xs, size_t n_s, uint32_t* n_list_out){
+    const uint32_t dp = h->dim_pad;
+    const uint32_t n_list = h->n_list_max < n_s? h->n_list_max: n_s;
+    float   * centroids = malloc((size_t)n_list*dp*sizeof(float));
+    float   * c_sum  = malloc((size_t)n_list*dp*sizeof(float));
+    int32_t * assign = malloc(n_s*sizeof(int32_t));
+    uint32_t* count  = malloc(n_list*sizeof(uint32_t));
+    if (centroids==NULL || c_sum==NULL || assign==NULL || count==NULL) {
+        free(centroids); free(c_sum); free(assign); free(count);
+        return NULL;
+    }
+    for (uint32_t c=0; c<n_list; c++)
+        __builtin_memcpy(centroids + (size_t)c*dp, xs + (c*n_s/n_list)*dp, dp*sizeof(float));
+    struct _index_assign a = {centroids, xs, n_list, dp, assign};
+    for (int it=0; it<INDEX_ITER; it++) {
+        qnn_pool_parallel_for(qnn_pool_default(), n_s, 16, _index_assign_range, &a);
+        __builtin_bzero(c_sum, (size_t)n_list*dp*sizeof(float));
+        __builtin_bzero(count, n_list*sizeof(uint32_t));
+        for (size_t i=0; i<n_s; i++) {
+            float * s = c_sum + (size_t)assign[i]*dp;
+            const float * v = xs + i*dp;
+            for (uint32_t j=0; j<dp; j++) s[j] += v[j];
+            count[assign[i]]++;
+        }
+        for (uint32_t c=0; c<n_list; c++) {// пустой кластер сохраняет прежний центроид
+            if (count[c]) qnn_embed_l2normalize(centroids + (size_t)c*dp, c_sum + (size_t)c*dp, dp);
+        }
+    }
+    free(count);
+    free(assign);
+    free(c_sum);
+    *n_list_out = n_list;
+    return centroids;
+}
+/*! \brief обучение центроидов на выборке строк индекса с шагом и перенос строк в новые списки
+    \return 0 или -1, если не хватает памяти, тогда индекс не меняется
+ */
+static int _index_retrain(qnn_embed_index_t* ix){
+    const uint32_t dp = ix->h.dim_pad;
+    const uint64_t n_vec = ix->h.n_vec;
+    const size_t row_size = ix->h.row_size;
+    const size_t n_s = n_vec < INDEX_TRAIN? n_vec: INDEX_TRAIN;
+    float * xs = malloc(n_s*dp*sizeof(float));
+    if (xs==NULL) return -1;
+    uint32_t cs = 0;
+    uint64_t r0 = 0;// первая строка списка cs в порядке списков
+    for (size_t i=0; i<n_s; i++) {
+        const uint64_t r = i*n_vec/n_s;
+        while (r >= r0 + ix->list[cs].n) r0 += ix->list[cs++].n;
+        _index_decode(&ix->h, ix->list[cs].data + (r-r0)*row_size, xs + i*dp);
+    }
+    uint32_t n_list = 0;
+    float * centroids = _index_train(&ix->h, xs, n_s, &n_list);
+    free(xs);
+    struct _index_list * list = calloc(n_list, sizeof(struct _index_list));
+    float   * xn     = malloc((size_t)INDEX_CHUNK*dp*sizeof(float));
+    int32_t * assign = malloc(INDEX_CHUNK*sizeof(int32_t));
+    bool ok = centroids!=NULL && list!=NULL && xn!=NULL && assign!=NULL;
+    struct _index_assign a = {centroids, xn, n_list, dp, assign};
+    for (uint32_t c=0; ok && c<ix->h.n_list; c++) {
+        const struct _index_list * l = &ix->list[c];
+        for (uint64_t i0=0; ok && i0<l->n; i0+=INDEX_CHUNK) {
+            const size_t m = l->n-i0 < INDEX_CHUNK? l->n-i0: INDEX_CHUNK;
+            for (size_t i=0; i<m; i++)
+                _index_decode(&ix->h, l->data + (i0+i)*row_size, xn + i*dp);
+            qnn_pool_parallel_for(qnn_pool_default(), m, 16, _index_assign_range, &a);
+            for (size_t i=0; ok && i<m; i++)
+                ok = _index_list_append(&list[assign[i]], l->ids[i0+i], l->data + (i0+i)*row_size, row_size);
+        }
+    }
+    free(assign);
+    free(xn);
+    if (!ok) {
+        _index_lists_free(list, n_list);
+        free(centroids);
+        return -1;
+    }
+    _index_lists_free(ix->list, ix->h.n_list);
+    free(ix->centroids);
+    ix->list = list;
+    ix->centroids = centroids;
+    ix->h.n_list = n_list;
+    ix->h.n_trained = n_vec;
+    return 0;
+}
+// --- Создание и добавление ---
+/*! \brief новый пустой индекс
+    \param type - хранение векторов QNN_INDEX_F32, QNN_INDEX_Q8_0, QNN_INDEX_F8
+    \param dim  - размерность, для кадра n_mmproj_embd
+    \param n_list - число кластеров, порядка sqrt(n) для n векторов; центроиды обучаются,
+        когда векторов не меньше n_list
+ */
+qnn_embed_index_t* qnn_embed_index_new(int type, unsigned dim, unsigned n_list){
+    if (type<QNN_INDEX_F32 || type>QNN_INDEX_F8 || dim==0) {
+        fprintf(stderr, "%s: invalid type %d or dim %u\n", __func__, type, dim);
+        return NULL;
+    }
+    _index_lut_init();
+    qnn_embed_index_t* ix = calloc(1, sizeof(qnn_embed_index_t));
+    __builtin_memcpy(ix->h.magic, INDEX_MAGIC, 8);
+    ix->h.type    = type;
+    ix->h.dim     = dim;
+    ix->h.dim_pad = (dim + QK8_0-1)/QK8_0*QK8_0;
+    ix->h.n_list  = 1;
+    ix->h.n_list_max = n_list? n_list: 1;
+    ix->h.row_size= _index_row_size(type, ix->h.dim_pad);
+    ix->centroids = calloc(ix->h.dim_pad, sizeof(float));// нулевой центроид
+    ix->list      = calloc(1, sizeof(struct _index_list));
+    return ix;
+}
+size_t qnn_embed_index_len(const qnn_embed_index_t* ix){
+    return ix->h.n_vec;
+}
+/*! \brief освобождение списков и центроидов индекса или отображения файла */
+static void _index_release(qnn_embed_index_t* ix){
+    if (ix->mapping) {
+#if !defined(_WIN32)
+        munmap(ix->mapping, ix->mapping_size);
+#else
+        free(ix->mapping);
+#endif
+        ix->mapping = NULL;
+        free(ix->list);
+    } else {
+        _index_lists_free(ix->list, ix->h.n_list);
+        free(ix->centroids);
+    }
+    ix->list = NULL;
+    ix->centroids = NULL;
+}
+void qnn_embed_index_free(qnn_embed_index_t* ix){
+    if (ix==NULL) return;
+    _index_release(ix);
+    free(ix);
+}
+/*! \brief копирование центроидов и списков из отображения файла в память перед добавлением
+    \return 0 или -1, если не хватает памяти
+ */
+static int _index_own(qnn_embed_index_t* ix){
+    if (ix->mapping==NULL) return 0;
+    const uint32_t n_list = ix->h.n_list;
+    const size_t row_size = ix->h.row_size;
+    const size_t c_size = (size_t)n_list*ix->h.dim_pad*sizeof(float);
+    float * centroids = malloc(c_size);
+    struct _index_list * list = calloc(n_list, sizeof(struct _index_list));
+    bool ok = centroids!=NULL && list!=NULL;
+    for (uint32_t c=0; ok && c<n_list; c++) {
+        const struct _index_list * l = &ix->list[c];
+        if (l->n==0) continue;
+        list[c].ids  = malloc(l->n*sizeof(uint64_t));
+        list[c].data = malloc(l->n*row_size);
+        ok = list[c].ids!=NULL && list[c].data!=NULL;
+        if (!ok) break;
+        __builtin_memcpy(list[c].ids,  l->ids,  l->n*sizeof(uint64_t));
+        __builtin_memcpy(list[c].data, l->data, l->n*row_size);
+        list[c].n = list[c].n_alloc = l->n;
+    }
+    if (!ok) {
+        _index_lists_free(list, n_list);
+        free(centroids);
+        return -1;
+    }
+    __builtin_memcpy(centroids, ix->centroids, c_size);
+    _index_release(ix);
+    ix->centroids = centroids;
+    ix->list = list;
+    return 0;
+}
+/*! \brief пакетное добавление векторов
+    \param x - n векторов по dim чисел F32, не обязательно нормированы
+    \param ids - идентификаторы векторов, например unix_usec кадра, или NULL - порядковые номера
+    \return 0 или -1, если не хватает памяти
+
+    Векторы кодируются порциями по INDEX_CHUNK и дописываются в списки ближайших центроидов,
+    затраты O(n) на вызов, векторы можно добавлять по одному. Когда число векторов достигает n_list
+    и далее растет в INDEX_RETRAIN раз, центроиды переобучаются, \see _index_retrain()
+ */
+int qnn_embed_index_add(qnn_embed_index_t* ix, const float* x, const uint64_t* ids, size_t n){
+    if (n==0) return 0;
+    const uint32_t dim = ix->h.dim, dp = ix->h.dim_pad;
+    const size_t row_size = ix->h.row_size;
+    int32_t * assign = malloc(INDEX_CHUNK*sizeof(int32_t));
+    float   * xn     = malloc((size_t)INDEX_CHUNK*dp*sizeof(float));
+    uint8_t * row    = malloc(row_size);
+    bool ok = assign!=NULL && xn!=NULL && row!=NULL && _index_own(ix)==0;
+    for (size_t i0=0; ok && i0<n; i0+=INDEX_CHUNK) {
+        const size_t m = n-i0 < INDEX_CHUNK? n-i0: INDEX_CHUNK;
+        for (size_t i=0; i<m; i++)
+            _index_normalize(xn + i*dp, x + (i0+i)*dim, dim, dp);
+        if (ix->h.n_list > 1)
+            _index_assign(ix, xn, m, assign);
+        else
+            __builtin_bzero(assign, m*sizeof(int32_t));
+        for (size_t i=0; ok && i<m; i++) {
+            _index_encode(&ix->h, xn + i*dp, row);
+            ok = _index_list_append(&ix->list[assign[i]], ids? ids[i0+i]: ix->h.n_vec, row, row_size);
+            if (ok) ix->h.n_vec++;
+        }
+    }
+    free(row);
+    free(xn);
+    free(assign);
+    const uint64_t n_vec = ix->h.n_vec, n_trained = ix->h.n_trained;
+    if (ok && ix->h.n_list_max > 1 && n_vec >= ix->h.n_list_max
+    && (n_trained==0 || (n_trained < INDEX_TRAIN && n_vec >= INDEX_RETRAIN*n_trained)))
+        ok = _index_retrain(ix)==0;
+    if (!ok) {
+        fprintf(stderr, "%s: cannot allocate %"PRIu64" vectors\n", __func__, n_vec);
+        return -1;
+    }
+    return 0;
+}
+// --- Поиск ---
+struct _index_hit {
+    float    score;
+    uint64_t id;
+};
+struct _index_search {
+    const qnn_embed_index_t * ix;
+    const float * q;        //!< нормированный запрос
+    const struct _index_list ** probe;  //!< просматриваемые списки
+    const uint64_t * pre;   //!< n_probe+1 префиксных сумм длин списков
+    int n_probe, k;
+    struct _index_hit * heap;   //!< k лучших на поток, минимум в корне
+    int * n_heap;
+};
+static void _heap_push(struct _index_hit * h, int * n, int k, float score, uint64_t id){
+    int i;
+    if (*n < k) {
+        i = (*n)++;
+        while (i>0 && h[(i-1)/2].score > score) {
+            h[i] = h[(i-1)/2];
+            i = (i-1)/2;
+        }
+    } else {
+        if (score <= h[0].score) return;
+        i = 0;// замена минимума и просеивание вниз
+        for (;;) {
+            int j = 2*i+1;
+            if (j >= k) break;
+            if (j+1 < k && h[j+1].score < h[j].score) j++;
+            if (h[j].score >= score) break;
+            h[i] = h[j];
+            i = j;
+        }
+    }
+    h[i].score = score;
+    h[i].id    = id;
+}
+static void _index_search_range(void * arg, int64_t i0, int64_t i1, int ith){
+    struct _index_search * s = arg;
+    const qnn_embed_index_t * ix = s->ix;
+    struct _index_hit * heap = s->heap + (size_t)ith*s->k;
+    int p = 0;
+    while (s->pre[p+1] <= (uint64_t)i0) p++;
+    for (int64_t i=i0; i<i1; i++) {
+        while (s->pre[p+1] <= (uint64_t)i) p++;
+        const struct _index_list * l = s->probe[p];
+        const uint64_t j = i - s->pre[p];
+        float score = _index_score(&ix->h, s->q, l->data + j*ix->h.row_size);
+        _heap_push(heap, &s->n_heap[ith], s->k, score, l->ids[j]);
+    }
+}
+static int _hit_cmp(const void * a, const void * b){
+    float x = ((const struct _index_hit*)a)->score, y = ((const struct _index_hit*)b)->score;
+    return (x<y) - (x>y);// по убыванию
+}
+/*! \brief поиск k векторов, наиболее схожих с запросом
+    \param q - вектор dim чисел F32
+    \param n_probe - число просматриваемых кластеров, больше - точнее и медленнее
+    \param ids, score - k идентификаторов и схожестей в порядке убывания схожести, score может быть NULL
+    \return число найденных векторов, не больше k
+ */
+int qnn_embed_index_search(const qnn_embed_index_t* ix, const float* q, int k, int n_probe, uint64_t* ids, float* score){
+    const uint32_t dp = ix->h.dim_pad, n_list = ix->h.n_list;
+    if (ix->h.n_vec==0 || k<=0) return 0;
+    if (n_probe<=0) n_probe = 1;
+    if ((uint32_t)n_probe > n_list) n_probe = n_list;
+    float * qn = malloc(dp*sizeof(float));
+    _index_normalize(qn, q, ix->h.dim, dp);
+    // ближайшие центроиды
+    struct _index_hit * near = malloc(n_probe*sizeof(struct _index_hit));
+    int n_near = 0;
+    for (uint32_t c=0; c<n_list; c++)
+        _heap_push(near, &n_near, n_probe, qnn_embed_dot(qn, ix->centroids + (size_t)c*dp, dp), c);
+    const struct _index_list ** probe = malloc(n_probe*sizeof(struct _index_list*));
+    uint64_t * pre = malloc((n_probe+1)*sizeof(uint64_t));
+    pre[0] = 0;
+    for (int p=0; p<n_probe; p++) {
+        probe[p] = &ix->list[near[p].id];
+        pre[p+1] = pre[p] + probe[p]->n;
+    }
+    free(near);
+    struct qnn_pool * pool = qnn_pool_default();
+    const int nth = qnn_pool_size(pool);
+    struct _index_search s = {ix, qn, probe, pre, n_probe, k,
+        malloc((size_t)nth*k*sizeof(struct _index_hit)), calloc(nth, sizeof(int))};
+    qnn_pool_parallel_for(pool, pre[n_probe], INDEX_GRAIN, _index_search_range, &s);
+    // объединение куч потоков
+    int n_hit = 0;
+    for (int t=0; t<nth; t++) {
+        memmove(s.heap + n_hit, s.heap + (size_t)t*k, s.n_heap[t]*sizeof(struct _index_hit));
+        n_hit += s.n_heap[t];
+    }
+    qsort(s.heap, n_hit, sizeof(struct _index_hit), _hit_cmp);
+    if (n_hit > k) n_hit = k;
+    for (int i=0; i<n_hit; i++) {
+        ids[i] = s.heap[i].id;
+        if (score) score[i] = s.heap[i].score;
+    }
+    free(s.heap);
+    free(s.n_heap);
+    free(pre);
+    free(probe);
+    free(qn);
+    return n_hit;
+}
+// --- Файл ---
+static bool _write_at(FILE* fp, uint64_t offs, const void* data, size_t size){
+    static const uint8_t zero[INDEX_ALIGN] = {0};
+    off_t pos = ftello(fp);
+    if (pos < 0 || (uint64_t)pos > offs) return false;
+    if (fwrite(zero, 1, offs - pos, fp)!=offs - pos) return false;
+    return fwrite(data, 1, size, fp)==size;
+}
+/*! \brief запись индекса в файл, \see qnn_embed_index_load()
+    \return 0 или -1 при ошибке записи
+ */
+int qnn_embed_index_save(const qnn_embed_index_t* ix, const char* fname){
+    struct _index_header h = ix->h;
+    const uint64_t n_list = h.n_list;
+    h.offs_centroids = _align(sizeof(struct _index_header));
+    h.offs_lists = _align(h.offs_centroids + n_list*h.dim_pad*sizeof(float));
+    h.offs_ids   = _align(h.offs_lists + (n_list+1)*sizeof(uint64_t));
+    h.offs_data  = _align(h.offs_ids   + h.n_vec*sizeof(uint64_t));
+    uint64_t * lists = malloc((n_list+1)*sizeof(uint64_t));
+    if (lists==NULL) return -1;
+    lists[0] = 0;
+    for (uint32_t c=0; c<n_list; c++) lists[c+1] = lists[c] + ix->list[c].n;
+    FILE* fp = fopen(fname, "wb");
+    if (fp==NULL) {
+        fprintf(stderr, "%s: '%s': %s\n", __func__, fname, strerror(errno));
+        free(lists);
+        return -1;
+    }
+    // списки записываются подряд: идентификаторы, затем векторы
+    bool ok = fwrite(&h, sizeof(h), 1, fp)==1
+        && _write_at(fp, h.offs_centroids, ix->centroids, n_list*h.dim_pad*sizeof(float))
+        && _write_at(fp, h.offs_lists, lists, (n_list+1)*sizeof(uint64_t))
+        && _write_at(fp, h.offs_ids, NULL, 0);
+    for (uint32_t c=0; ok && c<n_list; c++)
+        ok = fwrite(ix->list[c].ids, sizeof(uint64_t), ix->list[c].n, fp)==ix->list[c].n;
+    ok = ok && _write_at(fp, h.offs_data, NULL, 0);
+    for (uint32_t c=0; ok && c<n_list; c++)
+        ok = fwrite(ix->list[c].data, h.row_size, ix->list[c].n, fp)==ix->list[c].n;
+    free(lists);
+    if (fclose(fp)!=0) ok = false;
+    if (!ok) fprintf(stderr, "%s: '%s': write failed\n", __func__, fname);
+    return ok? 0: -1;
+}
+//!< раздел из n элементов по size байт, выровненный на INDEX_ALIGN, помещается в файл после заголовка
+static bool _index_section(uint64_t offs, uint64_t n, uint64_t size, uint64_t file_size){
+    return offs >= sizeof(struct _index_header) && offs%INDEX_ALIGN==0 && offs <= file_size
+        && n <= (file_size - offs)/size;
+}
+//!< проверка заголовка по размеру файла до отображения, все разделы в пределах файла
+static bool _index_check(const struct _index_header* h, uint64_t file_size){
+    if (memcmp(h->magic, INDEX_MAGIC, 8)!=0 || h->type>QNN_INDEX_F8 || h->dim==0
+    ||  h->dim_pad%QK8_0!=0 || h->dim_pad<h->dim || h->dim_pad-h->dim>=QK8_0
+    ||  h->row_size!=_index_row_size(h->type, h->dim_pad))
+        return false;
+    return h->n_list>0 && h->n_list<=h->n_list_max && h->n_trained<=h->n_vec
+        && _index_section(h->offs_centroids, (uint64_t)h->n_list*h->dim_pad, sizeof(float), file_size)
+        && _index_section(h->offs_lists, (uint64_t)h->n_list+1, sizeof(uint64_t), file_size)
+        && _index_section(h->offs_ids,   h->n_vec, sizeof(uint64_t), file_size)
+        && _index_section(h->offs_data,  h->n_vec, h->row_size, file_size);
+}
+//!< границы списков: от 0 до n_vec без убывания
+static bool _index_check_lists(const uint64_t* lists, uint32_t n_list, uint64_t n_vec){
+    if (lists[0]!=0 || lists[n_list]!=n_vec) return false;
+    for (uint32_t c=0; c<n_list; c++)
+        if (lists[c]>lists[c+1]) return false;
+    return true;
+}
+/*! \brief загрузка индекса отображением файла в память, только для чтения
+    \return индекс или NULL при ошибке, освобождается qnn_embed_index_free()
+ */
+qnn_embed_index_t* qnn_embed_index_load(const char* fname){
+    FILE* fp = fopen(fname, "rb");
+    if (fp==NULL) {
+        fprintf(stderr, "%s: '%s': %s\n", __func__, fname, strerror(errno));
+        return NULL;
+    }
+    struct _index_header h;
+    fseeko(fp, 0, SEEK_END);
+    const uint64_t file_size = ftello(fp);
+    fseeko(fp, 0, SEEK_SET);
+    if (fread(&h, sizeof(h), 1, fp)!=1 || !_index_check(&h, file_size)) {
+        fprintf(stderr, "%s: '%s': invalid index file\n", __func__, fname);
+        fclose(fp);
+        return NULL;
+    }
+    _index_lut_init();
+#if !defined(_WIN32)
+    void * mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if (mapping==MAP_FAILED) {
+        fprintf(stderr, "%s: mmap failed: '%s'\n", __func__, strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+#else
+    void * mapping = malloc(file_size);
+    fseeko(fp, 0, SEEK_SET);
+    if (mapping==NULL || fread(mapping, 1, file_size, fp)!=file_size) {
+        fprintf(stderr, "%s: '%s': failed to load %"PRIu64" bytes\n", __func__, fname, file_size);
+        free(mapping);
+        fclose(fp);
+        return NULL;
+    }
+#endif
+    fclose(fp);// отображение сохраняется после закрытия файла
+    qnn_embed_index_t* ix = calloc(1, sizeof(qnn_embed_index_t));
+    ix->h = h;
+    ix->mapping      = mapping;
+    ix->mapping_size = file_size;
+    ix->centroids = (float *)((uint8_t*)mapping + h.offs_centroids);
+    ix->list      = calloc(h.n_list, sizeof(struct _index_list));
+    const uint64_t * lists = (const uint64_t*)((uint8_t*)mapping + h.offs_lists);
+    if (!_index_check_lists(lists, h.n_list, h.n_vec)) {
+        fprintf(stderr, "%s: '%s': invalid index lists\n", __func__, fname);
+        qnn_embed_index_free(ix);
+        return NULL;
+    }
+    uint64_t * ids  = (uint64_t*)((uint8_t*)mapping + h.offs_ids);
+    uint8_t  * data = (uint8_t *)mapping + h.offs_data;
+    for (uint32_t c=0; c<h.n_list; c++) {// списки ссылаются на отображение файла
+        ix->list[c].n    = lists[c+1] - lists[c];
+        ix->list[c].ids  = ids  + lists[c];
+        ix->list[c].data = data + lists[c]*h.row_size;
+    }
+    return ix;
+}
+
+#ifdef TEST_EMBED_INDEX
+#include <time.h>
+static double _now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+static uint64_t _rnd_state = 0x9E3779B97F4A7C15uLL;
+static float _rnd(){// равномерное [-1, 1)
+    _rnd_state = _rnd_state*6364136223846793005uLL + 1442695040888963407uLL;
+    return (int32_t)(_rnd_state>>32)*(1.0f/2147483648.0f);
+}
+/*! Синтетические кадры: n_scene сцен, кадры сцены - центр сцены плюс шум. Запрос - зашумленный кадр,
+    recall@k - доля точных k ближайших (полный перебор F32), найденных индексом.
+ */
+int main(int argc, char** argv){
+    const size_t   n   = argc>1? strtoul(argv[1], NULL, 0): 100000;
+    const unsigned dim = argc>2? strtoul(argv[2], NULL, 0): 256;
+    const unsigned n_scene = 1000, n_query = 100, k = 10;
+    const unsigned n_list = 4*(unsigned)sqrt((double)n);
+    float * x = malloc(n*dim*sizeof(float));
+    float * sc= malloc((size_t)n_scene*dim*sizeof(float));
+    for (size_t i=0; i<(size_t)n_scene*dim; i++) sc[i] = _rnd();
+    for (size_t i=0; i<n; i++)
+        for (unsigned j=0; j<dim; j++)
+            x[i*dim+j] = sc[(i/(n/n_scene+1))*dim + j] + 0.5f*_rnd();
+    float * q = malloc((size_t)n_query*dim*sizeof(float));
+    for (unsigned i=0; i<n_query; i++) {
+        const size_t r = (i*7919uLL)%n;
+        for (unsigned j=0; j<dim; j++) q[i*dim+j] = x[r*dim+j] + 0.3f*_rnd();
+    }
+    // точные ответы перебором
+    uint64_t * ref = malloc((size_t)n_query*k*sizeof(uint64_t));
+    float * xn = malloc(dim*sizeof(float)), * qn = malloc(dim*sizeof(float));
+    double t0 = _now();
+    for (unsigned i=0; i<n_query; i++) {
+        struct _index_hit heap[16];
+        int n_heap = 0;
+        qnn_embed_l2normalize(qn, q + i*dim, dim);
+        for (size_t r=0; r<n; r++) {
+            qnn_embed_l2normalize(xn, x + r*dim, dim);
+            _heap_push(heap, &n_heap, k, qnn_embed_dot(qn, xn, dim), r);
+        }
+        for (unsigned j=0; j<k; j++) ref[i*k+j] = heap[j].id;
+    }
+    printf("brute force: n=%zu dim=%u %8.3f ms/query\n", n, dim, (_now()-t0)*1e3/n_query);
+    int fail = 0;
+    static const char* type_name[] = {"F32", "Q8_0", "F8"};
+    for (int type=QNN_INDEX_F32; type<=QNN_INDEX_F8; type++) {
+        qnn_embed_index_t * ix = qnn_embed_index_new(type, dim, n_list);
+        t0 = _now();
+        qnn_embed_index_add(ix, x, NULL, n/2);// две порции, вторая дописывается в списки
+        qnn_embed_index_add(ix, x + n/2*dim, NULL, n - n/2);
+        double t_add = _now()-t0;
+        if (qnn_embed_index_len(ix)!=n) fail++;
+        qnn_embed_index_save(ix, "test.ivf");
+        qnn_embed_index_t * iy = qnn_embed_index_load("test.ivf");
+        if (iy==NULL) { fail++; qnn_embed_index_free(ix); continue; }
+        for (int n_probe=4; n_probe<=32; n_probe*=2) {
+            uint64_t ids[16], ids2[16];
+            float score[16], score2[16];
+            unsigned found = 0;
+            t0 = _now();
+            for (unsigned i=0; i<n_query; i++) {
+                int m = qnn_embed_index_search(iy, q + i*dim, k, n_probe, ids, score);
+                for (int a=0; a<m; a++)
+                    for (unsigned b=0; b<k; b++) found += ids[a]==ref[i*k+b];
+            }
+            double t_q = (_now()-t0)*1e3/n_query;
+            // отображение файла и индекс в памяти дают один результат
+            int m1 = qnn_embed_index_search(ix, q, k, n_probe, ids, score);
+            int m2 = qnn_embed_index_search(iy, q, k, n_probe, ids2, score2);
+            if (m1!=m2 || memcmp(ids, ids2, m1*sizeof(uint64_t))!=0) fail++;
+            const float recall = (float)found/(n_query*k);
+            printf("%-4s n_list=%u n_probe=%2d recall@%u %1.3f %8.3f ms/query, add %6.2f s, %5.1f MB\n",
+                type_name[type], ix->h.n_list, n_probe, k, recall, t_q, t_add, n*ix->h.row_size/1e6);
+            if (n_probe==32 && recall < 0.8f) fail++;
+        }
+        qnn_embed_index_free(iy);
+        qnn_embed_index_free(ix);
+    }
+    // добавление по одному вектору: центроиды обучаются и переобучаются по мере роста индекса
+    {
+        const unsigned n_list1 = 64;
+        const size_t n1 = n < 4096? n: 4096;
+        qnn_embed_index_t * ix = qnn_embed_index_new(QNN_INDEX_Q8_0, dim, n_list1);
+        t0 = _now();
+        for (size_t i=0; i<n1; i++) {
+            const uint64_t id = i;
+            if (qnn_embed_index_add(ix, x + i*dim, &id, 1)!=0) fail++;
+        }
+        const double t_add = _now()-t0;
+        unsigned found = 0;
+        for (unsigned i=0; i<n_query; i++) {
+            const size_t r = (i*7919uLL)%n1;
+            uint64_t id;
+            found += qnn_embed_index_search(ix, x + r*dim, 1, 8, &id, NULL)==1 && id==r;
+        }
+        printf("Q8_0 add by one: n=%zu n_list=%u n_trained=%"PRIu64" %6.2f us/add, self-recall@1 %1.3f\n",
+            n1, ix->h.n_list, ix->h.n_trained, t_add*1e6/n1, (float)found/n_query);
+        if (qnn_embed_index_len(ix)!=n1 || (n1>=n_list1 && ix->h.n_list!=n_list1) || found < n_query*9/10) fail++;
+        qnn_embed_index_free(ix);
+    }
+    // поврежденный файл не загружается: разделы за пределами файла, списки не монотонны
+    FILE* fp = fopen("test.ivf", "rb");
+    fseek(fp, 0, SEEK_END);
+    const size_t size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t * file = malloc(size), * bad = malloc(size);
+    if (fread(file, 1, size, fp)!=size) fail++;
+    fclose(fp);
+    const struct _index_header * h = (const struct _index_header *)file;
+    const size_t n_bad = 5;
+    for (size_t k=0; k<n_bad; k++) {
+        memcpy(bad, file, size);
+        struct _index_header * hb = (struct _index_header *)bad;
+        uint64_t * lists = (uint64_t *)(bad + h->offs_lists);
+        switch (k) {
+        case 0: hb->n_list = size; break;
+        case 1: hb->offs_ids = size - 8; break;
+        case 2: hb->offs_data = UINT64_MAX - 63; break;
+        case 3: lists[1] = h->n_vec + 1; break;
+        case 4: lists[h->n_list] = h->n_vec - 1; break;
+        }
+        fp = fopen("test_bad.ivf", "wb");
+        fwrite(bad, 1, size, fp);
+        fclose(fp);
+        qnn_embed_index_t * iz = qnn_embed_index_load("test_bad.ivf");
+        if (iz!=NULL) { fail++; qnn_embed_index_free(iz); }
+    }
+    printf("corrupted files rejected: %s\n", fail? "FAIL": "ok");
+    free(bad); free(file);
+    remove("test_bad.ivf");
+    remove("test.ivf");
+    free(ref); free(xn); free(qn); free(q); free(sc); free(x);
+    printf("%s\n", fail? "FAIL": "OK");
+    return fail;
+}
+#endif
@@ -0,0 +1,758 @@
+/*! \file qnn_embed_ops.c
+    \brief Операции над векторами Visual Embedding, \see qnn_embed.h
+
+Сборка и тестирование
+    $ gcc -DTEST_EMBED_OPS -O3 -march=native -o test qnn_embed_ops.c -lm
+
+Эмбеддинг кадра - матрица n_output_tokens*n_mmproj_embd чисел F32 (256x2560 для Gemma3, 256x3584 для Qwen2.5-VL),
+около 3 МБ, поэтому операции ограничены пропускной способностью памяти и задержкой цепочки зависимостей
+в редукциях. Версии для AVX2 и AVX-512 выбираются во время исполнения по набору инструкций процессора.
+
+* Редукции (dot, distance, sad, нормы) используют четыре независимых аккумулятора, чтобы скрыть задержку FMA,
+  остаток вектора загружается по маске.
+* Слитные варианты считают несколько сумм за один проход: косинусная схожесть - dot(u,v), |u|^2 и |v|^2,
+  structural_sim - пять моментов, layer_norm - сумму и сумму квадратов.
+* softmax вычисляется в два прохода: нормирующий множитель считается онлайн вместе с максимумом
+  [Milakov, Gimelshein 2018, Online normalizer calculation for softmax], результат записывается один раз.
+* mean и sum по токенам складывают по четыре строки за проход, строка результата остается в L1.
+
+Суммы по 4 аккумуляторам складываются в другом порядке, чем в скалярной версии, результаты разных версий
+совпадают с точностью до округления. Чтобы ошибка округления не росла с длиной вектора, редукция выполняется
+блоками по EMBED_BLOCK элементов: внутри блока - во float, суммы блоков - в double.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "qnn_embed.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx2,fma")))
+#endif
+
+#define EMBED_EPS 1e-6f // добавка к дисперсии в rms_norm и layer_norm, как в ggml_norm
+#define EMBED_BLOCK 4096 // редукция по блокам: сумма блока во float, сумма блоков в double
+
+//!< набор ядер для одного набора инструкций, номера версий совпадают с QNN_ISA_* в qnn.h
+struct _embed_kernels {
+    float (*dot)  (const float* u, const float* v, unsigned n);
+    void  (*dot3) (const float* u, const float* v, unsigned n, double s[3]);   //!< u*v, u*u, v*v
+    void  (*mom5) (const float* u, const float* v, unsigned n, double s[5]);   //!< u, v, u*u, v*v, u*v
+    float (*dist2)(const float* u, const float* v, unsigned n);
+    float (*sad)  (const float* u, const float* v, unsigned n);
+    void  (*mom2) (const float* v, const float* w, unsigned n, double s[2]);   //!< v, v*v; w не используется
+    void  (*smax) (const float* v, unsigned n, float it, float* m, double* s); //!< онлайн максимум и сумма exp
+    void  (*sexp) (float* r, const float* v, unsigned n, float it, float m, float is);
+    void  (*axpb) (float* r, const float* v, unsigned n, float a, float b);    //!< r = a*v + b
+    void  (*lerp) (float* r, const float* v, unsigned n, float mu);            //!< r = mu*r + (1-mu)*v
+    void  (*add4) (float* r, const float* v, unsigned k, unsigned nr);         //!< r += v[0..nr-1], nr<=4 строк
+    void  (*sub)  (float* r, const float* a, const float* b, unsigned k);      //!< r = a - b
+};
+
+// --- Скалярная версия ---
+static float _dot_ref(const float* u, const float* v, unsigned n){
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    unsigned i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += u[i]*v[i]; s1 += u[i+1]*v[i+1]; s2 += u[i+2]*v[i+2]; s3 += u[i+3]*v[i+3];
+    }
+    for (; i < n; i++) s0 += u[i]*v[i];
+    return (s0 + s1) + (s2 + s3);
+}
+static void _dot3_ref(const float* u, const float* v, unsigned n, double s[3]){
+    float uv = 0, uu = 0, vv = 0;
+    for (unsigned i = 0; i < n; i++) {
+        uv += u[i]*v[i]; uu += u[i]*u[i]; vv += v[i]*v[i];
+    }
+    s[0] = uv; s[1] = uu; s[2] = vv;
+}
+static void _mom5_ref(const float* u, const float* v, unsigned n, double s[5]){
+    float su = 0, sv = 0, uu = 0, vv = 0, uv = 0;
+    for (unsigned i = 0; i < n; i++) {
+        su += u[i]; sv += v[i]; uu += u[i]*u[i]; vv += v[i]*v[i]; uv += u[i]*v[i];
+    }
+    s[0] = su; s[1] = sv; s[2] = uu; s[3] = vv; s[4] = uv;
+}
+static float _dist2_ref(const float* u, const float* v, unsigned n){
+    float s = 0;
+    for (unsigned i = 0; i < n; i++) s += (u[i] - v[i])*(u[i] - v[i]);
+    return s;
+}
+static float _sad_ref(const float* u, const float* v, unsigned n){
+    float s = 0;
+    for (unsigned i = 0; i < n; i++) s += fabsf(u[i] - v[i]);
+    return s;
+}
+static void _mom2_ref(const float* v, const float* w, unsigned n, double s[2]){
+    (void)w;
+    float s1 = 0, s2 = 0;
+    for (unsigned i = 0; i < n; i++) { s1 += v[i]; s2 += v[i]*v[i]; }
+    s[0] = s1; s[1] = s2;
+}
+static void _smax_ref(const float* v, unsigned n, float it, float* m, double* s){
+    float mx = -FLT_MAX, sum = 0;
+    for (unsigned i = 0; i < n; i++) {
+        float x = v[i]*it;
+        if (x > mx) { sum *= expf(mx - x); mx = x; }
+        sum += expf(x - mx);
+    }
+    *m = mx; *s = sum;
+}
+static void _sexp_ref(float* r, const float* v, unsigned n, float it, float m, float is){
+    for (unsigned i = 0; i < n; i++) r[i] = expf(v[i]*it - m)*is;
+}
+static void _axpb_ref(float* r, const float* v, unsigned n, float a, float b){
+    for (unsigned i = 0; i < n; i++) r[i] = a*v[i] + b;
+}
+static void _lerp_ref(float* r, const float* v, unsigned n, float mu){
+    for (unsigned i = 0; i < n; i++) r[i] = mu*r[i] + (1 - mu)*v[i];
+}
+static void _add4_ref(float* r, const float* v, unsigned k, unsigned nr){
+    for (unsigned j = 0; j < nr; j++, v += k)
+        for (unsigned i = 0; i < k; i++) r[i] += v[i];
+}
+static void _sub_ref(float* r, const float* a, const float* b, unsigned k){
+    for (unsigned i = 0; i < k; i++) r[i] = a[i] - b[i];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Экспонента для аргументов [-87, 88]: 2^n * P(r), r = x - n*ln2, полином степени 6 из Cephes expf,
+   относительная ошибка около 2 ulp */
+#define EXP_P0 1.9875691500E-4f
+#define EXP_P1 1.3981999507E-3f
+#define EXP_P2 8.3334519073E-3f
+#define EXP_P3 4.1665795894E-2f
+#define EXP_P4 1.6666665459E-1f
+#define EXP_P5 5.0000001201E-1f
+#define EXP_LN2_HI  0.693359375f
+#define EXP_LN2_LO -2.12194440e-4f
+
+// --- AVX2 ---
+static const int32_t _mask_tbl[16] = {-1,-1,-1,-1,-1,-1,-1,-1, 0,0,0,0,0,0,0,0};
+static inline TARGET_AVX2 __m256i _mask8(unsigned r){// r = 1..8 первых элементов
+    return _mm256_loadu_si256((const __m256i*)(_mask_tbl + 8 - r));
+}
+static inline TARGET_AVX2 float _hsum_avx2(__m256 v){
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+static inline TARGET_AVX2 __m256 _exp_avx2(__m256 x){
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_LO), r);
+    __m256 p = _mm256_set1_ps(EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+    p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+/* цикл редукции: STEP(k, i, LOAD) добавляет 8 элементов с позиции i в аккумулятор k;
+   4 аккумулятора по 32 элемента, затем по 8 элементов, остаток - загрузкой по маске */
+#define LOAD_AVX2(p)  _mm256_loadu_ps(p)
+#define LOADM_AVX2(p) _mm256_maskload_ps(p, _m)
+#define REDUCE_AVX2(n, STEP) do {                               \
+    unsigned i = 0;                                             \
+    for (; i + 32 <= n; i += 32) {                              \
+        STEP(0, i, LOAD_AVX2);    STEP(1, i+8,  LOAD_AVX2);     \
+        STEP(2, i+16, LOAD_AVX2); STEP(3, i+24, LOAD_AVX2);     \
+    }                                                           \
+    for (; i + 8 <= n; i += 8) STEP(0, i, LOAD_AVX2);           \
+    if (i < n) { const __m256i _m = _mask8(n - i); STEP(1, i, LOADM_AVX2); } \
+} while (0)
+#define ACC4_AVX2(a) __m256 a[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()}
+#define SUM4_AVX2(a) _hsum_avx2(_mm256_add_ps(_mm256_add_ps(a[0], a[1]), _mm256_add_ps(a[2], a[3])))
+
+static TARGET_AVX2 float _dot_avx2(const float* u, const float* v, unsigned n){
+    ACC4_AVX2(a);
+#define STEP(k, i, LD) a[k] = _mm256_fmadd_ps(LD(u + (i)), LD(v + (i)), a[k])
+    REDUCE_AVX2(n, STEP);
+#undef STEP
+    return SUM4_AVX2(a);
+}
+static TARGET_AVX2 void _dot3_avx2(const float* u, const float* v, unsigned n, double s[3]){
+    ACC4_AVX2(uv); ACC4_AVX2(uu); ACC4_AVX2(vv);
+#define STEP(k, i, LD) do { __m256 x = LD(u + (i)), y = LD(v + (i)); \
+    uv[k] = _mm256_fmadd_ps(x, y, uv[k]); uu[k] = _mm256_fmadd_ps(x, x, uu[k]); vv[k] = _mm256_fmadd_ps(y, y, vv[k]); } while(0)
+    REDUCE_AVX2(n, STEP);
+#undef STEP
+    s[0] = SUM4_AVX2(uv); s[1] = SUM4_AVX2(uu); s[2] = SUM4_AVX2(vv);
+}
+static TARGET_AVX2 void _mom5_avx2(const float* u, const float* v, unsigned n, double s[5]){
+    __m256 a[5][2];// пять сумм по два аккумулятора, 16 регистров ymm не хватает на 4
+    for (int j = 0; j < 5; j++) a[j][0] = a[j][1] = _mm256_setzero_ps();
+    unsigned i = 0;
+#define STEP(k, i, LD) do { __m256 x = LD(u + (i)), y = LD(v + (i)); \
+    a[0][k] = _mm256_add_ps(a[0][k], x); a[1][k] = _mm256_add_ps(a[1][k], y); \
+    a[2][k] = _mm256_fmadd_ps(x, x, a[2][k]); a[3][k] = _mm256_fmadd_ps(y, y, a[3][k]); \
+    a[4][k] = _mm256_fmadd_ps(x, y, a[4][k]); } while(0)
+    for (; i + 16 <= n; i += 16) { STEP(0, i, LOAD_AVX2); STEP(1, i+8, LOAD_AVX2); }
+    for (; i + 8 <= n; i += 8) STEP(0, i, LOAD_AVX2);
+    if (i < n) { const __m256i _m = _mask8(n - i); STEP(1, i, LOADM_AVX2); }
+#undef STEP
+    for (int j = 0; j < 5; j++) s[j] = _hsum_avx2(_mm256_add_ps(a[j][0], a[j][1]));
+}
+static TARGET_AVX2 float _dist2_avx2(const float* u, const float* v, unsigned n){
+    ACC4_AVX2(a);
+#define STEP(k, i, LD) do { __m256 d = _mm256_sub_ps(LD(u + (i)), LD(v + (i))); a[k] = _mm256_fmadd_ps(d, d, a[k]); } while(0)
+    REDUCE_AVX2(n, STEP);
+#undef STEP
+    return SUM4_AVX2(a);
+}
+static TARGET_AVX2 float _sad_avx2(const float* u, const float* v, unsigned n){
+    ACC4_AVX2(a);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+#define STEP(k, i, LD) a[k] = _mm256_add_ps(a[k], _mm256_andnot_ps(sign, _mm256_sub_ps(LD(u + (i)), LD(v + (i)))))
+    REDUCE_AVX2(n, STEP);
+#undef STEP
+    return SUM4_AVX2(a);
+}
+static TARGET_AVX2 void _mom2_avx2(const float* v, const float* w, unsigned n, double s[2]){
+    (void)w;
+    ACC4_AVX2(s1); ACC4_AVX2(s2);
+#define STEP(k, i, LD) do { __m256 x = LD(v + (i)); s1[k] = _mm256_add_ps(s1[k], x); s2[k] = _mm256_fmadd_ps(x, x, s2[k]); } while(0)
+    REDUCE_AVX2(n, STEP);
+#undef STEP
+    s[0] = SUM4_AVX2(s1); s[1] = SUM4_AVX2(s2);
+}
+/* онлайн нормирующий множитель: на блок из 4 векторов один пересчет суммы к новому максимуму */
+static TARGET_AVX2 void _smax_avx2(const float* v, unsigned n, float it, float* m, double* s){
+    const __m256 t = _mm256_set1_ps(it);
+    __m256 mx = _mm256_set1_ps(-FLT_MAX), sum = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256 x0 = _mm256_mul_ps(_mm256_loadu_ps(v + i),      t), x1 = _mm256_mul_ps(_mm256_loadu_ps(v + i + 8),  t);
+        __m256 x2 = _mm256_mul_ps(_mm256_loadu_ps(v + i + 16), t), x3 = _mm256_mul_ps(_mm256_loadu_ps(v + i + 24), t);
+        __m256 mn = _mm256_max_ps(mx, _mm256_max_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(x2, x3)));
+        __m256 e  = _mm256_add_ps(_mm256_add_ps(_exp_avx2(_mm256_sub_ps(x0, mn)), _exp_avx2(_mm256_sub_ps(x1, mn))),
+                                  _mm256_add_ps(_exp_avx2(_mm256_sub_ps(x2, mn)), _exp_avx2(_mm256_sub_ps(x3, mn))));
+        sum = _mm256_fmadd_ps(sum, _exp_avx2(_mm256_sub_ps(mx, mn)), e);
+        mx  = mn;
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 x  = _mm256_mul_ps(_mm256_loadu_ps(v + i), t);
+        __m256 mn = _mm256_max_ps(mx, x);
+        sum = _mm256_fmadd_ps(sum, _exp_avx2(_mm256_sub_ps(mx, mn)), _exp_avx2(_mm256_sub_ps(x, mn)));
+        mx  = mn;
+    }
+    float lm[8], ls[8], M = -FLT_MAX;
+    double S = 0;
+    _mm256_storeu_ps(lm, mx); _mm256_storeu_ps(ls, sum);
+    for (int l = 0; l < 8; l++) if (lm[l] > M) M = lm[l];
+    for (; i < n; i++) if (v[i]*it > M) M = v[i]*it;
+    for (int l = 0; l < 8; l++) S += ls[l]*expf(lm[l] - M);
+    for (unsigned j = n & ~7u; j < n; j++) S += expf(v[j]*it - M);
+    *m = M; *s = S;
+}
+static TARGET_AVX2 void _sexp_avx2(float* r, const float* v, unsigned n, float it, float m, float is){
+    const __m256 t = _mm256_set1_ps(it), mm = _mm256_set1_ps(m), s = _mm256_set1_ps(is);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(r + i, _mm256_mul_ps(_exp_avx2(_mm256_fmsub_ps(_mm256_loadu_ps(v + i), t, mm)), s));
+    if (i < n) {
+        const __m256i _m = _mask8(n - i);
+        _mm256_maskstore_ps(r + i, _m, _mm256_mul_ps(_exp_avx2(_mm256_fmsub_ps(_mm256_maskload_ps(v + i, _m), t, mm)), s));
+    }
+}
+static TARGET_AVX2 void _axpb_avx2(float* r, const float* v, unsigned n, float a, float b){
+    const __m256 va = _mm256_set1_ps(a), vb = _mm256_set1_ps(b);
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 x0 = _mm256_loadu_ps(v + i), x1 = _mm256_loadu_ps(v + i + 8);
+        _mm256_storeu_ps(r + i,     _mm256_fmadd_ps(x0, va, vb));
+        _mm256_storeu_ps(r + i + 8, _mm256_fmadd_ps(x1, va, vb));
+    }
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(r + i, _mm256_fmadd_ps(_mm256_loadu_ps(v + i), va, vb));
+    if (i < n) {
+        const __m256i _m = _mask8(n - i);
+        _mm256_maskstore_ps(r + i, _m, _mm256_fmadd_ps(_mm256_maskload_ps(v + i, _m), va, vb));
+    }
+}
+static TARGET_AVX2 void _lerp_avx2(float* r, const float* v, unsigned n, float mu){
+    const __m256 a = _mm256_set1_ps(mu);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8) {// r = v + mu*(r - v)
+        __m256 x = _mm256_loadu_ps(v + i);
+        _mm256_storeu_ps(r + i, _mm256_fmadd_ps(a, _mm256_sub_ps(_mm256_loadu_ps(r + i), x), x));
+    }
+    if (i < n) {
+        const __m256i _m = _mask8(n - i);
+        __m256 x = _mm256_maskload_ps(v + i, _m);
+        _mm256_maskstore_ps(r + i, _m, _mm256_fmadd_ps(a, _mm256_sub_ps(_mm256_maskload_ps(r + i, _m), x), x));
+    }
+}
+static TARGET_AVX2 void _add4_avx2(float* r, const float* v, unsigned k, unsigned nr){
+    if (nr < 4) { _add4_ref(r, v, k, nr); return; }
+    unsigned i = 0;
+    for (; i + 8 <= k; i += 8) {
+        __m256 s = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(v + i),       _mm256_loadu_ps(v + k + i)),
+                                 _mm256_add_ps(_mm256_loadu_ps(v + 2*k + i), _mm256_loadu_ps(v + 3*k + i)));
+        _mm256_storeu_ps(r + i, _mm256_add_ps(_mm256_loadu_ps(r + i), s));
+    }
+    for (; i < k; i++) r[i] += (v[i] + v[k + i]) + (v[2*k + i] + v[3*k + i]);
+}
+static TARGET_AVX2 void _sub_avx2(float* r, const float* a, const float* b, unsigned k){
+    unsigned i = 0;
+    for (; i + 8 <= k; i += 8) _mm256_storeu_ps(r + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    if (i < k) {
+        const __m256i _m = _mask8(k - i);
+        _mm256_maskstore_ps(r + i, _m, _mm256_sub_ps(_mm256_maskload_ps(a + i, _m), _mm256_maskload_ps(b + i, _m)));
+    }
+}
+
+// --- AVX-512 ---
+static inline TARGET_AVX512 __m512 _exp_avx512(__m512 x){
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.0f)), _mm512_set1_ps(88.0f));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_HI), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_LO), r);
+    __m512 p = _mm512_set1_ps(EXP_P0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P5));
+    p = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+    return _mm512_scalef_ps(p, n);
+}
+#define LOAD_AVX512(p)  _mm512_loadu_ps(p)
+#define LOADM_AVX512(p) _mm512_maskz_loadu_ps(_m, p)
+#define REDUCE_AVX512(n, STEP) do {                                 \
+    unsigned i = 0;                                                 \
+    for (; i + 64 <= n; i += 64) {                                  \
+        STEP(0, i, LOAD_AVX512);    STEP(1, i+16, LOAD_AVX512);     \
+        STEP(2, i+32, LOAD_AVX512); STEP(3, i+48, LOAD_AVX512);     \
+    }                                                               \
+    for (; i + 16 <= n; i += 16) STEP(0, i, LOAD_AVX512);           \
+    if (i < n) { const __mmask16 _m = (1u << (n - i)) - 1; STEP(1, i, LOADM_AVX512); } \
+} while (0)
+#define ACC4_AVX512(a) __m512 a[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()}
+#define SUM4_AVX512(a) _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(a[0], a[1]), _mm512_add_ps(a[2], a[3])))
+
+static TARGET_AVX512 float _dot_avx512(const float* u, const float* v, unsigned n){
+    ACC4_AVX512(a);
+#define STEP(k, i, LD) a[k] = _mm512_fmadd_ps(LD(u + (i)), LD(v + (i)), a[k])
+    REDUCE_AVX512(n, STEP);
+#undef STEP
+    return SUM4_AVX512(a);
+}
+static TARGET_AVX512 void _dot3_avx512(const float* u, const float* v, unsigned n, double s[3]){
+    ACC4_AVX512(uv); ACC4_AVX512(uu); ACC4_AVX512(vv);
+#define STEP(k, i, LD) do { __m512 x = LD(u + (i)), y = LD(v + (i)); \
+    uv[k] = _mm512_fmadd_ps(x, y, uv[k]); uu[k] = _mm512_fmadd_ps(x, x, uu[k]); vv[k] = _mm512_fmadd_ps(y, y, vv[k]); } while(0)
+    REDUCE_AVX512(n, STEP);
+#undef STEP
+    s[0] = SUM4_AVX512(uv); s[1] = SUM4_AVX512(uu); s[2] = SUM4_AVX512(vv);
+}
+static TARGET_AVX512 void _mom5_avx512(const float* u, const float* v, unsigned n, double s[5]){
+    ACC4_AVX512(su); ACC4_AVX512(sv); ACC4_AVX512(uu); ACC4_AVX512(vv); ACC4_AVX512(uv);
+#define STEP(k, i, LD) do { __m512 x = LD(u + (i)), y = LD(v + (i)); \
+    su[k] = _mm512_add_ps(su[k], x); sv[k] = _mm512_add_ps(sv[k], y); \
+    uu[k] = _mm512_fmadd_ps(x, x, uu[k]); vv[k] = _mm512_fmadd_ps(y, y, vv[k]); uv[k] = _mm512_fmadd_ps(x, y, uv[k]); } while(0)
+    REDUCE_AVX512(n, STEP);
+#undef STEP
+    s[0] = SUM4_AVX512(su); s[1] = SUM4_AVX512(sv); s[2] = SUM4_AVX512(uu); s[3] = SUM4_AVX512(vv); s[4] = SUM4_AVX512(uv);
+}
+static TARGET_AVX512 float _dist2_avx512(const float* u, const float* v, unsigned n){
+    ACC4_AVX512(a);
+#define STEP(k, i, LD) do { __m512 d = _mm512_sub_ps(LD(u + (i)), LD(v + (i))); a[k] = _mm512_fmadd_ps(d, d, a[k]); } while(0)
+    REDUCE_AVX512(n, STEP);
+#undef STEP
+    return SUM4_AVX512(a);
+}
+static TARGET_AVX512 float _sad_avx512(const float* u, const float* v, unsigned n){
+    ACC4_AVX512(a);
+#define STEP(k, i, LD) a[k] = _mm512_add_ps(a[k], _mm512_abs_ps(_mm512_sub_ps(LD(u + (i)), LD(v + (i)))))
+    REDUCE_AVX512(n, STEP);
+#undef STEP
+    return SUM4_AVX512(a);
+}
+static TARGET_AVX512 void _mom2_avx512(const float* v, const float* w, unsigned n, double s[2]){
+    (void)w;
+    ACC4_AVX512(s1); ACC4_AVX512(s2);
+#define STEP(k, i, LD) do { __m512 x = LD(v + (i)); s1[k] = _mm512_add_ps(s1[k], x); s2[k] = _mm512_fmadd_ps(x, x, s2[k]); } while(0)
+    REDUCE_AVX512(n, STEP);
+#undef STEP
+    s[0] = SUM4_AVX512(s1); s[1] = SUM4_AVX512(s2);
+}
+static TARGET_AVX512 void _smax_avx512(const float* v, unsigned n, float it, float* m, double* s){
+    const __m512 t = _mm512_set1_ps(it);
+    __m512 mx = _mm512_set1_ps(-FLT_MAX), sum = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512 x0 = _mm512_mul_ps(_mm512_loadu_ps(v + i),      t), x1 = _mm512_mul_ps(_mm512_loadu_ps(v + i + 16), t);
+        __m512 x2 = _mm512_mul_ps(_mm512_loadu_ps(v + i + 32), t), x3 = _mm512_mul_ps(_mm512_loadu_ps(v + i + 48), t);
+        __m512 mn = _mm512_max_ps(mx, _mm512_max_ps(_mm512_max_ps(x0, x1), _mm512_max_ps(x2, x3)));
+        __m512 e  = _mm512_add_ps(_mm512_add_ps(_exp_avx512(_mm512_sub_ps(x0, mn)), _exp_avx512(_mm512_sub_ps(x1, mn))),
+                                  _mm512_add_ps(_exp_avx512(_mm512_sub_ps(x2, mn)), _exp_avx512(_mm512_sub_ps(x3, mn))));
+        sum = _mm512_fmadd_ps(sum, _exp_avx512(_mm512_sub_ps(mx, mn)), e);
+        mx  = mn;
+    }
+    for (; i < n; i += 16) {// остаток по маске, в неиспользуемых элементах максимум и сумма не меняются
+        const __mmask16 k = n - i >= 16 ? 0xFFFF : (1u << (n - i)) - 1;
+        __m512 x  = _mm512_mul_ps(_mm512_maskz_loadu_ps(k, v + i), t);
+        __m512 mn = _mm512_mask_max_ps(mx, k, mx, x);
+        __m512 sr = _mm512_mul_ps(sum, _exp_avx512(_mm512_sub_ps(mx, mn)));
+        sum = _mm512_mask_add_ps(sr, k, sr, _exp_avx512(_mm512_sub_ps(x, mn)));
+        mx  = mn;
+    }
+    const float M = _mm512_reduce_max_ps(mx);
+    *m = M;
+    *s = _mm512_reduce_add_ps(_mm512_mul_ps(sum, _exp_avx512(_mm512_sub_ps(mx, _mm512_set1_ps(M)))));
+}
+static TARGET_AVX512 void _sexp_avx512(float* r, const float* v, unsigned n, float it, float m, float is){
+    const __m512 t = _mm512_set1_ps(it), mm = _mm512_set1_ps(m), s = _mm512_set1_ps(is);
+    unsigned i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm512_storeu_ps(r + i, _mm512_mul_ps(_exp_avx512(_mm512_fmsub_ps(_mm512_loadu_ps(v + i), t, mm)), s));
+    if (i < n) {
+        const __mmask16 k = (1u << (n - i)) - 1;
+        _mm512_mask_storeu_ps(r + i, k, _mm512_mul_ps(_exp_avx512(_mm512_fmsub_ps(_mm512_maskz_loadu_ps(k, v + i), t, mm)), s));
+    }
+}
+static TARGET_AVX512 void _axpb_avx512(float* r, const float* v, unsigned n, float a, float b){
+    const __m512 va = _mm512_set1_ps(a), vb = _mm512_set1_ps(b);
+    unsigned i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 x0 = _mm512_loadu_ps(v + i), x1 = _mm512_loadu_ps(v + i + 16);
+        _mm512_storeu_ps(r + i,      _mm512_fmadd_ps(x0, va, vb));
+        _mm512_storeu_ps(r + i + 16, _mm512_fmadd_ps(x1, va, vb));
+    }
+    for (; i < n; i += 16) {
+        const __mmask16 k = n - i >= 16 ? 0xFFFF : (1u << (n - i)) - 1;
+        _mm512_mask_storeu_ps(r + i, k, _mm512_fmadd_ps(_mm512_maskz_loadu_ps(k, v + i), va, vb));
+    }
+}
+static TARGET_AVX512 void _lerp_avx512(float* r, const float* v, unsigned n, float mu){
+    const __m512 a = _mm512_set1_ps(mu);
+    for (unsigned i = 0; i < n; i += 16) {
+        const __mmask16 k = n - i >= 16 ? 0xFFFF : (1u << (n - i)) - 1;
+        __m512 x = _mm512_maskz_loadu_ps(k, v + i);
+        _mm512_mask_storeu_ps(r + i, k, _mm512_fmadd_ps(a, _mm512_sub_ps(_mm512_maskz_loadu_ps(k, r + i), x), x));
+    }
+}
+static TARGET_AVX512 void _add4_avx512(float* r, const float* v, unsigned k, unsigned nr){
+    if (nr < 4) { _add4_ref(r, v, k, nr); return; }
+    for (unsigned i = 0; i < k; i += 16) {
+        const __mmask16 m = k - i >= 16 ? 0xFFFF : (1u << (k - i)) - 1;
+        __m512 s = _mm512_add_ps(_mm512_add_ps(_mm512_maskz_loadu_ps(m, v + i),       _mm512_maskz_loadu_ps(m, v + k + i)),
+                                 _mm512_add_ps(_mm512_maskz_loadu_ps(m, v + 2*k + i), _mm512_maskz_loadu_ps(m, v + 3*k + i)));
+        _mm512_mask_storeu_ps(r + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, r + i), s));
+    }
+}
+static TARGET_AVX512 void _sub_avx512(float* r, const float* a, const float* b, unsigned k){
+    for (unsigned i = 0; i < k; i += 16) {
+        const __mmask16 m = k - i >= 16 ? 0xFFFF : (1u << (k - i)) - 1;
+        _mm512_mask_storeu_ps(r + i, m, _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i)));
+    }
+}
+#endif
+
+#define EMBED_ISA_COUNT 3 // generic, avx2, avx512
+#define EMBED_KERNELS(s) {_dot##s, _dot3##s, _mom5##s, _dist2##s, _sad##s, _mom2##s, _smax##s, _sexp##s, \
+    _axpb##s, _lerp##s, _add4##s, _sub##s}
+static const struct _embed_kernels _kernels[EMBED_ISA_COUNT] = {
+    EMBED_KERNELS(_ref),
+#if defined(__x86_64__) || defined(__i386__)
+    EMBED_KERNELS(_avx2),
+    EMBED_KERNELS(_avx512),
+#endif
+};
+#undef EMBED_KERNELS
+static const struct _embed_kernels * _Atomic _ek = NULL;// выбранная версия, устанавливается один раз
+
+//!< лучшая версия ядер, поддерживаемая процессором
+static int _isa_max(){
+    int max = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        max = 2;
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        max = 1;
+#endif
+    return max;
+}
+/*! \brief выбор версии ядер по набору инструкций
+    \param isa - номер версии QNN_ISA_GENERIC, QNN_ISA_AVX2, QNN_ISA_AVX512; -1 - лучшая из доступных
+    \return выбранная версия, не выше поддерживаемой процессором
+
+    Используется для проверки и замеров, по умолчанию версия выбирается при первом вызове.
+ */
+int qnn_embed_ops_isa(int isa)
+{
+    const int max = _isa_max();
+    if (isa < 0 || isa > max) isa = max;
+    atomic_store_explicit(&_ek, &_kernels[isa], memory_order_release);
+    return isa;
+}
+/*! \brief версия ядер, при первом вызове выбирается лучшая из доступных
+
+    Первые вызовы из разных потоков могут выбрать версию одновременно, выбор одинаков,
+    версия, заданная qnn_embed_ops_isa(), не заменяется.
+ */
+static inline const struct _embed_kernels * _kernels_get(){
+    const struct _embed_kernels * ek = atomic_load_explicit(&_ek, memory_order_acquire);
+    if (__builtin_expect(ek == NULL, 0)) {
+        const struct _embed_kernels * expected = NULL;
+        ek = &_kernels[_isa_max()];
+        if (!atomic_compare_exchange_strong_explicit(&_ek, &expected, ek, memory_order_acq_rel, memory_order_acquire))
+            ek = expected;
+    }
+    return ek;
+}
+//!< блочная редукция для ядер с результатом float
+static double _reduce(float (*fn)(const float*, const float*, unsigned), const float* u, const float* v, unsigned n){
+    double s = 0;
+    for (unsigned i = 0; i < n; i += EMBED_BLOCK)
+        s += fn(u + i, v + i, n - i < EMBED_BLOCK ? n - i : EMBED_BLOCK);
+    return s;
+}
+//!< блочная редукция для ядер с несколькими суммами
+static void _reduce_n(void (*fn)(const float*, const float*, unsigned, double*), int ns, 
+        const float* u, const float* v, unsigned n, double* s){
+    double t[5];
+    for (int j = 0; j < ns; j++) s[j] = 0;
+    for (unsigned i = 0; i < n; i += EMBED_BLOCK) {
+        fn(u + i, v + i, n - i < EMBED_BLOCK ? n - i : EMBED_BLOCK, t);
+        for (int j = 0; j < ns; j++) s[j] += t[j];
+    }
+}
+
+/*! \brief косинусная схожесть, dot(u,v) и нормы векторов считаются за один проход */
+float qnn_embed_similarity_cos(const float* u, const float* v, unsigned n){
+    double s[3];
+    _reduce_n(_kernels_get()->dot3, 3, u, v, n, s);
+    double d = sqrt(s[1]*s[2]);
+    return d > 0 ? s[0]/d : 0.f;
+}
+/*! \brief евклидово расстояние |u - v| */
+float qnn_embed_distance(const float* u, const float* v, unsigned n){
+    return sqrt(_reduce(_kernels_get()->dist2, u, v, n));
+}
+float qnn_embed_dot(const float* u, const float* v, unsigned n){
+    return _reduce(_kernels_get()->dot, u, v, n);
+}
+/*! \brief сумма модулей разности, sum of absolute differences */
+float qnn_embed_sad(const float* u, const float* v, unsigned n){
+    return _reduce(_kernels_get()->sad, u, v, n);
+}
+/*! \brief структурная схожесть SSIM = l*c*s для пары векторов
+    \param l - схожесть средних (luminance), может быть NULL
+    \param c - схожесть дисперсий (contrast), может быть NULL
+    \return s - коэффициент корреляции (structure)
+
+    Пять моментов считаются за один проход.
+ */
+float qnn_embed_structural_sim(const float* u, const float* v, float* l, float *c, unsigned n){
+    const double c1 = 1e-8, c2 = 1e-8, c3 = c2/2;
+    double s[5];
+    _reduce_n(_kernels_get()->mom5, 5, u, v, n, s);
+    double mu = s[0]/n, mv = s[1]/n;
+    double du = fmax(s[2]/n - mu*mu, 0), dv = fmax(s[3]/n - mv*mv, 0), cv = s[4]/n - mu*mv;
+    double su = sqrt(du), sv = sqrt(dv);
+    if (l) *l = (2*mu*mv + c1)/(mu*mu + mv*mv + c1);
+    if (c) *c = (2*su*sv + c2)/(du + dv + c2);
+    return (cv + c3)/(su*sv + c3);
+}
+/*! \brief r = v*scale
+    \return scale
+ */
+float qnn_embed_scale(float* r, const float* v, unsigned n, float scale){
+    _kernels_get()->axpb(r, v, n, scale, 0.f);
+    return scale;
+}
+/*! \brief r = softmax(v/tau) по k элементам
+    \return log(sum(exp(v/tau))) - нормирующий множитель, для расчета перекрестной энтропии
+
+    Первый проход - максимум и сумма экспонент онлайн, второй - запись результата.
+ */
+float qnn_embed_softmax(float* r, const float* v, unsigned k, float tau){
+    const struct _embed_kernels * ek = _kernels_get();
+    float m; double s;
+    ek->smax(v, k, 1.f/tau, &m, &s);
+    ek->sexp(r, v, k, 1.f/tau, m, (float)(1.0/s));
+    return m + (float)log(s);
+}
+/*! \brief r = v/|v|
+    \return |v|
+ */
+float qnn_embed_l2normalize(float* r, const float* v, unsigned n){
+    double s[2];
+    _reduce_n(_kernels_get()->mom2, 2, v, v, n, s);
+    double norm = sqrt(s[1]);
+    _kernels_get()->axpb(r, v, n, norm > 0 ? (float)(1.0/norm) : 0.f, 0.f);
+    return norm;
+}
+/*! \brief r = v/rms(v)
+    \return rms(v)
+ */
+float qnn_embed_rms_norm(float* r, const float* v, unsigned n){
+    double s[2];
+    _reduce_n(_kernels_get()->mom2, 2, v, v, n, s);
+    double rms = sqrt(s[1]/n + EMBED_EPS);
+    _kernels_get()->axpb(r, v, n, (float)(1.0/rms), 0.f);
+    return rms;
+}
+/*! \brief r = (v - mean)/sigma, сумма и сумма квадратов считаются за один проход
+    \return sigma
+ */
+float qnn_embed_layer_norm(float* r, const float* v, unsigned n){
+    double s[2];
+    _reduce_n(_kernels_get()->mom2, 2, v, v, n, s);
+    double mean = s[0]/n, var = fmax(s[1]/n - mean*mean, 0);
+    double is = 1.0/sqrt(var + EMBED_EPS);
+    _kernels_get()->axpb(r, v, n, (float)is, (float)(-mean*is));
+    return sqrt(var);
+}
+/*! \brief смешивание по времени r = mu*r + (1-mu)*v, экспоненциальное среднее последовательности векторов */
+void qnn_embed_time_mix(float* r, const float* v, unsigned n, float mu){
+    _kernels_get()->lerp(r, v, n, mu);
+}
+/*! \brief сумма по токенам r[j] = sum_i v[i*k + j]
+    \param n - число токенов
+    \param k - размерность токена
+ */
+void qnn_embed_sum(float* r, const float* v, unsigned n, unsigned k){
+    const struct _embed_kernels * ek = _kernels_get();
+    for (unsigned j = 0; j < k; j++) r[j] = 0;
+    for (unsigned i = 0; i < n; i += 4)
+        ek->add4(r, v + (size_t)i*k, k, n - i < 4 ? n - i : 4);
+}
+/*! \brief среднее по токенам r[j] = sum_i v[i*k + j]/n */
+void qnn_embed_mean(float* r, const float* v, unsigned n, unsigned k){
+    qnn_embed_sum(r, v, n, k);
+    if (n) _kernels_get()->axpb(r, r, k, 1.f/n, 0.f);
+}
+/*! \brief вычитание вектора из каждого токена r[i*k + j] = a[i*k + j] - b[j], допускается r == a */
+void qnn_embed_sub(float* r, const float *a, const float *b, unsigned n, unsigned k){
+    const struct _embed_kernels * ek = _kernels_get();
+    for (unsigned i = 0; i < n; i++)
+        ek->sub(r + (size_t)i*k, a + (size_t)i*k, b, k);
+}
+
+#ifdef TEST_EMBED_OPS
+#include <stdlib.h>
+#include "qnn_bench.h"
+/*! Проверка: сравнение версий с вычислением в double, замер на размерах эмбеддингов Gemma3 и Qwen2.5-VL */
+static void _rand_f32(float * x, size_t n, uint32_t * seed){
+    for (size_t i = 0; i < n; i++) {
+        *seed = *seed*1664525u + 1013904223u;
+        x[i] = ((int32_t)*seed)*(1.0f/2147483648.0f);
+    }
+}
+static double _rel(double a, double b){
+    return fabs(a - b)/fmax(fabs(b), 1e-30);
+}
+static double _max_rel(const float* r, const double* ref, unsigned n){
+    double e = 0, norm = 0;
+    for (unsigned i = 0; i < n; i++) { e = fmax(e, fabs(r[i] - ref[i])); norm = fmax(norm, fabs(ref[i])); }
+    return e/fmax(norm, 1e-30);
+}
+int main(int argc, char** argv){
+    static const char* isa_name[EMBED_ISA_COUNT] = {"generic", "avx2", "avx512"};
+    static const unsigned shapes[][2] = {{256, 2560}, {256, 3584}, {3, 37}};// последний - проверка остатков
+    const unsigned n_runs = argc > 1 ? atoi(argv[1]) : 50;
+    const int max_isa = qnn_embed_ops_isa(-1);
+    int fail = 0;
+    uint32_t seed = 1;
+    for (int s = 0; s < sizeof(shapes)/sizeof(shapes[0]); s++) {
+        const unsigned n_tok = shapes[s][0], k = shapes[s][1], n = n_tok*k;
+        float  * u = malloc(sizeof(float)*n), * v = malloc(sizeof(float)*n), * r = malloc(sizeof(float)*n);
+        double * ref = malloc(sizeof(double)*n);
+        _rand_f32(u, n, &seed);
+        _rand_f32(v, n, &seed);
+        for (unsigned i = 0; i < n; i++) v[i] = 0.5f*v[i] + 0.5f*u[i] + 0.25f;// коррелированные векторы со смещением
+        double uv = 0, uu = 0, vv = 0, d2 = 0, sad = 0, su = 0, sv = 0;
+        for (unsigned i = 0; i < n; i++) {
+            uv += (double)u[i]*v[i]; uu += (double)u[i]*u[i]; vv += (double)v[i]*v[i];
+            d2 += ((double)u[i] - v[i])*((double)u[i] - v[i]); sad += fabs((double)u[i] - v[i]);
+            su += u[i]; sv += v[i];
+        }
+        const double cos_ref = uv/sqrt(uu*vv);
+        const double corr_ref = (uv/n - su/n*sv/n)/sqrt((uu/n - su/n*su/n)*(vv/n - sv/n*sv/n));
+        printf("=== %u x %u ===\n", n_tok, k);
+        for (int isa = 0; isa <= max_isa; isa++) {
+            qnn_embed_ops_isa(isa);
+            double e, err = 0;
+            err = fmax(err, _rel(qnn_embed_similarity_cos(u, v, n), cos_ref));
+            err = fmax(err, _rel(qnn_embed_dot(u, v, n), uv));
+            err = fmax(err, _rel(qnn_embed_distance(u, v, n), sqrt(d2)));
+            err = fmax(err, _rel(qnn_embed_sad(u, v, n), sad));
+            err = fmax(err, _rel(qnn_embed_structural_sim(u, v, NULL, NULL, n), corr_ref));
+            // softmax по строкам-токенам, температура 0.1
+            double es = 0;
+            for (unsigned i = 0; i < n_tok; i++) {
+                const float * x = v + (size_t)i*k;
+                double m = -INFINITY, sum = 0;
+                for (unsigned j = 0; j < k; j++) m = fmax(m, x[j]/0.1);
+                for (unsigned j = 0; j < k; j++) sum += exp(x[j]/0.1 - m);
+                for (unsigned j = 0; j < k; j++) ref[j] = exp(x[j]/0.1 - m)/sum;
+                float lse = qnn_embed_softmax(r, x, k, 0.1f);
+                es = fmax(es, _max_rel(r, ref, k));
+                es = fmax(es, _rel(lse, m + log(sum)));
+            }
+            err = fmax(err, es);
+            // нормализация
+            double mean = su/n, var = uu/n - mean*mean;
+            for (unsigned i = 0; i < n; i++) ref[i] = (u[i] - mean)/sqrt(var + EMBED_EPS);
+            e = _rel(qnn_embed_layer_norm(r, u, n), sqrt(var));
+            err = fmax(err, fmax(e, _max_rel(r, ref, n)));
+            for (unsigned i = 0; i < n; i++) ref[i] = u[i]/sqrt(uu/n + EMBED_EPS);
+            e = _rel(qnn_embed_rms_norm(r, u, n), sqrt(uu/n + EMBED_EPS));
+            err = fmax(err, fmax(e, _max_rel(r, ref, n)));
+            for (unsigned i = 0; i < n; i++) ref[i] = u[i]/sqrt(uu);
+            e = _rel(qnn_embed_l2normalize(r, u, n), sqrt(uu));
+            err = fmax(err, fmax(e, _max_rel(r, ref, n)));
+            // среднее по токенам и вычитание
+            for (unsigned j = 0; j < k; j++) {
+                double m = 0;
+                for (unsigned i = 0; i < n_tok; i++) m += u[(size_t)i*k + j];
+                ref[j] = m/n_tok;
+            }
+            qnn_embed_mean(r, u, n_tok, k);
+            err = fmax(err, _max_rel(r, ref, k));
+            float * w = r + k;
+            qnn_embed_sub(w, u, r, n_tok - 1, k);
+            e = 0;
+            for (unsigned i = 0; i < (n_tok - 1)*k; i++) e = fmax(e, fabs(w[i] - (u[i] - r[i % k])));
+            err = fmax(err, e);
+            const double tol = isa ? 1e-5 : 1e-4;// скалярная версия накапливает блок в одной сумме
+            printf("%-8s max rel.err %.2e %s\n", isa_name[isa], err, err < tol ? "ok" : "fail");
+            fail += !(err < tol);
+            if (n < 1024) continue;
+            // замер: такты на элемент эмбеддинга
+            struct bench b;
+            char name[64];
+            volatile float sink;
+#define BENCH_EMBED(label, stmt) do { \
+            snprintf(name, sizeof(name), "%-8s %s", isa_name[isa], label); \
+            bench_init(&b, name, n_runs); BENCH_RUN(&b, stmt); bench_report(&b, n); bench_free(&b); } while(0)
+            BENCH_EMBED("similarity_cos", sink = qnn_embed_similarity_cos(u, v, n));
+            BENCH_EMBED("dot",            sink = qnn_embed_dot(u, v, n));
+            BENCH_EMBED("distance",       sink = qnn_embed_distance(u, v, n));
+            BENCH_EMBED("sad",            sink = qnn_embed_sad(u, v, n));
+            BENCH_EMBED("structural_sim", sink = qnn_embed_structural_sim(u, v, NULL, NULL, n));
+            BENCH_EMBED("softmax",        for (unsigned i = 0; i < n_tok; i++) sink = qnn_embed_softmax(r + (size_t)i*k, v + (size_t)i*k, k, 0.1f));
+            BENCH_EMBED("l2normalize",    sink = qnn_embed_l2normalize(r, u, n));
+            BENCH_EMBED("rms_norm",       sink = qnn_embed_rms_norm(r, u, n));
+            BENCH_EMBED("layer_norm",     sink = qnn_embed_layer_norm(r, u, n));
+            BENCH_EMBED("mean",           qnn_embed_mean(r, u, n_tok, k));
+            BENCH_EMBED("sub",            qnn_embed_sub(r, u, v, n_tok, k));
+#undef BENCH_EMBED
+            (void)sink;
+        }
+        free(u); free(v); free(r); free(ref);
+    }
+    return fail != 0;
+}
+#endif
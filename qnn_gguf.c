@@ -1,11 +1,12 @@
 /*
 
 Сборка 
-	$ gcc -DTEST_GGUF -O3 -march=native -o test qnn_gguf.c qnn_png.c xxh64.c quarks.c `pkgconf --cflags --libs glib-2.0` -lz -lpng
-	$ gcc -DTEST_GGUF -O3 -march=native -o test qnn_gguf.c qnn_png.c xxh64.c sha256_ni.c shake256.c quarks.c hmac.c `pkgconf --cflags --libs glib-2.0` -lz -lpng
+	$ gcc -DTEST_GGUF -O3 -march=native -o test qnn_gguf.c qnn_pool.c qnn_png.c xxh64.c quarks.c `pkgconf --cflags --libs glib-2.0` -lz -lpng -lpthread
+	$ gcc -DTEST_GGUF -O3 -march=native -o test qnn_gguf.c qnn_pool.c qnn_png.c xxh64.c sha256_ni.c shake256.c quarks.c hmac.c `pkgconf --cflags --libs glib-2.0` -lz -lpng -lpthread
 	
 Тестирование
 	$ ./test.exe ../../llama.cpp/models/Rombos-Coder-V2.5-Qwen-14b-Q8_0.gguf -v -n blk.1.attn_q.weight -o test.png
+	$ ./test ../../llama.cpp/models/Rombos-Coder-V2.5-Qwen-14b-Q8_0.gguf -m Rombos-Coder-V2.5-Qwen-14b-Q8_0.manifest -j 8
 
 
 Чего надо
@@ -17,13 +18,21 @@
 #define FINITE_ONLY // не проверять NAN
 #include "qnn.h"
 #include "quarks.h"
+#include "xxh64.h"
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <errno.h>
+#include <time.h>
 #include <glib.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 
 #define GGUF_MAGIC 		"GGUF"
@@ -60,6 +69,8 @@ struct {
 	[GGML_TYPE_F32]	={1,4},
 	[GGML_TYPE_F16]	={1,2},
 	[GGML_TYPE_BF16]={1,2},
+	[GGML_TYPE_BF8 ]={1,1},
+	[GGML_TYPE_HF8 ]={1,1},
 	[GGML_TYPE_I32 ]={1,4},
 	[GGML_TYPE_Q8_0]={QK8_0, sizeof(block_q8_0)},
 	[GGML_TYPE_Q8_1]={QK8_1, sizeof(block_q8_1)},
@@ -67,7 +78,7 @@ struct {
 	[GGML_TYPE_Q4_K]={QK_K,  sizeof(block_q4_K)},
 	[GGML_TYPE_Q5_K]={QK_K,  sizeof(block_q5_K)},
 	[GGML_TYPE_Q6_K]={QK_K,  sizeof(block_q6_K)},
-	[GGML_TYPE_Q8_K]={QK_K,  sizeof(block_q8_K)},
+	[GGML_TYPE_Q8_K]={Q8K_K, sizeof(block_q8_K)},
 };
 const char* GGML_TYPE_NAME[GGML_TYPE_COUNT] = {
 	[GGML_TYPE_F64 ]    = "F64",
@@ -77,6 +88,7 @@ const char* GGML_TYPE_NAME[GGML_TYPE_COUNT] = {
 // QNN
 	[GGML_TYPE_HF8 ]    = "HF8", // E4M3 (Intel conversion rules https://www.intel.com/content/www/us/en/developer/articles/technical/introduction-to-oneapi-ml-common-extensions.html)
 	[GGML_TYPE_BF8 ]    = "BF8", // E5M2
+	[GGML_TYPE_Q2_0]    = "Q2_0",// BitCPM4
 //	[GGML_TYPE_E4M3FN]  = "E4M3FN",// E4M3FN
 	
 	[GGML_TYPE_Q4_0]    = "Q4_0",
@@ -323,9 +335,10 @@ int gguf_find_key(const struct gguf_context * ctx, const char * key) {
 }
 
 void gguf_free(gguf_cxt_t* ctx){
-	if(ctx->header.n_tensors) 
-	if(ctx->header.n_kv) 
-
+#if !defined(_WIN32)
+	if(ctx->mapping)
+		munmap(ctx->mapping, ctx->mapping_size);
+#endif
 	if(ctx->kv)
 		g_free(ctx->kv);
 	if(ctx->infos)
@@ -430,9 +443,61 @@ uint32_t _htable_insert_tensor_info(HTable_t *htable, const struct gguf_str *nam
 	*head = y;
 	return y;
 }
+#if !defined(_WIN32)
+/*! \brief Отображает файл в память, тензоры ссылаются на данные в отображении без копирования
+	
+	Отображение только для чтения MAP_SHARED, страницы загружаются по обращению и разделяются 
+	между процессами через кеш страниц. Смещения тензоров проверяются на кратность `general.alignment`.
+	\param fd дескриптор открытого файла
+	\param params флаги GGUF_INIT_PREFETCH
+	\return 0 при успешном отображении
+ */
+static int _gguf_mmap(gguf_cxt_t * ctx, int fd, uint32_t params)
+{
+	struct stat st;
+	if (fstat(fd, &st)!=0) {
+		fprintf(stderr, "%s: fstat failed: '%s'\n", __func__, strerror(errno));
+		return -1;
+	}
+	size_t file_size = st.st_size;
+	if (file_size < ctx->offset) {
+		fprintf(stderr, "%s: file is truncated, data offset %zu > size %zu\n", __func__, ctx->offset, file_size);
+		return -1;
+	}
+	void * mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapping==MAP_FAILED) {
+		fprintf(stderr, "%s: mmap failed: '%s'\n", __func__, strerror(errno));
+		return -1;
+	}
+	ctx->mapping      = mapping;
+	ctx->mapping_size = file_size;
+	ctx->data = (uint8_t*)mapping + ctx->offset;
+	ctx->size = file_size - ctx->offset;
+	for (uint64_t i = 0; i < ctx->header.n_tensors; ++i) {
+		struct gguf_tensor_info * info = &ctx->infos[i];
+		size_t size = _tensor_info_nbytes(info);
+		if (info->offset % ctx->alignment != 0 || info->offset + size > ctx->size) {
+			fprintf(stderr, "%s: tensor '%.*s' offs=%"PRIu64" size=%zu out of data section\n", 
+				__func__, (int)info->name.n, info->name.data, info->offset, size);
+			munmap(mapping, file_size);
+			ctx->mapping = NULL;
+			ctx->data = NULL;
+			return -1;
+		}
+		info->data = (uint8_t*)ctx->data + info->offset;
+		info->size = size;
+	}
+	// веса читаются последовательно по порядку слоев
+	madvise(mapping, file_size, (params & GGUF_INIT_PREFETCH)? MADV_WILLNEED: MADV_SEQUENTIAL);
+	return 0;
+}
+#endif
 /*! \brief 
 	Составляет таблицу информации по файлу
 
+	\param params флаги GGUF_INIT_MMAP -- отобразить файл в память, \ref gguf_tensor_info::data 
+	указывает на данные тензора в отображении; GGUF_INIT_PREFETCH -- начать загрузку страниц заранее.
+	Без флага GGUF_INIT_MMAP данные загружаются через blk_load()
  */
 gguf_cxt_t * gguf_init_from_file(const char * fname, uint32_t/* struct gguf_init_params */params) {
     FILE * file = fopen(fname, "rb");
@@ -683,6 +748,13 @@ fprintf(stdout, "data offset: %d kB\n", (uint32_t)(ctx->offset/1024));
     // compute the total size of the data section, taking into account the alignment
     // load the tensor data only if requested
 //	fprintf(stdout, "data offset: %d kB\n", ctx->offset/1024);
+#if !defined(_WIN32)
+	if ((params & GGUF_INIT_MMAP) && _gguf_mmap(ctx, fileno(file), params)!=0) {
+		fclose(file);
+		gguf_free(ctx);
+		return NULL;
+	}
+#endif
     fclose(file);
 //_quark_to_csv(qt);
     return ctx;
@@ -856,94 +928,287 @@ static int strtohash(uint8_t* hash, char *s, char** tail, int tlen){
 	return 0; // SUCCESS
 }
 uint8_t* blk_load(const char* path,  struct gguf_str * name, uint64_t offset, size_t size );
-/*! \brief Загрузить таблицу хэшей из файла .manifest
-	\return 
+enum _hash_alg { HASH_NONE, HASH_XXH64, HASH_SHA256 };
+/*! \brief Потоковый SHA-256 (FIPS 180-4), данные подаются блоками произвольной длины */
+struct _sha256_ctx {
+	uint32_t h[8];
+	uint8_t  block[64];
+	int      offset;	//!< число байт в block
+	uint64_t length;	//!< общая длина данных
+};
+static const uint32_t _sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+#define ROTR32(x,n) (((x)>>(n))|((x)<<(32-(n))))
+static void _sha256_block(uint32_t* h, const uint8_t* p)
+{
+	uint32_t w[64];
+	for (int i=0; i<16; i++)
+		w[i] = (uint32_t)p[4*i]<<24 | (uint32_t)p[4*i+1]<<16 | (uint32_t)p[4*i+2]<<8 | p[4*i+3];
+	for (int i=16; i<64; i++) {
+		uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15],18) ^ (w[i-15]>> 3);
+		uint32_t s1 = ROTR32(w[i- 2],17) ^ ROTR32(w[i- 2],19) ^ (w[i- 2]>>10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	uint32_t a=h[0], b=h[1], c=h[2], d=h[3], e=h[4], f=h[5], g=h[6], k=h[7];
+	for (int i=0; i<64; i++) {
+		uint32_t t1 = k + (ROTR32(e,6) ^ ROTR32(e,11) ^ ROTR32(e,25)) + ((e&f) ^ (~e&g)) + _sha256_k[i] + w[i];
+		uint32_t t2 = (ROTR32(a,2) ^ ROTR32(a,13) ^ ROTR32(a,22)) + ((a&b) ^ (a&c) ^ (b&c));
+		k = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e; h[5]+=f; h[6]+=g; h[7]+=k;
+}
+static void _sha256_init(struct _sha256_ctx* ctx)
+{
+	static const uint32_t h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	__builtin_memcpy(ctx->h, h0, sizeof(h0));
+	ctx->offset = 0;
+	ctx->length = 0;
+}
+static void _sha256_update(struct _sha256_ctx* ctx, const uint8_t* data, size_t len)
+{
+	ctx->length += len;
+	if (ctx->offset) {
+		size_t n = 64 - ctx->offset < len? 64 - ctx->offset: len;
+		__builtin_memcpy(ctx->block + ctx->offset, data, n);
+		ctx->offset += n; data += n; len -= n;
+		if (ctx->offset < 64) return;
+		_sha256_block(ctx->h, ctx->block);
+		ctx->offset = 0;
+	}
+	for (; len>=64; data+=64, len-=64)
+		_sha256_block(ctx->h, data);
+	__builtin_memcpy(ctx->block, data, len);
+	ctx->offset = len;
+}
+static void _sha256_final(struct _sha256_ctx* ctx, uint8_t* hash)
+{
+	const uint64_t bits = ctx->length*8;
+	ctx->block[ctx->offset++] = 0x80;
+	if (ctx->offset > 56) {
+		__builtin_memset(ctx->block + ctx->offset, 0, 64 - ctx->offset);
+		_sha256_block(ctx->h, ctx->block);
+		ctx->offset = 0;
+	}
+	__builtin_memset(ctx->block + ctx->offset, 0, 56 - ctx->offset);
+	for (int i=0; i<8; i++) ctx->block[56+i] = bits>>(56-8*i);
+	_sha256_block(ctx->h, ctx->block);
+	for (int i=0; i<8; i++) {
+		hash[4*i+0] = ctx->h[i]>>24; hash[4*i+1] = ctx->h[i]>>16;
+		hash[4*i+2] = ctx->h[i]>> 8; hash[4*i+3] = ctx->h[i];
+	}
+}
+//!< запись манифеста, результат проверки одного тензора
+struct _hash_entry {
+	struct gguf_tensor_info * info;
+	enum _hash_alg alg;
+	int   status;	//!< 0 - ok, 1 - не совпадает, -1 - ошибка чтения
+	uint8_t hash[256/8];// ожидаемое значение
+	uint8_t  res[256/8];// вычисленное значение
+};
+struct _hash_verify {
+	gguf_cxt_t * ctx;
+	const char * path;
+	struct _hash_entry * entries;
+	int n_entries;
+	volatile int next;	//!< индекс следующей записи, разбирается потоками атомарно
+};
+#define HASH_CHUNK_SIZE (16u<<20)// блок потокового хеширования и упреждающего чтения
+#if !defined(_WIN32)
+//!< упреждающее чтение блока отображения, границы выравниваются по страницам
+static void _hash_prefetch(uint8_t* data, size_t size, uintptr_t page)
+{
+	uint8_t* base = (uint8_t*)((uintptr_t)data & ~(page-1));
+	madvise(base, (data + size) - base, MADV_WILLNEED);
+}
+#endif
+/*! \brief Вычислить хеш тензора
+	
+	Тензор хешируется блоками HASH_CHUNK_SIZE потоковыми xxh64_update() и _sha256_update().
+	Если файл отображен в память, блок хешируется прямо из отображения: для следующего блока 
+	запрашивается упреждающее чтение, страницы проверенного блока освобождаются.
+	Иначе каждый блок загружается через blk_load(), в памяти находится не больше одного блока.
  */
-int gguf_hash_load(gguf_cxt_t * ctx_gguf, const char* path, char* data, size_t size)
+static void _hash_entry_verify(struct _hash_verify * hv, struct _hash_entry * e)
+{
+	struct gguf_tensor_info * info = e->info;
+	const size_t size = _tensor_info_nbytes(info);
+	HashCtx_t xctx;
+	struct _sha256_ctx sctx;
+	if (e->alg==HASH_XXH64) xxh64_init(&xctx, 0);
+	else _sha256_init(&sctx);
+#if !defined(_WIN32)
+	const uintptr_t page = sysconf(_SC_PAGESIZE);
+	if (info->data)
+		_hash_prefetch(info->data, size<HASH_CHUNK_SIZE? size: HASH_CHUNK_SIZE, page);
+#endif
+	for (size_t offs=0; offs<size; offs+=HASH_CHUNK_SIZE) {
+		const size_t chunk = (size-offs)<HASH_CHUNK_SIZE? size-offs: HASH_CHUNK_SIZE;
+		uint8_t* data = info->data? (uint8_t*)info->data + offs: 
+			blk_load(hv->path, NULL, info->offset+hv->ctx->offset+offs, chunk);
+		if (data==NULL) {
+			e->status = -1;
+			return;
+		}
+#if !defined(_WIN32)
+		uint8_t* base = (uint8_t*)((uintptr_t)data & ~(page-1));
+		if (info->data && offs+chunk<size)
+			_hash_prefetch(data + chunk, (size-offs-chunk)<HASH_CHUNK_SIZE? size-offs-chunk: HASH_CHUNK_SIZE, page);
+#endif
+		if (e->alg==HASH_XXH64) xxh64_update(&xctx, data, chunk);
+		else _sha256_update(&sctx, data, chunk);
+		if (info->data==NULL)
+			g_free(data);
+#if !defined(_WIN32)
+		else // страницы остаются в кеше файла, освобождаем только отображение
+			madvise(base, (data + chunk) - base, MADV_DONTNEED);
+#endif
+	}
+	if (e->alg==HASH_XXH64) {
+		uint64_t h = __builtin_bswap64(xxh64_final(&xctx));
+		__builtin_memcpy(e->res, &h, sizeof(h));
+		e->status = __builtin_memcmp(e->res, e->hash, 64/8)!=0;
+	} else {
+		_sha256_final(&sctx, e->res);
+		e->status = __builtin_memcmp(e->res, e->hash, 256/8)!=0;
+	}
+}
+static void _hash_verify_thread(void* arg, int ith, int nth)
+{// тензоры разного размера, потоки разбирают их по одному от больших к меньшим
+	struct _hash_verify * hv = arg;
+	int i;
+	while ((i = __atomic_fetch_add(&hv->next, 1, __ATOMIC_RELAXED)) < hv->n_entries)
+		_hash_entry_verify(hv, &hv->entries[i]);
+}
+static int _hash_entry_cmp(const void* a, const void* b)
+{// сначала большие тензоры, для равномерной загрузки потоков
+	size_t sa = _tensor_info_nbytes(((const struct _hash_entry*)a)->info);
+	size_t sb = _tensor_info_nbytes(((const struct _hash_entry*)b)->info);
+	return sa<sb? 1: sa>sb? -1: 0;
+}
+static void _hash_print(FILE* fp, const uint8_t* hash, int len){
+	for (int i=0; i<len; i++) fprintf(fp, "%02x", hash[i]);
+}
+/*! \brief Проверить тензоры по таблице хэшей из файла .manifest
+	
+	Строки манифеста `xxh64 <hex> :name`, `sha256 <hex> :name`. Тензоры проверяются параллельно 
+	в n_threads потоках общего пула (\see qnn_pool_default), данные берутся из общего отображения файла (\see GGUF_INIT_MMAP). 
+	По окончании выводится сводка в формате JSON: по строке на каждый несовпавший или 
+	не найденный тензор и итоговая строка с объемом и скоростью проверки. Строки `sha3-256` не проверяются,
+	такие тензоры выводятся со статусом unverified и считаются в сводке отдельно.
+	\param n_threads число потоков, 0 - все потоки пула; больше размера пула не бывает
+	\return число ошибок, -1 если манифест не разобран
+ */
+int gguf_hash_verify(gguf_cxt_t * ctx_gguf, const char* path, char* data, size_t size, int n_threads)
 {
 	char* s = data;
 	char* e = data + size;
-	char* name = NULL;
-	uint8_t hash[512/8];
+	int n_alloc = 64, n_entries = 0, n_missing = 0, n_unverified = 0;
+	struct _hash_entry * entries = g_new0(struct _hash_entry, n_alloc);
 	while(s<e && s[0]!='\0'){
-		if(strncmp(s, "xxh64", 5)==0){
-			s+=6;
-			strtohash(hash, s, &s, 64);
-			//while (isspace(*s)) s++;
-			uint64_t h64 = __builtin_bswap64(*(uint64_t*)hash);
-			//h64 = strtoull(s, &s, 16);
-			while (s[0]!=':' && s[0]!='\0') s++;
-			if(s[0]==':') {
-				s++;
-				name = s;
-				while (isalnum(*s) || *s=='.'|| *s=='_') s++;
-				int len = s - name;
-				// проверить SDNV и загрузить хэш
-				struct gguf_str str = {len, name};
-				int y = _htable_lookup_tensor_info(ctx_gguf->htable, &str, ctx_gguf->infos);
-				if (y>=0) {
-					struct gguf_tensor_info * info = &ctx_gguf->infos[y];
-					uint64_t sdnv = info->sdnv;
-					printf("xxh64:  %016"PRIx64" #%04lx :%.*s\n", h64, sdnv, len, name);	
-					size_t   size = _tensor_info_nbytes(info);
-					uint8_t* data = blk_load(path,  NULL, info->offset+ctx_gguf->offset,  size);
-					uint64_t h = 0;
-					if (data != NULL && (h = xxh64(0, data, size))==h64){
-						//printf("xxh64: %016"PRIx64" %s\n", h, "ok");
-					} else {
-						printf("xxh64: %016"PRIx64" offs=%zu, size=%zu %s\n", h, info->offset, size, "fail");
-					}
-					g_free(data);
-				} else {
-					uint64_t sdnv = ctx_gguf->infos[0].sdnv;
-					fprintf(stderr, "xxh64: #%04lx :`%.*s` -- not found\n", sdnv, len, name);
-				}
-			}
+		enum _hash_alg alg;
+		int bits;
+		if (strncmp(s, "xxh64", 5)==0){
+			alg = HASH_XXH64; bits = 64; s+=6;
 		} else if (strncmp(s, "sha256", 6)==0){
-			s+=7;
-			strtohash(hash, s, &s, 256);
-			while (s[0]!=':' && s[0]!='\0') s++;
-			if(s[0]==':') {
-				s++;
-				name = s;
-				while (isalnum(*s) || *s=='.'|| *s=='_') s++;
-				int len = s - name;
-				// проверить SDNV и загрузить хэш
-				struct gguf_str str = {len, name};
-				int y = _htable_lookup_tensor_info(ctx_gguf->htable, &str, ctx_gguf->infos);
-				if (y>=0) {
-					uint64_t h64 = __builtin_bswap64(*(uint64_t*)hash);
-					struct gguf_tensor_info * info = &ctx_gguf->infos[y];
-					printf("sha256: %016"PRIx64" #%04lx :%.*s\n", h64, info->sdnv, len, name);	
-					size_t size = _tensor_info_nbytes(info);
-					uint8_t* data = blk_load(path,  NULL, info->offset+ctx_gguf->offset,  size);
-					extern void sha256(uint8_t *hash, const uint8_t *data, unsigned int len);
-					sha256(hash, data, size);
-					uint64_t h = __builtin_bswap64(*(uint64_t*)hash);
-					if (data != NULL && h ==h64){
-						// printf("sha256: %016"PRIx64" %s\n", h, "ok");
-					} else {
-						printf("sha256: %016"PRIx64" offs=%zu, size=%zu %s\n", h, info->offset, size, "fail");
-					}
-					g_free(data);
-				}
-			}
-			int len = s - name;
+			alg = HASH_SHA256; bits = 256; s+=7;
 		} else if (strncmp(s, "sha3-256", 8)==0){
-			s+=9;
-			strtohash(hash, s, &s, 256);
+			alg = HASH_NONE; bits = 256; s+=9;// не поддерживается, тензор не проверяется
 		} else {
-			fprintf(stderr, "\n");
-			_Exit(1);
+			fprintf(stderr, "%s: unknown manifest line `%.*s`\n", __func__, (int)strcspn(s, "\n"), s);
+			g_free(entries);
+			return -1;
+		}
+		uint8_t hash[256/8];
+		if (strtohash(hash, s, &s, bits)!=0) {
+			fprintf(stderr, "%s: invalid hash `%.*s`\n", __func__, (int)strcspn(s, "\n"), s);
+			g_free(entries);
+			return -1;
+		}
+		while (s[0]!=':' && s[0]!='\n' && s[0]!='\0') s++;
+		if(s[0]==':') {
+			s++;
+			char* name = s;
+			while (isalnum(*s) || *s=='.'|| *s=='_') s++;
+			int len = s - name;
+			struct gguf_str str = {len, name};
+			int y = _htable_lookup_tensor_info(ctx_gguf->htable, &str, ctx_gguf->infos);
+			if (alg==HASH_NONE) {
+				fprintf(stdout, "{\"tensor\":\"%.*s\",\"status\":\"unverified\",\"alg\":\"sha3-256\"}\n", len, name);
+				n_unverified++;
+			} else
+			if (y>=0) {
+				if (n_entries==n_alloc) {
+					n_alloc += n_alloc;
+					entries = g_renew(struct _hash_entry, entries, n_alloc);
+				}
+				struct _hash_entry * en = &entries[n_entries++];
+				en->info = &ctx_gguf->infos[y];
+				en->alg  = alg;
+				en->status = 0;
+				__builtin_memcpy(en->hash, hash, bits/8);
+			} else {
+				fprintf(stdout, "{\"tensor\":\"%.*s\",\"status\":\"missing\"}\n", len, name);
+				n_missing++;
+			}
 		}
 		// до конца строки
 		while(s[0]!='\0' && s[0]!='\n') s++;
 		if (s[0]=='\n') s++;
 	}
-	return 0;
+	qsort(entries, n_entries, sizeof(struct _hash_entry), _hash_entry_cmp);
+	if (n_threads<=0) n_threads = qnn_pool_size(qnn_pool_default());
+	if (n_threads>n_entries) n_threads = n_entries>0? n_entries: 1;
+
+	struct _hash_verify hv = {.ctx = ctx_gguf, .path = path, .entries = entries, .n_entries = n_entries, .next = 0};
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n_threads = qnn_pool_run(qnn_pool_default(), n_threads, _hash_verify_thread, &hv);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+
+	uint64_t bytes = 0;
+	int n_failed = 0;
+	for (int i=0; i<n_entries; i++) {
+		struct _hash_entry * en = &entries[i];
+		struct gguf_tensor_info * info = en->info;
+		size_t size = _tensor_info_nbytes(info);
+		bytes += size;
+		if (en->status==0) continue;
+		n_failed++;
+		int len = en->alg==HASH_XXH64? 64/8: 256/8;
+		fprintf(stdout, "{\"tensor\":\"%.*s\",\"status\":\"%s\",\"alg\":\"%s\",\"offset\":%"PRIu64",\"size\":%zu", 
+			(int)info->name.n, info->name.data, en->status<0? "read_error": "fail", 
+			en->alg==HASH_XXH64? "xxh64": "sha256", info->offset, size);
+		fprintf(stdout, ",\"expected\":\"");
+		_hash_print(stdout, en->hash, len);
+		fprintf(stdout, "\",\"actual\":\"");
+		_hash_print(stdout, en->res, len);
+		fprintf(stdout, "\"}\n");
+	}
+	fprintf(stdout, "{\"summary\":{\"tensors\":%d,\"failed\":%d,\"missing\":%d,\"unverified\":%d,\"bytes\":%"PRIu64","
+		"\"threads\":%d,\"seconds\":%.3f,\"GBps\":%.2f}}\n",
+		n_entries, n_failed, n_missing, n_unverified, bytes, n_threads, sec, sec>0? bytes/sec*1e-9: 0.0);
+	g_free(entries);
+	return n_failed + n_missing;
+}
+/*! \brief Загрузить таблицу хэшей из файла .manifest и проверить тензоры
+	\see gguf_hash_verify
+ */
+int gguf_hash_load(gguf_cxt_t * ctx_gguf, const char* path, char* data, size_t size)
+{
+	return gguf_hash_verify(ctx_gguf, path, data, size, 0);
 }
 
-
 // ----------------------
 typedef struct _MainOptions MainOptions;
 struct _MainOptions {
@@ -955,6 +1220,7 @@ struct _MainOptions {
 	char* name;// имя параметра для вывода в файл
 
 	int   overwrite;
+	int   threads;	// число потоков проверки манифеста
 	int   verify;	// проверить манифест
 	int   verbose;
 	int   version;
@@ -972,6 +1238,7 @@ static GOptionEntry entries[] =
   { "name", 	'n', 0, G_OPTION_ARG_STRING,   &options.name, "name", "blk.*.attn_k.weight" },
 
   { "overwrite",'O', 0, G_OPTION_ARG_NONE, &options.overwrite, "overwtite output", NULL },
+  { "threads", 	'j', 0, G_OPTION_ARG_INT,  &options.threads, "number of threads", "N" },
   { "verify", 	'V', 0, G_OPTION_ARG_NONE, &options.verify,  "verify manifest", NULL },
   { "verbose", 	'v', 0, G_OPTION_ARG_NONE, &options.verbose, "Be verbose", NULL },
   { "version", 	 0 , 0, G_OPTION_ARG_NONE, &options.version, "program info", NULL },
@@ -989,12 +1256,11 @@ static inline void get_scale_min_k4(int j, const uint8_t * restrict q, uint8_t *
     }
 }
 
-float dequantize_row_q4_K(const block_q4_K * restrict x, float * restrict y, int64_t k) 
+void dequantize_row_q4_K_ref(const block_q4_K * restrict x, float * restrict y, int64_t k) 
 {
 //    assert(k % QK_K == 0);
     const int nb = k / QK_K;
 
-	float y_max = 0;
     for (int i = 0; i < nb; i++) {
         const uint8_t * q = x[i].qs;
 
@@ -1008,17 +1274,14 @@ float dequantize_row_q4_K(const block_q4_K * restrict x, float * restrict y, int
             const float d1 = d * sc; const float m1 = min * m;
             get_scale_min_k4(is + 1, x[i].scales, &sc, &m);
             const float d2 = d * sc; const float m2 = min * m;
-			if (d1>y_max) y_max = d1;
-			if (d2>y_max) y_max = d2;
             for (int l = 0; l < 32; ++l) *y++ = d1*(q[l] & 0xF) + m1;
             for (int l = 0; l < 32; ++l) *y++ = d2*(q[l]  >> 4) + m2;
             q += 32; is += 2;
         }
     }
-	return y_max;
 }
 
-void  dequantize_row_q5_K(const block_q5_K * restrict x, float * restrict y, int64_t k) {
+void  dequantize_row_q5_K_ref(const block_q5_K * restrict x, float * restrict y, int64_t k) {
 //    assert(k % QK_K == 0);
     const int64_t nb = k / QK_K;
 
@@ -1045,7 +1308,7 @@ void  dequantize_row_q5_K(const block_q5_K * restrict x, float * restrict y, int
     }
 }
 
-void dequantize_row_q4_0(const block_q4_0 * restrict x, float * restrict y, int64_t k) {
+void dequantize_row_q4_0_ref(const block_q4_0 * restrict x, float * restrict y, int64_t k) {
     static const int qk = QK4_0;
 
     assert(k % qk == 0);
@@ -1079,10 +1342,8 @@ float dequantize_row_q8_0(const block_q8_0 * restrict x, float * restrict y, int
 		if(d>d_max) d_max = d;
 		if(d<d_min) d_min = d;
 		if(d==0.0f) zero_blk++;
-        for (unsigned j = 0; j < qk; ++j) {
-            y[i*qk + j] = x[i].qs[j]*d;
-        }
     }
+	qnn_dequantize_row(GGML_TYPE_Q8_0)(x, y, nb*qk);
 //	printf("d(%d/%d)=%f %f %f...\n", zero_blk,nb, GGML_FP16_TO_FP32(x[0].d), GGML_FP16_TO_FP32(x[1].d), GGML_FP16_TO_FP32(x[2].d));
 	printf("d(%d/%d)=%f %f ...\n", zero_blk,nb, d_min, d_max);
 	return d_max;
@@ -1104,7 +1365,7 @@ void quantize_row_q8_0_ref(const float * restrict x, block_q8_0 * restrict y, in
         const float d = amax / ((1 << 7) - 1);
         const float id = d ? 1.0f/d : 0.0f;
 
-        y[i].d = GGML_FP32_TO_FP16(d);
+        y[i].d = (ggml_half)d;
 
         for (int j = 0; j < QK8_0; ++j) {
             const float x0 = x[i*QK8_0 + j]*id;
@@ -1137,6 +1398,147 @@ static inline int32_t nearest_int(float fval) {
 	__builtin_memcpy(&i, &val, sizeof(int));
     return (i & 0x007fffff) - 0x00400000;
 }
+/*! \brief Подбор масштаба и смещения для блока n значений, x = scale*L - the_min
+    Перебор nstep вариантов масштаба с уточнением методом взвешенных наименьших квадратов, 
+    как в ggml `make_qkx2_quants()`
+    \param weights - веса ошибки элементов
+    \param L - квантованные значения 0..nmax
+    \param Laux - рабочий буфер n элементов
+    \return масштаб
+ */
+static float make_qkx2_quants(int n, int nmax, const float * restrict x, const float * restrict weights,
+        uint8_t * restrict L, float * restrict the_min, uint8_t * restrict Laux,
+        float rmin, float rdelta, int nstep, bool use_mad) {
+    float min = x[0];
+    float max = x[0];
+    float sum_w = weights[0];
+    float sum_x = sum_w * x[0];
+    for (int i = 1; i < n; ++i) {
+        if (x[i] < min) min = x[i];
+        if (x[i] > max) max = x[i];
+        float w = weights[i];
+        sum_w += w;
+        sum_x += w * x[i];
+    }
+    if (min > 0) min = 0;
+    if (max == min) {
+        for (int i = 0; i < n; ++i) L[i] = 0;
+        *the_min = -min;
+        return 0.f;
+    }
+    float iscale = nmax/(max - min);
+    float scale = 1/iscale;
+    float best_mad = 0;
+    for (int i = 0; i < n; ++i) {
+        int l = nearest_int(iscale*(x[i] - min));
+        L[i] = MAX(0, MIN(nmax, l));
+        float diff = scale * L[i] + min - x[i];
+        diff = use_mad ? fabsf(diff) : diff * diff;
+        best_mad += weights[i] * diff;
+    }
+    if (nstep < 1) {
+        *the_min = -min;
+        return scale;
+    }
+    for (int is = 0; is <= nstep; ++is) {
+        iscale = (rmin + rdelta*is + nmax)/(max - min);
+        float sum_l = 0, sum_l2 = 0, sum_xl = 0;
+        for (int i = 0; i < n; ++i) {
+            int l = nearest_int(iscale*(x[i] - min));
+            l = MAX(0, MIN(nmax, l));
+            Laux[i] = l;
+            float w = weights[i];
+            sum_l  += w*l;
+            sum_l2 += w*l*l;
+            sum_xl += w*l*x[i];
+        }
+        float D = sum_w * sum_l2 - sum_l * sum_l;
+        if (D > 0) {
+            float this_scale = (sum_w * sum_xl - sum_x * sum_l)/D;
+            float this_min   = (sum_l2 * sum_x - sum_l * sum_xl)/D;
+            if (this_min > 0) {
+                this_min = 0;
+                this_scale = sum_xl / sum_l2;
+            }
+            float mad = 0;
+            for (int i = 0; i < n; ++i) {
+                float diff = this_scale * Laux[i] + this_min - x[i];
+                diff = use_mad ? fabsf(diff) : diff * diff;
+                mad += weights[i] * diff;
+            }
+            if (mad < best_mad) {
+                for (int i = 0; i < n; ++i) L[i] = Laux[i];
+                best_mad = mad;
+                scale = this_scale;
+                min = this_min;
+            }
+        }
+    }
+    *the_min = -min;
+    return scale;
+}
+/*! \brief Квантизация строки в формат Q4_K, обратное преобразование dequantize_row_q4_K_ref()
+    Суперблок QK_K=256 из 8 блоков по 32 элемента, масштаб и смещение блока кодируются 6 битами
+ */
+void quantize_row_q4_K_ref(const float * restrict x, block_q4_K * restrict y, int64_t k) {
+    assert(k % QK_K == 0);
+    const int nb = k / QK_K;
+
+    uint8_t L[QK_K];
+    uint8_t Laux[32];
+    float   weights[32];
+    float mins[QK_K/32];
+    float scales[QK_K/32];
+
+    for (int i = 0; i < nb; i++) {
+        float max_scale = 0; // as we are deducting the min, scales are always positive
+        float max_min = 0;
+        for (int j = 0; j < QK_K/32; ++j) {
+            float sum_x2 = 0;
+            for (int l = 0; l < 32; ++l) sum_x2 += x[32*j + l] * x[32*j + l];
+            float av_x = sqrtf(sum_x2/32);
+            for (int l = 0; l < 32; ++l) weights[l] = av_x + fabsf(x[32*j + l]);
+            scales[j] = make_qkx2_quants(32, 15, x + 32*j, weights, L + 32*j, &mins[j], Laux, -1.f, 0.1f, 20, false);
+            if (scales[j] > max_scale) max_scale = scales[j];
+            if (mins[j] > max_min) max_min = mins[j];
+        }
+
+        float inv_scale = max_scale > 0 ? 63.f/max_scale : 0.f;
+        float inv_min   = max_min   > 0 ? 63.f/max_min   : 0.f;
+        for (int j = 0; j < QK_K/32; ++j) {
+            uint8_t ls = MIN(63, nearest_int(inv_scale*scales[j]));
+            uint8_t lm = MIN(63, nearest_int(inv_min*mins[j]));
+            if (j < 4) {
+                y[i].scales[j] = ls;
+                y[i].scales[j+4] = lm;
+            } else {
+                y[i].scales[j+4] = (ls & 0xF) | ((lm & 0xF) << 4);
+                y[i].scales[j-4] |= ((ls >> 4) << 6);
+                y[i].scales[j-0] |= ((lm >> 4) << 6);
+            }
+        }
+        y[i].d    = (ggml_half)(max_scale/63.f);
+        y[i].dmin = (ggml_half)(max_min/63.f);
+
+        uint8_t sc, m;
+        for (int j = 0; j < QK_K/32; ++j) {// повторная квантизация с округленными масштабами
+            get_scale_min_k4(j, y[i].scales, &sc, &m);
+            const float d = GGML_FP16_TO_FP32(y[i].d) * sc;
+            if (!d) continue;
+            const float dm = GGML_FP16_TO_FP32(y[i].dmin) * m;
+            for (int ii = 0; ii < 32; ++ii) {
+                int l = nearest_int((x[32*j + ii] + dm)/d);
+                L[32*j + ii] = MAX(0, MIN(15, l));
+            }
+        }
+        uint8_t * q = y[i].qs;
+        for (int j = 0; j < QK_K; j += 64) {
+            for (int l = 0; l < 32; ++l) q[l] = L[j + l] | (L[j + l + 32] << 4);
+            q += 32;
+        }
+        x += QK_K;
+    }
+}
 
 /* Теория 
 1. квантизация выполняется по блокам 32 значения или по плитке 16x16 (K тип). Квантизация может быть двумерная.
@@ -1412,38 +1814,1224 @@ float dot_q8_K_q8_K(const block_q8_K * restrict x, const block_q8_K * restrict y
 	}
 	return sum;
 }
-void  dequantize_row_q8_K(const block_q8_K * restrict x, float * restrict y, int64_t n) {
+void  dequantize_row_q8_K_ref(const block_q8_K * restrict x, float * restrict y, int64_t n) {
     assert(n % Q8K_K == 0);
     const int nb = n / Q8K_K;
-    for (int i = 0; i < nb; i++)
+    for (int i = 0; i < nb; i++) {
+        const float d = GGML_FP16_TO_FP32(x[i].d);
         for (int j = 0; j < Q8K_K; ++j)
-            *y++ = x[i].d *x[i].qs[j];
+            *y++ = d *x[i].qs[j];
+    }
 }
-void  dequantize_row_q2_0(const block_q2_0 * restrict x, float * restrict y, int64_t n) {
+void  dequantize_row_q2_0_ref(const block_q2_0 * restrict x, float * restrict y, int64_t n) {
     assert(n % QK2_0 == 0);
     const int nb = n / QK2_0;
     for (int i = 0; i < nb; i++){// по числу блоков	
+        const float d = GGML_FP16_TO_FP32(x[i].d);
 		for (int l = 0; l < 4; l++)
 			for (int j = 0; j < QK2_0/4; ++j) {// -1, 0, 1 <= 0, 1, 2 
 				// Intel DPAS: Signed 2-bits     | [-2, 1]     |  0x04  | s2
-				*y++ = x[i].d *(((x[i].qs[j] >> (l*2)) & 3u) - 1u);
+				*y++ = d *((int)((x[i].qs[j] >> (l*2)) & 3u) - 1);
 			}
 	}
 }
-/*! 
-	\todo оптимизацию под AVX512_BF16 и простой вариант под AVX512F
+/*! \brief Векторные версии распаковки блоков GGUF
+
+	Версии для AVX2 и AVX-512 компилируются с атрибутом target и выбираются во время исполнения
+	по возможностям процессора, см. qnn_dequantize_row(). Результат совпадает побитно со скалярной
+	версией `_ref`, порядок операций умножения и сложения сохраняется. Проверка и замер скорости
+	см. TEST_DEQUANT.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TARGET_AVX2   __attribute__((target("avx2,fma,f16c")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,fma,f16c")))
+
+static inline TARGET_AVX2 __m256 _u8x8_to_ps(__m128i v){
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+}
+static inline TARGET_AVX2 __m256 _i8x8_to_ps(__m128i v){
+	return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v));
+}
+static inline TARGET_AVX512 __m512 _u8x16_to_ps(__m128i v){
+	return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(v));
+}
+static inline TARGET_AVX512 __m512 _i8x16_to_ps(__m128i v){
+	return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(v));
+}
+/*! \brief распаковка шкал и смещений 6 бит для 8 подблоков q4_K, q5_K */
+static inline void _scale_min_k4(const block_q4_K * x, float * d, float * m, float dmin_sign){
+	const float d0  = GGML_FP16_TO_FP32(x->d);
+	const float min = dmin_sign*GGML_FP16_TO_FP32(x->dmin);
+	uint8_t sc, mn;
+	for (int is = 0; is < QK_K/32; is++) {
+		get_scale_min_k4(is, x->scales, &sc, &mn);
+		d[is] = d0 * sc; m[is] = min * mn;
+	}
+}
+// --- AVX2 ---
+static TARGET_AVX2 void dequantize_row_q8_0_avx2(const block_q8_0 * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK8_0;
+	for (int i = 0; i < nb; i++, y += QK8_0) {
+		const __m256 d = _mm256_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		for (int j = 0; j < QK8_0; j += 8)
+			_mm256_storeu_ps(y+j, _mm256_mul_ps(_i8x8_to_ps(_mm_loadl_epi64((const __m128i*)(x[i].qs+j))), d));
+	}
+}
+static TARGET_AVX2 void dequantize_row_q4_0_avx2(const block_q4_0 * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK4_0;
+	const __m128i m4 = _mm_set1_epi8(0xF);
+	const __m256  c8 = _mm256_set1_ps(8.0f);
+	for (int i = 0; i < nb; i++, y += QK4_0) {
+		const __m256 d = _mm256_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		__m128i q  = _mm_loadu_si128((const __m128i*)x[i].qs);
+		__m128i lo = _mm_and_si128(q, m4);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(q, 4), m4);
+		_mm256_storeu_ps(y+ 0, _mm256_mul_ps(_mm256_sub_ps(_u8x8_to_ps(lo), c8), d));
+		_mm256_storeu_ps(y+ 8, _mm256_mul_ps(_mm256_sub_ps(_u8x8_to_ps(_mm_srli_si128(lo, 8)), c8), d));
+		_mm256_storeu_ps(y+16, _mm256_mul_ps(_mm256_sub_ps(_u8x8_to_ps(hi), c8), d));
+		_mm256_storeu_ps(y+24, _mm256_mul_ps(_mm256_sub_ps(_u8x8_to_ps(_mm_srli_si128(hi, 8)), c8), d));
+	}
+}
+static TARGET_AVX2 void dequantize_row_q8_K_avx2(const block_q8_K * restrict x, float * restrict y, int64_t k){
+	const int nb = k / Q8K_K;
+	for (int i = 0; i < nb; i++, y += Q8K_K) {
+		const __m256 d = _mm256_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		for (int j = 0; j < Q8K_K; j += 8)
+			_mm256_storeu_ps(y+j, _mm256_mul_ps(d, _u8x8_to_ps(_mm_loadl_epi64((const __m128i*)(x[i].qs+j)))));
+	}
+}
+static TARGET_AVX2 void dequantize_row_q2_0_avx2(const block_q2_0 * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK2_0;
+	const __m256i m3 = _mm256_set1_epi32(3);
+	const __m256i c1 = _mm256_set1_epi32(1);
+	for (int i = 0; i < nb; i++, y += QK2_0) {
+		const __m256 d = _mm256_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		__m256i q = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)x[i].qs));
+		for (int l = 0; l < 4; l++) {
+			__m256i v = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(q, 2*l), m3), c1);
+			_mm256_storeu_ps(y+8*l, _mm256_mul_ps(d, _mm256_cvtepi32_ps(v)));
+		}
+	}
+}
+static TARGET_AVX2 void dequantize_row_q4_K_avx2(const block_q4_K * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK_K;
+	const __m256i m4 = _mm256_set1_epi8(0xF);
+	float d[QK_K/32], m[QK_K/32];
+	for (int i = 0; i < nb; i++) {
+		_scale_min_k4(&x[i], d, m, -1.0f);
+		const uint8_t * q = x[i].qs;
+		for (int j = 0; j < QK_K/64; j++, q += 32, y += 64) {
+			__m256i qv = _mm256_loadu_si256((const __m256i*)q);
+			__m256i lo = _mm256_and_si256(qv, m4);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(qv, 4), m4);
+			const __m256 d1 = _mm256_set1_ps(d[2*j+0]), m1 = _mm256_set1_ps(m[2*j+0]);
+			const __m256 d2 = _mm256_set1_ps(d[2*j+1]), m2 = _mm256_set1_ps(m[2*j+1]);
+			for (int l = 0; l < 4; l++) {
+				__m128i l8 = l<2? _mm256_castsi256_si128(lo): _mm256_extracti128_si256(lo, 1);
+				__m128i h8 = l<2? _mm256_castsi256_si128(hi): _mm256_extracti128_si256(hi, 1);
+				if (l&1) { l8 = _mm_srli_si128(l8, 8); h8 = _mm_srli_si128(h8, 8); }
+				_mm256_storeu_ps(y+ 0+8*l, _mm256_add_ps(_mm256_mul_ps(d1, _u8x8_to_ps(l8)), m1));
+				_mm256_storeu_ps(y+32+8*l, _mm256_add_ps(_mm256_mul_ps(d2, _u8x8_to_ps(h8)), m2));
+			}
+		}
+	}
+}
+static TARGET_AVX2 void dequantize_row_q5_K_avx2(const block_q5_K * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK_K;
+	const __m256i m4  = _mm256_set1_epi8(0xF);
+	const __m256i b16 = _mm256_set1_epi8(16);
+	float d[QK_K/32], m[QK_K/32];
+	for (int i = 0; i < nb; i++) {
+		_scale_min_k4((const block_q4_K*)&x[i], d, m, 1.0f);
+		const uint8_t * q = x[i].qs;
+		const __m256i qh = _mm256_loadu_si256((const __m256i*)x[i].qh);
+		for (int j = 0; j < QK_K/64; j++, q += 32, y += 64) {
+			__m256i qv = _mm256_loadu_si256((const __m256i*)q);
+			// старший бит: (qh >> 2j)&1 -> 16, (qh >> 2j+1)&1 -> 16
+			__m256i u1 = _mm256_set1_epi8(1<<(2*j)), u2 = _mm256_set1_epi8(2<<(2*j));
+			__m256i lo = _mm256_or_si256(_mm256_and_si256(qv, m4),
+				_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(qh, u1), u1), b16));
+			__m256i hi = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qv, 4), m4),
+				_mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(qh, u2), u2), b16));
+			const __m256 d1 = _mm256_set1_ps(d[2*j+0]), m1 = _mm256_set1_ps(m[2*j+0]);
+			const __m256 d2 = _mm256_set1_ps(d[2*j+1]), m2 = _mm256_set1_ps(m[2*j+1]);
+			for (int l = 0; l < 4; l++) {
+				__m128i l8 = l<2? _mm256_castsi256_si128(lo): _mm256_extracti128_si256(lo, 1);
+				__m128i h8 = l<2? _mm256_castsi256_si128(hi): _mm256_extracti128_si256(hi, 1);
+				if (l&1) { l8 = _mm_srli_si128(l8, 8); h8 = _mm_srli_si128(h8, 8); }
+				_mm256_storeu_ps(y+ 0+8*l, _mm256_sub_ps(_mm256_mul_ps(d1, _u8x8_to_ps(l8)), m1));
+				_mm256_storeu_ps(y+32+8*l, _mm256_sub_ps(_mm256_mul_ps(d2, _u8x8_to_ps(h8)), m2));
+			}
+		}
+	}
+}
+// --- AVX-512 ---
+static TARGET_AVX512 void dequantize_row_q8_0_avx512(const block_q8_0 * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK8_0;
+	for (int i = 0; i < nb; i++, y += QK8_0) {
+		const __m512 d = _mm512_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		_mm512_storeu_ps(y+ 0, _mm512_mul_ps(_i8x16_to_ps(_mm_loadu_si128((const __m128i*)(x[i].qs+ 0))), d));
+		_mm512_storeu_ps(y+16, _mm512_mul_ps(_i8x16_to_ps(_mm_loadu_si128((const __m128i*)(x[i].qs+16))), d));
+	}
+}
+static TARGET_AVX512 void dequantize_row_q4_0_avx512(const block_q4_0 * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK4_0;
+	const __m128i m4 = _mm_set1_epi8(0xF);
+	const __m512  c8 = _mm512_set1_ps(8.0f);
+	for (int i = 0; i < nb; i++, y += QK4_0) {
+		const __m512 d = _mm512_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		__m128i q = _mm_loadu_si128((const __m128i*)x[i].qs);
+		_mm512_storeu_ps(y+ 0, _mm512_mul_ps(_mm512_sub_ps(_u8x16_to_ps(_mm_and_si128(q, m4)), c8), d));
+		_mm512_storeu_ps(y+16, _mm512_mul_ps(_mm512_sub_ps(_u8x16_to_ps(_mm_and_si128(_mm_srli_epi16(q, 4), m4)), c8), d));
+	}
+}
+static TARGET_AVX512 void dequantize_row_q8_K_avx512(const block_q8_K * restrict x, float * restrict y, int64_t k){
+	const int nb = k / Q8K_K;
+	for (int i = 0; i < nb; i++, y += Q8K_K) {
+		const __m512 d = _mm512_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		_mm512_storeu_ps(y+ 0, _mm512_mul_ps(d, _u8x16_to_ps(_mm_loadu_si128((const __m128i*)(x[i].qs+ 0)))));
+		_mm512_storeu_ps(y+16, _mm512_mul_ps(d, _u8x16_to_ps(_mm_loadu_si128((const __m128i*)(x[i].qs+16)))));
+	}
+}
+static TARGET_AVX512 void dequantize_row_q2_0_avx512(const block_q2_0 * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK2_0;
+	const __m512i m3 = _mm512_set1_epi32(3);
+	const __m512i c1 = _mm512_set1_epi32(1);
+	// сдвиги для элементов l*8+j: первая половина l=0,1, вторая l=2,3
+	const __m512i s0 = _mm512_set_epi32(2,2,2,2,2,2,2,2, 0,0,0,0,0,0,0,0);
+	const __m512i s1 = _mm512_set_epi32(6,6,6,6,6,6,6,6, 4,4,4,4,4,4,4,4);
+	for (int i = 0; i < nb; i++, y += QK2_0) {
+		const __m512 d = _mm512_set1_ps(GGML_FP16_TO_FP32(x[i].d));
+		__m128i q8 = _mm_loadl_epi64((const __m128i*)x[i].qs);
+		__m512i q  = _mm512_cvtepu8_epi32(_mm_unpacklo_epi64(q8, q8));
+		__m512i v0 = _mm512_sub_epi32(_mm512_and_si512(_mm512_srlv_epi32(q, s0), m3), c1);
+		__m512i v1 = _mm512_sub_epi32(_mm512_and_si512(_mm512_srlv_epi32(q, s1), m3), c1);
+		_mm512_storeu_ps(y+ 0, _mm512_mul_ps(d, _mm512_cvtepi32_ps(v0)));
+		_mm512_storeu_ps(y+16, _mm512_mul_ps(d, _mm512_cvtepi32_ps(v1)));
+	}
+}
+static TARGET_AVX512 void dequantize_row_q4_K_avx512(const block_q4_K * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK_K;
+	const __m256i m4 = _mm256_set1_epi8(0xF);
+	float d[QK_K/32], m[QK_K/32];
+	for (int i = 0; i < nb; i++) {
+		_scale_min_k4(&x[i], d, m, -1.0f);
+		const uint8_t * q = x[i].qs;
+		for (int j = 0; j < QK_K/64; j++, q += 32, y += 64) {
+			__m256i qv = _mm256_loadu_si256((const __m256i*)q);
+			__m256i lo = _mm256_and_si256(qv, m4);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(qv, 4), m4);
+			const __m512 d1 = _mm512_set1_ps(d[2*j+0]), m1 = _mm512_set1_ps(m[2*j+0]);
+			const __m512 d2 = _mm512_set1_ps(d[2*j+1]), m2 = _mm512_set1_ps(m[2*j+1]);
+			_mm512_storeu_ps(y+ 0, _mm512_add_ps(_mm512_mul_ps(d1, _u8x16_to_ps(_mm256_castsi256_si128(lo))), m1));
+			_mm512_storeu_ps(y+16, _mm512_add_ps(_mm512_mul_ps(d1, _u8x16_to_ps(_mm256_extracti128_si256(lo, 1))), m1));
+			_mm512_storeu_ps(y+32, _mm512_add_ps(_mm512_mul_ps(d2, _u8x16_to_ps(_mm256_castsi256_si128(hi))), m2));
+			_mm512_storeu_ps(y+48, _mm512_add_ps(_mm512_mul_ps(d2, _u8x16_to_ps(_mm256_extracti128_si256(hi, 1))), m2));
+		}
+	}
+}
+static TARGET_AVX512 void dequantize_row_q5_K_avx512(const block_q5_K * restrict x, float * restrict y, int64_t k){
+	const int nb = k / QK_K;
+	const __m256i m4  = _mm256_set1_epi8(0xF);
+	const __m256i b16 = _mm256_set1_epi8(16);
+	float d[QK_K/32], m[QK_K/32];
+	for (int i = 0; i < nb; i++) {
+		_scale_min_k4((const block_q4_K*)&x[i], d, m, 1.0f);
+		const uint8_t * q = x[i].qs;
+		const __m256i qh = _mm256_loadu_si256((const __m256i*)x[i].qh);
+		for (int j = 0; j < QK_K/64; j++, q += 32, y += 64) {
+			__m256i qv = _mm256_loadu_si256((const __m256i*)q);
+			// маска старшего бита сразу формирует слагаемое 16
+			__m256i lo = _mm256_or_si256(_mm256_and_si256(qv, m4),
+				_mm256_maskz_mov_epi8(_mm256_test_epi8_mask(qh, _mm256_set1_epi8(1<<(2*j))), b16));
+			__m256i hi = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qv, 4), m4),
+				_mm256_maskz_mov_epi8(_mm256_test_epi8_mask(qh, _mm256_set1_epi8(2<<(2*j))), b16));
+			const __m512 d1 = _mm512_set1_ps(d[2*j+0]), m1 = _mm512_set1_ps(m[2*j+0]);
+			const __m512 d2 = _mm512_set1_ps(d[2*j+1]), m2 = _mm512_set1_ps(m[2*j+1]);
+			_mm512_storeu_ps(y+ 0, _mm512_sub_ps(_mm512_mul_ps(d1, _u8x16_to_ps(_mm256_castsi256_si128(lo))), m1));
+			_mm512_storeu_ps(y+16, _mm512_sub_ps(_mm512_mul_ps(d1, _u8x16_to_ps(_mm256_extracti128_si256(lo, 1))), m1));
+			_mm512_storeu_ps(y+32, _mm512_sub_ps(_mm512_mul_ps(d2, _u8x16_to_ps(_mm256_castsi256_si128(hi))), m2));
+			_mm512_storeu_ps(y+48, _mm512_sub_ps(_mm512_mul_ps(d2, _u8x16_to_ps(_mm256_extracti128_si256(hi, 1))), m2));
+		}
+	}
+}
+// --- Скалярное произведение квантованных строк на активации block_q8_1 ---
+#define TARGET_AVX512_VNNI __attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni,avx2,fma,f16c")))
+#define VEC_DOT_NC 4// число столбцов активаций на одну распаковку блока весов
+#define INLINE_ALWAYS inline __attribute__((always_inline))
+static inline TARGET_AVX2 float _hsum_ps256(__m256 v){
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_movehdup_ps(s));
+	return _mm_cvtss_f32(s);
+}
+/*! \brief сумма попарных произведений u8 x s8 в 8 x int32, без VNNI 
+	\note произведения складываются в int16 с насыщением, u*s*2 должно быть меньше 2^15
+ */
+static inline TARGET_AVX2 __m256i _dot_u8i8_avx2(__m256i u, __m256i s){
+	return _mm256_madd_epi16(_mm256_maddubs_epi16(u, s), _mm256_set1_epi16(1));
+}
+/*! \brief Разбиение столбцов активаций на группы по VEC_DOT_NC и остаток по одному
+	
+	Ядро _cols вызывается с постоянным NC, после подстановки аккумуляторы группы остаются в регистрах.
+ */
+#define VEC_DOT_COLS(_cols, block_t) \
+	for (int r = 0; r < nr; r++) { \
+		const block_t * x = (const block_t *)((const uint8_t*)vx + r*bx); \
+		int c = 0; \
+		for (; c + VEC_DOT_NC <= nc; c += VEC_DOT_NC) \
+			_cols(n, s + r + c*bs, bs, x, (const uint8_t*)vy + c*by, by, VEC_DOT_NC); \
+		for (; c < nc; c++) \
+			_cols(n, s + r + c*bs, bs, x, (const uint8_t*)vy + c*by, by, 1); \
+	}
+
+static INLINE_ALWAYS TARGET_AVX2 void _vec_dot_q8_0_cols_avx2(int64_t n, float * s, size_t bs, const block_q8_0 * x, const void * vy, size_t by, const int NC){
+	const int nb = n / QK8_0;
+	__m256 acc[VEC_DOT_NC];
+	for (int c = 0; c < NC; c++) acc[c] = _mm256_setzero_ps();
+	for (int i = 0; i < nb; i++) {
+		__m256i qx = _mm256_loadu_si256((const __m256i*)x[i].qs);
+		__m256i ux = _mm256_sign_epi8(qx, qx);
+		const float dx = GGML_FP16_TO_FP32(x[i].d);
+		for (int c = 0; c < NC; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i;
+			// знак переносится на активации: |x|*sign(y,x)
+			__m256i p = _dot_u8i8_avx2(ux, _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)y->qs), qx));
+			acc[c] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_set1_ps(dx*GGML_FP16_TO_FP32(y->d)), acc[c]);
+		}
+	}
+	for (int c = 0; c < NC; c++) s[c*bs] = _hsum_ps256(acc[c]);
+}
+static TARGET_AVX2 void vec_dot_q8_0_q8_1_avx2(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	VEC_DOT_COLS(_vec_dot_q8_0_cols_avx2, block_q8_0)
+}
+static INLINE_ALWAYS TARGET_AVX2 void _vec_dot_q4_K_cols_avx2(int64_t n, float * s, size_t bs, const block_q4_K * x, const void * vy, size_t by, const int NC){
+	const int nb = n / QK_K;
+	const __m256i m4 = _mm256_set1_epi8(0xF);
+	__m256 acc[VEC_DOT_NC];
+	float sum_m[VEC_DOT_NC];
+	for (int c = 0; c < NC; c++) acc[c] = _mm256_setzero_ps(), sum_m[c] = 0;
+	for (int i = 0; i < nb; i++) {
+		float d[QK_K/32], m[QK_K/32];
+		_scale_min_k4(&x[i], d, m, 1.0f);
+		const uint8_t * q = x[i].qs;
+		for (int j = 0; j < QK_K/64; j++, q += 32) {
+			__m256i qv = _mm256_loadu_si256((const __m256i*)q);
+			__m256i q0 = _mm256_and_si256(qv, m4);
+			__m256i q1 = _mm256_and_si256(_mm256_srli_epi16(qv, 4), m4);
+			for (int c = 0; c < NC; c++) {
+				const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i*(QK_K/QK8_1) + 2*j;
+				__m256i p0 = _dot_u8i8_avx2(q0, _mm256_loadu_si256((const __m256i*)y[0].qs));
+				__m256i p1 = _dot_u8i8_avx2(q1, _mm256_loadu_si256((const __m256i*)y[1].qs));
+				acc[c] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p0), _mm256_set1_ps(d[2*j+0]*GGML_FP16_TO_FP32(y[0].d)), acc[c]);
+				acc[c] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p1), _mm256_set1_ps(d[2*j+1]*GGML_FP16_TO_FP32(y[1].d)), acc[c]);
+			}
+		}
+		for (int c = 0; c < NC; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i*(QK_K/QK8_1);
+			for (int is = 0; is < QK_K/32; is++)
+				sum_m[c] += m[is]*GGML_FP16_TO_FP32(y[is].s);
+		}
+	}
+	for (int c = 0; c < NC; c++) s[c*bs] = _hsum_ps256(acc[c]) - sum_m[c];
+}
+static TARGET_AVX2 void vec_dot_q4_K_q8_1_avx2(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	VEC_DOT_COLS(_vec_dot_q4_K_cols_avx2, block_q4_K)
+}
+static INLINE_ALWAYS TARGET_AVX2 void _vec_dot_q8_K_cols_avx2(int64_t n, float * s, size_t bs, const block_q8_K * x, const void * vy, size_t by, const int NC){
+	const int nb = n / Q8K_K;
+	const __m256i m7 = _mm256_set1_epi8(0x7F);
+	const __m256i b1 = _mm256_set1_epi8(1);
+	__m256 acc[VEC_DOT_NC];
+	for (int c = 0; c < NC; c++) acc[c] = _mm256_setzero_ps();
+	for (int i = 0; i < nb; i++) {
+		// u8 = (u & 0x7F) + 128*(u>>7), иначе переполнение maddubs
+		__m256i qx = _mm256_loadu_si256((const __m256i*)x[i].qs);
+		__m256i lo = _mm256_and_si256(qx, m7);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(qx, 7), b1);
+		const float dx = GGML_FP16_TO_FP32(x[i].d);
+		for (int c = 0; c < NC; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i;
+			__m256i qy = _mm256_loadu_si256((const __m256i*)y->qs);
+			__m256i p  = _mm256_add_epi32(_dot_u8i8_avx2(lo, qy), _mm256_slli_epi32(_dot_u8i8_avx2(hi, qy), 7));
+			acc[c] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_set1_ps(dx*GGML_FP16_TO_FP32(y->d)), acc[c]);
+		}
+	}
+	for (int c = 0; c < NC; c++) s[c*bs] = _hsum_ps256(acc[c]);
+}
+static TARGET_AVX2 void vec_dot_q8_K_q8_1_avx2(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	VEC_DOT_COLS(_vec_dot_q8_K_cols_avx2, block_q8_K)
+}
+static INLINE_ALWAYS TARGET_AVX512_VNNI void _vec_dot_q8_0_cols_vnni(int64_t n, float * s, size_t bs, const block_q8_0 * x, const void * vy, size_t by, const int NC){
+	const int nb = n / QK8_0;
+	__m256 acc[VEC_DOT_NC];
+	for (int c = 0; c < NC; c++) acc[c] = _mm256_setzero_ps();
+	for (int i = 0; i < nb; i++) {
+		__m256i qx = _mm256_loadu_si256((const __m256i*)x[i].qs);
+		__m256i ux = _mm256_abs_epi8(qx);
+		const float dx = GGML_FP16_TO_FP32(x[i].d);
+		for (int c = 0; c < NC; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i;
+			__m256i p = _mm256_dpbusd_epi32(_mm256_setzero_si256(), ux, 
+				_mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)y->qs), qx));
+			acc[c] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_set1_ps(dx*GGML_FP16_TO_FP32(y->d)), acc[c]);
+		}
+	}
+	for (int c = 0; c < NC; c++) s[c*bs] = _hsum_ps256(acc[c]);
+}
+static TARGET_AVX512_VNNI void vec_dot_q8_0_q8_1_vnni(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	VEC_DOT_COLS(_vec_dot_q8_0_cols_vnni, block_q8_0)
+}
+static INLINE_ALWAYS TARGET_AVX512_VNNI void _vec_dot_q4_K_cols_vnni(int64_t n, float * s, size_t bs, const block_q4_K * x, const void * vy, size_t by, const int NC){
+	const int nb = n / QK_K;
+	const __m512i m4 = _mm512_set1_epi8(0xF);
+	__m512 acc[VEC_DOT_NC];
+	float sum_m[VEC_DOT_NC];
+	for (int c = 0; c < NC; c++) acc[c] = _mm512_setzero_ps(), sum_m[c] = 0;
+	for (int i = 0; i < nb; i++) {
+		float d[QK_K/32], m[QK_K/32];
+		_scale_min_k4(&x[i], d, m, 1.0f);
+		const uint8_t * q = x[i].qs;
+		for (int j = 0; j < QK_K/64; j++, q += 32) {
+			// младшие тетрады - подблок 2j, старшие - 2j+1, в одном 512 битном векторе
+			__m256i qv = _mm256_loadu_si256((const __m256i*)q);
+			__m512i qx = _mm512_and_si512(_mm512_inserti64x4(_mm512_castsi256_si512(qv), _mm256_srli_epi16(qv, 4), 1), m4);
+			for (int c = 0; c < NC; c++) {
+				const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i*(QK_K/QK8_1) + 2*j;
+				__m512i qy = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i*)y[0].qs)),
+				                                _mm256_loadu_si256((const __m256i*)y[1].qs), 1);
+				__m512i p  = _mm512_dpbusd_epi32(_mm512_setzero_si512(), qx, qy);
+				__m512  dv = _mm512_mask_blend_ps(0xFF00, _mm512_set1_ps(d[2*j+0]*GGML_FP16_TO_FP32(y[0].d)),
+				                                          _mm512_set1_ps(d[2*j+1]*GGML_FP16_TO_FP32(y[1].d)));
+				acc[c] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(p), dv, acc[c]);
+			}
+		}
+		for (int c = 0; c < NC; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i*(QK_K/QK8_1);
+			for (int is = 0; is < QK_K/32; is++)
+				sum_m[c] += m[is]*GGML_FP16_TO_FP32(y[is].s);
+		}
+	}
+	for (int c = 0; c < NC; c++) s[c*bs] = _mm512_reduce_add_ps(acc[c]) - sum_m[c];
+}
+static TARGET_AVX512_VNNI void vec_dot_q4_K_q8_1_vnni(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	VEC_DOT_COLS(_vec_dot_q4_K_cols_vnni, block_q4_K)
+}
+static INLINE_ALWAYS TARGET_AVX512_VNNI void _vec_dot_q8_K_cols_vnni(int64_t n, float * s, size_t bs, const block_q8_K * x, const void * vy, size_t by, const int NC){
+	const int nb = n / Q8K_K;
+	__m256 acc[VEC_DOT_NC];
+	for (int c = 0; c < NC; c++) acc[c] = _mm256_setzero_ps();
+	for (int i = 0; i < nb; i++) {
+		__m256i qx = _mm256_loadu_si256((const __m256i*)x[i].qs);
+		const float dx = GGML_FP16_TO_FP32(x[i].d);
+		for (int c = 0; c < NC; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by) + i;
+			__m256i p = _mm256_dpbusd_epi32(_mm256_setzero_si256(), qx, _mm256_loadu_si256((const __m256i*)y->qs));
+			acc[c] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_set1_ps(dx*GGML_FP16_TO_FP32(y->d)), acc[c]);
+		}
+	}
+	for (int c = 0; c < NC; c++) s[c*bs] = _hsum_ps256(acc[c]);
+}
+static TARGET_AVX512_VNNI void vec_dot_q8_K_q8_1_vnni(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	VEC_DOT_COLS(_vec_dot_q8_K_cols_vnni, block_q8_K)
+}
+#undef VEC_DOT_COLS
+#endif
+//!< таблица версий распаковки по набору инструкций QNN_ISA_*
+static const struct {
+	enum ggml_type type;
+	qnn_dequantize_row_t isa[QNN_ISA_COUNT];
+} _dequantize_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+#define DEQUANT_KERNEL(T, t) {GGML_TYPE_##T, {(qnn_dequantize_row_t)dequantize_row_##t##_ref, \
+	(qnn_dequantize_row_t)dequantize_row_##t##_avx2, (qnn_dequantize_row_t)dequantize_row_##t##_avx512, \
+	(qnn_dequantize_row_t)dequantize_row_##t##_avx512, (qnn_dequantize_row_t)dequantize_row_##t##_avx512}}
+#else
+#define DEQUANT_KERNEL(T, t) {GGML_TYPE_##T, {(qnn_dequantize_row_t)dequantize_row_##t##_ref}}
+#endif
+	DEQUANT_KERNEL(Q8_0, q8_0),
+	DEQUANT_KERNEL(Q4_0, q4_0),
+	DEQUANT_KERNEL(Q4_K, q4_K),
+	DEQUANT_KERNEL(Q5_K, q5_K),
+	DEQUANT_KERNEL(Q8_K, q8_K),
+	DEQUANT_KERNEL(Q2_0, q2_0),
+#undef DEQUANT_KERNEL
+};
+static qnn_dequantize_row_t _dequantize_row[GGML_TYPE_COUNT];
+/*! \brief Определить доступный набор инструкций */
+int qnn_cpu_isa(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+		if (__builtin_cpu_supports("avx512vnni"))
+			return __builtin_cpu_supports("avx512bf16")? QNN_ISA_AVX512_BF16: QNN_ISA_AVX512_VNNI;
+		return QNN_ISA_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return QNN_ISA_AVX2;
+#endif
+	return QNN_ISA_GENERIC;
+}
+/*! \brief Версия распаковки для заданного набора инструкций, используется для проверки и замеров
+	\return NULL если тип или набор инструкций не поддерживается
+ */
+qnn_dequantize_row_t qnn_dequantize_row_isa(enum ggml_type type, int isa)
+{
+	for (int i = 0; i < sizeof(_dequantize_kernels)/sizeof(_dequantize_kernels[0]); i++)
+		if (_dequantize_kernels[i].type == type)
+			return isa < QNN_ISA_COUNT? _dequantize_kernels[i].isa[isa]: NULL;
+	return NULL;
+}
+/*! \brief Квантизация строки активаций в блоки Q8_1 для произведения с квантованными весами
+	
+	Значения округляются в диапазон [-127, 127], чтобы при переносе знака весов на активации 
+	(\see vec_dot_q8_0_q8_1) не возникало переполнения. Поле s хранит d*sum(qs) для учета смещения 
+	весов Q4_K.
+ */
+void quantize_row_q8_1(const float * restrict x, block_q8_1 * restrict y, int64_t k) {
+    assert(k % QK8_1 == 0);
+    const int nb = k / QK8_1;
+    for (int i = 0; i < nb; i++, x += QK8_1) {
+        float amax = 0.0f;
+        for (int j = 0; j < QK8_1; j++)
+            amax = MAX(amax, fabsf(x[j]));
+        const float d  = amax / ((1 << 7) - 1);
+        const float id = d ? 1.0f/d : 0.0f;
+        int sum = 0;
+        for (int j = 0; j < QK8_1; ++j) {
+            y[i].qs[j] = nearest_int(x[j]*id);
+            sum += y[i].qs[j];
+        }
+        y[i].d = (ggml_half)d;
+        y[i].s = (ggml_half)(d*sum);
+    }
+}
+/*! \brief Скалярное произведение nr строк весов Q8_0 на nc столбцов активаций Q8_1
+	\param n длина строки
+	\param s результат, s[r + c*bs]
+	\param vx строки весов с шагом bx байт
+	\param vy столбцы активаций по n/QK8_1 блоков с шагом by байт
+ */
+void vec_dot_q8_0_q8_1_ref(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	const int nb = n / QK8_0;
+	for (int r = 0; r < nr; r++) {
+		const block_q8_0 * x = (const block_q8_0 *)((const uint8_t*)vx + r*bx);
+		for (int c = 0; c < nc; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by);
+			float sum = 0;
+			for (int i = 0; i < nb; i++) {
+				int32_t isum = 0;
+				for (int j = 0; j < QK8_0; j++)
+					isum += x[i].qs[j]*y[i].qs[j];
+				sum += GGML_FP16_TO_FP32(x[i].d)*GGML_FP16_TO_FP32(y[i].d)*isum;
+			}
+			s[r + c*bs] = sum;
+		}
+	}
+}
+/*! \brief Скалярное произведение строк Q4_K на активации Q8_1
+	
+	x = d*sc*q - dmin*m, поэтому по каждому подблоку: d*sc*dy*sum(q*qy) - dmin*m*(dy*sum(qy)),
+	вторая сумма хранится в активациях в поле s.
+ */
+void vec_dot_q4_K_q8_1_ref(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	const int nb = n / QK_K;
+	for (int r = 0; r < nr; r++) {
+		const block_q4_K * x = (const block_q4_K *)((const uint8_t*)vx + r*bx);
+		for (int c = 0; c < nc; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by);
+			float sum = 0;
+			for (int i = 0; i < nb; i++, y += QK_K/QK8_1) {
+				const float d    = GGML_FP16_TO_FP32(x[i].d);
+				const float dmin = GGML_FP16_TO_FP32(x[i].dmin);
+				const uint8_t * q = x[i].qs;
+				uint8_t sc, m;
+				for (int j = 0; j < QK_K/64; j++, q += 32) {
+					int32_t isum0 = 0, isum1 = 0;
+					for (int l = 0; l < 32; l++) {
+						isum0 += (q[l] & 0xF)*y[2*j+0].qs[l];
+						isum1 += (q[l] >>  4)*y[2*j+1].qs[l];
+					}
+					get_scale_min_k4(2*j+0, x[i].scales, &sc, &m);
+					sum += d*sc*GGML_FP16_TO_FP32(y[2*j+0].d)*isum0 - dmin*m*GGML_FP16_TO_FP32(y[2*j+0].s);
+					get_scale_min_k4(2*j+1, x[i].scales, &sc, &m);
+					sum += d*sc*GGML_FP16_TO_FP32(y[2*j+1].d)*isum1 - dmin*m*GGML_FP16_TO_FP32(y[2*j+1].s);
+				}
+			}
+			s[r + c*bs] = sum;
+		}
+	}
+}
+/*! \brief Скалярное произведение строк Q8_K на активации Q8_1, x = d*qs как в dequantize_row_q8_K() */
+void vec_dot_q8_K_q8_1_ref(int64_t n, float * restrict s, size_t bs, const void * restrict vx, size_t bx, int nr, const void * restrict vy, size_t by, int nc){
+	const int nb = n / Q8K_K;
+	for (int r = 0; r < nr; r++) {
+		const block_q8_K * x = (const block_q8_K *)((const uint8_t*)vx + r*bx);
+		for (int c = 0; c < nc; c++) {
+			const block_q8_1 * y = (const block_q8_1 *)((const uint8_t*)vy + c*by);
+			float sum = 0;
+			for (int i = 0; i < nb; i++) {
+				int32_t isum = 0;
+				for (int j = 0; j < Q8K_K; j++)
+					isum += x[i].qs[j]*y[i].qs[j];// dpbusd VNNI
+				sum += GGML_FP16_TO_FP32(x[i].d)*GGML_FP16_TO_FP32(y[i].d)*isum;
+			}
+			s[r + c*bs] = sum;
+		}
+	}
+}
+//!< таблица версий скалярного произведения на активации Q8_1
+static const struct {
+	enum ggml_type type;
+	qnn_vec_dot_t isa[QNN_ISA_COUNT];
+} _vec_dot_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+#define VEC_DOT_KERNEL(T, t) {GGML_TYPE_##T, {vec_dot_##t##_q8_1_ref, \
+	vec_dot_##t##_q8_1_avx2, vec_dot_##t##_q8_1_avx2, vec_dot_##t##_q8_1_vnni, vec_dot_##t##_q8_1_vnni}}
+#else
+#define VEC_DOT_KERNEL(T, t) {GGML_TYPE_##T, {vec_dot_##t##_q8_1_ref}}
+#endif
+	VEC_DOT_KERNEL(Q8_0, q8_0),
+	VEC_DOT_KERNEL(Q4_K, q4_K),
+	VEC_DOT_KERNEL(Q8_K, q8_K),
+#undef VEC_DOT_KERNEL
+};
+static qnn_vec_dot_t _vec_dot_q8_1[GGML_TYPE_COUNT];
+/*! \brief Версия скалярного произведения для заданного набора инструкций
+	\return NULL если тип или набор инструкций не поддерживается
  */
+qnn_vec_dot_t qnn_vec_dot_q8_1_isa(enum ggml_type type, int isa)
+{
+	for (int i = 0; i < sizeof(_vec_dot_kernels)/sizeof(_vec_dot_kernels[0]); i++)
+		if (_vec_dot_kernels[i].type == type)
+			return isa < QNN_ISA_COUNT? _vec_dot_kernels[i].isa[isa]: NULL;
+	return NULL;
+}
+/*! \brief Скалярное произведение строк весов на активации Q8_1 без распаковки весов в F32
+	\return NULL если тип весов не поддерживается
+ */
+qnn_vec_dot_t qnn_vec_dot_q8_1(enum ggml_type type)
+{
+	return type < GGML_TYPE_COUNT? _vec_dot_q8_1[type]: NULL;
+}
+__attribute__((constructor))
+static void _dequantize_init(void)
+{
+	int isa = qnn_cpu_isa();
+	for (int i = 0; i < sizeof(_dequantize_kernels)/sizeof(_dequantize_kernels[0]); i++)
+		_dequantize_row[_dequantize_kernels[i].type] = _dequantize_kernels[i].isa[isa];
+	for (int i = 0; i < sizeof(_vec_dot_kernels)/sizeof(_vec_dot_kernels[0]); i++)
+		_vec_dot_q8_1[_vec_dot_kernels[i].type] = _vec_dot_kernels[i].isa[isa];
+}
+/*! \brief Распаковка строки блоков в F32, версия выбирается по возможностям процессора при загрузке
+	\return NULL если тип не поддерживается
+ */
+qnn_dequantize_row_t qnn_dequantize_row(enum ggml_type type)
+{
+	return type < GGML_TYPE_COUNT? _dequantize_row[type]: NULL;
+}
+struct _dequantize_rows {
+	qnn_dequantize_row_t fn;
+	const char * x;
+	size_t bx;
+	float * y;
+	int64_t k;
+};
+static void _dequantize_rows_range(void * arg, int64_t i0, int64_t i1, int ith)
+{
+	const struct _dequantize_rows * dr = arg;
+	for (int64_t i = i0; i < i1; i++)
+		dr->fn(dr->x + i*dr->bx, dr->y + i*dr->k, dr->k);
+}
+/*! \brief Распаковка nr строк в F32 потоками общего пула
+
+	Строки по bx байт распаковываются в непрерывный массив y[nr][k]. Работа делится на 
+	задачи по нескольку строк, потоки, закончившие раньше, перехватывают строки у других.
+	Из потока пула вызов выполняется последовательно.
+ */
+void qnn_dequantize_rows(enum ggml_type type, const void * x, size_t bx, float * y, int64_t k, int64_t nr)
+{
+	qnn_dequantize_row_t fn = qnn_dequantize_row(type);
+	if (fn==NULL) {
+		fprintf(stderr, "%s: type %d not supported\n", __func__, type);
+		return;
+	}
+	struct _dequantize_rows dr = {.fn = fn, .x = x, .bx = bx, .y = y, .k = k};
+	// задача не меньше 64К значений, чтобы деление не стоило дороже распаковки
+	const int64_t grain = k < (1<<16)? (1<<16)/k: 1;
+	qnn_pool_parallel_for(qnn_pool_default(), nr, grain, _dequantize_rows_range, &dr);
+}
+/*! \return максимальное значение шкалы подблока */
+float dequantize_row_q4_K(const block_q4_K * restrict x, float * restrict y, int64_t k)
+{
+	_dequantize_row[GGML_TYPE_Q4_K](x, y, k);
+	const int nb = k / QK_K;
+	float y_max = 0;
+	for (int i = 0; i < nb; i++) {
+		const float d = GGML_FP16_TO_FP32(x[i].d);
+		uint8_t sc, m;
+		for (int is = 0; is < QK_K/32; is++) {
+			get_scale_min_k4(is, x[i].scales, &sc, &m);
+			if (d*sc>y_max) y_max = d*sc;
+		}
+	}
+	return y_max;
+}
+void dequantize_row_q5_K(const block_q5_K * restrict x, float * restrict y, int64_t k) {
+	_dequantize_row[GGML_TYPE_Q5_K](x, y, k);
+}
+void dequantize_row_q4_0(const block_q4_0 * restrict x, float * restrict y, int64_t k) {
+	_dequantize_row[GGML_TYPE_Q4_0](x, y, k);
+}
+void dequantize_row_q8_K(const block_q8_K * restrict x, float * restrict y, int64_t k) {
+	_dequantize_row[GGML_TYPE_Q8_K](x, y, k);
+}
+void dequantize_row_q2_0(const block_q2_0 * restrict x, float * restrict y, int64_t k) {
+	_dequantize_row[GGML_TYPE_Q2_0](x, y, k);
+}
+/*! \brief Преобразование строк между форматами F32, F16, BF16, TF32, BF8 (E5M2), HF8 (E4M3) и E4M3FN
+
+	Векторные версии повторяют целочисленную схему округления ggml_compute_* из qnn.h и совпадают
+	со скалярными побитно, включая NaN, переполнение, денормализованные числа и стохастическое
+	округление. Ветви скалярной функции вычисляются для всех элементов и объединяются по маскам.
+	Команда VCVTNEPS2BF16 (AVX512_BF16) заменяет денормализованные числа нулем, такие элементы 
+	пересчитываются целочисленно. Для FP8 в AVX-512 FP16 нет подходящих команд округления (они
+	появляются в AVX10.2), перевод F32->F16->FP8 дает двойное округление, поэтому используется
+	целочисленная схема. Проверка и замер скорости см. TEST_CONVERT.
+ */
+/*! \brief случайный байт для стохастического округления элемента i
+
+	Генератор со счетчиком: результат не зависит от разбиения строки на части и от ширины вектора.
+ */
+static inline uint32_t _convert_rnd8(uint32_t seed, uint32_t i){
+	uint32_t x = seed ^ (i*0x9E3779B1u);
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35u;
+	return x >> 24;
+}
+static void convert_row_f32_to_bf16_ref(const float * restrict x, ggml_bf16_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp32_to_bf16(x[i]);
+}
+static void convert_row_bf16_to_f32_ref(const ggml_bf16_t * restrict x, float * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_bf16_to_fp32(x[i]);
+}
+static void convert_row_f32_to_tf32_ref(const float * restrict x, ggml_tf32_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp32_to_tf32(x[i]);
+}
+static void convert_row_f32_to_bf8_ref(const float * restrict x, uint8_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp32_to_bf8(x[i]);
+}
+static void convert_row_f32_to_hf8_ref(const float * restrict x, uint8_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp32_to_hf8(x[i]);
+}
+static void convert_row_f16_to_bf8_ref(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp16_to_bf8(x[i]).bits;
+}
+static void convert_row_f16_to_bf8_sr_ref(const ggml_half * restrict x, uint8_t * restrict y, int64_t n, uint32_t seed){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp16_to_bf8_stochastic(x[i], _convert_rnd8(seed, i)).bits;
+}
+static void convert_row_f16_to_hf8_ref(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp16_to_fp8(x[i]);
+}
+static void convert_row_f16_to_e4m3fn_ref(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp16_to_fp8_e4m3fn(x[i]);
+}
+static void convert_row_bf8_to_f32_ref(const uint8_t * restrict x, float * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_convert_bf8_to_f32((ggml_bf8_t){x[i]});
+}
+static void convert_row_hf8_to_f32_ref(const uint8_t * restrict x, float * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_hf8_to_fp32((ggml_hf8_t){x[i]});
+}
+static void convert_row_e4m3fn_to_f32_ref(const uint8_t * restrict x, float * restrict y, int64_t n){
+	for (int64_t i = 0; i < n; i++) y[i] = ggml_compute_fp8_e4m3fn_to_fp32(x[i]);
+}
+#if defined(__x86_64__) || defined(__i386__)
+#define TARGET_AVX512_BF16 __attribute__((target("avx512f,avx512bw,avx512vl,avx512vnni,avx512bf16,avx2,fma,f16c")))
+#define SET1(v) _mm256_set1_epi32(v)
+// --- AVX2, 8 элементов в 32-битных словах ---
+/*! \brief F32 -> FP8 с M битами мантиссы: M=3 HF8 (E4M3), M=2 BF8 (E5M2), см. ggml_compute_fp32_to_hf8 */
+static INLINE_ALWAYS TARGET_AVX2 __m256i _f32_to_f8_avx2(__m256i u, const int M){
+	const int S = 23-M, B = (1<<(6-M))-1, E = 127-B;
+	const __m256i one = SET1(1), rnd = SET1((1<<(S-1))-1), low = SET1((1<<S)-1);
+	const __m256i ex = _mm256_and_si256(_mm256_srli_epi32(u, 23), SET1(0xff));
+	const __m256i ma = _mm256_and_si256(u, SET1(0x7fffff));
+	// нормальные числа (u + rnd + fixup)>>S
+	__m256i v = _mm256_add_epi32(_mm256_add_epi32(u, rnd), _mm256_and_si256(_mm256_srli_epi32(u, S), one));
+	__m256i r = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(v, S), SET1((1<<(8+M))-1)), SET1(E<<M));
+	// денормализованные, сдвиг мантиссы с сохранением sticky бита
+	__m256i m = _mm256_srlv_epi32(_mm256_or_si256(ma, SET1(0x800000)), _mm256_sub_epi32(SET1(E+1), ex));
+	m = _mm256_or_si256(m, _mm256_srli_epi32(_mm256_add_epi32(_mm256_and_si256(ma, low), low), S));
+	m = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(m, rnd), _mm256_and_si256(_mm256_srli_epi32(m, S), one)), S);
+	r = _mm256_blendv_epi8(r, m, _mm256_cmpgt_epi32(SET1(E+1), ex));
+	r = _mm256_andnot_si256(_mm256_cmpgt_epi32(SET1(E-M), ex), r);// underflow
+	r = _mm256_blendv_epi8(r, SET1(((1<<(7-M))-1)<<M), _mm256_cmpgt_epi32(ex, SET1(127+B)));// overflow -> INF
+	__m256i nan = _mm256_or_si256(_mm256_srli_epi32(ma, S), SET1(1<<(M-1)));
+	nan = _mm256_andnot_si256(_mm256_cmpeq_epi32(ma, _mm256_setzero_si256()), nan);
+	r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpeq_epi32(ex, SET1(0xff)), nan));
+	return _mm256_or_si256(r, _mm256_and_si256(_mm256_srli_epi32(u, 24), SET1(0x80)));
+}
+/*! \brief F16 -> E4M3: fn=0 HF8 ggml_compute_fp16_to_fp8, fn=1 ggml_compute_fp16_to_fp8_e4m3fn */
+static INLINE_ALWAYS TARGET_AVX2 __m256i _f16_to_f8_avx2(__m256i h, const int fn){
+	const __m256i one = SET1(1);
+	const __m256i ex = _mm256_and_si256(_mm256_srli_epi32(h, 10), SET1(0x1f));
+	const __m256i ma = _mm256_and_si256(h, SET1(0x3ff));
+	__m256i v = _mm256_add_epi32(_mm256_add_epi32(h, SET1(0x3f)), _mm256_and_si256(_mm256_srli_epi32(h, 7), one));
+	__m256i r = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 7), SET1(0xff)), SET1(8<<3));
+	__m256i m = _mm256_srlv_epi32(_mm256_or_si256(ma, SET1(0x400)), _mm256_sub_epi32(SET1(9), ex));
+	m = _mm256_or_si256(m, _mm256_srli_epi32(_mm256_add_epi32(_mm256_and_si256(ma, SET1(0x7f)), SET1(0x7f)), 7));
+	m = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(m, SET1(0x3f)), _mm256_and_si256(_mm256_srli_epi32(m, 7), one)), 7);
+	r = _mm256_blendv_epi8(r, m, _mm256_cmpgt_epi32(SET1(9), ex));
+	r = _mm256_andnot_si256(_mm256_cmpgt_epi32(SET1(5), ex), r);
+	r = _mm256_blendv_epi8(r, SET1(fn? 0x7e: 0x78), _mm256_cmpgt_epi32(_mm256_and_si256(h, SET1(0x7fff)), SET1(0x5f40)));
+	__m256i sp = fn? _mm256_add_epi32(SET1(0x7f), _mm256_cmpeq_epi32(ma, _mm256_setzero_si256())): SET1(0x7f);
+	r = _mm256_blendv_epi8(r, sp, _mm256_cmpeq_epi32(ex, SET1(0x1f)));
+	return _mm256_or_si256(r, _mm256_and_si256(_mm256_srli_epi32(h, 8), SET1(0x80)));
+}
+/*! \brief F16 -> BF8 в 16-битных словах, fix: 0x7f+lsb для RNE или случайный байт
+	INF и NaN отбрасывают младший байт без округления, как в ggml_compute_fp16_to_bf8: условие 
+	(u & 0x7c00)==0x7c00 в ветви INF/NaN всегда истинно, бит quiet не выставляется */
+static INLINE_ALWAYS TARGET_AVX2 __m256i _f16_to_bf8_avx2(__m256i h, __m256i fix){
+	const __m256i ha = _mm256_and_si256(h, _mm256_set1_epi16(0x7fff));
+	__m256i v = _mm256_add_epi16(h, fix);
+	v = _mm256_blendv_epi8(v, h, _mm256_cmpgt_epi16(ha, _mm256_set1_epi16(0x7bff)));
+	return _mm256_srli_epi16(v, 8);
+}
+static INLINE_ALWAYS TARGET_AVX2 __m256i _f16_rne8_avx2(__m256i h){
+	return _mm256_add_epi16(_mm256_set1_epi16(0x7f), _mm256_and_si256(_mm256_srli_epi16(h, 8), _mm256_set1_epi16(1)));
+}
+static INLINE_ALWAYS TARGET_AVX2 __m256i _rnd8_avx2(__m256i seed, __m256i i){
+	__m256i x = _mm256_xor_si256(seed, _mm256_mullo_epi32(i, SET1(0x9E3779B1u)));
+	x = _mm256_mullo_epi32(_mm256_xor_si256(x, _mm256_srli_epi32(x, 16)), SET1(0x85EBCA6Bu));
+	x = _mm256_mullo_epi32(_mm256_xor_si256(x, _mm256_srli_epi32(x, 13)), SET1(0xC2B2AE35u));
+	return _mm256_srli_epi32(x, 24);
+}
+//!< 8 слов по 32 бита со значениями < 256 -> 8 байт
+static INLINE_ALWAYS TARGET_AVX2 __m128i _pack_u32_u8_avx2(__m256i r){
+	__m128i w = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+	return _mm_packus_epi16(w, w);
+}
+//!< E4M3 -> F32, fn=0 HF8, fn=1 E4M3FN
+static INLINE_ALWAYS TARGET_AVX2 __m256i _f8_to_f32_avx2(__m256i b, const int fn){
+	const __m256i e = _mm256_and_si256(b, SET1(0x78));
+	const __m256i m = _mm256_and_si256(b, SET1(7));
+	__m256i r = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(b, SET1(0x7f)), 20), SET1(120<<23));
+	__m256i d = _mm256_castps_si256(_mm256_mul_ps(_mm256_cvtepi32_ps(m), _mm256_set1_ps(1.0f/512)));
+	r = _mm256_blendv_epi8(r, d, _mm256_cmpeq_epi32(e, _mm256_setzero_si256()));
+	if (fn) {
+		r = _mm256_blendv_epi8(r, SET1(0x7FC00000), _mm256_cmpeq_epi32(_mm256_and_si256(b, SET1(0x7f)), SET1(0x7f)));
+	} else {
+		__m256i nan = _mm256_or_si256(SET1(0x7F800000), _mm256_slli_epi32(m, 20));
+		nan = _mm256_or_si256(nan, _mm256_andnot_si256(_mm256_cmpeq_epi32(m, _mm256_setzero_si256()), SET1(0x00400000)));
+		r = _mm256_blendv_epi8(r, nan, _mm256_cmpeq_epi32(e, SET1(0x78)));
+	}
+	return _mm256_or_si256(r, _mm256_slli_epi32(_mm256_and_si256(b, SET1(0x80)), 24));
+}
+static TARGET_AVX2 void convert_row_f32_to_bf16_avx2(const float * restrict x, ggml_bf16_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i u = _mm256_loadu_si256((const __m256i*)(x+i));
+		__m256i r = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(u, SET1(0x7fff)), 
+			_mm256_and_si256(_mm256_srli_epi32(u, 16), SET1(1))), 16);
+		__m256i q = _mm256_or_si256(_mm256_srli_epi32(u, 16), SET1(64));
+		r = _mm256_blendv_epi8(r, q, _mm256_cmpgt_epi32(_mm256_and_si256(u, SET1(0x7fffffff)), SET1(0x7f800000)));
+		_mm_storeu_si128((__m128i*)(y+i), _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+	}
+	convert_row_f32_to_bf16_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_bf16_to_f32_avx2(const ggml_bf16_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i u = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(x+i)));
+		_mm256_storeu_si256((__m256i*)(y+i), _mm256_slli_epi32(u, 16));
+	}
+	convert_row_bf16_to_f32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_f32_to_tf32_avx2(const float * restrict x, ggml_tf32_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i u = _mm256_loadu_si256((const __m256i*)(x+i));
+		__m256i r = _mm256_add_epi32(_mm256_add_epi32(u, SET1(0x1fff)), _mm256_and_si256(_mm256_srli_epi32(u, 14), SET1(1)));
+		__m256i q = _mm256_or_si256(u, SET1(64<<16));
+		r = _mm256_blendv_epi8(r, q, _mm256_cmpgt_epi32(_mm256_and_si256(u, SET1(0x7fffffff)), SET1(0x7f800000)));
+		_mm256_storeu_si256((__m256i*)(y+i), _mm256_and_si256(r, SET1(0xFFFFE000u)));
+	}
+	convert_row_f32_to_tf32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_f32_to_bf8_avx2(const float * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm_storel_epi64((__m128i*)(y+i), _pack_u32_u8_avx2(_f32_to_f8_avx2(_mm256_loadu_si256((const __m256i*)(x+i)), 2)));
+	convert_row_f32_to_bf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_f32_to_hf8_avx2(const float * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm_storel_epi64((__m128i*)(y+i), _pack_u32_u8_avx2(_f32_to_f8_avx2(_mm256_loadu_si256((const __m256i*)(x+i)), 3)));
+	convert_row_f32_to_hf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_f16_to_bf8_avx2(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i h = _mm256_loadu_si256((const __m256i*)(x+i));
+		__m256i r = _f16_to_bf8_avx2(h, _f16_rne8_avx2(h));
+		_mm_storeu_si128((__m128i*)(y+i), _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+	}
+	convert_row_f16_to_bf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_f16_to_bf8_sr_avx2(const ggml_half * restrict x, uint8_t * restrict y, int64_t n, uint32_t seed){
+	const __m256i vs = SET1(seed);
+	__m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i h = _mm256_loadu_si256((const __m256i*)(x+i));
+		__m256i r0 = _rnd8_avx2(vs, idx);
+		__m256i r1 = _rnd8_avx2(vs, _mm256_add_epi32(idx, SET1(8)));
+		idx = _mm256_add_epi32(idx, SET1(16));
+		__m256i rnd = _mm256_permute4x64_epi64(_mm256_packus_epi32(r0, r1), 0xD8);
+		// стохастическое округление только для нормализованных чисел
+		__m256i sub = _mm256_cmpgt_epi16(_mm256_set1_epi16(0x0400), _mm256_and_si256(h, _mm256_set1_epi16(0x7fff)));
+		__m256i r = _f16_to_bf8_avx2(h, _mm256_blendv_epi8(rnd, _f16_rne8_avx2(h), sub));
+		_mm_storeu_si128((__m128i*)(y+i), _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+	}
+	for (; i < n; i++) y[i] = ggml_compute_fp16_to_bf8_stochastic(x[i], _convert_rnd8(seed, i)).bits;
+}
+static TARGET_AVX2 void convert_row_f16_to_hf8_avx2(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(x+i)));
+		_mm_storel_epi64((__m128i*)(y+i), _pack_u32_u8_avx2(_f16_to_f8_avx2(h, 0)));
+	}
+	convert_row_f16_to_hf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_f16_to_e4m3fn_avx2(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(x+i)));
+		_mm_storel_epi64((__m128i*)(y+i), _pack_u32_u8_avx2(_f16_to_f8_avx2(h, 1)));
+	}
+	convert_row_f16_to_e4m3fn_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_bf8_to_f32_avx2(const uint8_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i h = _mm_slli_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(x+i))), 8);
+		_mm256_storeu_ps(y+i, _mm256_cvtph_ps(h));
+	}
+	convert_row_bf8_to_f32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_hf8_to_f32_avx2(const uint8_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(x+i)));
+		_mm256_storeu_si256((__m256i*)(y+i), _f8_to_f32_avx2(b, 0));
+	}
+	convert_row_hf8_to_f32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX2 void convert_row_e4m3fn_to_f32_avx2(const uint8_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(x+i)));
+		_mm256_storeu_si256((__m256i*)(y+i), _f8_to_f32_avx2(b, 1));
+	}
+	convert_row_e4m3fn_to_f32_ref(x+i, y+i, n-i);
+}
+#undef SET1
+// --- AVX-512, 16 элементов в 32-битных словах, сравнения в регистры масок ---
+#define SET1(v) _mm512_set1_epi32(v)
+static INLINE_ALWAYS TARGET_AVX512 __m512i _f32_to_f8_avx512(__m512i u, const int M){
+	const int S = 23-M, B = (1<<(6-M))-1, E = 127-B;
+	const __m512i one = SET1(1), rnd = SET1((1<<(S-1))-1), low = SET1((1<<S)-1);
+	const __m512i ex = _mm512_and_si512(_mm512_srli_epi32(u, 23), SET1(0xff));
+	const __m512i ma = _mm512_and_si512(u, SET1(0x7fffff));
+	__m512i v = _mm512_add_epi32(_mm512_add_epi32(u, rnd), _mm512_and_si512(_mm512_srli_epi32(u, S), one));
+	__m512i r = _mm512_sub_epi32(_mm512_and_si512(_mm512_srli_epi32(v, S), SET1((1<<(8+M))-1)), SET1(E<<M));
+	__m512i m = _mm512_srlv_epi32(_mm512_or_si512(ma, SET1(0x800000)), _mm512_sub_epi32(SET1(E+1), ex));
+	m = _mm512_or_si512(m, _mm512_srli_epi32(_mm512_add_epi32(_mm512_and_si512(ma, low), low), S));
+	m = _mm512_srli_epi32(_mm512_add_epi32(_mm512_add_epi32(m, rnd), _mm512_and_si512(_mm512_srli_epi32(m, S), one)), S);
+	r = _mm512_mask_mov_epi32(r, _mm512_cmple_epi32_mask(ex, SET1(E)), m);
+	r = _mm512_mask_mov_epi32(r, _mm512_cmplt_epi32_mask(ex, SET1(E-M)), _mm512_setzero_si512());
+	r = _mm512_mask_mov_epi32(r, _mm512_cmpgt_epi32_mask(ex, SET1(127+B)), SET1(((1<<(7-M))-1)<<M));
+	__m512i nan = _mm512_or_si512(_mm512_srli_epi32(ma, S), SET1(1<<(M-1)));
+	r = _mm512_mask_or_epi32(r, _mm512_mask_test_epi32_mask(_mm512_cmpeq_epi32_mask(ex, SET1(0xff)), ma, ma), r, nan);
+	return _mm512_ternarylogic_epi32(r, _mm512_srli_epi32(u, 24), SET1(0x80), 0xF8);// r | (a & b)
+}
+static INLINE_ALWAYS TARGET_AVX512 __m512i _f16_to_f8_avx512(__m512i h, const int fn){
+	const __m512i one = SET1(1);
+	const __m512i ex = _mm512_and_si512(_mm512_srli_epi32(h, 10), SET1(0x1f));
+	const __m512i ma = _mm512_and_si512(h, SET1(0x3ff));
+	__m512i v = _mm512_add_epi32(_mm512_add_epi32(h, SET1(0x3f)), _mm512_and_si512(_mm512_srli_epi32(h, 7), one));
+	__m512i r = _mm512_sub_epi32(_mm512_and_si512(_mm512_srli_epi32(v, 7), SET1(0xff)), SET1(8<<3));
+	__m512i m = _mm512_srlv_epi32(_mm512_or_si512(ma, SET1(0x400)), _mm512_sub_epi32(SET1(9), ex));
+	m = _mm512_or_si512(m, _mm512_srli_epi32(_mm512_add_epi32(_mm512_and_si512(ma, SET1(0x7f)), SET1(0x7f)), 7));
+	m = _mm512_srli_epi32(_mm512_add_epi32(_mm512_add_epi32(m, SET1(0x3f)), _mm512_and_si512(_mm512_srli_epi32(m, 7), one)), 7);
+	r = _mm512_mask_mov_epi32(r, _mm512_cmple_epi32_mask(ex, SET1(8)), m);
+	r = _mm512_mask_mov_epi32(r, _mm512_cmplt_epi32_mask(ex, SET1(5)), _mm512_setzero_si512());
+	r = _mm512_mask_mov_epi32(r, _mm512_cmpgt_epi32_mask(_mm512_and_si512(h, SET1(0x7fff)), SET1(0x5f40)), SET1(fn? 0x7e: 0x78));
+	const __mmask16 sp = _mm512_cmpeq_epi32_mask(ex, SET1(0x1f));
+	r = _mm512_mask_mov_epi32(r, sp, SET1(0x7f));
+	if (fn) r = _mm512_mask_mov_epi32(r, _mm512_mask_testn_epi32_mask(sp, ma, ma), SET1(0x7e));
+	return _mm512_ternarylogic_epi32(r, _mm512_srli_epi32(h, 8), SET1(0x80), 0xF8);
+}
+static INLINE_ALWAYS TARGET_AVX512 __m512i _f16_to_bf8_avx512(__m512i h, __m512i fix){
+	const __m512i ha = _mm512_and_si512(h, _mm512_set1_epi16(0x7fff));
+	__m512i v = _mm512_add_epi16(h, fix);
+	v = _mm512_mask_mov_epi16(v, _mm512_cmpgt_epu16_mask(ha, _mm512_set1_epi16(0x7bff)), h);
+	return _mm512_srli_epi16(v, 8);
+}
+static INLINE_ALWAYS TARGET_AVX512 __m512i _f16_rne8_avx512(__m512i h){
+	return _mm512_add_epi16(_mm512_set1_epi16(0x7f), _mm512_and_si512(_mm512_srli_epi16(h, 8), _mm512_set1_epi16(1)));
+}
+static INLINE_ALWAYS TARGET_AVX512 __m512i _rnd8_avx512(__m512i seed, __m512i i){
+	__m512i x = _mm512_xor_si512(seed, _mm512_mullo_epi32(i, SET1(0x9E3779B1u)));
+	x = _mm512_mullo_epi32(_mm512_xor_si512(x, _mm512_srli_epi32(x, 16)), SET1(0x85EBCA6Bu));
+	x = _mm512_mullo_epi32(_mm512_xor_si512(x, _mm512_srli_epi32(x, 13)), SET1(0xC2B2AE35u));
+	return _mm512_srli_epi32(x, 24);
+}
+static INLINE_ALWAYS TARGET_AVX512 __m512i _f8_to_f32_avx512(__m512i b, const int fn){
+	const __m512i e = _mm512_and_si512(b, SET1(0x78));
+	const __m512i m = _mm512_and_si512(b, SET1(7));
+	__m512i r = _mm512_add_epi32(_mm512_slli_epi32(_mm512_and_si512(b, SET1(0x7f)), 20), SET1(120<<23));
+	__m512i d = _mm512_castps_si512(_mm512_mul_ps(_mm512_cvtepi32_ps(m), _mm512_set1_ps(1.0f/512)));
+	r = _mm512_mask_mov_epi32(r, _mm512_testn_epi32_mask(e, e), d);
+	if (fn) {
+		r = _mm512_mask_mov_epi32(r, _mm512_cmpeq_epi32_mask(_mm512_and_si512(b, SET1(0x7f)), SET1(0x7f)), SET1(0x7FC00000));
+	} else {
+		__m512i nan = _mm512_or_si512(SET1(0x7F800000), _mm512_slli_epi32(m, 20));
+		nan = _mm512_mask_or_epi32(nan, _mm512_test_epi32_mask(m, m), nan, SET1(0x00400000));
+		r = _mm512_mask_mov_epi32(r, _mm512_cmpeq_epi32_mask(e, SET1(0x78)), nan);
+	}
+	return _mm512_or_si512(r, _mm512_slli_epi32(_mm512_and_si512(b, SET1(0x80)), 24));
+}
+static INLINE_ALWAYS TARGET_AVX512 __m256i _f32_to_bf16_avx512(__m512i u){
+	__m512i r = _mm512_srli_epi32(_mm512_add_epi32(_mm512_add_epi32(u, SET1(0x7fff)), 
+		_mm512_and_si512(_mm512_srli_epi32(u, 16), SET1(1))), 16);
+	__m512i q = _mm512_or_si512(_mm512_srli_epi32(u, 16), SET1(64));
+	r = _mm512_mask_mov_epi32(r, _mm512_cmpgt_epu32_mask(_mm512_and_si512(u, SET1(0x7fffffff)), SET1(0x7f800000)), q);
+	return _mm512_cvtepi32_epi16(r);
+}
+static TARGET_AVX512 void convert_row_f32_to_bf16_avx512(const float * restrict x, ggml_bf16_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm256_storeu_si256((__m256i*)(y+i), _f32_to_bf16_avx512(_mm512_loadu_si512(x+i)));
+	convert_row_f32_to_bf16_ref(x+i, y+i, n-i);
+}
+/*! VCVTNEPS2BF16 округляет RNE и переводит NaN в quiet так же, как ggml_compute_fp32_to_bf16, 
+	но денормализованные числа заменяет нулем: такие элементы пересчитываются целочисленно */
+static TARGET_AVX512_BF16 void convert_row_f32_to_bf16_avx512bf16(const float * restrict x, ggml_bf16_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i u = _mm512_loadu_si512(x+i);
+		__m256i r = (__m256i)_mm512_cvtneps_pbh(_mm512_castsi512_ps(u));
+		__mmask16 den = _mm512_cmplt_epu32_mask(_mm512_sub_epi32(_mm512_and_si512(u, SET1(0x7fffffff)), SET1(1)), SET1(0x7fffff));
+		if (den) {
+			__m256i s = _f32_to_bf16_avx512(u);
+			r = _mm256_mask_mov_epi16(r, den, s);
+		}
+		_mm256_storeu_si256((__m256i*)(y+i), r);
+	}
+	convert_row_f32_to_bf16_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_bf16_to_f32_avx512(const ggml_bf16_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i u = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(x+i)));
+		_mm512_storeu_si512(y+i, _mm512_slli_epi32(u, 16));
+	}
+	convert_row_bf16_to_f32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_f32_to_tf32_avx512(const float * restrict x, ggml_tf32_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i u = _mm512_loadu_si512(x+i);
+		__m512i r = _mm512_add_epi32(_mm512_add_epi32(u, SET1(0x1fff)), _mm512_and_si512(_mm512_srli_epi32(u, 14), SET1(1)));
+		r = _mm512_mask_or_epi32(r, _mm512_cmpgt_epu32_mask(_mm512_and_si512(u, SET1(0x7fffffff)), SET1(0x7f800000)), u, SET1(64<<16));
+		_mm512_storeu_si512(y+i, _mm512_and_si512(r, SET1(0xFFFFE000u)));
+	}
+	convert_row_f32_to_tf32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_f32_to_bf8_avx512(const float * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i*)(y+i), _mm512_cvtepi32_epi8(_f32_to_f8_avx512(_mm512_loadu_si512(x+i), 2)));
+	convert_row_f32_to_bf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_f32_to_hf8_avx512(const float * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16)
+		_mm_storeu_si128((__m128i*)(y+i), _mm512_cvtepi32_epi8(_f32_to_f8_avx512(_mm512_loadu_si512(x+i), 3)));
+	convert_row_f32_to_hf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_f16_to_bf8_avx512(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m512i h = _mm512_loadu_si512(x+i);
+		_mm256_storeu_si256((__m256i*)(y+i), _mm512_cvtepi16_epi8(_f16_to_bf8_avx512(h, _f16_rne8_avx512(h))));
+	}
+	convert_row_f16_to_bf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_f16_to_bf8_sr_avx512(const ggml_half * restrict x, uint8_t * restrict y, int64_t n, uint32_t seed){
+	const __m512i vs = SET1(seed);
+	__m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	int64_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m512i h = _mm512_loadu_si512(x+i);
+		__m256i r0 = _mm512_cvtepi32_epi16(_rnd8_avx512(vs, idx));
+		__m256i r1 = _mm512_cvtepi32_epi16(_rnd8_avx512(vs, _mm512_add_epi32(idx, SET1(16))));
+		idx = _mm512_add_epi32(idx, SET1(32));
+		__m512i rnd = _mm512_inserti64x4(_mm512_castsi256_si512(r0), r1, 1);
+		__mmask32 sub = _mm512_cmplt_epu16_mask(_mm512_and_si512(h, _mm512_set1_epi16(0x7fff)), _mm512_set1_epi16(0x0400));
+		__m512i r = _f16_to_bf8_avx512(h, _mm512_mask_mov_epi16(rnd, sub, _f16_rne8_avx512(h)));
+		_mm256_storeu_si256((__m256i*)(y+i), _mm512_cvtepi16_epi8(r));
+	}
+	for (; i < n; i++) y[i] = ggml_compute_fp16_to_bf8_stochastic(x[i], _convert_rnd8(seed, i)).bits;
+}
+static TARGET_AVX512 void convert_row_f16_to_hf8_avx512(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(x+i)));
+		_mm_storeu_si128((__m128i*)(y+i), _mm512_cvtepi32_epi8(_f16_to_f8_avx512(h, 0)));
+	}
+	convert_row_f16_to_hf8_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_f16_to_e4m3fn_avx512(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(x+i)));
+		_mm_storeu_si128((__m128i*)(y+i), _mm512_cvtepi32_epi8(_f16_to_f8_avx512(h, 1)));
+	}
+	convert_row_f16_to_e4m3fn_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_bf8_to_f32_avx512(const uint8_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i h = _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(x+i))), 8);
+		_mm512_storeu_ps(y+i, _mm512_cvtph_ps(h));
+	}
+	convert_row_bf8_to_f32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_hf8_to_f32_avx512(const uint8_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i b = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(x+i)));
+		_mm512_storeu_si512(y+i, _f8_to_f32_avx512(b, 0));
+	}
+	convert_row_hf8_to_f32_ref(x+i, y+i, n-i);
+}
+static TARGET_AVX512 void convert_row_e4m3fn_to_f32_avx512(const uint8_t * restrict x, float * restrict y, int64_t n){
+	int64_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m512i b = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(x+i)));
+		_mm512_storeu_si512(y+i, _f8_to_f32_avx512(b, 1));
+	}
+	convert_row_e4m3fn_to_f32_ref(x+i, y+i, n-i);
+}
+#undef SET1
+#endif
+//!< таблица версий преобразования по набору инструкций QNN_ISA_*
+static const qnn_convert_row_t _convert_kernels[QNN_CONVERT_COUNT][QNN_ISA_COUNT] = {
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_KERNEL(OP, f) [QNN_CONVERT_##OP] = {(qnn_convert_row_t)convert_row_##f##_ref, \
+	(qnn_convert_row_t)convert_row_##f##_avx2, (qnn_convert_row_t)convert_row_##f##_avx512, \
+	(qnn_convert_row_t)convert_row_##f##_avx512, (qnn_convert_row_t)convert_row_##f##_avx512}
+#else
+#define CONVERT_KERNEL(OP, f) [QNN_CONVERT_##OP] = {(qnn_convert_row_t)convert_row_##f##_ref}
+#endif
+	CONVERT_KERNEL(F32_BF16,   f32_to_bf16),
+	CONVERT_KERNEL(BF16_F32,   bf16_to_f32),
+	CONVERT_KERNEL(F32_TF32,   f32_to_tf32),
+	CONVERT_KERNEL(F32_BF8,    f32_to_bf8),
+	CONVERT_KERNEL(F32_HF8,    f32_to_hf8),
+	CONVERT_KERNEL(F16_BF8,    f16_to_bf8),
+	CONVERT_KERNEL(F16_HF8,    f16_to_hf8),
+	CONVERT_KERNEL(F16_E4M3FN, f16_to_e4m3fn),
+	CONVERT_KERNEL(BF8_F32,    bf8_to_f32),
+	CONVERT_KERNEL(HF8_F32,    hf8_to_f32),
+	CONVERT_KERNEL(E4M3FN_F32, e4m3fn_to_f32),
+#undef CONVERT_KERNEL
+};
+static const qnn_convert_row_sr_t _convert_sr_kernels[QNN_ISA_COUNT] = {
+	(qnn_convert_row_sr_t)convert_row_f16_to_bf8_sr_ref,
+#if defined(__x86_64__) || defined(__i386__)
+	(qnn_convert_row_sr_t)convert_row_f16_to_bf8_sr_avx2, (qnn_convert_row_sr_t)convert_row_f16_to_bf8_sr_avx512,
+	(qnn_convert_row_sr_t)convert_row_f16_to_bf8_sr_avx512, (qnn_convert_row_sr_t)convert_row_f16_to_bf8_sr_avx512,
+#endif
+};
+static qnn_convert_row_t    _convert_row[QNN_CONVERT_COUNT];
+static qnn_convert_row_sr_t _convert_row_sr;
+/*! \brief Версия преобразования для заданного набора инструкций, используется для проверки и замеров
+	\return NULL если набор инструкций не поддерживается
+ */
+qnn_convert_row_t qnn_convert_row_isa(enum qnn_convert op, int isa)
+{
+	qnn_convert_row_t fn = (op < QNN_CONVERT_COUNT && isa < QNN_ISA_COUNT)? _convert_kernels[op][isa]: NULL;
+#if defined(__x86_64__) || defined(__i386__)
+	if (op==QNN_CONVERT_F32_BF16 && isa==QNN_ISA_AVX512_BF16)
+		fn = (qnn_convert_row_t)convert_row_f32_to_bf16_avx512bf16;
+#endif
+	return fn;
+}
+qnn_convert_row_sr_t qnn_convert_row_sr_isa(int isa)
+{
+	return isa < QNN_ISA_COUNT? _convert_sr_kernels[isa]: NULL;
+}
+__attribute__((constructor))
+static void _convert_init(void)
+{
+	int isa = qnn_cpu_isa();
+	for (int op = 0; op < QNN_CONVERT_COUNT; op++)
+		_convert_row[op] = qnn_convert_row_isa(op, isa);
+	_convert_row_sr = _convert_sr_kernels[isa];
+}
+void convert_row_f32_to_bf16(const float * restrict x, ggml_bf16_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F32_BF16](x, y, n);
+}
+void convert_row_bf16_to_f32(const ggml_bf16_t * restrict x, float * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_BF16_F32](x, y, n);
+}
+void convert_row_f32_to_tf32(const float * restrict x, ggml_tf32_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F32_TF32](x, y, n);
+}
+void convert_row_f32_to_bf8(const float * restrict x, uint8_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F32_BF8](x, y, n);
+}
+void convert_row_f32_to_hf8(const float * restrict x, uint8_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F32_HF8](x, y, n);
+}
+void convert_row_f16_to_bf8(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F16_BF8](x, y, n);
+}
+/*! \param seed начальное значение генератора, случайный байт элемента i вычисляется из (seed, i) */
+void convert_row_f16_to_bf8_stochastic(const ggml_half * restrict x, uint8_t * restrict y, int64_t n, uint32_t seed){
+	_convert_row_sr(x, y, n, seed);
+}
+void convert_row_f16_to_hf8(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F16_HF8](x, y, n);
+}
+void convert_row_f16_to_e4m3fn(const ggml_half * restrict x, uint8_t * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_F16_E4M3FN](x, y, n);
+}
+void convert_row_bf8_to_f32(const uint8_t * restrict x, float * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_BF8_F32](x, y, n);
+}
+void convert_row_hf8_to_f32(const uint8_t * restrict x, float * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_HF8_F32](x, y, n);
+}
+void convert_row_e4m3fn_to_f32(const uint8_t * restrict x, float * restrict y, int64_t n){
+	_convert_row[QNN_CONVERT_E4M3FN_F32](x, y, n);
+}
 static inline
 void dequantize_row_bf16(ggml_bf16_t* src, float* dst, size_t k){
-	for(int i=0; i<k; ++i)
-		dst[i] = GGML_BF16_TO_FP32(src[i]);
+	convert_row_bf16_to_f32(src, dst, k);
 }
 static inline
 void dequantize_row_f16(ggml_fp16_t* src, float* dst, size_t k){
 	for(int i=0; i<k; ++i)
 		dst[i] = GGML_FP16_TO_FP32(src[i]);
 }
-static inline
 uint8_t convert_f32_to_f8_e4m3fn(float x, int emax){
 	const int f32_bias = 127;
 	const int  f8_bias = 7;// может быть 8
@@ -1616,6 +3204,31 @@ if (0) {
 }
 	return blk;
 }
+#else
+/*! \brief Загрузить блок данных из файла в буфер g_malloc, используется когда файл не отображен в память */
+uint8_t* blk_load(const char* path,  struct gguf_str * name, uint64_t offset, size_t size ){
+	int fd = open(path, O_RDONLY);
+	if (fd<0) {
+		fprintf(stderr, "%s: open failed '%s'\n", __func__, strerror(errno));
+		return NULL;
+	}
+	uint8_t *blk = g_malloc(size);
+	size_t offs = 0;
+	while (offs<size) {
+		size_t chunk = (size-offs)<64*1024*1024? size-offs: 64*1024*1024;
+		ssize_t res = pread(fd, blk + offs, chunk, offset + offs);
+		if (res<=0) {
+			if (res<0 && errno==EINTR) continue;
+			fprintf(stderr, "%s: read failed at 0x%"PRIx64" '%s'\n", __func__, offset + offs, res<0? strerror(errno): "EOF");
+			g_free(blk);
+			blk = NULL;
+			break;
+		}
+		offs += res;
+	}
+	close(fd);
+	return blk;
+}
 #endif
 #define Ftype float
 /*! Вычисление скалярного произведения от двух колонок матрицы
@@ -1817,7 +3430,7 @@ static int test_f8_e4m3fn(){
 	}
 	return 0;
 }
-#if 1 //def TEST_GGUF
+#ifdef TEST_GGUF
 
 #if defined(__F16C__)
 short convert_f32_to_f16(float x){
@@ -1894,7 +3507,7 @@ int main (int argc, char *argv[]){
 
 	if (argc<2) return 0;
 	char *path = argv[1];
-	gguf_cxt_t *ctx = gguf_init_from_file(path, 0);
+	gguf_cxt_t *ctx = gguf_init_from_file(path, GGUF_INIT_MMAP);
 
 	if (0) gguf_vocab_token_types(ctx); // статистика токенов
 	printf("Tensors ...\n", options.name);
@@ -1909,8 +3522,9 @@ int main (int argc, char *argv[]){
 			printf("Can't read manifest file `%s`: %s\n", options.manifest, error->message);
 			_Exit(1);
 		}
-		gguf_hash_load(ctx, path, manifest_data, manifest_size);
-		return 0;
+		int n_err = gguf_hash_verify(ctx, path, manifest_data, manifest_size, options.threads);
+		gguf_free(ctx);
+		return n_err!=0;
 	}
 	// найти матрицу и показать
 	if (options.name!=NULL && options.output_file!=NULL && g_str_has_suffix(options.output_file, ".png")) {
@@ -1935,7 +3549,7 @@ int main (int argc, char *argv[]){
 			// выполнить деквантизацию.. во внутренний формат f32
 			if (info->type==GGML_TYPE_F32){
 				info->size = (sizeof(float)*width*height);
-				float*  blk = (float*)blk_load(path, &info->name, info->offset+ctx->offset, info->size);
+				float*  blk = (float*)(info->data? info->data: blk_load(path, &info->name, info->offset+ctx->offset, info->size));
 				// анализ может это TF32?
 				uint32_t mask= 0;
 				int emax= __FLT16_MIN_EXP__;
@@ -1972,7 +3586,7 @@ int main (int argc, char *argv[]){
 			} else
 			if (info->type==GGML_TYPE_F16){
 				info->size = (sizeof(_Float16)*width*height);
-				_Float16*  blk = (_Float16*)blk_load(path, &info->name, info->offset+ctx->offset, info->size);
+				_Float16*  blk = (_Float16*)(info->data? info->data: blk_load(path, &info->name, info->offset+ctx->offset, info->size));
 				uint32_t mask= 0;
 				int normal = 1;
 				int finite = 1;
@@ -2068,7 +3682,7 @@ int main (int argc, char *argv[]){
 			} else
 			if (info->type==GGML_TYPE_BF16){
 				info->size = (sizeof(uint16_t)*width*height);
-				ggml_bf16_t*  blk = (ggml_bf16_t*)blk_load(path, &info->name, info->offset+ctx->offset, info->size);
+				ggml_bf16_t*  blk = (ggml_bf16_t*)(info->data? info->data: blk_load(path, &info->name, info->offset+ctx->offset, info->size));
 				uint32_t mask= 0;
 				double err=0;
 				double max_err=0;
@@ -2097,19 +3711,19 @@ int main (int argc, char *argv[]){
 			} else
 			if (info->type==GGML_TYPE_Q8_0){
 				info->size = (sizeof(block_q8_0)*width*height)/QK8_0;
-				uint8_t*  blk = blk_load(path, &info->name, info->offset+ctx->offset, info->size);
+				uint8_t*  blk = info->data? info->data: blk_load(path, &info->name, info->offset+ctx->offset, info->size);
 				float d_max = dequantize_row_q8_0((const block_q8_0 *)blk, data_f32, width*height);
 				//for(int i = 0; i<width*height; i++) if(data_f32[i]>d_max) d_max = data_f32[i];
 				printf(" - max %e\n", (double)d_max);
 			} else
 			if (info->type==GGML_TYPE_Q4_0){
 				info->size = (sizeof(block_q4_0)*width*height)/QK4_0;
-				uint8_t*  blk = blk_load(path, &info->name, info->offset+ctx->offset, info->size);
+				uint8_t*  blk = info->data? info->data: blk_load(path, &info->name, info->offset+ctx->offset, info->size);
 				dequantize_row_q4_0((const block_q4_0 *)blk, data_f32, width*height);
 			} else
 			if (info->type==GGML_TYPE_Q4_K){
 				info->size = (sizeof(block_q4_K)*width*height)/QK_K;
-				uint8_t*  blk = blk_load(path, &info->name, info->offset+ctx->offset, info->size);
+				uint8_t*  blk = info->data? info->data: blk_load(path, &info->name, info->offset+ctx->offset, info->size);
 				float d_max = dequantize_row_q4_K((const block_q4_K *)blk, data_f32, width*height);
 				printf(" - max %e\n", (double)d_max);
 				uint32_t mask= 0;
@@ -2163,4 +3777,195 @@ int main (int argc, char *argv[]){
 	gguf_free (ctx);
 	return 0;
 }
-#endif
\ No newline at end of file
+#endif
+#ifdef TEST_DEQUANT
+/*
+	$ gcc -DTEST_DEQUANT -O3 -march=native -o test qnn_gguf.c qnn_pool.c xxh64.c quarks.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
+	$ ./test
+ */
+#include <time.h>
+static uint64_t _rand_state = 0x9E3779B97F4A7C15ULL;
+static inline uint64_t _rand64(void){// xorshift64*
+	_rand_state ^= _rand_state >> 12;
+	_rand_state ^= _rand_state << 25;
+	_rand_state ^= _rand_state >> 27;
+	return _rand_state * 0x2545F4914F6CDD1DULL;
+}
+int main(int argc, char** argv)
+{
+	static const struct { enum ggml_type type; size_t blck_size, type_size; } formats[] = {
+		{GGML_TYPE_Q8_0, QK8_0, sizeof(block_q8_0)},
+		{GGML_TYPE_Q4_0, QK4_0, sizeof(block_q4_0)},
+		{GGML_TYPE_Q4_K, QK_K,  sizeof(block_q4_K)},
+		{GGML_TYPE_Q5_K, QK_K,  sizeof(block_q5_K)},
+		{GGML_TYPE_Q8_K, Q8K_K, sizeof(block_q8_K)},
+		{GGML_TYPE_Q2_0, QK2_0, sizeof(block_q2_0)},
+	};
+	static const char* isa_name[QNN_ISA_COUNT] = {"generic", "avx2", "avx512", "avx512vnni", "avx512bf16"};
+	const int64_t n = 1<<22;// элементов в строке
+	const int n_iter = argc>1? atoi(argv[1]): 20;
+	int isa_max = qnn_cpu_isa();
+	float* ref = _aligned_malloc(n*sizeof(float), 64);
+	float* out = _aligned_malloc(n*sizeof(float), 64);
+	int fail = 0;
+	printf("cpu isa: %s\n", isa_name[isa_max]);
+	for (int f = 0; f < sizeof(formats)/sizeof(formats[0]); f++) {
+		const int64_t nb = n/formats[f].blck_size;
+		const size_t size = nb*formats[f].type_size;
+		uint8_t* blk = g_malloc(size);
+		for (size_t i = 0; i < size; i += 8) {
+			uint64_t r = _rand64();
+			__builtin_memcpy(blk+i, &r, size-i<8? size-i: 8);
+		}
+		for (int64_t i = 0; i < nb; i++) {// шкалы: конечные числа F16 в диапазоне [2^-10, 1)
+			uint8_t* b = blk + i*formats[f].type_size;
+			ggml_half d = (ggml_half)ldexpf(1.0f + (_rand64()&1023)/1024.0f, -(int)(_rand64()%10)-1);
+			ggml_half m = (ggml_half)ldexpf(1.0f + (_rand64()&1023)/1024.0f, -(int)(_rand64()%10)-1);
+			switch (formats[f].type) {
+			case GGML_TYPE_Q4_K: ((block_q4_K*)b)->d = d; ((block_q4_K*)b)->dmin = m; break;
+			case GGML_TYPE_Q5_K: ((block_q5_K*)b)->d = d; ((block_q5_K*)b)->dmin = m; break;
+			case GGML_TYPE_Q8_K: ((block_q8_K*)b)->d = d; break;
+			default: __builtin_memcpy(b, &d, sizeof(d)); break;// d в начале блока
+			}
+		}
+		qnn_dequantize_row_isa(formats[f].type, QNN_ISA_GENERIC)(blk, ref, n);
+		for (int isa = 0; isa <= isa_max; isa++) {
+			qnn_dequantize_row_t fn = qnn_dequantize_row_isa(formats[f].type, isa);
+			if (fn==NULL) continue;
+			__builtin_memset(out, 0xFF, n*sizeof(float));
+			fn(blk, out, n);
+			int ok = __builtin_memcmp(out, ref, n*sizeof(float))==0;
+			fail += !ok;
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (int it = 0; it < n_iter; it++)
+				fn(blk, out, n);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+			printf("%-5s %-8s %s %6.2f GB/s\n", GGML_TYPE_NAME[formats[f].type], isa_name[isa], ok? "ok  ": "FAIL",
+				(double)n*sizeof(float)*n_iter/sec*1e-9);
+		}
+		{// та же память как nr строк, распаковка потоками пула
+			const int64_t k = 4096, nr = n/k;
+			__builtin_memset(out, 0xFF, n*sizeof(float));
+			qnn_dequantize_rows(formats[f].type, blk, k/formats[f].blck_size*formats[f].type_size, out, k, nr);
+			int ok = __builtin_memcmp(out, ref, n*sizeof(float))==0;
+			fail += !ok;
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (int it = 0; it < n_iter; it++)
+				qnn_dequantize_rows(formats[f].type, blk, k/formats[f].blck_size*formats[f].type_size, out, k, nr);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+			printf("%-5s pool x%-3d %s %6.2f GB/s\n", GGML_TYPE_NAME[formats[f].type], qnn_pool_size(qnn_pool_default()),
+				ok? "ok  ": "FAIL", (double)n*sizeof(float)*n_iter/sec*1e-9);
+		}
+		g_free(blk);
+	}
+	_aligned_free(ref);
+	_aligned_free(out);
+	return fail!=0;
+}
+#endif
+#ifdef TEST_CONVERT
+/*
+	$ gcc -DTEST_CONVERT -O3 -march=native -o test qnn_gguf.c qnn_pool.c xxh64.c quarks.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
+	$ ./test
+ */
+#include <time.h>
+static uint64_t _rand_state = 0x9E3779B97F4A7C15ULL;
+static inline uint64_t _rand64(void){// xorshift64*
+	_rand_state ^= _rand_state >> 12;
+	_rand_state ^= _rand_state << 25;
+	_rand_state ^= _rand_state >> 27;
+	return _rand_state * 0x2545F4914F6CDD1DULL;
+}
+static double _elapsed(struct timespec t0, struct timespec t1){
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1e-9;
+}
+int main(int argc, char** argv)
+{
+	enum { SRC_F32, SRC_F16, SRC_BF16, SRC_U8 };
+	static const struct { enum qnn_convert op; const char* name; int src; size_t dst_size; } ops[] = {
+		{QNN_CONVERT_F32_BF16,   "f32->bf16",   SRC_F32,  2},
+		{QNN_CONVERT_BF16_F32,   "bf16->f32",   SRC_BF16, 4},
+		{QNN_CONVERT_F32_TF32,   "f32->tf32",   SRC_F32,  4},
+		{QNN_CONVERT_F32_BF8,    "f32->bf8",    SRC_F32,  1},
+		{QNN_CONVERT_F32_HF8,    "f32->hf8",    SRC_F32,  1},
+		{QNN_CONVERT_F16_BF8,    "f16->bf8",    SRC_F16,  1},
+		{QNN_CONVERT_F16_HF8,    "f16->hf8",    SRC_F16,  1},
+		{QNN_CONVERT_F16_E4M3FN, "f16->e4m3fn", SRC_F16,  1},
+		{QNN_CONVERT_BF8_F32,    "bf8->f32",    SRC_U8,   4},
+		{QNN_CONVERT_HF8_F32,    "hf8->f32",    SRC_U8,   4},
+		{QNN_CONVERT_E4M3FN_F32, "e4m3fn->f32", SRC_U8,   4},
+	};
+	static const char* isa_name[QNN_ISA_COUNT] = {"generic", "avx2", "avx512", "avx512vnni", "avx512bf16"};
+	const int64_t n = (1<<20) + 13;// хвост не кратный ширине вектора
+	const int n_iter = argc>1? atoi(argv[1]): 50;
+	int isa_max = qnn_cpu_isa();
+	int fail = 0;
+	// обратное преобразование FP8 для всех кодов
+	for (int c = 0; c < 256; c++) {
+		float v = ggml_compute_hf8_to_fp32((ggml_hf8_t){c});
+		if ((c&0x7f) <= 0x78 && ggml_compute_fp32_to_hf8(v)!=c) {
+			printf("hf8 %02X -> %g -> %02X FAIL\n", c, v, ggml_compute_fp32_to_hf8(v));
+			fail++;
+		}
+		v = ggml_compute_fp8_e4m3fn_to_fp32(c);
+		if ((c&0x7f) != 0x7f && ggml_compute_fp16_to_fp8_e4m3fn((_Float16)v)!=c) {
+			printf("e4m3fn %02X -> %g FAIL\n", c, v);
+			fail++;
+		}
+	}
+	uint32_t* f32 = _aligned_malloc(n*sizeof(float), 64);
+	uint16_t* f16 = _aligned_malloc(n*sizeof(uint16_t), 64);
+	uint16_t* bf16= _aligned_malloc(n*sizeof(uint16_t), 64);
+	uint8_t*  u8  = _aligned_malloc(n, 64);
+	uint8_t*  ref = _aligned_malloc(n*sizeof(float), 64);
+	uint8_t*  out = _aligned_malloc(n*sizeof(float), 64);
+	for (int64_t i = 0; i < n; i++) {
+		uint64_t r = _rand64();
+		switch (i&3) {// произвольные коды, включая NaN, и числа в диапазоне FP8
+		case 0: f32[i] = r; break;
+		case 1: f32[i] = r & 0x807FFFFFu; break;// денормализованные
+		default: {
+			union { float f; uint32_t i; } u = {.f = ldexpf(1.0f + (r&0xFFFFFF)/16777216.0f, (int)((r>>32)%48) - 28)};
+			f32[i] = u.i | (uint32_t)(r>>63)<<31;
+		} break;
+		}
+		f16[i] = i;// все коды F16
+		bf16[i]= r>>40;
+		u8[i]  = i;
+	}
+	printf("cpu isa: %s\n", isa_name[isa_max]);
+	for (int k = 0; k <= sizeof(ops)/sizeof(ops[0]); k++) {
+		const int sr = k==sizeof(ops)/sizeof(ops[0]);// стохастическое округление F16 -> BF8
+		const int src = sr? SRC_F16: ops[k].src;
+		const size_t dst_size = sr? 1: ops[k].dst_size;
+		const void* x = src==SRC_F32? (void*)f32: src==SRC_F16? (void*)f16: src==SRC_BF16? (void*)bf16: (void*)u8;
+		if (sr) qnn_convert_row_sr_isa(QNN_ISA_GENERIC)(x, ref, n, 12345);
+		else    qnn_convert_row_isa(ops[k].op, QNN_ISA_GENERIC)(x, ref, n);
+		for (int isa = 0; isa <= isa_max; isa++) {
+			qnn_convert_row_t    fn = sr? NULL: qnn_convert_row_isa(ops[k].op, isa);
+			qnn_convert_row_sr_t fs = sr? qnn_convert_row_sr_isa(isa): NULL;
+			if (fn==NULL && fs==NULL) continue;
+			if (isa==QNN_ISA_AVX512_VNNI || (isa==QNN_ISA_AVX512_BF16 && !(ops[k].op==QNN_CONVERT_F32_BF16 && !sr)))
+				continue;// те же версии, что и для AVX-512
+			__builtin_memset(out, 0xFF, n*dst_size);
+			if (sr) fs(x, out, n, 12345); else fn(x, out, n);
+			int ok = __builtin_memcmp(out, ref, n*dst_size)==0;
+			fail += !ok;
+			struct timespec t0, t1;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (int it = 0; it < n_iter; it++)
+				if (sr) fs(x, out, n, it); else fn(x, out, n);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			printf("%-14s %-10s %s %7.3f Gelem/s\n", sr? "f16->bf8 sr": ops[k].name, isa_name[isa], ok? "ok  ": "FAIL",
+				(double)n*n_iter/_elapsed(t0, t1)*1e-9);
+		}
+	}
+	_aligned_free(f32); _aligned_free(f16); _aligned_free(bf16); _aligned_free(u8);
+	_aligned_free(ref); _aligned_free(out);
+	return fail!=0;
+}
+#endif
@@ -7,12 +7,18 @@
 
     Сборка
 $ gcc -march=native -O3 -o test qnn_hexl.c
+$ gcc -DTEST_NTT -march=native -O3 -o test qnn_hexl.c qnn_pool.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
+$ gcc -DTEST_NTT -march=haswell -O3 -o test qnn_hexl.c qnn_pool.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm -- сравнение IFMA52 с версией AVX2
 
 Все алгоритмы используют векторные инструкции 64бит. Это связано с тем что при редуцировании чисел 32 бит используется 64 битная арифметика. 
 
 Оптимизация
 На x86 есть единственная операция умножения векторов 32х32=64 бита. Нет операции mullo и mulhi для epu32, чтобы оставаться в 32 битах.
 Есть операция для работы с 52 битными целыми числами, но операнды должны быть с выравниванием на 64 бит.
+Её использует NTT_ifma52(): коэффициенты расширяются до 64 бит, умножение на степень корня по Шоупу 
+выполняется тремя инструкциями vpmadd52, редуцирование между слоями ленивое. Версия выбирается при загрузке.
+Слои объединяются попарно (radix-4), четыре последних слоя вычисляются на регистрах: 
+число проходов по массиву $\lceil(\log_2 N - 4)/2\rceil + 1$ вместо $\log_2 N - 2$ при N >= 64.
 
 При работе с векторами используются операции:
 1. Сложение модульное
@@ -63,6 +69,8 @@ https://eprint.iacr.org/2012/470.pdf
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include "qnn.h"
 
 
 // Prime modulus q = 2^23 - 2^13 + 1
@@ -374,12 +382,16 @@ typedef uint32_t uint32x8_t __attribute__((__vector_size__(32)));
 static inline __m256i _mod1_avx2(__m256i x, __m256i q){
     return _mm256_min_epu32(x, _mm256_sub_epi32(x, q));
 }
+/*! \brief min(r, r-q) для 64 битных чисел $0 \le r < 2q$, в AVX2 нет _mm256_min_epu64 */
+static inline __m256i _min_epu64_avx2(__m256i r, __m256i t){
+    return _mm256_blendv_epi8(t, r, _mm256_cmpgt_epi64(_mm256_setzero_si256(), t));
+}
 static inline __m256i _barret_avx2(__m256i d, __m256i q, __m256i u) {
     __m256i c1 = _mm256_srli_epi64(d, 32);
     __m256i c2 = _mm256_add_epi64(d, _mm256_mul_epu32(c1, u));
     __m256i c3 = _mm256_srli_epi64(c2, 32);
     __m256i c4 = _mm256_sub_epi64(d, _mm256_mul_epu32(c3, q));
-    return _mm256_min_epu32(c4, _mm256_sub_epi32(c4, q));
+    return _min_epu64_avx2(c4, _mm256_sub_epi64(c4, q));
 /*
     __m256i c4_minus_q = _mm256_sub_epi64(c4, q);       // Compare c4 < c4_minus_q (unsigned comparison)
     __m256i cmp = _mm256_cmpgt_epi64(c4_minus_q, c4);   // c4_minus_q > c4
@@ -390,7 +402,7 @@ static inline __m256i _shoup_avx2(__m256i a, __m256i  b, __m256i w, __m256i q){
     __m256i r,p;
     p = _mm256_srli_epi64(_mm256_mul_epu32(a, w),32);
     r = _mm256_sub_epi64(_mm256_mul_epu32(a, b), _mm256_mul_epu32(q, p));
-    return _mm256_min_epu64(r, _mm256_sub_epi64(r, q));
+    return _min_epu64_avx2(r, _mm256_sub_epi64(r, q));
 }
 /*! \brief signed montgomery reduction
     \param d input value (uint64_t)
@@ -406,6 +418,13 @@ static inline __m256i _montgomery_avx2(__m256i d, __m256i q, __m256i qm) {
     return r;// _mm256_srai_epi64(r, 32);
 }
 
+#if !((defined(__AVX512F__) && defined(__AVX512VL__)) || defined(__AVX10_1__))
+//! маска a < b для чисел без знака, сравнение со сдвигом знакового бита
+static inline __m256i _cmplt_epu32_avx2(__m256i a, __m256i b) {
+    const __m256i s = _mm256_set1_epi32(0x80000000);
+    return _mm256_cmpgt_epi32(_mm256_xor_si256(b, s), _mm256_xor_si256(a, s));
+}
+#endif
 static inline __m256i _addm_avx2(__m256i a, __m256i b, __m256i q) {
     __m256i d = _mm256_add_epi32(a, b);
     // if overflow
@@ -413,11 +432,8 @@ static inline __m256i _addm_avx2(__m256i a, __m256i b, __m256i q) {
     d = _mm256_mask_sub_epi32(d, _mm256_cmplt_epu32_mask(d,b), d, q);
     return d;
 #else
-//    __m256i d_minus_q = _mm256_sub_epi64(d, q);       // Compare c4 < c4_minus_q (unsigned comparison)
-//    __m256i cmp = _mm256_cmplt_epu32(d, b);   // c4_minus_q > c4
-//    d = _mm256_blendv_epi8(d, d_minus_q, cmp);     // Select: if c4 < c4_minus_q, take c4; else take c4_minus_q
-
-    return _mm256_min_epu32(d, _mm256_sub_epi32(d, q));
+    __m256i t = _mm256_sub_epi32(d, q);
+    return _mm256_blendv_epi8(_mm256_min_epu32(d, t), t, _cmplt_epu32_avx2(d, b));
 #endif
 }
 static inline __m256i _subm_avx2(__m256i a, __m256i b, __m256i q) {
@@ -425,9 +441,8 @@ static inline __m256i _subm_avx2(__m256i a, __m256i b, __m256i q) {
 #if (defined(__AVX512F__) && defined(__AVX512VL__)) || defined(__AVX10_1__) 
     d = _mm256_mask_add_epi32(d, _mm256_cmplt_epu32_mask(a,b), d, q);
     return d;
-#else
-    __m256i t = _mm256_add_epi32(d, q);
-    return _mm256_min_epu32(d, t);
+#else// при q > 2^{31} сумма d+q переполняется, min() не годится
+    return _mm256_blendv_epi8(d, _mm256_add_epi32(d, q), _cmplt_epu32_avx2(a, b));
 #endif
 }
 static inline __m256i _mulm_avx2(__m256i a, __m256i b, __m256i q, __m256i u){
@@ -445,7 +460,7 @@ static inline __m256i _mulm_shoup_avx2(__m256i a, __m256i b, __m256i w, __m256i
 static inline 
 void poly_mod1(uint32_t *r, const unsigned int N, const uint32_t p) {
     __m256i q = _mm256_set1_epi32(p);
-    for (int i = 0; i < N; i += 16) {
+    for (int i = 0; i < N; i += 8) {
         __m256i v = _mm256_loadu_si256((__m256i *)(r + i));
         __m256i vr = _mod1_avx2(v, q);
         _mm256_storeu_si256((__m256i *)(r + i), vr);
@@ -471,14 +486,13 @@ static inline void poly_mulm(uint32_t *result, const uint32_t *a, const uint32_t
     }
 }
 static inline void poly_mulm_u(uint32_t *result, const uint32_t *a, const uint32_t b, unsigned int N, uint32_t p) {
-    uint64_t Ur = INVL(p);
-    __m256i q = _mm256_set1_epi32(p);
+    const uint64_t w = ((uint64_t)b<<32)/p;
     __m256i q_= _mm256_set1_epi64x(p);
-    __m256i u = _mm256_set1_epi64x(Ur);
+    __m256i vw= _mm256_set1_epi64x(w);
     __m256i vb= _mm256_set1_epi32(b);
     for (int i = 0; i < N; i += 8) {
         __m256i va = _mm256_loadu_si256((__m256i *)(a + i));
-        __m256i vr = _mulm_avx2(va, vb, q_, u);
+        __m256i vr = _mulm_shoup_avx2(va, vb, vw, q_);
         _mm256_storeu_si256((__m256i *)(result + i), vr);
     }
 }
@@ -760,6 +774,357 @@ void vec_mulm_u(uint32_t *r, const uint32_t *a, const uint32_t b, const unsigned
 static void NTT_CT_butterfly(uint32_t *a, uint32_t *b, uint32_t g, unsigned int n, uint32_t q);
 /*! \brief Gentleman-Sande batterfly векторный вариант "бабочки" */
 static void NTT_GS_butterfly(uint32_t *a, uint32_t *b, uint32_t g, unsigned int n, uint32_t q);
+/*! \defgroup _ntt_ifma52 NTT на AVX-512 IFMA52
+    Умножение на степени корня выполняется инструкциями vpmadd52luq/vpmadd52huq по алгоритму Шоупа 
+    с константой $w' = \lfloor w\cdot 2^{52}/q \rfloor$. Коэффициенты хранятся в 64 битных словах, 
+    по 8 в векторе, редуцирование ленивое [2103.16400]: в прямом преобразовании значения между слоями 
+    лежат в интервале [0, 4q), в обратном - в [0, 2q), полное редуцирование выполняется при записи 
+    результата. Четыре последних слоя (n = 8, 4, 2, 1) вычисляются на регистрах по 16 коэффициентов,
+    по аналогии с NTT_CT_butterfly_2xVL() в ml_kem.c, остальные слои объединяются попарно (radix-4): 
+    за один проход по памяти четыре вектора проходят два слоя "бабочек".
+
+    Версия выбирается при загрузке по возможностям процессора, см. NTT(), invNTT(). 
+    Требуется N >= 16.
+    \{
+ */
+#define TARGET_IFMA52 __attribute__((target("avx512f,avx512vl,avx512ifma")))
+/*! \brief Константа Шоупа для 52 битного умножения $\lfloor w\cdot 2^{52}/q \rfloor$, $w < q < 2^{32}$ */
+static inline uint64_t SHOUP52(uint32_t w, uint32_t q){
+    uint64_t f = (double)w*0x1p52/q;// приближение, уточняется по остатку
+    __int128 r = ((__int128)w<<52) - (__int128)f*q;
+    while (r <  0) { f--; r += q; }
+    while (r >= q) { f++; r -= q; }
+    return f;
+}
+/*! \brief Умножение по модулю на константу $a\cdot w \mod q$ в интервале [0, 2q)
+    \param a  - вектор 64 бит x8, $a < 2^{52}$
+    \param w  - константа
+    \param wp - константа Шоупа SHOUP52(w, q)
+    \param nq - $2^{52} - q$
+ */
+TARGET_IFMA52
+static inline __m512i _mulm_shoup52(__m512i a, __m512i w, __m512i wp, __m512i nq){
+    const __m512i z = _mm512_setzero_si512();
+    __m512i h = _mm512_madd52hi_epu64(z, a, wp);
+    __m512i r = _mm512_madd52lo_epu64(z, a, w);
+    r = _mm512_madd52lo_epu64(r, h, nq);// a*w - h*q mod 2^{52}
+    return _mm512_and_si512(r, _mm512_set1_epi64((1uLL<<52)-1));
+}
+//! Cooley-Tukey: вход и выход в интервале [0, 4q)
+TARGET_IFMA52
+static inline void _ct_butterfly52(__m512i *x, __m512i *y, __m512i w, __m512i wp, __m512i q2, __m512i nq){
+    __m512i X = _mm512_min_epu64(*x, _mm512_sub_epi64(*x, q2));
+    __m512i T = _mulm_shoup52(*y, w, wp, nq);
+    *x = _mm512_add_epi64(X, T);
+    *y = _mm512_add_epi64(_mm512_sub_epi64(X, T), q2);
+}
+//! Gentleman-Sande: вход и выход в интервале [0, 2q)
+TARGET_IFMA52
+static inline void _gs_butterfly52(__m512i *x, __m512i *y, __m512i w, __m512i wp, __m512i q2, __m512i nq){
+    __m512i T = _mm512_add_epi64(*x, *y);
+    __m512i D = _mm512_add_epi64(_mm512_sub_epi64(*x, *y), q2);
+    *x = _mm512_min_epu64(T, _mm512_sub_epi64(T, q2));
+    *y = _mulm_shoup52(D, w, wp, nq);
+}
+/*! \brief Таблица констант Шоупа к степеням корня, wp[0] не используется */
+static uint64_t* _ntt_shoup52_table(const uint32_t *gamma, unsigned int N, uint32_t q){
+    uint64_t *wp = aligned_alloc(64, N*sizeof(uint64_t));
+    wp[0] = 0;
+    for (unsigned int i=1; i<N; i++)
+        wp[i] = SHOUP52(gamma[i], q);
+    return wp;
+}
+/*  Перестановки для трех последних слоев: 16 коэффициентов в векторах v0, v1 
+    разделяются на X - первые, Y - вторые элементы пар "бабочки" с расстоянием n = 4, 2, 1
+ */
+#define NTT52_SPLIT(v0, v1, X, Y, ix, iy) do { \
+    X = _mm512_permutex2var_epi64(v0, ix, v1); \
+    Y = _mm512_permutex2var_epi64(v0, iy, v1); \
+} while(0)
+#define NTT52_MERGE(X, Y, v0, v1, i0, i1) do { \
+    v0 = _mm512_permutex2var_epi64(X, i0, Y); \
+    v1 = _mm512_permutex2var_epi64(X, i1, Y); \
+} while(0)
+/*! \brief Два слоя Cooley-Tukey (radix-4) за один проход по памяти: 
+    слой m с расстоянием n и слой 2m с расстоянием n/2.
+    \param t  коэффициенты 64 бит, расстояния n в элементах t, n/2 кратно 8
+ */
+TARGET_IFMA52
+static void _ct_radix4_52(uint64_t *t, unsigned int m, size_t n, const uint32_t *gamma, const uint64_t *wp, __m512i q2, __m512i nq){
+    const size_t h = n/2;
+    for (unsigned int i=0; i<m; i++) {
+        uint64_t *s = t + 2*n*i;
+        const __m512i w1 = _mm512_set1_epi64(gamma[m+i]),       p1 = _mm512_set1_epi64(wp[m+i]);
+        const __m512i w2 = _mm512_set1_epi64(gamma[2*m+2*i]),   p2 = _mm512_set1_epi64(wp[2*m+2*i]);
+        const __m512i w3 = _mm512_set1_epi64(gamma[2*m+2*i+1]), p3 = _mm512_set1_epi64(wp[2*m+2*i+1]);
+        for (size_t j=0; j<h; j+=8) {
+            __m512i x0 = _mm512_load_si512(s+j);
+            __m512i x1 = _mm512_load_si512(s+j+h);
+            __m512i x2 = _mm512_load_si512(s+j+n);
+            __m512i x3 = _mm512_load_si512(s+j+n+h);
+            _ct_butterfly52(&x0, &x2, w1, p1, q2, nq);
+            _ct_butterfly52(&x1, &x3, w1, p1, q2, nq);
+            _ct_butterfly52(&x0, &x1, w2, p2, q2, nq);
+            _ct_butterfly52(&x2, &x3, w3, p3, q2, nq);
+            _mm512_store_si512(s+j,     x0);
+            _mm512_store_si512(s+j+h,   x1);
+            _mm512_store_si512(s+j+n,   x2);
+            _mm512_store_si512(s+j+n+h, x3);
+        }
+    }
+}
+//! один слой Cooley-Tukey m с расстоянием n, n кратно 8
+TARGET_IFMA52
+static void _ct_radix2_52(uint64_t *t, unsigned int m, size_t n, const uint32_t *gamma, const uint64_t *wp, __m512i q2, __m512i nq){
+    for (unsigned int i=0; i<m; i++) {
+        uint64_t *s = t + 2*n*i;
+        const __m512i w = _mm512_set1_epi64(gamma[m+i]), vp = _mm512_set1_epi64(wp[m+i]);
+        for (size_t j=0; j<n; j+=8) {
+            __m512i x = _mm512_load_si512(s+j);
+            __m512i y = _mm512_load_si512(s+j+n);
+            _ct_butterfly52(&x, &y, w, vp, q2, nq);
+            _mm512_store_si512(s+j,   x);
+            _mm512_store_si512(s+j+n, y);
+        }
+    }
+}
+/*! \brief Два слоя Gentleman-Sande (radix-4) за один проход: слой m с расстоянием n и слой m/2 с расстоянием 2n, n кратно 8 */
+TARGET_IFMA52
+static void _gs_radix4_52(uint64_t *t, unsigned int m, size_t n, const uint32_t *gamma, const uint64_t *wp, __m512i q2, __m512i nq){
+    for (unsigned int i=0; i<m/2; i++) {
+        uint64_t *s = t + 4*n*i;
+        const __m512i w1 = _mm512_set1_epi64(gamma[m+2*i]),   p1 = _mm512_set1_epi64(wp[m+2*i]);
+        const __m512i w2 = _mm512_set1_epi64(gamma[m+2*i+1]), p2 = _mm512_set1_epi64(wp[m+2*i+1]);
+        const __m512i w3 = _mm512_set1_epi64(gamma[m/2+i]),   p3 = _mm512_set1_epi64(wp[m/2+i]);
+        for (size_t j=0; j<n; j+=8) {
+            __m512i x0 = _mm512_load_si512(s+j);
+            __m512i x1 = _mm512_load_si512(s+j+n);
+            __m512i x2 = _mm512_load_si512(s+j+2*n);
+            __m512i x3 = _mm512_load_si512(s+j+3*n);
+            _gs_butterfly52(&x0, &x1, w1, p1, q2, nq);
+            _gs_butterfly52(&x2, &x3, w2, p2, q2, nq);
+            _gs_butterfly52(&x0, &x2, w3, p3, q2, nq);
+            _gs_butterfly52(&x1, &x3, w3, p3, q2, nq);
+            _mm512_store_si512(s+j,     x0);
+            _mm512_store_si512(s+j+n,   x1);
+            _mm512_store_si512(s+j+2*n, x2);
+            _mm512_store_si512(s+j+3*n, x3);
+        }
+    }
+}
+//! один слой Gentleman-Sande m с расстоянием n, n кратно 8
+TARGET_IFMA52
+static void _gs_radix2_52(uint64_t *t, unsigned int m, size_t n, const uint32_t *gamma, const uint64_t *wp, __m512i q2, __m512i nq){
+    for (unsigned int i=0; i<m; i++) {
+        uint64_t *s = t + 2*n*i;
+        const __m512i w = _mm512_set1_epi64(gamma[m+i]), vp = _mm512_set1_epi64(wp[m+i]);
+        for (size_t j=0; j<n; j+=8) {
+            __m512i x = _mm512_load_si512(s+j);
+            __m512i y = _mm512_load_si512(s+j+n);
+            _gs_butterfly52(&x, &y, w, vp, q2, nq);
+            _mm512_store_si512(s+j,   x);
+            _mm512_store_si512(s+j+n, y);
+        }
+    }
+}
+/*! \brief Прямое NTT, версия AVX-512 IFMA52
+    \param wp константы Шоупа к степеням корня gamma
+    \param t  рабочий буфер N x 64 бит, выровненный на 64 байта
+ */
+TARGET_IFMA52
+static void _NTT_ifma52(uint32_t *a, const uint32_t *gamma, const uint64_t *wp, unsigned int N, uint32_t q, uint64_t *t){
+    const __m512i q1 = _mm512_set1_epi64(q);
+    const __m512i q2 = _mm512_set1_epi64(2*(uint64_t)q);
+    const __m512i nq = _mm512_set1_epi64((1uLL<<52) - q);
+    unsigned int i, j, k, m, n, r = __builtin_ctz(N) - 4;// слоев до n = 8
+    if (r >= 2) {// первые два слоя, загрузка 32 бит
+        const __m512i w1 = _mm512_set1_epi64(gamma[1]), p1 = _mm512_set1_epi64(wp[1]);
+        const __m512i w2 = _mm512_set1_epi64(gamma[2]), p2 = _mm512_set1_epi64(wp[2]);
+        const __m512i w3 = _mm512_set1_epi64(gamma[3]), p3 = _mm512_set1_epi64(wp[3]);
+        n = N/4;
+        for (j=0; j<n; j+=8) {
+            __m512i x0 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+j)));
+            __m512i x1 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+j+n)));
+            __m512i x2 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+j+2*n)));
+            __m512i x3 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+j+3*n)));
+            _ct_butterfly52(&x0, &x2, w1, p1, q2, nq);
+            _ct_butterfly52(&x1, &x3, w1, p1, q2, nq);
+            _ct_butterfly52(&x0, &x1, w2, p2, q2, nq);
+            _ct_butterfly52(&x2, &x3, w3, p3, q2, nq);
+            _mm512_store_si512(t+j,     x0);
+            _mm512_store_si512(t+j+n,   x1);
+            _mm512_store_si512(t+j+2*n, x2);
+            _mm512_store_si512(t+j+3*n, x3);
+        }
+        m = 4, n = N/8, r -= 2;
+    } else {// N = 16, 32: загрузка 32 бит
+        for (j=0; j<N; j+=8)
+            _mm512_store_si512(t+j, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+j))));
+        m = 1, n = N/2;
+    }
+    for (; r >= 2; r -= 2, m = 4*m, n = n/4)
+        _ct_radix4_52(t, m, n, gamma, wp, q2, nq);
+    if (r == 1)
+        _ct_radix2_52(t, m, n, gamma, wp, q2, nq);
+    const __m512i x4 = _mm512_setr_epi64(0, 1, 2, 3,  8,  9, 10, 11), y4 = _mm512_setr_epi64(4, 5, 6, 7, 12, 13, 14, 15);
+    const __m512i x2 = _mm512_setr_epi64(0, 1, 4, 5,  8,  9, 12, 13), y2 = _mm512_setr_epi64(2, 3, 6, 7, 10, 11, 14, 15);
+    const __m512i x1 = _mm512_setr_epi64(0, 2, 4, 6,  8, 10, 12, 14), y1 = _mm512_setr_epi64(1, 3, 5, 7,  9, 11, 13, 15);
+    const __m512i m2 = _mm512_setr_epi64(0, 1, 8, 9,  2,  3, 10, 11), n2 = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    const __m512i m1 = _mm512_setr_epi64(0, 8, 1, 9,  2, 10,  3, 11), n1 = _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15);
+    const __m512i r4 = _mm512_setr_epi64(0, 0, 0, 0,  1,  1,  1,  1), r2 = _mm512_setr_epi64(0, 0, 1, 1, 2, 2, 3, 3);
+    for (k=0; k<N; k+=16) {// слои n = 8, 4, 2, 1
+        __m512i v0 = _mm512_load_si512(t+k), v1 = _mm512_load_si512(t+k+8), X, Y, w, vp;
+        i = N/16 + k/16;
+        _ct_butterfly52(&v0, &v1, _mm512_set1_epi64(gamma[i]), _mm512_set1_epi64(wp[i]), q2, nq);
+        i = N/8 + k/8;
+        w  = _mm512_permutexvar_epi64(r4, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(gamma+i))));
+        vp = _mm512_permutexvar_epi64(r4, _mm512_loadu_si512(wp+i));
+        NTT52_SPLIT(v0, v1, X, Y, x4, y4);
+        _ct_butterfly52(&X, &Y, w, vp, q2, nq);
+        NTT52_MERGE(X, Y, v0, v1, x4, y4);
+        i = N/4 + k/4;
+        w  = _mm512_permutexvar_epi64(r2, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(gamma+i))));
+        vp = _mm512_permutexvar_epi64(r2, _mm512_loadu_si512(wp+i));
+        NTT52_SPLIT(v0, v1, X, Y, x2, y2);
+        _ct_butterfly52(&X, &Y, w, vp, q2, nq);
+        NTT52_MERGE(X, Y, v0, v1, m2, n2);
+        i = N/2 + k/2;
+        w  = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(gamma+i)));
+        vp = _mm512_loadu_si512(wp+i);
+        NTT52_SPLIT(v0, v1, X, Y, x1, y1);
+        _ct_butterfly52(&X, &Y, w, vp, q2, nq);
+        NTT52_MERGE(X, Y, v0, v1, m1, n1);
+        // [0, 4q) -> [0, q)
+        v0 = _mm512_min_epu64(v0, _mm512_sub_epi64(v0, q2));
+        v1 = _mm512_min_epu64(v1, _mm512_sub_epi64(v1, q2));
+        v0 = _mm512_min_epu64(v0, _mm512_sub_epi64(v0, q1));
+        v1 = _mm512_min_epu64(v1, _mm512_sub_epi64(v1, q1));
+        _mm256_storeu_si256((void*)(a+k),   _mm512_cvtepi64_epi32(v0));
+        _mm256_storeu_si256((void*)(a+k+8), _mm512_cvtepi64_epi32(v1));
+    }
+}
+/*! \brief Обратное NTT, версия AVX-512 IFMA52. Множитель $N^{-1}$ учитывается в последнем слое.
+    \param wp константы Шоупа к степеням корня gamma
+    \param t  рабочий буфер N x 64 бит, выровненный на 64 байта
+ */
+TARGET_IFMA52
+static void _invNTT_ifma52(uint32_t *a, const uint32_t *gamma, const uint64_t *wp, unsigned int N, uint32_t q, uint64_t *t){
+    const __m512i q1 = _mm512_set1_epi64(q);
+    const __m512i q2 = _mm512_set1_epi64(2*(uint64_t)q);
+    const __m512i nq = _mm512_set1_epi64((1uLL<<52) - q);
+    const __m512i x4 = _mm512_setr_epi64(0, 1, 2, 3,  8,  9, 10, 11), y4 = _mm512_setr_epi64(4, 5, 6, 7, 12, 13, 14, 15);
+    const __m512i x2 = _mm512_setr_epi64(0, 1, 4, 5,  8,  9, 12, 13), y2 = _mm512_setr_epi64(2, 3, 6, 7, 10, 11, 14, 15);
+    const __m512i x1 = _mm512_setr_epi64(0, 2, 4, 6,  8, 10, 12, 14), y1 = _mm512_setr_epi64(1, 3, 5, 7,  9, 11, 13, 15);
+    const __m512i m2 = _mm512_setr_epi64(0, 1, 8, 9,  2,  3, 10, 11), n2 = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+    const __m512i m1 = _mm512_setr_epi64(0, 8, 1, 9,  2, 10,  3, 11), n1 = _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15);
+    const __m512i r4 = _mm512_setr_epi64(0, 0, 0, 0,  1,  1,  1,  1), r2 = _mm512_setr_epi64(0, 0, 1, 1, 2, 2, 3, 3);
+    unsigned int i, j, k, m, n, r = __builtin_ctz(N) - 4;// слоев после n = 8
+    for (k=0; k<N; k+=16) {// слои n = 1, 2, 4, 8, загрузка 32 бит
+        __m512i v0 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+k)));
+        __m512i v1 = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a+k+8)));
+        __m512i X, Y, w, vp;
+        i = N/2 + k/2;
+        w  = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(gamma+i)));
+        vp = _mm512_loadu_si512(wp+i);
+        NTT52_SPLIT(v0, v1, X, Y, x1, y1);
+        _gs_butterfly52(&X, &Y, w, vp, q2, nq);
+        NTT52_MERGE(X, Y, v0, v1, m1, n1);
+        i = N/4 + k/4;
+        w  = _mm512_permutexvar_epi64(r2, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(gamma+i))));
+        vp = _mm512_permutexvar_epi64(r2, _mm512_loadu_si512(wp+i));
+        NTT52_SPLIT(v0, v1, X, Y, x2, y2);
+        _gs_butterfly52(&X, &Y, w, vp, q2, nq);
+        NTT52_MERGE(X, Y, v0, v1, m2, n2);
+        i = N/8 + k/8;
+        w  = _mm512_permutexvar_epi64(r4, _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(gamma+i))));
+        vp = _mm512_permutexvar_epi64(r4, _mm512_loadu_si512(wp+i));
+        NTT52_SPLIT(v0, v1, X, Y, x4, y4);
+        _gs_butterfly52(&X, &Y, w, vp, q2, nq);
+        NTT52_MERGE(X, Y, v0, v1, x4, y4);
+        i = N/16 + k/16;
+        _gs_butterfly52(&v0, &v1, _mm512_set1_epi64(gamma[i]), _mm512_set1_epi64(wp[i]), q2, nq);
+        _mm512_store_si512(t+k,   v0);
+        _mm512_store_si512(t+k+8, v1);
+    }
+    for (m = N/32, n = 16; r > 2; r -= 2, m = m/4, n = 4*n)
+        _gs_radix4_52(t, m, n, gamma, wp, q2, nq);
+    const uint32_t n_inv = INVM(N, q);
+    const uint32_t g_inv = MULM(gamma[1], n_inv, q);
+    const __m512i u  = _mm512_set1_epi64(n_inv), up = _mm512_set1_epi64(SHOUP52(n_inv, q));
+    const __m512i w  = _mm512_set1_epi64(g_inv), vp = _mm512_set1_epi64(SHOUP52(g_inv, q));
+    if (r == 2) {// два последних слоя, множитель N^{-1} в последнем, запись 32 бит
+        const __m512i w2 = _mm512_set1_epi64(gamma[2]), p2 = _mm512_set1_epi64(wp[2]);
+        const __m512i w3 = _mm512_set1_epi64(gamma[3]), p3 = _mm512_set1_epi64(wp[3]);
+        n = N/4;
+        for (j=0; j<n; j+=8) {
+            __m512i x0 = _mm512_load_si512(t+j);
+            __m512i x1 = _mm512_load_si512(t+j+n);
+            __m512i x2 = _mm512_load_si512(t+j+2*n);
+            __m512i x3 = _mm512_load_si512(t+j+3*n);
+            _gs_butterfly52(&x0, &x1, w2, p2, q2, nq);
+            _gs_butterfly52(&x2, &x3, w3, p3, q2, nq);
+            __m512i s0 = _mulm_shoup52(_mm512_add_epi64(x0, x2), u, up, nq);
+            __m512i s1 = _mulm_shoup52(_mm512_add_epi64(x1, x3), u, up, nq);
+            __m512i d0 = _mulm_shoup52(_mm512_add_epi64(_mm512_sub_epi64(x0, x2), q2), w, vp, nq);
+            __m512i d1 = _mulm_shoup52(_mm512_add_epi64(_mm512_sub_epi64(x1, x3), q2), w, vp, nq);
+            s0 = _mm512_min_epu64(s0, _mm512_sub_epi64(s0, q1));
+            s1 = _mm512_min_epu64(s1, _mm512_sub_epi64(s1, q1));
+            d0 = _mm512_min_epu64(d0, _mm512_sub_epi64(d0, q1));
+            d1 = _mm512_min_epu64(d1, _mm512_sub_epi64(d1, q1));
+            _mm256_storeu_si256((void*)(a+j),     _mm512_cvtepi64_epi32(s0));
+            _mm256_storeu_si256((void*)(a+j+n),   _mm512_cvtepi64_epi32(s1));
+            _mm256_storeu_si256((void*)(a+j+2*n), _mm512_cvtepi64_epi32(d0));
+            _mm256_storeu_si256((void*)(a+j+3*n), _mm512_cvtepi64_epi32(d1));
+        }
+    } else if (r == 1) {// последний слой с множителем N^{-1}, запись 32 бит
+        n = N/2;
+        for (j=0; j<n; j+=8) {
+            __m512i x = _mm512_load_si512(t+j);
+            __m512i y = _mm512_load_si512(t+j+n);
+            __m512i s = _mulm_shoup52(_mm512_add_epi64(x, y), u, up, nq);
+            __m512i d = _mulm_shoup52(_mm512_add_epi64(_mm512_sub_epi64(x, y), q2), w, vp, nq);
+            s = _mm512_min_epu64(s, _mm512_sub_epi64(s, q1));
+            d = _mm512_min_epu64(d, _mm512_sub_epi64(d, q1));
+            _mm256_storeu_si256((void*)(a+j),   _mm512_cvtepi64_epi32(s));
+            _mm256_storeu_si256((void*)(a+j+n), _mm512_cvtepi64_epi32(d));
+        }
+    } else {// N = 16: все слои на регистрах, множитель N^{-1}
+        for (j=0; j<N; j+=8) {
+            __m512i x = _mulm_shoup52(_mm512_load_si512(t+j), u, up, nq);
+            x = _mm512_min_epu64(x, _mm512_sub_epi64(x, q1));
+            _mm256_storeu_si256((void*)(a+j), _mm512_cvtepi64_epi32(x));
+        }
+    }
+}
+#undef NTT52_SPLIT
+#undef NTT52_MERGE
+/*! \brief Прямое NTT, версия AVX-512 IFMA52, аргументы \see NTT()
+    Константы Шоупа считаются при каждом вызове, без этого - ntt_plan() и NTT_batch().
+ */
+uint32_t* NTT_ifma52(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
+    uint64_t *t  = aligned_alloc(64, N*sizeof(uint64_t));
+    uint64_t *wp = _ntt_shoup52_table(gamma, N, q);
+    _NTT_ifma52(a, gamma, wp, N, q, t);
+    free(wp);
+    free(t);
+    return a;
+}
+/*! \brief Обратное NTT, версия AVX-512 IFMA52, аргументы \see invNTT() */
+uint32_t* invNTT_ifma52(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
+    uint64_t *t  = aligned_alloc(64, N*sizeof(uint64_t));
+    uint64_t *wp = _ntt_shoup52_table(gamma, N, q);
+    _invNTT_ifma52(a, gamma, wp, N, q, t);
+    free(wp);
+    free(t);
+    return a;
+}
+//!\}
+static int _ntt_ifma52 = 0;
+__attribute__((constructor))
+static void _ntt_init(void){
+    __builtin_cpu_init();
+    _ntt_ifma52 = __builtin_cpu_supports("avx512ifma") && __builtin_cpu_supports("avx512vl");
+}
 /*! \brief Чисто-теоретическое преобразование на кольце $\mathbb{Z}_q/\langle x^N + 1\rangle$ 
     \param a First polynomial (array of 256 uint32_t coefficients). return NTT(a) in bit-reversed order.
     \param gamma store powers of gamma in bit-reverse ordering
@@ -771,7 +1136,7 @@ static void NTT_GS_butterfly(uint32_t *a, uint32_t *b, uint32_t g, unsigned int
     * [2024/585](https://eprint.iacr.org/2024/585.pdf) 
     * [NIST:FIPS.203](https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.203.pdf)
 */
-uint32_t* NTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
+uint32_t* NTT_vec(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
     unsigned int i, j, k, m, n;
     n = N/2;
     for (m = 1; m < N/8; m = 2*m, n = n/2) {
@@ -780,7 +1145,7 @@ uint32_t* NTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
             NTT_CT_butterfly(a+k, a+k+n, w, n, q);
         }
     }
-    // можно оптимизировать см ml_kem.c
+    // можно оптимизировать см ml_kem.c, сделано в _NTT_ifma52()
     for (; m < N; m = 2*m, n = n/2) {
         for (i=0, k=0; i<m; i++, k+=2*n) {
             uint32_t w = gamma[m+i];
@@ -797,7 +1162,7 @@ uint32_t* NTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
     \param N_inv inverse of N modulo $q$
     \param q prime modulus satisfying $q \equiv 1 \mod 2N$
  */
-uint32_t* invNTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
+uint32_t* invNTT_vec(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
     unsigned int i, j, k, m, n;
     n = 1;
     for (m = N/2; m > 0; m = m/2, n=n*2) {
@@ -811,6 +1176,16 @@ uint32_t* invNTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q)
     //poly_mod1(a, N, q);
     return a;
 }
+/*! \brief Прямое NTT, версия выбирается по возможностям процессора: AVX-512 IFMA52 или NTT_vec() */
+uint32_t* NTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
+    if (_ntt_ifma52 && N>=16) return NTT_ifma52(a, gamma, N, q);
+    return NTT_vec(a, gamma, N, q);
+}
+/*! \brief Обратное NTT, версия выбирается по возможностям процессора: AVX-512 IFMA52 или invNTT_vec() */
+uint32_t* invNTT(uint32_t *a, const uint32_t *gamma, unsigned int N, uint32_t q){
+    if (_ntt_ifma52 && N>=16) return invNTT_ifma52(a, gamma, N, q);
+    return invNTT_vec(a, gamma, N, q);
+}
 /*! \brief Чисто-теоретическое преобразование на кольце $\mathbb{Z}_q/\langle x^N + 1\rangle$ 
     референсная реализация
     \param r результат преобразования
@@ -1179,6 +1554,247 @@ static int jacobi(uint64_t a, uint64_t m)
 	return t;
 }
 
+/*! \defgroup _ntt_plan План NTT и пакетное преобразование
+    План для пары (N, q) хранит корень степени 2N, степени корня и обратного корня в обратном 
+    битовом порядке и константы Шоупа к ним. План строится один раз при первом запросе и 
+    хранится до завершения программы, поиск и добавление в список выполняются без блокировок.
+
+    NTT_batch() преобразует k полиномов. При наличии IFMA52 полиномы обрабатываются группами 
+    по 8: коэффициент i всех полиномов группы занимает один вектор, каждый слой - вертикальные 
+    "бабочки" с общей степенью корня, без перестановок. Группы распределяются по потокам общего 
+    пула qnn_pool_default(). Остаток группы и полиномы с N > NTT_BATCH_NMAX, для которых 
+    рабочий буфер группы 64N байт не помещается в кеш L2, преобразуются по одному.
+    \{
+ */
+#ifndef NTT_BATCH_NMAX
+#define NTT_BATCH_NMAX 4096
+#endif
+struct ntt_plan {
+    unsigned int N;
+    uint32_t q;
+    uint32_t g;             //!< корень степени 2N из единицы
+    uint32_t *gamma;        //!< $g^i$ в обратном битовом порядке, \see NTT()
+    uint32_t *r_gamma;      //!< $g^{-i}$ в обратном битовом порядке, \see invNTT()
+    uint64_t *gamma_p52;    //!< константы Шоупа SHOUP52() к gamma
+    uint64_t *r_gamma_p52;  //!< константы Шоупа SHOUP52() к r_gamma
+    struct ntt_plan *next;
+};
+static struct ntt_plan * _Atomic _ntt_plans = NULL;
+
+static void _ntt_plan_free(struct ntt_plan *p){
+    free(p->gamma);
+    free(p->r_gamma);
+    free(p->gamma_p52);
+    free(p->r_gamma_p52);
+    free(p);
+}
+/*! \brief План NTT для кольца $\mathbb{Z}_q[x]/(x^N + 1)$
+    \param N power of 2, N >= 16
+    \param q prime modulus $q \equiv 1 \mod 2N$
+    \return план из кеша, NULL если параметры не подходят
+ */
+const struct ntt_plan* ntt_plan(unsigned int N, uint32_t q){
+    struct ntt_plan *p, *head = atomic_load_explicit(&_ntt_plans, memory_order_acquire);
+    for (p = head; p != NULL; p = p->next)
+        if (p->N==N && p->q==q) return p;
+    if (N < 16 || (N & (N-1))!=0 || q%(2*N)!=1) {
+        fprintf(stderr, "%s: N=%u q=%08x: N must be a power of 2 >= 16, q = 1 mod 2N\n", __func__, N, q);
+        return NULL;
+    }
+    p = malloc(sizeof(struct ntt_plan));
+    p->N = N;
+    p->q = q;
+    p->g = ntt_root(N, q);
+    p->gamma   = aligned_alloc(64, N*sizeof(uint32_t));
+    p->r_gamma = aligned_alloc(64, N*sizeof(uint32_t));
+    ntt_precompute_rev(p->gamma,   p->g, N, q);
+    ntt_precompute_rev(p->r_gamma, INVM(p->g, q), N, q);
+    p->gamma_p52   = _ntt_shoup52_table(p->gamma,   N, q);
+    p->r_gamma_p52 = _ntt_shoup52_table(p->r_gamma, N, q);
+    do {// план мог добавить другой поток
+        for (struct ntt_plan *e = head; e != NULL; e = e->next)
+            if (e->N==N && e->q==q) {
+                _ntt_plan_free(p);
+                return e;
+            }
+        p->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&_ntt_plans, &head, p, memory_order_release, memory_order_acquire));
+    return p;
+}
+/*! \brief Транспонирование матрицы 8x8 из 64 битных чисел: строки - полиномы, столбцы - коэффициенты */
+TARGET_IFMA52
+static inline void _transpose8x8_epi64(__m512i r[8]){
+    __m512i t[8], s[8];
+    for (int i=0; i<8; i+=2) {
+        t[i]   = _mm512_unpacklo_epi64(r[i], r[i+1]);
+        t[i+1] = _mm512_unpackhi_epi64(r[i], r[i+1]);
+    }
+    for (int i=0; i<8; i+=4) {
+        s[i]   = _mm512_shuffle_i64x2(t[i],   t[i+2], 0x88);
+        s[i+1] = _mm512_shuffle_i64x2(t[i],   t[i+2], 0xDD);
+        s[i+2] = _mm512_shuffle_i64x2(t[i+1], t[i+3], 0x88);
+        s[i+3] = _mm512_shuffle_i64x2(t[i+1], t[i+3], 0xDD);
+    }
+    r[0] = _mm512_shuffle_i64x2(s[0], s[4], 0x88);
+    r[4] = _mm512_shuffle_i64x2(s[0], s[4], 0xDD);
+    r[2] = _mm512_shuffle_i64x2(s[1], s[5], 0x88);
+    r[6] = _mm512_shuffle_i64x2(s[1], s[5], 0xDD);
+    r[1] = _mm512_shuffle_i64x2(s[2], s[6], 0x88);
+    r[5] = _mm512_shuffle_i64x2(s[2], s[6], 0xDD);
+    r[3] = _mm512_shuffle_i64x2(s[3], s[7], 0x88);
+    r[7] = _mm512_shuffle_i64x2(s[3], s[7], 0xDD);
+}
+//! загрузка коэффициентов j..j+7 восьми полиномов, v[c] - коэффициент j+c всех полиномов
+TARGET_IFMA52
+static inline void _ntt_load8x8(__m512i v[8], const uint32_t *a, size_t lda, unsigned int j){
+    for (int r=0; r<8; r++)
+        v[r] = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const void*)(a + r*lda + j)));
+    _transpose8x8_epi64(v);
+}
+TARGET_IFMA52
+static inline void _ntt_store8x8(uint32_t *a, size_t lda, unsigned int j, __m512i v[8]){
+    _transpose8x8_epi64(v);
+    for (int r=0; r<8; r++)
+        _mm256_storeu_si256((void*)(a + r*lda + j), _mm512_cvtepi64_epi32(v[r]));
+}
+/*! \brief Прямое NTT восьми полиномов a + r*lda, коэффициенты чередуются в буфере t[N][8]
+    \param t рабочий буфер 8N x 64 бит
+ */
+TARGET_IFMA52
+static void _NTT_ifma52_x8(uint32_t *a, size_t lda, const struct ntt_plan *p, uint64_t *t){
+    const unsigned int N = p->N;
+    const uint32_t *gamma = p->gamma;
+    const uint64_t *wp = p->gamma_p52;
+    const __m512i q1 = _mm512_set1_epi64(p->q);
+    const __m512i q2 = _mm512_set1_epi64(2*(uint64_t)p->q);
+    const __m512i nq = _mm512_set1_epi64((1uLL<<52) - p->q);
+    unsigned int j, m, n = N/2;
+    {// первый слой, загрузка с транспонированием
+        __m512i w = _mm512_set1_epi64(gamma[1]), vp = _mm512_set1_epi64(wp[1]);
+        __m512i x[8], y[8];
+        for (j=0; j<n; j+=8) {
+            _ntt_load8x8(x, a, lda, j);
+            _ntt_load8x8(y, a, lda, j+n);
+            for (int c=0; c<8; c++) {
+                _ct_butterfly52(&x[c], &y[c], w, vp, q2, nq);
+                _mm512_store_si512(t+8*(j+c), x[c]);
+                _mm512_store_si512(t+8*(j+n+c), y[c]);
+            }
+        }
+    }
+    // коэффициент j занимает вектор t[8j..8j+7], расстояния в элементах t умножаются на 8
+    for (m = 2, n = N/4; n >= 2; m = 4*m, n = n/4)
+        _ct_radix4_52(t, m, 8*n, gamma, wp, q2, nq);
+    if (n == 1)
+        _ct_radix2_52(t, m, 8, gamma, wp, q2, nq);
+    for (j=0; j<N; j+=8) {// [0, 4q) -> [0, q), запись с транспонированием
+        __m512i v[8];
+        for (int c=0; c<8; c++) {
+            v[c] = _mm512_load_si512(t+8*(j+c));
+            v[c] = _mm512_min_epu64(v[c], _mm512_sub_epi64(v[c], q2));
+            v[c] = _mm512_min_epu64(v[c], _mm512_sub_epi64(v[c], q1));
+        }
+        _ntt_store8x8(a, lda, j, v);
+    }
+}
+/*! \brief Обратное NTT восьми полиномов a + r*lda, \see _NTT_ifma52_x8() */
+TARGET_IFMA52
+static void _invNTT_ifma52_x8(uint32_t *a, size_t lda, const struct ntt_plan *p, uint64_t *t){
+    const unsigned int N = p->N;
+    const uint32_t *gamma = p->r_gamma;
+    const uint64_t *wp = p->r_gamma_p52;
+    const __m512i q1 = _mm512_set1_epi64(p->q);
+    const __m512i q2 = _mm512_set1_epi64(2*(uint64_t)p->q);
+    const __m512i nq = _mm512_set1_epi64((1uLL<<52) - p->q);
+    unsigned int i, j, m, n;
+    for (j=0, m=N/2; j<N; j+=8) {// первый слой n = 1, загрузка с транспонированием
+        __m512i v[8];
+        _ntt_load8x8(v, a, lda, j);
+        for (int c=0; c<8; c+=2) {
+            i = (j + c)/2;
+            _gs_butterfly52(&v[c], &v[c+1], _mm512_set1_epi64(gamma[m+i]), _mm512_set1_epi64(wp[m+i]), q2, nq);
+            _mm512_store_si512(t+8*(j+c),   v[c]);
+            _mm512_store_si512(t+8*(j+c+1), v[c+1]);
+        }
+    }
+    for (m = N/4, n = 2; m > 2; m = m/4, n = 4*n)
+        _gs_radix4_52(t, m, 8*n, gamma, wp, q2, nq);
+    if (m == 2)
+        _gs_radix2_52(t, m, 8*n, gamma, wp, q2, nq);
+    {// последний слой с множителем N^{-1}, запись с транспонированием
+        const uint32_t n_inv = INVM(N, p->q);
+        const uint32_t g_inv = MULM(gamma[1], n_inv, p->q);
+        const __m512i u = _mm512_set1_epi64(n_inv), up = _mm512_set1_epi64(SHOUP52(n_inv, p->q));
+        const __m512i w = _mm512_set1_epi64(g_inv), vp = _mm512_set1_epi64(SHOUP52(g_inv, p->q));
+        n = N/2;
+        for (j=0; j<n; j+=8) {
+            __m512i s[8], d[8];
+            for (int c=0; c<8; c++) {
+                __m512i x = _mm512_load_si512(t+8*(j+c));
+                __m512i y = _mm512_load_si512(t+8*(j+n+c));
+                s[c] = _mulm_shoup52(_mm512_add_epi64(x, y), u, up, nq);
+                d[c] = _mulm_shoup52(_mm512_add_epi64(_mm512_sub_epi64(x, y), q2), w, vp, nq);
+                s[c] = _mm512_min_epu64(s[c], _mm512_sub_epi64(s[c], q1));
+                d[c] = _mm512_min_epu64(d[c], _mm512_sub_epi64(d[c], q1));
+            }
+            _ntt_store8x8(a, lda, j,   s);
+            _ntt_store8x8(a, lda, j+n, d);
+        }
+    }
+}
+struct _ntt_batch {
+    const struct ntt_plan *p;
+    uint32_t *a;
+    size_t lda;
+    int64_t k;
+    int group;  //!< полиномов в группе: 8 - чередование на дорожках вектора, 1 - по одному
+    int inv;
+};
+static void _ntt_batch_range(void *arg, int64_t i0, int64_t i1, int ith){
+    const struct _ntt_batch *b = arg;
+    const struct ntt_plan *p = b->p;
+    const unsigned int N = p->N;
+    uint64_t *t = _ntt_ifma52? aligned_alloc(64, b->group*N*sizeof(uint64_t)): NULL;
+    for (int64_t i = i0; i < i1; i++) {
+        uint32_t *a = b->a + i*b->group*b->lda;
+        int k = b->k - i*b->group < b->group? b->k - i*b->group: b->group;
+        if (k == 8) {
+            if (b->inv) _invNTT_ifma52_x8(a, b->lda, p, t);
+            else        _NTT_ifma52_x8(a, b->lda, p, t);
+            continue;
+        }
+        for (int j = 0; j < k; j++, a += b->lda) {
+            if (_ntt_ifma52) {
+                if (b->inv) _invNTT_ifma52(a, p->r_gamma, p->r_gamma_p52, N, p->q, t);
+                else        _NTT_ifma52(a, p->gamma, p->gamma_p52, N, p->q, t);
+            } else {
+                if (b->inv) invNTT_vec(a, p->r_gamma, N, p->q);
+                else        NTT_vec(a, p->gamma, N, p->q);
+            }
+        }
+    }
+    free(t);
+}
+static void _ntt_batch(const struct ntt_plan *p, uint32_t *a, size_t lda, int64_t k, int inv){
+    const int group = (_ntt_ifma52 && p->N <= NTT_BATCH_NMAX)? 8: 1;
+    struct _ntt_batch b = {.p = p, .a = a, .lda = lda, .k = k, .group = group, .inv = inv};
+    // задача не меньше 2^{16} "бабочек", чтобы деление не стоило дороже вычислений
+    const int64_t bf = (int64_t)group*(p->N/2)*__builtin_ctz(p->N);
+    const int64_t grain = bf < (1<<16)? (1<<16)/bf: 1;
+    qnn_pool_parallel_for(qnn_pool_default(), (k + group - 1)/group, grain, _ntt_batch_range, &b);
+}
+/*! \brief Прямое NTT k полиномов по плану, результат как у NTT()
+    \param a   полиномы a + j*lda, j < k, коэффициенты в интервале [0, q)
+    \param lda расстояние между полиномами в элементах, lda >= N
+ */
+void NTT_batch(const struct ntt_plan *p, uint32_t *a, size_t lda, int64_t k){
+    _ntt_batch(p, a, lda, k, 0);
+}
+/*! \brief Обратное NTT k полиномов по плану, результат как у invNTT(), \see NTT_batch() */
+void invNTT_batch(const struct ntt_plan *p, uint32_t *a, size_t lda, int64_t k){
+    _ntt_batch(p, a, lda, k, 1);
+}
+//!\}
 /*! \brief Специальный вид инверсии для алгоритма редуцирования $\lfloor (2^{64}-q)/q \rfloor$ */
 static inline uint64_t INVL128(uint64_t v) {
     return ((unsigned __int128)(-v)<<64)/v;
@@ -1205,6 +1821,7 @@ static uint64_t POWM128(const uint64_t b, uint64_t a, const uint64_t P)
 
 
 #if defined(TEST_NTT) || 0
+#include "qnn_bench.h"
 /// Reference implementation
 #define A0  0xFEA0u// 0xFF80u
 #define Q0  ((A0<<16)-1)
@@ -1818,6 +2435,132 @@ int main(int argc, char **argv){
             printf("..%s\n", res?"ok":"fail");
         }
     }
+    if (1) {// NTT: сравнение версий AVX-512 IFMA52 и NTT_vec(), такты на "бабочку"
+        static const struct { const char* name; uint32_t p; } bench_primes[] = {
+            {"Q_PRIME",    Q_PRIME},
+            {"Baby Bear",  (1u<<31) -(1u<<27)+1},
+            {"Koala Bear", (1u<<31) -(1u<<24)+1},
+        };
+#if defined(__AVX512F__)
+        const char* vec_name = "avx512";
+#else
+        const char* vec_name = "avx2";
+#endif
+        const unsigned int n_max = 1u<<16;
+        uint32_t *a  = aligned_alloc(64, n_max*sizeof(uint32_t));
+        uint32_t *b  = aligned_alloc(64, n_max*sizeof(uint32_t));
+        uint32_t *wv = aligned_alloc(64, n_max*sizeof(uint32_t));
+        uint32_t *vv = aligned_alloc(64, n_max*sizeof(uint32_t));
+        printf("NTT bench, ifma52 %s\n", _ntt_ifma52? "supported": "not supported");
+        for (int k=0; k<sizeof(bench_primes)/sizeof(bench_primes[0]); k++) {
+            uint32_t p = bench_primes[k].p;
+            for (unsigned int n = 32; n <= n_max; n*=2) {
+                if (p%(n+n)!=1) {// нет корня степени 2N
+                    printf("%-10s %08x N=%5u: q != 1 mod 2N, skip\n", bench_primes[k].name, p, n);
+                    break;
+                }
+                uint32_t g = ntt_root(n, p);
+                ntt_precompute_rev(wv, g, n, p);
+                ntt_precompute_rev(vv, INVM(g, p), n, p);
+                for (unsigned int i=0; i<n; i++) a[i] = ((uint64_t)i*0x9E3779B9u)%p;
+                int res = 1;
+                if (_ntt_ifma52) {
+                    for (unsigned int i=0; i<n; i++) b[i] = a[i];
+                    NTT_vec(a, wv, n, p);
+                    NTT_ifma52(b, wv, n, p);
+                    for (unsigned int i=0; i<n; i++) res = res && (a[i]==b[i]);
+                    invNTT_ifma52(b, vv, n, p);
+                    invNTT_vec(a, vv, n, p);
+                    for (unsigned int i=0; i<n; i++) res = res && (a[i]==b[i]) && (a[i]==((uint64_t)i*0x9E3779B9u)%p);
+                }
+                const double bf = (double)(n/2)*__builtin_ctz(n);// число "бабочек"
+                const int n_iter = bf < (1<<20)? (1<<20)/bf: 1;
+                double cyc[4] = {0};
+                uint64_t t0 = __rdtsc();
+                for (int it=0; it<n_iter; it++) NTT_vec(a, wv, n, p);
+                cyc[0] = (__rdtsc() - t0)/(bf*n_iter);
+                t0 = __rdtsc();
+                for (int it=0; it<n_iter; it++) invNTT_vec(a, vv, n, p);
+                cyc[1] = (__rdtsc() - t0)/(bf*n_iter);
+                if (_ntt_ifma52) {
+                    t0 = __rdtsc();
+                    for (int it=0; it<n_iter; it++) NTT_ifma52(a, wv, n, p);
+                    cyc[2] = (__rdtsc() - t0)/(bf*n_iter);
+                    t0 = __rdtsc();
+                    for (int it=0; it<n_iter; it++) invNTT_ifma52(a, vv, n, p);
+                    cyc[3] = (__rdtsc() - t0)/(bf*n_iter);
+                }
+                printf("%-10s %08x N=%5u: %s NTT %5.2f inv %5.2f | ifma52 NTT %5.2f inv %5.2f cyc/bf x%.2f %s\n", 
+                    bench_primes[k].name, p, n, vec_name, cyc[0], cyc[1], cyc[2], cyc[3], 
+                    cyc[2]>0? cyc[0]/cyc[2]: 0.0, res? "ok": "fail");
+            }
+        }
+        free(a); free(b); free(wv); free(vv);
+    }
+    if (1) {// пакетное NTT по плану: k полиномов, сравнение с NTT() по одному
+        const uint32_t p = (1u<<31) -(1u<<27)+1;// Baby Bear
+        const int64_t k = 256;
+        for (unsigned int n = 16; n <= 4096; n*=2) {
+            const struct ntt_plan *plan = ntt_plan(n, p);
+            if (plan==NULL || plan!=ntt_plan(n, p)) {
+                printf("ntt_plan N=%u fail\n", n);
+                continue;
+            }
+            uint32_t *a = aligned_alloc(64, k*n*sizeof(uint32_t));
+            uint32_t *b = aligned_alloc(64, k*n*sizeof(uint32_t));
+            for (int64_t i=0; i<k*n; i++) a[i] = b[i] = ((uint64_t)i*0x9E3779B9u)%p;
+            int res = 1;
+            NTT_batch(plan, a, n, k);
+            for (int64_t j=0; j<k; j++) NTT(b + j*n, plan->gamma, n, p);
+            for (int64_t i=0; i<k*n; i++) res = res && (a[i]==b[i]);
+            invNTT_batch(plan, a, n, k);
+            for (int64_t i=0; i<k*n; i++) res = res && (a[i]==((uint64_t)i*0x9E3779B9u)%p);
+            const int n_iter = 4;
+            uint64_t t0 = __rdtsc();
+            for (int it=0; it<n_iter; it++)
+                for (int64_t j=0; j<k; j++) NTT(b + j*n, plan->gamma, n, p);
+            double c0 = (double)(__rdtsc() - t0)/(k*n_iter);
+            t0 = __rdtsc();
+            for (int it=0; it<n_iter; it++) NTT_batch(plan, a, n, k);
+            double c1 = (double)(__rdtsc() - t0)/(k*n_iter);
+            printf("NTT_batch N=%5u k=%d threads %d: NTT() %8.0f, batch %8.0f cycles/poly x%.2f %s\n", 
+                n, (int)k, qnn_pool_size(qnn_pool_default()), c0, c1, c0/c1, res? "ok": "fail");
+            free(a); free(b);
+        }
+    }
+    if (1) {// медиана и p99 по отдельным замерам, такты на преобразование, см. qnn_bench.h
+        const uint32_t p = (1u<<31) -(1u<<27)+1;// Baby Bear
+        const unsigned int n_iter = 2000;
+        char name[64];
+        struct bench b;
+        bench_init(&b, name, n_iter);
+        for (unsigned int n = 256; n <= 4096; n*=4) {
+            const struct ntt_plan *plan = ntt_plan(n, p);
+            uint32_t *a = aligned_alloc(64, 8*n*sizeof(uint32_t));
+            for (unsigned int i=0; i<8*n; i++) a[i] = ((uint64_t)i*0x9E3779B9u)%p;
+            snprintf(name, sizeof(name), "NTT_vec N=%u", n);
+            BENCH_RUN(&b, NTT_vec(a, plan->gamma, n, p));
+            bench_report(&b, n);
+            snprintf(name, sizeof(name), "invNTT_vec N=%u", n);
+            BENCH_RUN(&b, invNTT_vec(a, plan->r_gamma, n, p));
+            bench_report(&b, n);
+            if (_ntt_ifma52) {
+                snprintf(name, sizeof(name), "NTT_ifma52 N=%u", n);
+                BENCH_RUN(&b, NTT_ifma52(a, plan->gamma, n, p));
+                bench_report(&b, n);
+                snprintf(name, sizeof(name), "invNTT_ifma52 N=%u", n);
+                BENCH_RUN(&b, invNTT_ifma52(a, plan->r_gamma, n, p));
+                bench_report(&b, n);
+            }
+            snprintf(name, sizeof(name), "NTT_batch k=8 N=%u", n);
+            b.count = 8;
+            BENCH_RUN(&b, NTT_batch(plan, a, n, 8));
+            bench_report(&b, n);
+            b.count = 1;
+            free(a);
+        }
+        bench_free(&b);
+    }
     if (1) {// Умножение полиномов методом NTT
         int res;
         printf("poly mul\n"); 
@@ -0,0 +1,547 @@
+/*! \file qnn_pool.c
+	\brief Пул потоков с перехватом работы (work stealing)
+
+Сборка и тестирование
+	$ gcc -DTEST_POOL -O3 -march=native -o test qnn_pool.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
+	$ ./test 4
+
+Потоки пула создаются один раз и используются совместно исполнением графа (qnn_graph_compute),
+проверкой хэшей тензоров (gguf_hash_verify) и пакетной распаковкой весов (qnn_dequantize_rows).
+Общий пул qnn_pool_default() имеет по одному потоку на доступный процессор, число участников
+задания ограничено размером пула, поэтому одновременные пользователи не создают лишних потоков.
+Задание, запущенное из потока пула, выполняется в вызывающем потоке.
+
+Задание qnn_pool_run() выполняется в модели SPMD: функция вызывается в nth потоках, вызывающий
+поток участвует с номером 0. Синхронизация фаз - барьер qnn_pool_barrier(): ожидание в цикле
+с командой pause, затем сон на условной переменной. Так же ожидают новое задание свободные потоки.
+
+Деление работы: диапазон задач [0, n) делится поровну между потоками, каждый поток берет задачи
+из начала своей очереди, а закончив свою долю, забирает половину остатка из конца очереди другого
+потока. Очередь - одно 64-битное слово (начало | конец<<32), изменяется операцией CAS владельцем
+и похитителями. Сначала перехват выполняется у потоков того же узла NUMA.
+
+Потоки закрепляются за процессорами по порядку узлов NUMA (/sys/devices/system/node), соседние
+номера потоков, которые обрабатывают соседние строки тензора, попадают на один узел.
+ */
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "qnn.h"
+
+#define QNN_POOL_SPIN  (1<<12)	// число итераций ожидания с pause до перехода ко сну
+#define QNN_POOL_TASKS 8	// задач на поток при автоматическом выборе размера задачи
+
+#if defined(__x86_64__) || defined(__i386__)
+ #define _cpu_relax() __builtin_ia32_pause()
+#else
+ #define _cpu_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+struct _pool_deque {
+	_Alignas(64) _Atomic uint64_t range;	// начало | конец<<32
+	int node;	// узел NUMA потока
+};
+struct qnn_pool {
+	int n_threads;
+	int spin;	// итераций ожидания до сна, 0 если потоков больше, чем процессоров
+	pthread_t * threads;
+	struct _pool_deque * deque;
+	pthread_mutex_t run_lock;	// одно задание в пуле в каждый момент
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;	// новое задание или завершение
+	pthread_cond_t  phase_cond;	// барьер
+	_Atomic uint32_t gen;	// номер задания, удвоенный: нечетный - задание записывается
+	atomic_int n_sleep;	// потоки, ожидающие задание на wake
+	atomic_int stop;
+	// задание, публикуется вместе с gen, \see _pool_publish()
+	_Atomic(qnn_pool_fn) fn;
+	_Atomic(void *) arg;
+	atomic_int nth;
+	struct _pool_job {
+		struct qnn_pool * pool;
+		int nth;	// число участников
+		struct _pool_deque * deque;
+	} job;
+	// барьер
+	_Alignas(64) atomic_int n_arrived;
+	_Atomic uint32_t phase;
+	atomic_int n_sleep_phase;
+};
+struct _pool_worker {
+	struct qnn_pool * pool;
+	int ith;
+	int cpu;
+};
+static _Thread_local struct _pool_job * _job = NULL;// задание, которое выполняет поток
+
+/*! \brief Список процессоров, упорядоченный по узлам NUMA
+	\return число процессоров, доступных процессу
+ */
+static int _cpu_topology(int * cpu, int * node, int max)
+{
+	int n = 0;
+#if defined(__linux__)
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask)!=0) return 0;
+	cpu_set_t seen;
+	CPU_ZERO(&seen);
+	for (int nd = 0; nd < 1024 && n < max; nd++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nd);
+		FILE * fp = fopen(path, "r");
+		if (fp==NULL) {
+			if (nd > 0) break;
+			continue;// нет сведений об узлах
+		}
+		int a, b;
+		while (fscanf(fp, "%d", &a)==1) {// список вида 0-3,8-11
+			b = a;
+			int c = fgetc(fp);
+			if (c=='-') {
+				if (fscanf(fp, "%d", &b)!=1) break;
+				c = fgetc(fp);
+			}
+			for (int i = a; i <= b && n < max; i++) {
+				if (i >= CPU_SETSIZE || !CPU_ISSET(i, &mask) || CPU_ISSET(i, &seen)) continue;
+				CPU_SET(i, &seen);
+				cpu[n] = i; node[n] = nd; n++;
+			}
+			if (c!=',') break;
+		}
+		fclose(fp);
+	}
+	for (int i = 0; i < CPU_SETSIZE && n < max; i++) {// процессоры вне описания узлов
+		if (!CPU_ISSET(i, &mask) || CPU_ISSET(i, &seen)) continue;
+		cpu[n] = i; node[n] = 0; n++;
+	}
+#else
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	for (; n < nproc && n < max; n++) {
+		cpu[n] = n; node[n] = 0;
+	}
+#endif
+	return n;
+}
+/*! \brief ожидание изменения счетчика: сначала в цикле, затем сон на условной переменной */
+static void _pool_wait(struct qnn_pool * pool, _Atomic uint32_t * counter, uint32_t value, pthread_cond_t * cond, atomic_int * n_sleep)
+{
+	for (int spin = 0; spin < pool->spin; spin++) {
+		if (atomic_load_explicit(counter, memory_order_acquire)!=value) return;
+		_cpu_relax();
+	}
+	pthread_mutex_lock(&pool->lock);
+	atomic_fetch_add(n_sleep, 1);
+	while (atomic_load(counter)==value)
+		pthread_cond_wait(cond, &pool->lock);
+	atomic_fetch_sub(n_sleep, 1);
+	pthread_mutex_unlock(&pool->lock);
+}
+/*! \brief изменить счетчик и разбудить спящих
+	Счетчик изменяется до проверки числа спящих, а спящий увеличивает число до проверки счетчика,
+	поэтому хотя бы один из двух потоков видит изменение другого.
+ */
+static void _pool_signal(struct qnn_pool * pool, _Atomic uint32_t * counter, pthread_cond_t * cond, atomic_int * n_sleep)
+{
+	atomic_fetch_add(counter, 1);
+	if (atomic_load(n_sleep) > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+/*! \brief барьер участников текущего задания
+
+	Последний пришедший поток переключает фазу, остальные ждут переключения.
+ */
+void qnn_pool_barrier(struct qnn_pool * pool)
+{
+	const int nth = _job!=NULL? _job->nth: 1;
+	if (nth <= 1) return;
+	const uint32_t phase = atomic_load_explicit(&pool->phase, memory_order_relaxed);
+	if (atomic_fetch_add_explicit(&pool->n_arrived, 1, memory_order_acq_rel) == nth - 1) {
+		atomic_store_explicit(&pool->n_arrived, 0, memory_order_relaxed);
+		_pool_signal(pool, &pool->phase, &pool->phase_cond, &pool->n_sleep_phase);
+	} else
+		_pool_wait(pool, &pool->phase, phase, &pool->phase_cond, &pool->n_sleep_phase);
+}
+/*! \brief опубликовать задание: fn, arg и nth изменяются между двумя увеличениями gen (seqlock)
+
+	Вызывается под run_lock, когда участники прежнего задания прошли барьер.
+ */
+static void _pool_publish(struct qnn_pool * pool, qnn_pool_fn fn, void * arg, int nth)
+{
+	atomic_fetch_add_explicit(&pool->gen, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&pool->fn,  fn,  memory_order_relaxed);
+	atomic_store_explicit(&pool->arg, arg, memory_order_relaxed);
+	atomic_store_explicit(&pool->nth, nth, memory_order_relaxed);
+	pool->job.nth = nth;
+	_pool_signal(pool, &pool->gen, &pool->wake, &pool->n_sleep);
+}
+/*! \brief прочитать задание целиком, одного номера gen
+	\return номер прочитанного задания
+
+	Поток, не участвующий в задании, может проснуться, когда уже опубликовано следующее.
+	Номер, параметры и число участников читаются согласованно, поэтому поток выполняет 
+	то задание, номер которого запоминает, и не выполняет одно задание дважды.
+ */
+static uint32_t _pool_read(struct qnn_pool * pool, qnn_pool_fn * fn, void ** arg, int * nth)
+{
+	for (;;) {
+		const uint32_t gen = atomic_load_explicit(&pool->gen, memory_order_acquire);
+		if (gen & 1) {
+			_cpu_relax();
+			continue;
+		}
+		*fn  = atomic_load_explicit(&pool->fn,  memory_order_relaxed);
+		*arg = atomic_load_explicit(&pool->arg, memory_order_relaxed);
+		*nth = atomic_load_explicit(&pool->nth, memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&pool->gen, memory_order_relaxed)==gen) return gen;
+	}
+}
+static void * _pool_thread(void * data)
+{
+	struct _pool_worker * w = data;
+	struct qnn_pool * pool = w->pool;
+	const int ith = w->ith;
+#if defined(__linux__)
+	if (w->cpu >= 0) {
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		CPU_SET(w->cpu, &mask);
+		pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+	}
+#endif
+	g_free(w);
+	uint32_t gen = 0;// номер последнего прочитанного задания
+	for (;;) {
+		_pool_wait(pool, &pool->gen, gen, &pool->wake, &pool->n_sleep);
+		qnn_pool_fn fn;
+		void * arg;
+		int nth;
+		gen = _pool_read(pool, &fn, &arg, &nth);
+		if (atomic_load_explicit(&pool->stop, memory_order_relaxed)) break;
+		if (ith < nth) {// задание не завершится без этого потока, pool->job не изменится
+			_job = &pool->job;
+			fn(arg, ith, nth);
+			qnn_pool_barrier(pool);
+			_job = NULL;
+		}
+	}
+	return NULL;
+}
+/*! \brief Создать пул
+	\param n_threads число потоков, включая вызывающий; 0 - по числу доступных процессоров
+	\return пул или NULL
+ */
+struct qnn_pool * qnn_pool_new(int n_threads)
+{
+	int max = n_threads > 0? n_threads: 1024;
+	int * cpu  = g_new(int, max);
+	int * node = g_new(int, max);
+	int n_cpu = _cpu_topology(cpu, node, max);
+	if (n_threads <= 0) n_threads = n_cpu > 0? n_cpu: 1;
+	struct qnn_pool * pool = g_new0(struct qnn_pool, 1);
+	pool->n_threads = n_threads;
+	pool->spin = n_threads <= n_cpu? QNN_POOL_SPIN: 0;
+	pool->threads = g_new0(pthread_t, n_threads);
+	pool->deque = _aligned_malloc(n_threads*sizeof(struct _pool_deque), 64);
+	pthread_mutex_init(&pool->run_lock, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->phase_cond, NULL);
+	atomic_init(&pool->gen, 0);
+	atomic_init(&pool->n_sleep, 0);
+	atomic_init(&pool->stop, 0);
+	atomic_init(&pool->fn, NULL);
+	atomic_init(&pool->arg, NULL);
+	atomic_init(&pool->nth, 1);
+	atomic_init(&pool->n_arrived, 0);
+	atomic_init(&pool->phase, 0);
+	atomic_init(&pool->n_sleep_phase, 0);
+	pool->job = (struct _pool_job){.pool = pool, .nth = 1, .deque = pool->deque};
+	for (int i = 0; i < n_threads; i++) {
+		atomic_init(&pool->deque[i].range, 0);
+		// при числе потоков больше числа процессоров закрепление не выполняется
+		pool->deque[i].node = n_threads <= n_cpu? node[i]: 0;
+	}
+	for (int i = 1; i < n_threads; i++) {
+		struct _pool_worker * w = g_new(struct _pool_worker, 1);
+		*w = (struct _pool_worker){.pool = pool, .ith = i, .cpu = n_threads <= n_cpu? cpu[i]: -1};
+		if (pthread_create(&pool->threads[i], NULL, _pool_thread, w)!=0) {
+			fprintf(stderr, "%s: failed to create thread %d\n", __func__, i);
+			g_free(w);
+			pool->n_threads = i;// пул меньшего размера
+			break;
+		}
+	}
+	g_free(cpu);
+	g_free(node);
+	return pool;
+}
+void qnn_pool_free(struct qnn_pool * pool)
+{
+	if (pool==NULL) return;
+	atomic_store(&pool->stop, 1);
+	_pool_publish(pool, NULL, NULL, 0);
+	for (int i = 1; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_cond_destroy(&pool->phase_cond);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->run_lock);
+	_aligned_free(pool->deque);
+	g_free(pool->threads);
+	g_free(pool);
+}
+static struct qnn_pool * _pool_default = NULL;
+static pthread_once_t _pool_default_once = PTHREAD_ONCE_INIT;
+static void _pool_default_init(void)
+{
+	const char * s = getenv("QNN_NUM_THREADS");
+	_pool_default = qnn_pool_new(s!=NULL? atoi(s): 0);
+}
+/*! \brief Общий пул процесса, создается при первом обращении
+	Размер пула задается переменной окружения QNN_NUM_THREADS, по умолчанию по числу процессоров.
+ */
+struct qnn_pool * qnn_pool_default(void)
+{
+	pthread_once(&_pool_default_once, _pool_default_init);
+	return _pool_default;
+}
+int qnn_pool_size(const struct qnn_pool * pool)
+{
+	return pool->n_threads;
+}
+/*! \brief Выполнить функцию в nth потоках пула: fn(arg, ith, nth), ith=0 - вызывающий поток
+	\param nth число участников, ограничивается размером пула; 0 - все потоки пула
+	\return число участников
+
+	Возврат после завершения всех участников. Вызов из задания этого же пула выполняется 
+	в вызывающем потоке с nth=1, вызовы из разных внешних потоков выполняются по очереди.
+ */
+int qnn_pool_run(struct qnn_pool * pool, int nth, qnn_pool_fn fn, void * arg)
+{
+	if (nth <= 0 || nth > pool->n_threads) nth = pool->n_threads;
+	if (nth==1 || (_job!=NULL && _job->pool==pool)) {// задание без участия других потоков
+		struct _pool_deque deque = {.node = 0};
+		struct _pool_job job = {.pool = pool, .nth = 1, .deque = &deque};
+		struct _pool_job * outer = _job;
+		_job = &job;
+		fn(arg, 0, 1);
+		_job = outer;
+		return 1;
+	}
+	pthread_mutex_lock(&pool->run_lock);
+	_pool_publish(pool, fn, arg, nth);
+	_job = &pool->job;
+	fn(arg, 0, nth);
+	qnn_pool_barrier(pool);
+	_job = NULL;
+	pthread_mutex_unlock(&pool->run_lock);
+	return nth;
+}
+/*! \brief Начальная доля задач потока ith из n задач текущего задания
+
+	Вызывается каждым участником до qnn_pool_rows_next(). Между двумя делениями работы участники
+	должны пройти барьер, чтобы ни один поток не брал задачи прежнего деления.
+ */
+void qnn_pool_rows_begin(struct qnn_pool * pool, int ith, int64_t n)
+{
+	const int nth = _job->nth;
+	const int64_t dn = (n + nth - 1)/nth;
+	const uint64_t lo = MIN(n, dn*ith);
+	const uint64_t hi = MIN(n, lo + dn);
+	atomic_store_explicit(&_job->deque[ith].range, lo | hi<<32, memory_order_release);
+}
+//!< забрать половину остатка из конца очереди потока v, первую задачу вернуть, остальные в свою очередь
+static int64_t _pool_steal(struct _pool_deque * deque, int ith, int v)
+{
+	_Atomic uint64_t * range = &deque[v].range;
+	uint64_t r = atomic_load_explicit(range, memory_order_acquire);
+	for (;;) {
+		const uint32_t lo = r, hi = r>>32;
+		if (lo >= hi) return -1;
+		const uint32_t mid = hi - (hi - lo + 1)/2;
+		if (atomic_compare_exchange_weak_explicit(range, &r, lo | (uint64_t)mid<<32,
+				memory_order_acq_rel, memory_order_acquire)) {
+			atomic_store_explicit(&deque[ith].range, (mid+1) | (uint64_t)hi<<32, memory_order_release);
+			return mid;
+		}
+	}
+}
+/*! \brief Следующая задача потока ith
+	\return номер задачи или -1, если задачи закончились у всех участников
+ */
+int64_t qnn_pool_rows_next(struct qnn_pool * pool, int ith)
+{
+	struct _pool_deque * deque = _job->deque;
+	_Atomic uint64_t * range = &deque[ith].range;
+	uint64_t r = atomic_load_explicit(range, memory_order_relaxed);
+	for (;;) {// из начала своей очереди
+		const uint32_t lo = r, hi = r>>32;
+		if (lo >= hi) break;
+		if (atomic_compare_exchange_weak_explicit(range, &r, r + 1, memory_order_acq_rel, memory_order_relaxed))
+			return lo;
+	}
+	const int nth  = _job->nth;
+	const int node = deque[ith].node;
+	for (int pass = 0; pass < 2; pass++)// сначала потоки своего узла NUMA
+	for (int k = 1; k < nth; k++) {
+		const int v = (ith + k) % nth;
+		if ((deque[v].node==node) != (pass==0)) continue;
+		int64_t t = _pool_steal(deque, ith, v);
+		if (t >= 0) return t;
+	}
+	return -1;
+}
+struct _pool_for {
+	int64_t n, grain;
+	qnn_pool_range_fn fn;
+	void * arg;
+	struct qnn_pool * pool;
+};
+static void _pool_for_thread(void * data, int ith, int nth)
+{
+	struct _pool_for * pf = data;
+	const int64_t n_tasks = (pf->n + pf->grain - 1)/pf->grain;
+	qnn_pool_rows_begin(pf->pool, ith, n_tasks);
+	for (int64_t t; (t = qnn_pool_rows_next(pf->pool, ith)) >= 0; )
+		pf->fn(pf->arg, t*pf->grain, MIN(pf->n, (t + 1)*pf->grain), ith);
+}
+/*! \brief Параллельный цикл по [0, n) блоками по grain элементов: fn(arg, i0, i1, ith)
+	\param grain размер задачи; 0 - выбрать так, чтобы на поток приходилось несколько задач
+ */
+void qnn_pool_parallel_for(struct qnn_pool * pool, int64_t n, int64_t grain, qnn_pool_range_fn fn, void * arg)
+{
+	if (n <= 0) return;
+	const int nth = (_job!=NULL && _job->pool==pool)? 1: pool->n_threads;
+	if (grain <= 0) grain = MAX(1, n/((int64_t)nth*QNN_POOL_TASKS));
+	if (n/grain >= UINT32_MAX) grain = n/(UINT32_MAX-1) + 1;// номер задачи 32 бита
+	struct _pool_for pf = {.n = n, .grain = grain, .fn = fn, .arg = arg, .pool = pool};
+	qnn_pool_run(pool, MIN((n + grain - 1)/grain, nth), _pool_for_thread, &pf);
+}
+/*! \brief Параллельная обработка строк тензора: fn(arg, ir0, ir1, ith) для блоков строк ggml_nrows(t) */
+void qnn_pool_rows(struct qnn_pool * pool, const struct ggml_tensor * t, int64_t grain, qnn_pool_range_fn fn, void * arg)
+{
+	qnn_pool_parallel_for(pool, ggml_nrows(t), grain, fn, arg);
+}
+
+#ifdef TEST_POOL
+#include <time.h>
+#include <math.h>
+static double _now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+// неравномерная нагрузка: стоимость строки растет к концу диапазона (треугольная матрица)
+static double _work(int64_t i){
+	double s = 0;
+	for (int64_t k = 0; k <= i; k++) s += sqrt((double)(k ^ i));
+	return s;
+}
+struct _test { double * out; atomic_long count; int64_t n, base; struct qnn_pool * pool; };
+static void _test_range(void * arg, int64_t i0, int64_t i1, int ith){
+	struct _test * t = arg;
+	for (int64_t i = i0; i < i1; i++) t->out[i] = _work(t->base + i);
+	atomic_fetch_add(&t->count, i1 - i0);
+}
+static void _test_static(void * arg, int ith, int nth){// деление без перехвата
+	struct _test * t = arg;
+	const int64_t dn = (t->n + nth - 1)/nth;
+	const int64_t i0 = MIN(t->n, dn*ith), i1 = MIN(t->n, i0 + dn);
+	_test_range(arg, i0, i1, ith);
+}
+static atomic_int _phase_count;
+static void _test_barrier(void * arg, int ith, int nth){
+	struct qnn_pool * pool = arg;
+	for (int r = 0; r < 1000; r++) {
+		atomic_fetch_add(&_phase_count, 1);
+		qnn_pool_barrier(pool);
+		if (atomic_load(&_phase_count) != (r + 1)*nth) {
+			fprintf(stderr, "barrier round %d: %d\n", r, atomic_load(&_phase_count));
+			abort();
+		}
+		qnn_pool_barrier(pool);
+	}
+}
+// задание выполняется ровно nth раз, по разу в каждом потоке ith < nth
+struct _test_count { atomic_int calls, mask; int nth; };
+static void _test_count(void * arg, int ith, int nth){
+	struct _test_count * c = arg;
+	if (nth != c->nth || ith >= nth || (atomic_fetch_or(&c->mask, 1<<ith) & (1<<ith)))
+		atomic_fetch_add(&c->calls, 1000);// чужое задание или повтор
+	atomic_fetch_add(&c->calls, 1);
+}
+static void _test_nested(void * arg, int64_t i0, int64_t i1, int ith){
+	struct _test * t = arg;
+	struct _test sub = {.out = t->out + i0, .base = i0};
+	qnn_pool_parallel_for(t->pool, i1 - i0, 1, _test_range, &sub);
+	atomic_fetch_add(&t->count, i1 - i0);
+}
+int main(int argc, char** argv)
+{
+	const int n_threads = argc > 1? atoi(argv[1]): 4;
+	const int64_t n = 4096;
+	struct qnn_pool * pool = qnn_pool_new(n_threads);
+	double * ref = g_new(double, n);
+	double * out = g_new(double, n);
+	int fail = 0;
+	for (int64_t i = 0; i < n; i++) ref[i] = _work(i);
+	struct _test t = {.out = out, .n = n, .pool = pool};
+	atomic_init(&t.count, 0);
+	// статическое деление и перехват работы
+	double t0 = _now();
+	qnn_pool_run(pool, 0, _test_static, &t);
+	double t1 = _now();
+	qnn_pool_parallel_for(pool, n, 16, _test_range, &t);
+	double t2 = _now();
+	fail += memcmp(out, ref, n*sizeof(double))!=0 || atomic_load(&t.count)!=2*n;
+	printf("threads %d: static %.2f ms, work stealing %.2f ms\n", qnn_pool_size(pool), (t1-t0)*1e3, (t2-t1)*1e3);
+	// барьер
+	atomic_init(&_phase_count, 0);
+	t0 = _now();
+	qnn_pool_run(pool, 0, _test_barrier, pool);
+	t1 = _now();
+	printf("barrier: %.2f us\n", (t1-t0)/2000*1e6);
+	// задание из потока пула выполняется в том же потоке
+	memset(out, 0, n*sizeof(double));
+	atomic_store(&t.count, 0);
+	qnn_pool_parallel_for(pool, n, 64, _test_nested, &t);
+	fail += memcmp(out, ref, n*sizeof(double))!=0 || atomic_load(&t.count)!=n;
+	// много коротких заданий: пробуждение потоков
+	t0 = _now();
+	for (int r = 0; r < 1000; r++)
+		qnn_pool_parallel_for(pool, 64, 1, _test_range, &t);
+	t1 = _now();
+	printf("dispatch: %.2f us\n", (t1-t0)/1000*1e6);
+	// задания меньше пула чередуются с заданиями на весь пул: потоки, не занятые в задании,
+	// не должны выполнять следующее задание дважды и приходить на чужой барьер
+	const int n_pool = MIN(qnn_pool_size(pool), 31);
+	int n_bad = 0;
+	for (int r = 0; r < 20000; r++) {
+		struct _test_count c = {.nth = (r & 1)? n_pool: 1 + r/2 % MAX(1, n_pool - 1)};
+		atomic_init(&c.calls, 0);
+		atomic_init(&c.mask, 0);
+		int nth = qnn_pool_run(pool, c.nth, _test_count, &c);
+		if (nth != c.nth || atomic_load(&c.calls) != c.nth) n_bad++;
+	}
+	printf("alternating nth: %d bad jobs\n", n_bad);
+	fail += n_bad;
+	qnn_pool_free(pool);
+	g_free(ref);
+	g_free(out);
+	printf("%s\n", fail? "FAIL": "ok");
+	return fail!=0;
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+/*! Пул потоков с перехватом работы, \see qnn_pool.c
+    Заголовок не зависит от qnn.h и подключается из C++ внутри extern "C" */
+struct qnn_pool;
+typedef void (*qnn_pool_fn)(void * arg, int ith, int nth);
+typedef void (*qnn_pool_range_fn)(void * arg, int64_t i0, int64_t i1, int ith);
+
+extern struct qnn_pool * qnn_pool_new(int n_threads);
+extern void qnn_pool_free(struct qnn_pool * pool);
+extern struct qnn_pool * qnn_pool_default(void);
+extern int  qnn_pool_size(const struct qnn_pool * pool);
+extern int  qnn_pool_run(struct qnn_pool * pool, int nth, qnn_pool_fn fn, void * arg);
+extern void qnn_pool_barrier(struct qnn_pool * pool);
+extern void    qnn_pool_rows_begin(struct qnn_pool * pool, int ith, int64_t n);
+extern int64_t qnn_pool_rows_next(struct qnn_pool * pool, int ith);
+extern void qnn_pool_parallel_for(struct qnn_pool * pool, int64_t n, int64_t grain, qnn_pool_range_fn fn, void * arg);
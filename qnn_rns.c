@@ -10,9 +10,16 @@
     RNS -- residue number system, непозиционная система остаточных классов
     MRC -- mixed radix conversion, позволяет восстановить число из остатков используя 
         позиционную систему из модулей
+
+Сборка и тестирование
+    $ gcc -DTEST_RNS -O3 -march=native -o test qnn_rns.c qnn_hexl.c qnn_pool.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
  */
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <x86intrin.h>
+#include "qnn.h"
 static inline int32_t MODB(int64_t x, const uint32_t q){
     return ((int64_t)x)%q;
 }
@@ -135,17 +142,354 @@ int64_t rns_restore(int32_t* a, const uint32_t* p, int n){
     }
     return x;
 }
+/*! \defgroup _rns_mul Умножение полиномов с большими коэффициентами в RNS
+    Коэффициенты произведения в кольце $\mathbb{Z}[x]/(x^N + 1)$ вычисляются точно по нескольким 
+    31-битным модулям $p_i \equiv 1 \mod 2N$: коэффициенты сомножителей приводятся по каждому модулю, 
+    полиномы умножаются через NTT по плану ntt_plan() из qnn_hexl.c, затем результат восстанавливается 
+    по CRT. Модули обрабатываются параллельно в потоках пула qnn_pool_default().
+
+    Восстановление - расширение базиса на модуль $2^{32w}$, как в rns_ext():
+    $x = \sum_i \xi_i \hat{p}_i - e P \mod 2^{32w}$, где $\xi_i = [x_i \tilde{p}_i]_{p_i}$, 
+    $e = \lfloor \sum_i \xi_i/p_i \rceil$. Произведение модулей выбирается с запасом $P > 4|x|$, 
+    тогда дробная часть суммы далека от 1/2 и $e$ в двойной точности вычисляется без ошибки.
+    Расчет векторный, по RNS_VL коэффициентов, переносы между словами 32 бит выполняются в конце.
+
+    Целые числа со знаком хранятся в дополнительном коде словами по 32 бит от младшего к старшему,
+    коэффициент j полинома с шириной w занимает слова [j*w, j*w + w).
+    \{
+ */
+struct ntt_plan;
+extern const struct ntt_plan* ntt_plan(unsigned int N, uint32_t q);
+extern void NTT_batch(const struct ntt_plan *p, uint32_t *a, size_t lda, int64_t k);
+extern void invNTT_batch(const struct ntt_plan *p, uint32_t *a, size_t lda, int64_t k);
+
+#if defined(__AVX512F__)
+#define RNS_VL 8    // коэффициентов в векторе
+#else
+#define RNS_VL 4
+#endif
+typedef uint32_t uint32xN_t  __attribute__((__vector_size__(4*RNS_VL)));
+typedef uint64_t uint64xN_t  __attribute__((__vector_size__(8*RNS_VL)));
+typedef  int64_t  int64xN_t  __attribute__((__vector_size__(8*RNS_VL)));
+typedef double   float64xN_t __attribute__((__vector_size__(8*RNS_VL)));
+
+//! простые 31 бит из таблицы primes[] qnn_hexl.c по убыванию степени двойки в $p-1$
+static const uint32_t rns_primes[] = {
+    0x78000001, 0x7e000001, 0x7f000001, 0x7c800001, // 2^27, 2^25, 2^24, 2^23
+    0x7d200001, 0x7e100001, 0x7bd00001, 0x7ff80001, // 2^21, 2^20, 2^20, 2^19
+    0x7ffe0001, 0x7a460001, 0x7bff0001, 0x7b270001, // 2^17, 2^17, 2^16, 2^16
+    0x79ef0001,                                     // 2^16
+    0x7fe7f001, 0x7fe01001, 0x7fd35001, 0x7fc5d001, // 2^12
+};
+#define RNS_PRIMES_MAX (sizeof(rns_primes)/sizeof(rns_primes[0]))
+struct rns_mul {
+    unsigned int N;
+    int k;          //!< число модулей
+    int wa, wb, wr; //!< слов 32 бит в коэффициентах сомножителей и произведения
+    uint32_t p[RNS_PRIMES_MAX];
+    const struct ntt_plan *plan[RNS_PRIMES_MAX];
+    uint32_t pt[RNS_PRIMES_MAX];    //!< $\tilde{p}_i = (P/p_i)^{-1} \mod p_i$
+    uint32_t pt_p[RNS_PRIMES_MAX];  //!< константы Шоупа к pt
+    double   p_inv[RNS_PRIMES_MAX]; //!< $1/p_i$
+    uint32_t *ph;   //!< $\hat{p}_i = P/p_i \mod 2^{32 wr}$, k x wr слов
+    uint32_t *nP;   //!< $-P \mod 2^{32 wr}$
+};
+//! константа Шоупа $\lfloor w\cdot 2^{32}/p \rfloor$
+static inline uint32_t SHOUP32(uint32_t w, uint32_t p){
+    return ((uint64_t)w<<32)/p;
+}
+//! произведение младших 32 бит элементов, 64 бит
+static inline uint64xN_t _mul_epu32_v(uint64xN_t a, uint64xN_t b){
+#if defined(__AVX512F__)
+    return (uint64xN_t)_mm512_mul_epu32((__m512i)a, (__m512i)b);
+#elif defined(__AVX2__)
+    return (uint64xN_t)_mm256_mul_epu32((__m256i)a, (__m256i)b);
+#else
+    return (a & 0xFFFFFFFFu)*(b & 0xFFFFFFFFu);
+#endif
+}
+//! $a\cdot w \mod p$, $a < 2^{32}$, результат в интервале [0, p)
+static inline uint64xN_t _mulm_shoup_v(uint64xN_t a, uint64_t w, uint64_t wp, uint64_t p){
+    uint64xN_t h = _mul_epu32_v(a, (uint64xN_t){0} + wp)>>32;
+    uint64xN_t r = _mul_epu32_v(a, (uint64xN_t){0} + w) - _mul_epu32_v(h, (uint64xN_t){0} + p);
+    return r - ((uint64xN_t)(r >= p) & p);
+}
+//! преобразование $x < 2^{52}$ в double через сложение с $2^{52}$, без AVX512DQ
+static inline float64xN_t _cvt_f64_v(uint64xN_t x){
+    return (float64xN_t)(x | 0x4330000000000000uLL) - 0x1p52;
+}
+//! округление до ближайшего целого $0 \le f < 2^{51}$
+static inline uint64xN_t _round_u64_v(float64xN_t f){
+    return (uint64xN_t)(f + 0x1p52) ^ 0x4330000000000000uLL;
+}
+//! $a\cdot b \mod p$, $a, b < p < 2^{31}$, частное оценивается в двойной точности с ошибкой не более 1
+static inline uint64xN_t _mulm_v(uint64xN_t a, uint64xN_t b, uint64_t p, double p_inv){
+    uint64xN_t h = _round_u64_v(_cvt_f64_v(a)*_cvt_f64_v(b)*p_inv);
+    int64xN_t   r = (int64xN_t)(_mul_epu32_v(a, b) - _mul_epu32_v(h, (uint64xN_t){0} + p));
+    r += (int64xN_t)(r < 0) & (int64_t)p;
+    r -= (int64xN_t)(r >= (int64_t)p) & (int64_t)p;
+    return (uint64xN_t)r;
+}
+static inline uint64xN_t _load_v(const uint32_t *a){
+    uint32xN_t v;
+    __builtin_memcpy(&v, a, sizeof(v));
+    return __builtin_convertvector(v, uint64xN_t);
+}
+static inline void _store_v(uint32_t *a, uint64xN_t x){
+    uint32xN_t v = __builtin_convertvector(x, uint32xN_t);
+    __builtin_memcpy(a, &v, sizeof(v));
+}
+/*! \brief Контекст умножения полиномов степени N с коэффициентами из wa и wb слов 32 бит, 
+    коэффициенты произведения занимают wa+wb+1 слов.
+    \return NULL, если в таблице не хватает модулей $p \equiv 1 \mod 2N$ для точного результата
+ */
+struct rns_mul* rns_mul_new(unsigned int N, int wa, int wb){
+    const double bits = 32.0*(wa + wb) + log2(N);// |x| < N 2^{32(wa+wb)-2}, P > 4|x|
+    double log2P = 0;
+    struct rns_mul *m = calloc(1, sizeof(struct rns_mul));
+    m->N = N, m->wa = wa, m->wb = wb, m->wr = wa + wb + 1;
+    for (int i=0; i<RNS_PRIMES_MAX && log2P <= bits; i++) {
+        if (rns_primes[i]%(2*N)!=1) continue;
+        m->plan[m->k] = ntt_plan(N, rns_primes[i]);
+        if (m->plan[m->k]==NULL) break;
+        m->p[m->k++] = rns_primes[i];
+        log2P += log2(rns_primes[i]);
+    }
+    if (log2P <= bits) {
+        fprintf(stderr, "%s: N=%u %dx%d words: %d primes, P < 2^%.0f\n", __func__, N, wa, wb, m->k, bits);
+        free(m);
+        return NULL;
+    }
+    const int k = m->k, wr = m->wr;
+    m->ph = calloc(k*wr, sizeof(uint32_t));
+    m->nP = calloc(wr, sizeof(uint32_t));
+    for (int i=0; i<k; i++) {
+        uint32_t *ph = m->ph + i*wr;
+        uint32_t  t  = 1;
+        ph[0] = 1;
+        for (int j=0; j<k; j++) {
+            if (j==i) continue;
+            t = MULM(t, m->p[j], m->p[i]);
+            uint64_t c = 0;
+            for (int l=0; l<wr; l++) {// ph = ph*p_j
+                c += (uint64_t)ph[l]*m->p[j];
+                ph[l] = c;
+                c >>= 32;
+            }
+        }
+        m->pt[i]   = INVM(t, m->p[i]);
+        m->pt_p[i] = SHOUP32(m->pt[i], m->p[i]);
+        m->p_inv[i] = 1.0/m->p[i];
+    }
+    uint64_t c = 0, s = 1;
+    for (int l=0; l<wr; l++) {// -P = ~(ph_0*p_0) + 1
+        c += (uint64_t)m->ph[l]*m->p[0];
+        s += (uint32_t)~c;
+        m->nP[l] = s;
+        c >>= 32;
+        s >>= 32;
+    }
+    return m;
+}
+void rns_mul_free(struct rns_mul *m){
+    free(m->ph);
+    free(m->nP);
+    free(m);
+}
+struct _rns_mul_task {
+    const struct rns_mul *m;
+    uint32_t *r;
+    const uint32_t *a, *b;
+    uint32_t *x;    //!< остатки: по два полинома N на модуль
+};
+/*! \brief Остатки коэффициентов со знаком j..j+RNS_VL-1 по всем модулям, схема Горнера по словам от старшего
+    \param x остатки, полином с номером s для каждого модуля
+ */
+static void _rns_encode(const struct rns_mul *m, uint32_t *x, int s, const uint32_t *a, int w, unsigned int j){
+    const unsigned int N = m->N;
+    uint64xN_t v[w];
+    for (int l=0; l<w; l++)
+        for (int t=0; t<RNS_VL; t++) v[l][t] = a[(j+t)*w + l];
+    const uint64xN_t sign = v[w-1] >> 31;
+    for (int i=0; i<m->k; i++) {
+        const uint32_t p = m->p[i];
+        const uint32_t c = (1uLL<<32)%p, cp = SHOUP32(c, p), up = SHOUP32(1, p);
+        uint32_t d = 1;
+        for (int l=0; l<w; l++) d = MULM(d, c, p);
+        d = p - d;// -2^{32w} mod p, поправка для отрицательных
+        uint64xN_t r = _mulm_shoup_v(v[w-1], 1, up, p);
+        for (int l=w-2; l>=0; l--) {
+            r = _mulm_shoup_v(r, c, cp, p) + _mulm_shoup_v(v[l], 1, up, p);
+            r -= (uint64xN_t)(r >= p) & p;
+        }
+        r += sign * d;
+        r -= (uint64xN_t)(r >= p) & p;
+        _store_v(x + (2*i + s)*N + j, r);
+    }
+}
+static void _rns_encode_range(void *arg, int64_t j0, int64_t j1, int ith){
+    const struct _rns_mul_task *task = arg;
+    for (int64_t j=RNS_VL*j0; j<RNS_VL*j1; j+=RNS_VL) {
+        _rns_encode(task->m, task->x, 0, task->a, task->m->wa, j);
+        _rns_encode(task->m, task->x, 1, task->b, task->m->wb, j);
+    }
+}
+/*! \brief Умножение по модулям i0..i1: NTT, поэлементное произведение, обратное NTT */
+static void _rns_mul_primes(void *arg, int64_t i0, int64_t i1, int ith){
+    const struct _rns_mul_task *task = arg;
+    const struct rns_mul *m = task->m;
+    const unsigned int N = m->N;
+    for (int64_t i=i0; i<i1; i++) {
+        const uint32_t p = m->p[i];
+        uint32_t *x = task->x + 2*N*i, *y = x + N;
+        NTT_batch(m->plan[i], x, N, 2);
+        for (unsigned int j=0; j<N; j+=RNS_VL)
+            _store_v(x+j, _mulm_v(_load_v(x+j), _load_v(y+j), p, m->p_inv[i]));
+        invNTT_batch(m->plan[i], x, N, 1);
+    }
+}
+/*! \brief Восстановление коэффициентов RNS_VL*j0..RNS_VL*j1 по CRT */
+static void _rns_crt(void *arg, int64_t j0, int64_t j1, int ith){
+    const struct _rns_mul_task *task = arg;
+    const struct rns_mul *m = task->m;
+    const unsigned int N = m->N;
+    const int k = m->k, wr = m->wr;
+    const uint64xN_t lo = (uint64xN_t){0} + 0xFFFFFFFFu;
+    uint64xN_t acc[wr+1];
+    for (int64_t j=RNS_VL*j0; j<RNS_VL*j1; j+=RNS_VL) {
+        float64xN_t z = {0};
+        for (int l=0; l<=wr; l++) acc[l] = (uint64xN_t){0};
+        for (int i=0; i<k; i++) {
+            uint64xN_t xi = _mulm_shoup_v(_load_v(task->x + 2*N*i + j), m->pt[i], m->pt_p[i], m->p[i]);
+            z += _cvt_f64_v(xi)*m->p_inv[i];
+            const uint32_t *ph = m->ph + i*wr;
+            for (int l=0; l<wr; l++) {
+                uint64xN_t t = _mul_epu32_v(xi, (uint64xN_t){0} + ph[l]);
+                acc[l]   += t & lo;
+                acc[l+1] += t >> 32;
+            }
+        }
+        uint64xN_t e = _round_u64_v(z);
+        uint64xN_t c = {0};
+        for (int l=0; l<wr; l++) {
+            uint64xN_t t = _mul_epu32_v(e, (uint64xN_t){0} + m->nP[l]);
+            c += acc[l] + (t & lo);
+            acc[l+1] += t >> 32;
+            for (int n=0; n<RNS_VL; n++) task->r[(j+n)*wr + l] = c[n];
+            c >>= 32;
+        }
+    }
+}
+/*! \brief Точное произведение полиномов $r = a\cdot b$ в $\mathbb{Z}[x]/(x^N + 1)$
+    \param r результат, N коэффициентов по m->wr слов
+    \param a,b сомножители, N коэффициентов по m->wa и m->wb слов
+ */
+void rns_poly_mul(const struct rns_mul *m, uint32_t *r, const uint32_t *a, const uint32_t *b){
+    struct _rns_mul_task task = {.m = m, .r = r, .a = a, .b = b};
+    task.x = aligned_alloc(64, 2*(size_t)m->k*m->N*sizeof(uint32_t));
+    qnn_pool_parallel_for(qnn_pool_default(), m->N/RNS_VL, 64, _rns_encode_range, &task);
+    qnn_pool_parallel_for(qnn_pool_default(), m->k, 1, _rns_mul_primes, &task);
+    qnn_pool_parallel_for(qnn_pool_default(), m->N/RNS_VL, 64, _rns_crt, &task);
+    free(task.x);
+}
+//!\}
 #ifdef TEST_RNS
 int32_t primes[] = {
     0x7ffd5601, 0x7ffd2601, 0x7ff8e201, 0x7ff83a01, 
     0x7ff82e01, 0x7ff04201, 0x7fee9201, 0x7fea4201,
 };
-#include <stdio.h>
 int main(int argc, char* argv[]){
     int n = 5;
     int count = 20;
     int32_t a_rns[n];
     int32_t q = primes[n];
+    if (1) {// умножение полиномов: сравнение с __int128 и по модулю 2^31-1, такты на коэффициент
+        uint64_t seed = 0x9E3779B97F4A7C15uLL;
+        #define RND() (seed ^= seed<<13, seed ^= seed>>7, seed ^= seed<<17)
+        const unsigned int N = 256;
+        struct rns_mul *m = rns_mul_new(N, 2, 2);
+        uint32_t *a = malloc(N*2*4), *b = malloc(N*2*4), *r = malloc(N*m->wr*4);
+        for (int j=0; j<N; j++) {// 56 бит со знаком
+            int64_t x = (int64_t)RND()>>8, y = (int64_t)RND()>>8;
+            a[2*j] = x, a[2*j+1] = x>>32;
+            b[2*j] = y, b[2*j+1] = y>>32;
+        }
+        rns_poly_mul(m, r, a, b);
+        int res = 1;
+        for (int j=0; j<N; j++) {
+            __int128 s = 0;
+            for (int i=0; i<N; i++) {
+                int64_t x = ((uint64_t)a[2*i+1]<<32)|a[2*i];
+                int l = j - i;
+                int64_t y = (l>=0)? ((uint64_t)b[2*l+1]<<32)|b[2*l]: -(int64_t)(((uint64_t)b[2*(l+N)+1]<<32)|b[2*(l+N)]);
+                s += (__int128)x*y;
+            }
+            for (int l=0; l<m->wr; l++)
+                res = res && r[j*m->wr + l] == (uint32_t)(s>>(l<4? 32*l: 127));
+        }
+        printf("rns_poly_mul N=%u 2x2 words, %d primes ..%s\n", N, m->k, res?"ok":"fail");
+        free(a); free(b); free(r);
+        rns_mul_free(m);
+    }
+    if (1) {
+        const uint32_t p = 0x7fffffff;
+        const unsigned int N = 1024;
+        const int w = 4;
+        uint64_t seed = 0x2545F4914F6CDD1DuLL;
+        struct rns_mul *m = rns_mul_new(N, w, w);
+        uint32_t *a = malloc(N*w*4), *b = malloc(N*w*4), *r = malloc(N*m->wr*4);
+        for (int j=0; j<N*w; j++) a[j] = RND(), b[j] = RND();
+        rns_poly_mul(m, r, a, b);
+        uint32_t *ap = malloc(N*4), *bp = malloc(N*4);
+        for (int j=0; j<N; j++) {// по модулю p, со знаком
+            uint64_t x = 0, y = 0;
+            for (int l=w-1; l>=0; l--) {
+                x = ((x<<32) + a[j*w+l])%p;
+                y = ((y<<32) + b[j*w+l])%p;
+            }
+            if (a[j*w+w-1]>>31) x = (x + p - (1u<<w))%p;// 2^{32w} = 2^w mod p, 2^{31} = 1
+            if (b[j*w+w-1]>>31) y = (y + p - (1u<<w))%p;
+            ap[j] = x, bp[j] = y;
+        }
+        int res = 1;
+        for (int j=0; j<N; j++) {
+            uint64_t s = 0, x = 0;
+            for (int i=0; i<N; i++) {
+                int l = j - i;
+                uint64_t t = (uint64_t)ap[i]*bp[l>=0? l: l+N]%p;
+                s = (l>=0? s + t: s + p - t)%p;
+            }
+            for (int l=m->wr-1; l>=0; l--) x = ((x<<32) + r[j*m->wr + l])%p;
+            if (r[j*m->wr + m->wr-1]>>31) x = (x + p - (1u<<m->wr))%p;
+            res = res && x==s;
+        }
+        printf("rns_poly_mul N=%u %dx%d words, %d primes ..%s\n", N, w, w, m->k, res?"ok":"fail");
+        free(ap); free(bp); free(a); free(b); free(r);
+        rns_mul_free(m);
+    }
+    if (1) {
+        const unsigned int N = 4096;
+        uint64_t seed = 0x9E3779B97F4A7C15uLL;
+        for (int w=1; w<=4; w++) {
+            struct rns_mul *m = rns_mul_new(N, w, w);
+            if (m==NULL) continue;
+            uint32_t *a = malloc(N*w*4), *b = malloc(N*w*4), *r = malloc(N*m->wr*4);
+            for (int j=0; j<N*w; j++) a[j] = RND(), b[j] = RND();
+            rns_poly_mul(m, r, a, b);
+            uint64_t best = ~0uLL;
+            for (int it=0; it<20; it++) {
+                uint64_t t0 = __rdtsc();
+                rns_poly_mul(m, r, a, b);
+                uint64_t t1 = __rdtsc() - t0;
+                if (t1 < best) best = t1;
+            }
+            printf("rns_poly_mul N=%u %dx%d words -> %2d bits, %2d primes: %6.1f cycles/coeff %5.1f per prime, threads %d\n", 
+                N, w, w, 32*m->wr, m->k, (double)best/N, (double)best/N/m->k, qnn_pool_size(qnn_pool_default()));
+            free(a); free(b); free(r);
+            rns_mul_free(m);
+        }
+        #undef RND
+    }
     for (int64_t i=0; i<0x1FFFFFF; i++){
         int64_t a = i<<33;
         rns_encode(a, a_rns, primes, n);
@@ -3,11 +3,16 @@
 Сборка и тестирование 
 
 ```bash
-gcc -O3 -o qnn qnn_safetensors.c json.c `pkgconf --cflags --libs glib-2.0`
+gcc -O3 -march=native -o qnn qnn_safetensors.c json.c quarks.c qnn_gguf.c qnn_pool.c xxh64.c sha256_ni.c `pkgconf --cflags --libs glib-2.0` -lpthread -lm
 ./qnn.exe -i models/InternViT/model.safetensors --list
 ./qnn.exe -i models/BitCPM4/model.safetensors --list -n model.layers.9.mlp.gate_proj.weight
+./qnn.exe -i models/Qwen3-14B/model-00001-of-00008.safetensors --list
+./qnn.exe -i models/Qwen3-14B/model-00001-of-00008.safetensors -o Qwen3-14B-Q8_0.gguf -t Q8_0 -j 8
 ```
-Модель может быть разбита на части
+Модель может быть разбита на части, по имени первой части `model-00001-of-00008.safetensors` 
+или `model_1_of_8.safetensors` определяется число частей и имена остальных файлов. 
+Все части отображаются в память (mmap), загрузка модели сводится к разбору заголовков, 
+данные тензоров подгружаются страницами при первом обращении, \see qnn_safetensors_init()
 
 Пример работы, вывод в формате JSON (PyTorch)
 ```json
@@ -38,8 +43,21 @@ gcc -O3 -o qnn qnn_safetensors.c json.c `pkgconf --cflags --libs glib-2.0`
 #include <stdint.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
 #include "json.h"
 #include "qnn.h"
+#include "quarks.h"
+#include <fcntl.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#include <windows.h>
+#endif
 
 #include <stdbool.h>
 #include <glib.h>
@@ -76,9 +94,11 @@ struct _MainOptions {
     char * output_file; //!< Сохранить результат в выбранном файле
     char * config_file;
     char * name;        //!< Анализировать выбранный тензор
+    char * type;        //!< Формат весов при конвертации в GGUF
 
     char * kernel;
 	int device_idx;
+    int threads;        //!< число потоков конвертации, 0 - по числу процессоров
 
     int count;
     int list;           //!< Вывести список тензоров
@@ -91,6 +111,7 @@ static MainOptions options = {
     .output_file = NULL,
     .config_file = "config.json",
     .name = "",
+    .type = "Q8_0",
 	.device_idx  = 0,
     .verbose  =false,
     .overwrite=false,
@@ -104,6 +125,8 @@ static GOptionEntry entries[] =
   { "output",   'o', 0, G_OPTION_ARG_FILENAME, &options.output_file, "output file name", "*.gguf" },
   { "config",   'c', 0, G_OPTION_ARG_FILENAME, &options.config_file, "config file name", "config.json" },
   { "name", 	'n', 0, G_OPTION_ARG_STRING,   &options.name, "name", "blk.*.attn_k.weight" },
+  { "type", 	't', 0, G_OPTION_ARG_STRING,   &options.type, "output weights type", "Q8_0|Q4_K|HF8|BF8|BF16|F16|F32" },
+  { "threads", 	'j', 0, G_OPTION_ARG_INT,      &options.threads, "number of threads", "N" },
   { "list",      0 , 0, G_OPTION_ARG_NONE, &options.list,       "list tensors", NULL },
   { "overwrite",'O', 0, G_OPTION_ARG_NONE, &options.overwrite,   "overwtite output", NULL },
   { "verbose",  'v', 0, G_OPTION_ARG_NONE, &options.verbose, "Be verbose", NULL },
@@ -124,12 +147,13 @@ static int  _cname_idx(const char* name, char* cname){
 		s++;
     	while (isdigit(*s)) index = index*10+(*s++ -'0');
 		*cname++ = '*'; 
-		do {*cname++ = *s++; } while (*s!='\0');// до конца строки
+		while (*s!='\0') *cname++ = *s++;// до конца строки
         *cname = '\0';
 		return index;
 	} else 
 		return -1;
 }
+#if defined(_WIN32)
 // см как сделана функция для Windows \see qnn_gguf.c: blk_load()
 static void* blk_load(FILE*fp, uint64_t offset, size_t size){
     int res = fseeko64(fp, offset, SEEK_SET);
@@ -139,6 +163,616 @@ static void* blk_load(FILE*fp, uint64_t offset, size_t size){
     fread(data, 1, size, fp);
     return data;
 }
+#endif
+/*! \brief Таблица типов данных safetensors */
+static const struct {
+    const char* name;
+    enum ggml_type type;
+    unsigned size;  // размер элемента в байтах
+} st_dtypes[] = {
+    {"F64",  GGML_TYPE_F64,  8},
+    {"F32",  GGML_TYPE_F32,  4},
+    {"F16",  GGML_TYPE_F16,  2},
+    {"BF16", GGML_TYPE_BF16, 2},
+    {"F8_E4M3", GGML_TYPE_HF8, 1},
+    {"F8_E5M2", GGML_TYPE_BF8, 1},
+    {"I64",  GGML_TYPE_I64,  8},
+    {"I32",  GGML_TYPE_I32,  4},
+    {"I16",  GGML_TYPE_I16,  2},
+    {"I8",   GGML_TYPE_I8,   1},
+};
+static const char* _st_dtype_name(enum ggml_type type){
+    for (int i=0; i<sizeof(st_dtypes)/sizeof(st_dtypes[0]); i++)
+        if (st_dtypes[i].type==type) return st_dtypes[i].name;
+    return "NONE";
+}
+/*! \brief Часть модели, файл отображенный в память */
+struct _st_shard {
+    void *   mapping;
+    size_t   mapping_size;
+    uint8_t* data;      //!< начало секции данных, после заголовка
+    size_t   size;      //!< размер секции данных
+};
+/*! \brief Описание тензора, приводится к типу tensor_weight_t */
+struct _st_tensor {
+    tensor_weight_t w;
+    GQuark   name;      //!< полное имя тензора
+    uint32_t shard;     //!< номер части модели
+};
+/*! \brief Модель safetensors, возможно разбитая на части */
+typedef struct _safetensors safetensors_t;
+struct _safetensors {
+    uint32_t n_shards;
+    uint32_t n_tensors;
+    struct _st_shard  * shards;
+    struct _st_tensor * tensors;    //!< тензоры в порядке следования в файлах
+    struct _st_index {
+        uint64_t sdnv;
+        uint32_t idx;
+    } * index;                      //!< индекс упорядоченный по SDNV
+    QTable_t * quarks;              //!< шаблоны имен cname
+    uint32_t n_meta;
+    struct _st_meta {
+        GQuark key;
+        char * value;
+    } * meta;                       //!< строки __metadata__ первой части модели
+};
+/*! \brief SDNV идентификатор имени тензора {cname_id, index}, \see qnn_gguf.c: _cname_to_sdnv()
+    \param insert - добавить шаблон имени в таблицу, иначе вернуть 0 если шаблон не найден
+ */
+static uint64_t _cname_sdnv(QTable_t * ht, const char* name, int insert){
+    char cname[strlen(name)+2];
+    int index = _cname_idx(name, cname);
+    uint32_t cname_id = _quark_lookup(ht, index<0? name: cname);
+    if (cname_id==QUARK_UNDEF) {
+        if (!insert) return 0;
+        cname_id = _quark_insert(ht, index<0? name: cname);
+    }
+    uint64_t sdnv=0;
+    uint8_t *v = (uint8_t *)&sdnv;
+    v = _sdnv_encode(v, cname_id);
+    if (index>=0) 
+        v = _sdnv_encode(v, index);
+    return sdnv;
+}
+/*! \brief число частей модели и позиция номера части в имени файла
+    Распознаются имена вида `model-00001-of-00008.safetensors` и `model_1_of_8.safetensors`, \see FILENAME_TPL
+    \param pos - позиция номера части в имени
+    \param width - число цифр в номере части, с ведущими нулями
+    \return число частей, 1 -- если модель не разбита на части
+ */
+static int _shard_count(const char* filename, int *pos, int *width){
+    const char* base = strrchr(filename, '/');
+    base = base? base+1: filename;
+    const char* s = base;
+    const char* of = NULL;
+    while ((s = strstr(s, "of"))!=NULL) {// последнее вхождение `-of-` или `_of_`
+        if (s>base && (s[-1]=='-' || s[-1]=='_') && (s[2]=='-' || s[2]=='_') 
+         && isdigit(s[3]) && s-1>base && isdigit(s[-2])) of = s;
+        s+=2;
+    }
+    if (of==NULL) return 1;
+    const char* e = of-1;
+    s = e;
+    while (s>base && isdigit(s[-1])) s--;
+    *pos = s - filename;
+    *width = (s[0]=='0')? e-s: 0;
+    return atoi(of+3);
+}
+//!< освободить отображение части модели
+static void _st_shard_unmap(struct _st_shard* sh){
+    if (sh->mapping==NULL) return;
+#if !defined(_WIN32)
+    munmap(sh->mapping, sh->mapping_size);
+#else
+    free(sh->mapping);
+#endif
+    sh->mapping = NULL;
+}
+/*! \brief отобразить часть модели в память и разобрать заголовок
+    \return заголовок в формате JSON, NULL при ошибке, отображение при ошибке освобождается
+ */
+static JsonNode* _st_shard_map(struct _st_shard* sh, const char* filename){
+    FILE* fp = fopen(filename, "rb");
+    if (fp==NULL) {
+        fprintf(stderr, "%s: '%s': %s\n", __func__, filename, strerror(errno));
+        return NULL;
+    }
+#if !defined(_WIN32)
+    struct stat st;
+    if (fstat(fileno(fp), &st)!=0) {
+        fprintf(stderr, "%s: fstat failed: '%s'\n", __func__, strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+    size_t file_size = st.st_size;
+#else
+    fseeko64(fp, 0, SEEK_END);
+    size_t file_size = ftello64(fp);
+    fseeko64(fp, 0, SEEK_SET);
+#endif
+    uint64_t length = 0;
+    if (file_size<8 || fread(&length, 1, 8, fp)!=8 || length > file_size-8) {
+        fprintf(stderr, "%s: '%s': invalid header length %"PRIu64"\n", __func__, filename, length);
+        fclose(fp);
+        return NULL;
+    }
+#if !defined(_WIN32)
+    void * mapping = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+    if (mapping==MAP_FAILED) {
+        fprintf(stderr, "%s: mmap failed: '%s'\n", __func__, strerror(errno));
+        fclose(fp);
+        return NULL;
+    }
+#else
+    void * mapping = blk_load(fp, 0, file_size);
+    if (mapping==NULL) {
+        fprintf(stderr, "%s: '%s': failed to load %zu bytes\n", __func__, filename, file_size);
+        fclose(fp);
+        return NULL;
+    }
+#endif
+    fclose(fp);// отображение сохраняется после закрытия файла
+    sh->mapping      = mapping;
+    sh->mapping_size = file_size;
+    sh->data = (uint8_t*)mapping + 8 + length;
+    sh->size = file_size - 8 - length;
+    char* header = malloc(length+1);
+    __builtin_memcpy(header, (uint8_t*)mapping + 8, length);
+    header[length] = '\0';
+    JsonNode* json = json_value(header, NULL, NULL);
+    free(header);
+    if (json==NULL || json->type!=JSON_OBJECT) {
+        fprintf(stderr, "%s: '%s': invalid JSON header\n", __func__, filename);
+        if (json) json_free(json);
+        _st_shard_unmap(sh);
+        return NULL;
+    }
+    return json;
+}
+static int _st_index_cmp(const void* a, const void* b){
+    uint64_t x = ((const struct _st_index*)a)->sdnv, y = ((const struct _st_index*)b)->sdnv;
+    return (x>y) - (x<y);
+}
+void qnn_safetensors_free(safetensors_t* st);
+/*! \brief Загрузить модель safetensors, все части модели отображаются в память
+
+    Разбираются только заголовки файлов, данные тензоров не читаются. Указатель 
+    \ref tensor_weight_t::data указывает на данные тензора в отображении, 
+    \ref tensor_weight_t::offset -- смещение данных от начала файла части модели.
+    Размерности тензора ne[] записываются в порядке GGML: ne[0] -- длина строки, 
+    \ref tensor_weight_t::op содержит размерность тензора.
+
+    \param filename - имя файла или первой части модели `model-00001-of-00008.safetensors`
+    \return модель или NULL при ошибке
+ */
+safetensors_t* qnn_safetensors_init(const char* filename)
+{
+    int pos = 0, width = 0;
+    int n_shards = _shard_count(filename, &pos, &width);
+    if (n_shards<1) {
+        fprintf(stderr, "%s: '%s': invalid number of shards\n", __func__, filename);
+        return NULL;
+    }
+    safetensors_t* st = calloc(1, sizeof(safetensors_t));
+    st->shards = calloc(n_shards, sizeof(struct _st_shard));
+    st->quarks = _quark_new(256, 1024);
+    const GQuark id_offs  = g_quark_from_string ("data_offsets");
+    const GQuark id_dtype = g_quark_from_string ("dtype");
+    const GQuark id_shape = g_quark_from_string ("shape");
+    const GQuark id_meta  = g_quark_from_string ("__metadata__");
+    uint32_t n_alloc = 0;
+    size_t len = strlen(filename);
+    char name[len+16];
+    for (int k=0; k<n_shards; k++) {
+        if (n_shards>1) {// имя k-й части модели
+            const char* tail = filename+pos;
+            while (isdigit(*tail)) tail++;
+            snprintf(name, sizeof(name), "%.*s%0*d%s", pos, filename, width, k+1, tail);
+        } else 
+            strcpy(name, filename);
+        struct _st_shard* sh = &st->shards[k];
+        JsonNode* json = _st_shard_map(sh, name);
+        if (json==NULL) {
+            qnn_safetensors_free(st);
+            return NULL;
+        }
+        st->n_shards = k+1;
+        for (GSList* list = json->value.list; list!=NULL; list = list->next) {
+            JsonNode* node = list->data;
+            if (node->type == JSON_OBJECT && node->tag_id == id_meta && k==0) {
+                for (GSList* m = node->value.list; m!=NULL; m = m->next) {
+                    JsonNode* kv = m->data;
+                    if (kv->type != JSON_STRING) continue;
+                    st->meta = realloc(st->meta, (st->n_meta+1)*sizeof(struct _st_meta));
+                    st->meta[st->n_meta++] = (struct _st_meta){.key = kv->tag_id, .value = strdup(kv->value.s)};
+                }
+            }
+            if (node->type != JSON_OBJECT || node->tag_id == id_meta) continue;
+            const char* dtype = json_get_string(node->value.list, id_dtype, NULL);
+            int i;
+            for (i=0; dtype!=NULL && i<sizeof(st_dtypes)/sizeof(st_dtypes[0]); i++)
+                if (strcmp(dtype, st_dtypes[i].name)==0) break;
+            if (dtype==NULL || i==sizeof(st_dtypes)/sizeof(st_dtypes[0])) {
+                fprintf(stderr, "%s: '%s': unknown type %s\n", __func__, g_quark_to_string(node->tag_id), dtype);
+                continue;
+            }
+            if (st->n_tensors == n_alloc) {
+                n_alloc = n_alloc? n_alloc*2: 256;
+                st->tensors = realloc(st->tensors, n_alloc*sizeof(struct _st_tensor));
+            }
+            struct _st_tensor* t = &st->tensors[st->n_tensors];
+            __builtin_memset(t, 0, sizeof(struct _st_tensor));
+            t->name  = node->tag_id;
+            t->shard = k;
+            t->w.type = st_dtypes[i].type;
+            // размерности в порядке GGML: ne[0] -- последний индекс в shape
+            GSList* shape = json_get_array(node->value.list, id_shape);
+            int n_dim = g_slist_length(shape);
+            if (n_dim>GGUF_MAX_DIMS) {
+                fprintf(stderr, "%s: '%s': n_dim=%d is not supported\n", __func__, g_quark_to_string(t->name), n_dim);
+                continue;
+            }
+            size_t n_elem = 1;
+            for (int d=0; d<GGML_MAX_DIMS; d++) t->w.ne[d] = 1;
+            for (int d=n_dim-1; d>=0; d--, shape = shape->next) {
+                t->w.ne[d] = ((JsonNode*)shape->data)->value.u;
+                n_elem *= t->w.ne[d];
+            }
+            t->w.op = n_dim;
+            GSList* data_offs = json_get_array(node->value.list, id_offs);
+            uint64_t offs = json_get_uint(data_offs, 0, 0);
+            uint64_t end  = data_offs? json_get_uint(data_offs->next, 0, 0): 0;
+            if (end<offs || end>sh->size || end-offs != n_elem*st_dtypes[i].size) {
+                fprintf(stderr, "%s: '%s' data_offsets=[%"PRIu64",%"PRIu64"] out of data section\n", 
+                    __func__, g_quark_to_string(t->name), offs, end);
+                continue;
+            }
+            t->w.offset = (sh->data - (uint8_t*)sh->mapping) + offs;
+            t->w.data   = sh->data + offs;
+            t->w.size   = end - offs;
+            t->w.sdnv   = _cname_sdnv(st->quarks, g_quark_to_string(t->name), 1);
+            st->n_tensors++;
+        }
+        json_free(json);
+    }
+    st->index = malloc(st->n_tensors*sizeof(struct _st_index));
+    for (uint32_t i=0; i<st->n_tensors; i++) {
+        st->index[i].sdnv = st->tensors[i].w.sdnv;
+        st->index[i].idx  = i;
+    }
+    qsort(st->index, st->n_tensors, sizeof(struct _st_index), _st_index_cmp);
+    return st;
+}
+/*! \brief найти тензор по имени
+    \return описание тензора или NULL, если тензор не найден
+ */
+tensor_weight_t* qnn_safetensors_get_tensor(safetensors_t* st, const char* name){
+    struct _st_index key = {.sdnv = _cname_sdnv(st->quarks, name, 0)};
+    if (key.sdnv==0) return NULL;
+    struct _st_index* r = bsearch(&key, st->index, st->n_tensors, sizeof(struct _st_index), _st_index_cmp);
+    return r? &st->tensors[r->idx].w: NULL;
+}
+void qnn_safetensors_free(safetensors_t* st){
+    for (uint32_t k=0; k<st->n_shards; k++)
+        _st_shard_unmap(&st->shards[k]);
+    for (uint32_t k=0; k<st->n_meta; k++)
+        free(st->meta[k].value);
+    free(st->meta);
+    free(st->shards);
+    free(st->tensors);
+    free(st->index);
+    _quark_free(st->quarks);
+    free(st);
+}
+/*! \brief Форматы весов при конвертации в GGUF, \see qnn_safetensors_to_gguf() */
+typedef void (*st_from_float_t)(const float * restrict x, void * restrict y, int64_t k);
+static void _row_f32_to_f32(const float * restrict x, void * restrict y, int64_t k){
+    __builtin_memcpy(y, x, k*sizeof(float));
+}
+static void _row_f32_to_f16(const float * restrict x, void * restrict y, int64_t k){
+    ggml_half * h = y;
+    for (int64_t i=0; i<k; i++) h[i] = (ggml_half)x[i];
+}
+static const struct {
+    const char* name;
+    enum ggml_type type;
+    unsigned blck_size;
+    unsigned type_size;
+    st_from_float_t from_float;
+} st_quants[] = {
+    {"Q8_0", GGML_TYPE_Q8_0, QK8_0, sizeof(block_q8_0), (st_from_float_t)quantize_row_q8_0_ref},
+    {"Q4_K", GGML_TYPE_Q4_K, QK_K,  sizeof(block_q4_K), (st_from_float_t)quantize_row_q4_K_ref},
+    {"HF8",  GGML_TYPE_HF8,  1, 1, (st_from_float_t)convert_row_f32_to_hf8},
+    {"BF8",  GGML_TYPE_BF8,  1, 1, (st_from_float_t)convert_row_f32_to_bf8},
+    {"BF16", GGML_TYPE_BF16, 1, 2, (st_from_float_t)convert_row_f32_to_bf16},
+    {"F16",  GGML_TYPE_F16,  1, 2, _row_f32_to_f16},
+    {"F32",  GGML_TYPE_F32,  1, 4, _row_f32_to_f32},
+};
+#define ST_QUANT_F32 (sizeof(st_quants)/sizeof(st_quants[0]) - 1)
+/*! \brief формат по имени Q8_0, q4_k, hf8 ... 
+    \return индекс в таблице st_quants или -1 */
+static int _st_quant_find(const char* name){
+    for (int i=0; i<sizeof(st_quants)/sizeof(st_quants[0]); i++)
+        if (strcasecmp(name, st_quants[i].name)==0) return i;
+    return -1;
+}
+static void _st_row_to_f32(enum ggml_type type, const void * restrict x, float * restrict y, int64_t k){
+    switch (type) {
+    case GGML_TYPE_BF16: 
+        convert_row_bf16_to_f32(x, y, k); 
+        break;
+    case GGML_TYPE_F16: {
+        const ggml_half * h = x;
+        for (int64_t i=0; i<k; i++) y[i] = GGML_FP16_TO_FP32(h[i]);
+    } break;
+    default:// F32
+        __builtin_memcpy(y, x, k*sizeof(float));
+        break;
+    }
+}
+#if defined(_WIN32)
+static int pwrite(int fd, const void* buf, size_t n, uint64_t offset){
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED ov = {.Offset = (DWORD)offset, .OffsetHigh = (DWORD)(offset>>32)};
+    DWORD written = 0;
+    if (!WriteFile(h, buf, n, &written, &ov)) return -1;
+    return written;
+}
+#endif
+static int _st_pwrite(int fd, const uint8_t* data, size_t len, uint64_t offset){
+    while (len>0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n<=0) {
+            if (n<0 && errno==EINTR) continue;
+            return -1;
+        }
+        data += n, offset += n, len -= n;
+    }
+    return 0;
+}
+#define GGUF_ALIGNMENT  32
+//!< запись пары {key, type, value} заголовка GGUF
+static void _gguf_kv(GString* hdr, const char* key, uint32_t type, const void* value, size_t size){
+    const uint64_t len = strlen(key);
+    g_string_append_len(hdr, (const char*)&len, sizeof(len));
+    g_string_append_len(hdr, key, len);
+    g_string_append_len(hdr, (const char*)&type, sizeof(type));
+    if (type==GGUF_TYPE_STRING) {
+        const uint64_t n = size;
+        g_string_append_len(hdr, (const char*)&n, sizeof(n));
+    }
+    g_string_append_len(hdr, value, size);
+}
+/*! \brief Параметры модели из config.json в ключи GGUF `{arch}.*`
+    Для многомодальных моделей (Gemma3, LLaVA) параметры языковой модели в разделе text_config */
+static const struct {
+    const char* name;   //!< ключ config.json
+    const char* key;    //!< ключ GGUF без префикса архитектуры
+    uint32_t    type;
+} st_hparams[] = {
+    {"max_position_embeddings", "context_length",       GGUF_TYPE_UINT32},
+    {"hidden_size",             "embedding_length",     GGUF_TYPE_UINT32},
+    {"num_hidden_layers",       "block_count",          GGUF_TYPE_UINT32},
+    {"intermediate_size",       "feed_forward_length",  GGUF_TYPE_UINT32},
+    {"num_attention_heads",     "attention.head_count", GGUF_TYPE_UINT32},
+    {"num_key_value_heads",     "attention.head_count_kv", GGUF_TYPE_UINT32},
+    {"head_dim",                "attention.key_length", GGUF_TYPE_UINT32},
+    {"sliding_window",          "attention.sliding_window", GGUF_TYPE_UINT32},
+    {"rms_norm_eps",            "attention.layer_norm_rms_epsilon", GGUF_TYPE_FLOAT32},
+    {"rope_theta",              "rope.freq_base",       GGUF_TYPE_FLOAT32},
+    {"vocab_size",              "vocab_size",           GGUF_TYPE_UINT32},
+};
+/*! \brief Метаданные GGUF: general.alignment, general.architecture и параметры из config.json,
+    строки __metadata__ safetensors с префиксом `safetensors.`
+    \return число записанных пар
+ */
+static uint64_t _st_gguf_meta(GString* hdr, const safetensors_t* st, JsonNode* config){
+    uint64_t n_kv = 0;
+    const uint32_t alignment = GGUF_ALIGNMENT;
+    _gguf_kv(hdr, "general.alignment", GGUF_TYPE_UINT32, &alignment, sizeof(alignment)), n_kv++;
+    const char* arch = config? json_object_get_string(config, g_quark_from_string("model_type"), NULL): NULL;
+    if (arch!=NULL) {
+        _gguf_kv(hdr, "general.architecture", GGUF_TYPE_STRING, arch, strlen(arch)), n_kv++;
+        JsonNode* text = json_object_get(config, g_quark_from_string("text_config"));
+        if (text==NULL || text->type!=JSON_OBJECT) text = config;
+        char key[128];
+        for (int i=0; i<sizeof(st_hparams)/sizeof(st_hparams[0]); i++) {
+            const GQuark id = g_quark_from_string(st_hparams[i].name);
+            JsonNode* v = json_object_get(text, id);
+            if (v==NULL) v = json_object_get(config, id);
+            if (v==NULL || (v->type!=JSON_UINT && v->type!=JSON_INT && v->type!=JSON_FLOAT)) continue;
+            snprintf(key, sizeof(key), "%s.%s", arch, st_hparams[i].key);
+            if (st_hparams[i].type==GGUF_TYPE_FLOAT32) {
+                const float f = v->type==JSON_FLOAT? v->value.f: v->type==JSON_INT? v->value.i: v->value.u;
+                _gguf_kv(hdr, key, GGUF_TYPE_FLOAT32, &f, sizeof(f)), n_kv++;
+            } else if (v->type!=JSON_FLOAT) {
+                const uint32_t u = v->value.u;
+                _gguf_kv(hdr, key, GGUF_TYPE_UINT32, &u, sizeof(u)), n_kv++;
+            }
+        }
+    } else 
+        fprintf(stderr, "%s: model_type is not found in config, general.architecture is not set\n", __func__);
+    char key[256];
+    for (uint32_t k=0; k<st->n_meta; k++) {
+        snprintf(key, sizeof(key), "safetensors.%s", g_quark_to_string(st->meta[k].key));
+        _gguf_kv(hdr, key, GGUF_TYPE_STRING, st->meta[k].value, strlen(st->meta[k].value)), n_kv++;
+    }
+    return n_kv;
+}
+#define CONVERT_CHUNK   (1u<<20)// элементов в задаче конвертации, кратно QK_K
+/*! \brief Тензор в выходном файле GGUF */
+struct _st_out {
+    struct _st_tensor * t;
+    int      q;         //!< индекс формата в st_quants, -1 -- копирование без преобразования
+    size_t   n_elem;
+    uint64_t offset;    //!< смещение от начала секции данных GGUF
+    size_t   size;
+};
+struct _st_convert {
+    struct _st_out * out;
+    struct _st_chunk {
+        uint32_t idx;   //!< номер тензора
+        uint64_t elem;  //!< первый элемент
+    } * chunks;
+    int      fd;
+    uint64_t data_offset;   //!< начало секции данных в файле GGUF
+    float   ** f32;         //!< буферы потоков
+    uint8_t ** buf;
+    volatile int error;
+};
+static void _st_convert_range(void* arg, int64_t i0, int64_t i1, int ith)
+{
+    struct _st_convert* cv = arg;
+    for (int64_t c=i0; c<i1 && !cv->error; c++) {
+        struct _st_out * o = &cv->out[cv->chunks[c].idx];
+        const tensor_weight_t * w = &o->t->w;
+        const uint64_t e0 = cv->chunks[c].elem;
+        const size_t n = MIN(CONVERT_CHUNK, o->n_elem - e0);
+        const size_t esize = w->size/o->n_elem;
+        const uint8_t * src = (const uint8_t*)w->data + e0*esize;
+        const uint8_t * data = src;
+        size_t   len = n*esize;
+        uint64_t dst = cv->data_offset + o->offset + e0*esize;
+        if (o->q>=0) {// блоки не пересекают границу задачи, CONVERT_CHUNK кратно размеру блока
+            const unsigned blck = st_quants[o->q].blck_size;
+            _st_row_to_f32(w->type, src, cv->f32[ith], n);
+            st_quants[o->q].from_float(cv->f32[ith], cv->buf[ith], n);
+            data = cv->buf[ith];
+            len  = n/blck*st_quants[o->q].type_size;
+            dst  = cv->data_offset + o->offset + e0/blck*st_quants[o->q].type_size;
+        }
+        if (_st_pwrite(cv->fd, data, len, dst)!=0) {
+            fprintf(stderr, "%s: '%s': write failed: '%s'\n", __func__, g_quark_to_string(o->t->name), strerror(errno));
+            cv->error = 1;
+        }
+#if !defined(_WIN32)
+        // прочитанные страницы остаются в кеше файла, освобождаем только отображение
+        uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t b = ((uintptr_t)src + page-1) & ~(page-1);
+        uintptr_t e = ((uintptr_t)src + n*esize) & ~(page-1);
+        if (e>b) madvise((void*)b, e-b, MADV_DONTNEED);
+#endif
+    }
+}
+/*! \brief Конвертировать модель safetensors в GGUF с квантизацией весов
+
+    Матрицы F32/F16/BF16 с длиной строки кратной размеру блока квантуются в формат type,
+    одномерные тензоры (нормировки, смещения) записываются в F32, остальные копируются 
+    без преобразования. Смещения тензоров вычисляются заранее по заголовку, тензоры 
+    разбиваются на задачи по CONVERT_CHUNK элементов, задачи выполняются в пуле потоков 
+    и записываются через pwrite() на свои места в файле. Память ограничена двумя 
+    буферами CONVERT_CHUNK на поток и не зависит от размера модели.
+
+    \param type - формат весов: Q8_0, Q4_K, HF8, BF8, BF16, F16, F32
+    \param config - config.json модели или NULL, из него берутся general.architecture и параметры модели
+    \param overwrite - перезаписать существующий файл
+    \return 0 при успешной записи
+ */
+int qnn_safetensors_to_gguf(safetensors_t* st, const char* filename, const char* type, JsonNode* config, 
+        struct qnn_pool* pool, int overwrite)
+{
+    const int q = _st_quant_find(type);
+    if (q<0) {
+        fprintf(stderr, "%s: unsupported type '%s'\n", __func__, type);
+        return -1;
+    }
+    // размещение тензоров в секции данных
+    struct _st_out * out = calloc(st->n_tensors, sizeof(struct _st_out));
+    uint64_t data_size = 0, n_chunks = 0;
+    for (uint32_t i=0; i<st->n_tensors; i++) {
+        struct _st_out * o = &out[i];
+        tensor_weight_t * w = &st->tensors[i].w;
+        o->t = &st->tensors[i];
+        o->n_elem = w->ne[0]*w->ne[1]*w->ne[2]*w->ne[3];
+        o->q = -1;
+        o->size = w->size;
+        if (w->type==GGML_TYPE_F32 || w->type==GGML_TYPE_F16 || w->type==GGML_TYPE_BF16) {
+            o->q = (w->op>=2 && w->ne[0]%st_quants[q].blck_size==0)? q: ST_QUANT_F32;
+            o->size = o->n_elem/st_quants[o->q].blck_size*st_quants[o->q].type_size;
+        }
+        o->offset = ALIGN(data_size, GGUF_ALIGNMENT);
+        data_size = o->offset + o->size;
+        if (o->n_elem>0) n_chunks += (o->n_elem + CONVERT_CHUNK-1)/CONVERT_CHUNK;
+    }
+    // заголовок GGUF: magic, version, n_tensors, n_kv, {key, type, value}, {name, n_dims, ne[], type, offset}
+    GString* hdr = g_string_sized_new(64*1024);
+    const uint32_t version = 3;
+    const uint64_t n_tensors = st->n_tensors;
+    uint64_t n_kv = 0;
+    g_string_append_len(hdr, "GGUF", 4);
+    g_string_append_len(hdr, (const char*)&version,   sizeof(version));
+    g_string_append_len(hdr, (const char*)&n_tensors, sizeof(n_tensors));
+    const size_t n_kv_offs = hdr->len;
+    g_string_append_len(hdr, (const char*)&n_kv,      sizeof(n_kv));
+    n_kv = _st_gguf_meta(hdr, st, config);
+    __builtin_memcpy(hdr->str + n_kv_offs, &n_kv, sizeof(n_kv));
+    for (uint32_t i=0; i<st->n_tensors; i++) {
+        const struct _st_out * o = &out[i];
+        const char* name = g_quark_to_string(o->t->name);
+        const uint64_t len = strlen(name);
+        const uint32_t n_dims = o->t->w.op>0? o->t->w.op: 1;
+        const uint32_t ttype  = o->q<0? o->t->w.type: st_quants[o->q].type;
+        g_string_append_len(hdr, (const char*)&len, sizeof(len));
+        g_string_append_len(hdr, name, len);
+        g_string_append_len(hdr, (const char*)&n_dims, sizeof(n_dims));
+        for (uint32_t d=0; d<n_dims; d++) {
+            const uint64_t ne = o->t->w.ne[d];
+            g_string_append_len(hdr, (const char*)&ne, sizeof(ne));
+        }
+        g_string_append_len(hdr, (const char*)&ttype,     sizeof(ttype));
+        g_string_append_len(hdr, (const char*)&o->offset, sizeof(o->offset));
+    }
+    while (hdr->len % GGUF_ALIGNMENT) g_string_append_c(hdr, 0);
+
+    int flags = O_WRONLY|O_CREAT|(overwrite? O_TRUNC: O_EXCL);
+#if defined(_WIN32)
+    flags |= O_BINARY;
+#endif
+    int fd = open(filename, flags, 0644);
+    if (fd<0) {
+        fprintf(stderr, "%s: '%s': %s\n", __func__, filename, strerror(errno));
+        g_string_free(hdr, TRUE);
+        free(out);
+        return -1;
+    }
+    struct _st_convert cv = {.out = out, .fd = fd, .data_offset = hdr->len};
+#if !defined(_WIN32)
+    if (ftruncate(fd, hdr->len + data_size)!=0) {// файл заполняется задачами в произвольном порядке
+        fprintf(stderr, "%s: '%s': %s\n", __func__, filename, strerror(errno));
+        cv.error = 1;
+    }
+#endif
+    if (!cv.error && _st_pwrite(fd, (const uint8_t*)hdr->str, hdr->len, 0)!=0) {
+        fprintf(stderr, "%s: '%s': write failed: '%s'\n", __func__, filename, strerror(errno));
+        cv.error = 1;
+    }
+    cv.chunks = malloc(n_chunks*sizeof(struct _st_chunk));
+    n_chunks = 0;
+    for (uint32_t i=0; i<st->n_tensors; i++)
+        for (uint64_t e=0; e<out[i].n_elem; e+=CONVERT_CHUNK)
+            cv.chunks[n_chunks++] = (struct _st_chunk){.idx = i, .elem = e};
+    const int nth = qnn_pool_size(pool);
+    cv.f32 = calloc(nth, sizeof(float*));
+    cv.buf = calloc(nth, sizeof(uint8_t*));
+    for (int k=0; k<nth; k++) {
+        cv.f32[k] = malloc(CONVERT_CHUNK*sizeof(float));
+        cv.buf[k] = malloc(CONVERT_CHUNK*sizeof(float));
+    }
+    if (!cv.error)
+        qnn_pool_parallel_for(pool, n_chunks, 1, _st_convert_range, &cv);
+    for (int k=0; k<nth; k++) {
+        free(cv.f32[k]);
+        free(cv.buf[k]);
+    }
+    free(cv.f32);
+    free(cv.buf);
+    free(cv.chunks);
+    if (close(fd)!=0) cv.error = 1;
+    g_string_free(hdr, TRUE);
+    free(out);
+    return cv.error? -1: 0;
+}
 #include <math.h>
 
 int main(int argc, char *argv[]){
@@ -156,122 +790,138 @@ int main(int argc, char *argv[]){
 	}
     if (options.input_file) {
         printf ("input file: %s\n", options.input_file);
-        char* header = NULL;
-        size_t header_len = 0;
-        if(qnn_load_safetensors(options.input_file, &header, &header_len)) _Exit(1);
-
-        // fprintf(stdout, "%s\n", header);
-        GError * error=NULL;
-        JsonNode* json = json_value(header, NULL, &error);
-        if (json==NULL) _Exit(1);
         if (options.verbose) {
+            char* header = NULL;
+            size_t header_len = 0;
+            if(qnn_load_safetensors(options.input_file, &header, &header_len)) _Exit(1);
+            GError * error=NULL;
+            JsonNode* json = json_value(header, NULL, &error);
+            if (json==NULL) _Exit(1);
             GString *str = g_string_sized_new(header_len);
             json_to_string(json, str, 0);
-            fprintf(stdout, "%s\n -- length=%d", str->str, str->len);
+            fprintf(stdout, "%s\n -- length=%zu\n", str->str, str->len);
             g_string_free(str, TRUE);
+            json_free(json);
+            free(header);
         }
-        char cname[72];
+        safetensors_t* st = qnn_safetensors_init(options.input_file);
+        if (st==NULL) _Exit(1);
+        printf ("shards: %u tensors: %u\n", st->n_shards, st->n_tensors);
+        char cname[256];
         if (options.list) {// вывести список всех тензоров
-            GSList* list = json->value.list;
-            GQuark id_offs  = g_quark_from_string ("data_offsets");
-            GQuark id_dtype = g_quark_from_string ("dtype");
-            GQuark id_shape = g_quark_from_string ("shape");
             // сформировать пространство имен для кэширования 
             int group = -1;
-            while (list){
-                JsonNode* node = list->data;
-                if (node->type == JSON_OBJECT) {
-                    const char* dtype = json_get_string(node->value.list, id_dtype, NULL);
-                    if (dtype!=NULL) {//  && strcmp(dtype,"BF16")==0
-                        GSList* shape     = json_get_array (node->value.list, id_shape);
-                        size_t ne[GGUF_MAX_DIMS]= {0};
-                        int i;
-                        size_t len=1;
-                        for (i=0; shape!=NULL && i<GGUF_MAX_DIMS; i++) {
-                            JsonNode* n = shape->data;
-                            ne[i] = n->value.u;
-                            shape = shape->next;
-                            len*= ne[i];
-                        }
-                        int n_dim = i;
-                        GSList* data_offs = json_get_array (node->value.list, id_offs);
-                        uint64_t offs = json_array_get_uint(data_offs, 0, 0);
-                        size_t   size = json_array_get_uint(data_offs, 1, 0) - offs;
-                        const char* name  = g_quark_to_string(node->tag_id);
-                        int idx = _cname_idx(name, cname);
-                        if (idx!=group) {
-                            fprintf(stdout, "layers[%d]:\n", idx);    
-                            group = idx;
-                        }
-                        fprintf(stdout, " '%s' (%s): \tlen=%zu k\n", idx<0?name:cname, dtype, len/1024);
-                        if (options.name && strcmp(name, options.name)==0) {// анализ для тензора
-                        // U8:
-                        // BF16: 
-                            FILE * fp = fopen(options.input_file, "rb");
-                            ggml_bf16_t* data_f16 = blk_load(fp, offs+header_len+8, size*sizeof(ggml_bf16_t));
-                            uint32_t mask = 0;
-                            float v_min =  __FLT_MAX__;
-                            float v_max = -__FLT_MAX__;
-                            float scale = 0;
-                            int e_max = -256, e_min = 256;
-                            ggml_bf16_t *scales = malloc(((size+31)>>5)*sizeof(ggml_bf16_t));
-                            int8_t* exp_d = malloc(((size+31)>>5)*sizeof(uint8_t));
-                            int8_t* exp_m = malloc(((size+31)>>5)*sizeof(uint8_t));
-                            for (size_t i=0; i<size; i++) {// максимум нормировки
-                                float v = GGML_BF16_TO_FP32(data_f16[i]);
-                                int e;
-                                //v = frexpf(v, &e);
-                                //if (v==1.f) {v/=2, e++; }
-                                if ((i&31)== 0) { 
-                                    scale = 0;
-                                    e_max = -256, e_min = 256; 
-                                }
-                                if (e<e_min) e_min=e;
-                                if (e>e_max) e_max=e;
-                                if (fabsf(v)>scale) scale = fabsf(v);
-                                if ((i&31)==31) {
-                                    scales[i>>5] = GGML_FP32_TO_BF16(scale);
-                                    exp_d[i>>5] = e_max - e_min;
-                                    exp_m[i>>5] = e_max;
-                                }
-                            }
-                            for (size_t i=0; i<size; i++) {// это вариант для выявления BitNET 
-                                if ((i&31)==0) {
-                                    scale = 1.f/GGML_BF16_TO_FP32(scales[i>>5]);
-                                    //if (i<512) fprintf(stdout, "%3d:%2d:", exp_m[i>>5],exp_d[i>>5]);
-                                }
-                                float v = GGML_BF16_TO_FP32(data_f16[i])*scale;
-                                //v = ldexp(v, -exp_m[i>>5]);
-                                if (i<512) {
-                                    fprintf(stdout, "%7.3g", v);
-                                    if ((i&15)==15) fprintf(stdout, "\n");
-                                }
-                                //if (isnormal(v)) 
-                                mask |= data_f16[i].bits;
-                                if (v>v_max) v_max = v;
-                                if (v<v_min) v_min = v;
-                            }
-                            printf("mask = %04x max=%g min=%g [%zu x %zu]\n", mask, v_max, v_min, ne[0], ne[1]);
-                            size_t m = n_dim>1?32:1;
-                            for (size_t i=0; i<m; i++) {
-                                for (size_t j=0; j<8 ; j++)
-                                    fprintf(stdout, "%-8.2g", GGML_BF16_TO_FP32(scales[i*(ne[0]>>5)+j]));
-                                fprintf(stdout, "\n");
-                            }
-                            free(scales);
-                            free(data_f16);
-                            fclose(fp);
-                            break;
-                        }
-
-                    } else {
-                        fprintf(stderr, "'%s': unknown type %s\n", g_quark_to_string(node->tag_id), dtype);
-                    }
+            for (uint32_t k=0; k<st->n_tensors; k++){
+                const char* name  = g_quark_to_string(st->tensors[k].name);
+                tensor_weight_t* t = &st->tensors[k].w;
+                size_t len = t->ne[0]*t->ne[1]*t->ne[2]*t->ne[3];
+                int idx = _cname_idx(name, cname);
+                if (idx!=group) {
+                    fprintf(stdout, "layers[%d]:\n", idx);    
+                    group = idx;
+                }
+                fprintf(stdout, " '%s' (%s): \tlen=%zu k\n", idx<0?name:cname, _st_dtype_name(t->type), len/1024);
+            }
+        }
+        tensor_weight_t* t = options.name[0]!='\0'? qnn_safetensors_get_tensor(st, options.name): NULL;
+        if (t!=NULL && t->type==GGML_TYPE_BF16) {// анализ для тензора
+            // данные тензора в отображении файла
+            const ggml_bf16_t* data_f16 = t->data;
+            size_t size = t->size/sizeof(ggml_bf16_t);
+            uint32_t mask = 0;
+            float v_min =  __FLT_MAX__;
+            float v_max = -__FLT_MAX__;
+            float scale = 0;
+            int e_max = -256, e_min = 256;
+            ggml_bf16_t *scales = malloc(((size+31)>>5)*sizeof(ggml_bf16_t));
+            int8_t* exp_d = malloc(((size+31)>>5)*sizeof(uint8_t));
+            int8_t* exp_m = malloc(((size+31)>>5)*sizeof(uint8_t));
+            for (size_t i=0; i<size; i++) {// максимум нормировки
+                float v = GGML_BF16_TO_FP32(data_f16[i]);
+                int e;
+                //v = frexpf(v, &e);
+                //if (v==1.f) {v/=2, e++; }
+                if ((i&31)== 0) { 
+                    scale = 0;
+                    e_max = -256, e_min = 256; 
+                }
+                if (e<e_min) e_min=e;
+                if (e>e_max) e_max=e;
+                if (fabsf(v)>scale) scale = fabsf(v);
+                if ((i&31)==31) {
+                    scales[i>>5] = GGML_FP32_TO_BF16(scale);
+                    exp_d[i>>5] = e_max - e_min;
+                    exp_m[i>>5] = e_max;
                 }
-                list = list->next;
-            } 
+            }
+            for (size_t i=0; i<size; i++) {// это вариант для выявления BitNET 
+                if ((i&31)==0) {
+                    scale = 1.f/GGML_BF16_TO_FP32(scales[i>>5]);
+                    //if (i<512) fprintf(stdout, "%3d:%2d:", exp_m[i>>5],exp_d[i>>5]);
+                }
+                float v = GGML_BF16_TO_FP32(data_f16[i])*scale;
+                //v = ldexp(v, -exp_m[i>>5]);
+                if (i<512) {
+                    fprintf(stdout, "%7.3g", v);
+                    if ((i&15)==15) fprintf(stdout, "\n");
+                }
+                //if (isnormal(v)) 
+                mask |= data_f16[i].bits;
+                if (v>v_max) v_max = v;
+                if (v<v_min) v_min = v;
+            }
+            printf("mask = %04x max=%g min=%g [%zu x %zu]\n", mask, v_max, v_min, t->ne[0], t->ne[1]);
+            size_t m = t->op>1?32:1;
+            for (size_t i=0; i<m && i<t->ne[1]; i++) {
+                for (size_t j=0; j<8 && j<(t->ne[0]>>5); j++)
+                    fprintf(stdout, "%-8.2g", GGML_BF16_TO_FP32(scales[i*(t->ne[0]>>5)+j]));
+                fprintf(stdout, "\n");
+            }
+            free(exp_m);
+            free(exp_d);
+            free(scales);
+        } else if (options.name[0]!='\0') {
+            fprintf(stderr, "'%s': tensor not found or not BF16\n", options.name);
         }
+        if (options.output_file) {// конвертация в GGUF
+            struct qnn_pool* pool = options.threads>0? qnn_pool_new(options.threads): qnn_pool_default();
+            size_t size = 0;
+            for (uint32_t k=0; k<st->n_tensors; k++) size += st->tensors[k].w.size;
+            int64_t t0 = g_get_monotonic_time();
+            // config.json в текущем каталоге или рядом с файлом модели
+            char* config_file = g_strdup(options.config_file);
+            if (!g_file_test(config_file, G_FILE_TEST_IS_REGULAR) && strchr(options.config_file, '/')==NULL) {
+                char* dir = g_path_get_dirname(options.input_file);
+                g_free(config_file);
+                config_file = g_build_filename(dir, options.config_file, NULL);
+                g_free(dir);
+            }
+            JsonNode* config = NULL;
+            char* config_data = NULL;
+            if (g_file_get_contents(config_file, &config_data, NULL, NULL)) {
+                config = json_value(config_data, NULL, NULL);
+                if (config!=NULL && config->type!=JSON_OBJECT) {
+                    json_free(config);
+                    config = NULL;
+                }
+                g_free(config_data);
+            }
+            if (config==NULL) fprintf(stderr, "'%s': model config is not loaded\n", config_file);
+            g_free(config_file);
+            int res = qnn_safetensors_to_gguf(st, options.output_file, options.type, config, pool, options.overwrite);
+            if (config) json_free(config);
+            double dt = (g_get_monotonic_time() - t0)*1e-6;
+            if (res==0)
+                printf("output file: %s (%s) %.2f GB in %.2f s, %.2f GB/s, %d threads\n", options.output_file, 
+                    options.type, size*1e-9, dt, size*1e-9/dt, qnn_pool_size(pool));
+            if (options.threads>0) qnn_pool_free(pool);
+            if (res!=0) {
+                qnn_safetensors_free(st);
+                _Exit(1);
+            }
+        }
+        qnn_safetensors_free(st);
     }
     
 	return 0;
-}
\ No newline at end of file
+}
@@ -7,18 +7,30 @@
 #ifndef QUARK_UNDEF
  #define QUARK_UNDEF 0
 #endif
-#define Nbucket 256
+#define QUARK_SEGMENTS 32 // число сегментов, размер сегмента k>0 равен 2^(shift+k-1)
+/*! Quarks - сопоставление имен и уникальных идентификаторов с использованием хеш таблицы
+
+	Таблица допускает одновременную вставку и поиск из многих потоков без блокировок.
+	Элементы цепочек и строки хранятся в сегментах удваивающегося размера, сегменты выделяются
+	при первом обращении и не перемещаются, поэтому рост таблицы не требует копирования и
+	не мешает читателям. Новый элемент публикуется в голове цепочки bucket операцией CAS,
+	после того как заполнены его поля и строка.
+ */
+struct _QChain {
+	uint32_t next;
+	uint32_t len;		// длина строки
+	uint32_t hash;
+	const char * str;	// NULL - идентификатор зарезервирован, но не занят (вставка дубликата)
+};
 struct _QTable {
-	uint32_t n_bucket;  // число признаков, ограничимся 256 например
-	uint32_t n_chain;   // длинный список например 1024-256
-    uint32_t count ;    // число элементов 
-	char* 	 dynstr;	// словарь
-	size_t 	 dynstr_size;	// размер словаря в байтах
-	uint32_t bucket[Nbucket];// два массива подряд =n_bucket + n_chain
-	struct _QChain {
-		uint32_t next;
-		uint32_t offs;
-	} chain[0];
+	uint32_t n_bucket;	// число цепочек хеш таблицы
+	uint32_t chain_shift;	// размер первого сегмента элементов 2^chain_shift
+	_Atomic uint32_t count;	// число выданных идентификаторов
+	uint32_t dynstr_shift;	// размер первого сегмента строк 2^dynstr_shift
+	_Atomic size_t dynstr_offs;	// смещение следующей строки в сквозной нумерации сегментов
+	struct _QChain * _Atomic chain[QUARK_SEGMENTS];
+	char * _Atomic dynstr[QUARK_SEGMENTS];
+	_Atomic uint32_t bucket[];
 };
 
 static uint64_t fnv_hash(const uint8_t * data, size_t len) {
@@ -31,106 +43,274 @@ static uint64_t fnv_hash(const uint8_t * data, size_t len) {
     }
     return hash;
 }
+/*! \brief номер сегмента и смещение в сегменте для сквозного индекса i */
+static inline unsigned _segment(size_t i, unsigned shift, size_t *offs)
+{
+	if ((i >> shift) == 0) {
+		*offs = i;
+		return 0;
+	}
+	unsigned k = 64 - __builtin_clzll(i >> shift);
+	*offs = i - ((size_t)1 << (shift + k - 1));
+	return k;
+}
+static inline size_t _segment_size(unsigned k, unsigned shift)
+{
+	return (size_t)1 << (k == 0? shift: shift + k - 1);
+}
+/*! \brief сегмент k, выделяется при первом обращении
 
-/*! Quarks - сопоставление имен и уникальных идентификаторов с использованием хеш таблицы */
-
-/*! \brief Инициализация хеш таблицы
+	Если несколько потоков выделили сегмент одновременно, сохраняется первый, остальные освобождаются.
  */
-static void _quark_init(QTable_t *htable, uint32_t n_bucket) 
+static void * _segment_get(void * _Atomic * seg, unsigned k, size_t size)
 {
-	htable->n_bucket = n_bucket;
-	uint32_t i;
-	for (i=0; i<n_bucket; i++){
-		htable->bucket[i]=QUARK_UNDEF;
+	void * p = atomic_load_explicit(&seg[k], memory_order_acquire);
+	if (p == NULL) {
+		void * q = calloc(1, size);
+		if (q == NULL) return NULL;
+		if (atomic_compare_exchange_strong_explicit(&seg[k], &p, q, memory_order_acq_rel, memory_order_acquire))
+			p = q;
+		else
+			free(q);
 	}
+	return p;
 }
-/*! \brief Создать словарь с размером 
-    \param n_bucket размер хеш таблицы
-    \param n_chain  предполагаемое число слов
- */
-QTable_t * _quark_new(uint32_t n_bucket, uint32_t n_chain) 
+static inline struct _QChain * _quark_chain(QTable_t *htable, uint32_t y)
 {
-    QTable_t *htable = (QTable_t *)malloc(sizeof(QTable_t) + (n_bucket - Nbucket)*sizeof(uint32_t) + n_chain * sizeof(struct _QChain));
-	htable->n_chain = n_chain;
-	htable->dynstr_size = 1024;
-	htable->dynstr = malloc(1024);
-	htable->count = 1;// один элемент - пустая строка
-    _quark_init(htable, n_bucket);
-    struct _QChain *chain = (struct _QChain *)(htable->bucket + htable->n_bucket);
-    chain[0].offs = 0;// пустая строка, длина строки 0
-	chain[0].next = QUARK_UNDEF;
-    chain[1].offs = 0;
-    return htable;
+	size_t offs;
+	unsigned k = _segment(y, htable->chain_shift, &offs);
+	struct _QChain * seg = _segment_get((void * _Atomic *)htable->chain, k,
+			_segment_size(k, htable->chain_shift)*sizeof(struct _QChain));
+	return seg? seg + offs: NULL;
 }
+/*! \brief место для строки длиной len+1 в буфере строк
 
-/*! \brief Увеличить размер словаря
+	Строка не пересекает границу сегмента: если выделенный интервал выходит за границу,
+	он пропускается и выделяется следующий.
  */
-static 
-QTable_t * _quark_resize(QTable_t* htable, uint32_t n_chain) 
+static char * _quark_dynstr_alloc(QTable_t* htable, size_t len)
 {
-	htable = (QTable_t *)realloc(htable, sizeof(QTable_t) + (htable->n_bucket - Nbucket)*sizeof(uint32_t) + n_chain * sizeof(struct _QChain));
-	return htable;
+	const unsigned base = htable->dynstr_shift;
+	while (1) {
+		size_t o = atomic_fetch_add_explicit(&htable->dynstr_offs, len + 1, memory_order_relaxed);
+		size_t offs, end;
+		unsigned k = _segment(o, base, &offs);
+		if (k >= QUARK_SEGMENTS) return NULL;
+		if (_segment(o + len, base, &end) != k) continue;
+		char * seg = _segment_get((void * _Atomic *)htable->dynstr, k, _segment_size(k, base));
+		return seg? seg + offs: NULL;
+	}
 }
-/*! \brief Увеличить размер буфера строк
+/*! \brief Создать словарь с размером
+    \param n_bucket размер хеш таблицы
+    \param n_chain  предполагаемое число слов, таблица увеличивается при необходимости
  */
-static 
-void _quark_dynstr_resize(QTable_t* htable, uint32_t n_chain) 
+QTable_t * _quark_new(uint32_t n_bucket, uint32_t n_chain)
 {
-	size_t  dynstr_size = ((size_t)(((float)htable->dynstr_size*n_chain)/htable->n_chain) + 1023u)&~1023u;
-	htable->dynstr = (char *)realloc(htable->dynstr, dynstr_size);
-	htable->dynstr_size = dynstr_size;
+	if (n_bucket == 0) n_bucket = 1;
+	QTable_t *htable = (QTable_t *)calloc(1, sizeof(QTable_t) + n_bucket*sizeof(uint32_t));
+	htable->n_bucket = n_bucket;
+	htable->chain_shift  = n_chain > 2? 32 - __builtin_clz(n_chain - 1): 1;
+	htable->dynstr_shift = 10;
+	atomic_init(&htable->count, 1);// один элемент - пустая строка
+	atomic_init(&htable->dynstr_offs, 0);
+	for (uint32_t i=0; i<n_bucket; i++)
+		atomic_init(&htable->bucket[i], QUARK_UNDEF);
+	struct _QChain *chain = _quark_chain(htable, 0);
+	chain->str  = "";// пустая строка
+	chain->len  = 0;
+	chain->next = QUARK_UNDEF;
+	return htable;
 }
-/*! \brief Найти строку в словаре 
+void _quark_free(QTable_t * htable)
+{
+	for (int k = 0; k < QUARK_SEGMENTS; k++) {
+		free(htable->chain[k]);
+		free(htable->dynstr[k]);
+	}
+	free(htable);
+}
+/*! \brief поиск в цепочке от элемента y до элемента last, не включая */
+static uint32_t _quark_find(QTable_t * htable, uint32_t y, uint32_t last, const char *cname, size_t len, uint32_t key)
+{
+	while (y != last && y != QUARK_UNDEF) {
+		const struct _QChain * e = _quark_chain(htable, y);
+		if (e->hash == key && e->len == len && __builtin_memcmp(e->str, cname, len) == 0)
+			return y;
+		y = e->next;
+	}
+	return QUARK_UNDEF;
+}
+/*! \brief Найти строку в словаре
 	\param cname строка - текстовый идентификатор
 	\return индекс строки или QUARK_UNDEF
  */
-int _quark_lookup(QTable_t * htable, const char *cname) 
+int _quark_lookup(QTable_t * htable, const char *cname)
 {
 	size_t   len = __builtin_strlen(cname);
-	uint32_t key = fnv_hash(cname, len);
-// printf("lookup cname=%s key=%08x\n", cname, key);
-	uint32_t y = htable->bucket[key % (htable->n_bucket)];
-    const struct _QChain *chain = (const struct _QChain *)(htable->bucket + htable->n_bucket);
-	while (y<htable->count && y!=QUARK_UNDEF) {
-		if (strncmp(htable->dynstr + chain[y].offs, cname, len)==0) 
-			return y;
-		y = chain[y].next;
-	}
-	return QUARK_UNDEF;
+	uint32_t key = fnv_hash((const uint8_t *)cname, len);
+	uint32_t y = atomic_load_explicit(&htable->bucket[key % htable->n_bucket], memory_order_acquire);
+	return _quark_find(htable, y, QUARK_UNDEF, cname, len, key);
 }
 /*! \brief Добавить строку в словарь
 	\param cname строка - текстовый идентификатор
-	\return индекс добавленной строки
+	\return индекс строки, если строка уже есть в словаре - ее индекс
+
+	Элемент заполняется до публикации и не изменяется после. Если голова цепочки изменилась
+	во время вставки, новые элементы цепочки проверяются на совпадение, при совпадении
+	зарезервированный идентификатор остается незанятым.
  */
-int _quark_insert(QTable_t * htable, const char *cname) 
+int _quark_insert(QTable_t * htable, const char *cname)
 {
 	size_t len = __builtin_strlen(cname);
-	uint32_t key = fnv_hash(cname, len);
-	uint32_t y = atomic_fetch_add(&htable->count,1);
-	// if (y==htable->n_chain) htable = _quark_resize(htable, htable->n_chain*2);
-    struct _QChain *chain = (struct _QChain *)(htable->bucket + htable->n_bucket);
-	chain[y+1].offs = chain[y].offs + (len+1); // atomic_fetch_add(&htable->size, len);
-    if (htable->dynstr_size < chain[y+1].offs) {// увеличить размер буфера имен
-        // _quark_dynstr_resize(htable, );
-    }
-	__builtin_memcpy(htable->dynstr + chain[y].offs, cname, len);
-	htable->dynstr[chain[y].offs + len] = '\0';
+	uint32_t key = fnv_hash((const uint8_t *)cname, len);
+	_Atomic uint32_t * head = &htable->bucket[key % htable->n_bucket];
+	uint32_t first = atomic_load_explicit(head, memory_order_acquire);
+	uint32_t y = _quark_find(htable, first, QUARK_UNDEF, cname, len, key);
+	if (y != QUARK_UNDEF) return y;
 
-	uint32_t* head = &htable->bucket[key % htable->n_bucket];
-	// \todo атомарно do {} while(!CAS);
-	chain[y].next = *head;
-	*head = y;
-	return y;
+	y = atomic_fetch_add_explicit(&htable->count, 1, memory_order_relaxed);
+	struct _QChain *e = _quark_chain(htable, y);
+	char * str = _quark_dynstr_alloc(htable, len);
+	if (e == NULL || str == NULL) {
+		fprintf(stderr, "%s: out of memory\n", __func__);
+		return QUARK_UNDEF;
+	}
+	__builtin_memcpy(str, cname, len);
+	str[len] = '\0';
+	e->str  = str;
+	e->len  = len;
+	e->hash = key;
+	do {
+		e->next = first;
+		if (atomic_compare_exchange_weak_explicit(head, &first, y, memory_order_release, memory_order_acquire))
+			return y;
+		uint32_t z = _quark_find(htable, first, e->next, cname, len, key);
+		if (z != QUARK_UNDEF) {// вставлена другим потоком, элемент y не опубликован
+			e->str = NULL;
+			return z;
+		}
+	} while (1);
+}
+/*! \brief строка по индексу
+	\return NULL если индекс не занят
+ */
+const char * _quark_to_string(QTable_t * htable, int id)
+{
+	if (id < 0 || (uint32_t)id >= atomic_load_explicit(&htable->count, memory_order_acquire))
+		return NULL;
+	const struct _QChain * e = _quark_chain(htable, id);
+	return e->str;
 }
-/*! \brief печать таблицы имен в формате csv 
+/*! \brief печать таблицы имен в формате csv
 
 	Можно использовать для преобразования в JSON формат в виде массива имен
 	\param htable - указатель на хэш таблицу
  */
 void _quark_to_csv(QTable_t * htable){
-	struct _QChain *chain = (struct _QChain *)(htable->bucket + htable->n_bucket);
-	for (int i=1; i<htable->count; i++){
-		int len = chain[i+1].offs - chain[i].offs;
-		printf("\"%.*s\"%c", len, htable->dynstr+ chain[i].offs, (i==htable->count-1)?'\n':',');
+	uint32_t count = atomic_load(&htable->count);
+	for (uint32_t i=1; i<count; i++){
+		const struct _QChain * e = _quark_chain(htable, i);
+		printf("\"%.*s\"%c", e->str? (int)e->len: 0, e->str? e->str: "", (i==count-1)?'\n':',');
+	}
+}
+#ifdef TEST_QUARKS
+/*! Проверка и замер: вставка и поиск имен тензоров модели MoE из многих потоков
+	$ gcc -DTEST_QUARKS -O2 -o test quarks.c -lpthread
+	$ ./test [n_threads]
+ */
+#include <pthread.h>
+#include <time.h>
+#define N_LAYER  64
+#define N_EXPERT 128
+#define N_KIND   4
+#define N_NAMES  (N_LAYER*N_EXPERT*N_KIND)
+static const char * kind_names[N_KIND] = {"ffn_gate_exps", "ffn_up_exps", "ffn_down_exps", "ffn_norm"};
+static char (*names)[48];
+struct _bench {
+	QTable_t * qt;
+	int ith, nth;
+	int shared;	// все потоки вставляют все имена, иначе каждый свою часть
+	int * ids;
+	pthread_barrier_t * barrier;
+	double t0, t1, t2;	// начало и конец вставки, конец поиска
+	int errors;
+};
+static double _now(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec*1e-9;
+}
+static void * _bench_thread(void * arg){
+	struct _bench * b = arg;
+	const int i0 = b->shared? 0: (int64_t)N_NAMES*b->ith/b->nth;
+	const int i1 = b->shared? N_NAMES: (int64_t)N_NAMES*(b->ith + 1)/b->nth;
+	pthread_barrier_wait(b->barrier);
+	b->t0 = _now();
+	for (int i = i0; i < i1; i++) {// разный порядок вставки в потоках
+		int k = b->shared? (i*7919 + b->ith*104729) % N_NAMES: i;
+		b->ids[k] = _quark_insert(b->qt, names[k]);
 	}
-}
\ No newline at end of file
+	b->t1 = _now();
+	pthread_barrier_wait(b->barrier);
+	for (int r = 0; r < 4; r++)
+	for (int i = 0; i < N_NAMES; i++) {
+		int k = (i*7919 + (b->ith + r)*104729) % N_NAMES;
+		if (_quark_lookup(b->qt, names[k]) != b->ids[k] && b->ids[k] != QUARK_UNDEF) b->errors++;
+	}
+	b->t2 = _now();
+	return NULL;
+}
+int main(int argc, char ** argv){
+	const int n_threads = argc > 1? atoi(argv[1]): 8;
+	names = malloc(sizeof(*names)*N_NAMES);
+	for (int l = 0, k = 0; l < N_LAYER; l++)
+	for (int e = 0; e < N_EXPERT; e++)
+	for (int j = 0; j < N_KIND; j++, k++)
+		snprintf(names[k], sizeof(names[k]), "blk.%d.%s.%d.weight", l, kind_names[j], e);
+	int fail = 0;
+	for (int shared = 0; shared < 2; shared++) {
+		QTable_t * qt = _quark_new(N_NAMES, 1024);// цепочки и строки растут в процессе вставки
+		pthread_barrier_t barrier;
+		pthread_barrier_init(&barrier, NULL, n_threads);
+		struct _bench b[n_threads];
+		pthread_t th[n_threads];
+		int * ids = calloc((size_t)n_threads*N_NAMES, sizeof(int));
+		for (int i = 0; i < n_threads; i++) {
+			b[i] = (struct _bench){.qt = qt, .ith = i, .nth = n_threads, .shared = shared, 
+				.ids = shared? ids + (size_t)i*N_NAMES: ids, .barrier = &barrier};
+			pthread_create(&th[i], NULL, _bench_thread, &b[i]);
+		}
+		// время от начала первого потока до завершения последнего
+		double t0 = 1e300, t1 = 0, t2 = 0;
+		int errors = 0;
+		for (int i = 0; i < n_threads; i++) {
+			pthread_join(th[i], NULL);
+			t0 = b[i].t0 < t0? b[i].t0: t0;
+			t1 = b[i].t1 > t1? b[i].t1: t1;
+			t2 = b[i].t2 > t2? b[i].t2: t2;
+			errors += b[i].errors;
+		}
+		const double t_insert = t1 - t0, t_lookup = t2 - t1;
+		// одно имя - один идентификатор во всех потоках, разные имена - разные идентификаторы
+		char * used = calloc(atomic_load(&qt->count), 1);
+		for (int k = 0; k < N_NAMES; k++) {
+			int id = ids[k];
+			if (id == QUARK_UNDEF || used[id]++ || strcmp(_quark_to_string(qt, id), names[k]) != 0) errors++;
+			for (int i = 1; shared && i < n_threads; i++)
+				if (ids[(size_t)i*N_NAMES + k] != id) errors++;
+		}
+		const double n_ins = (double)N_NAMES*(shared? n_threads: 1);
+		printf("%-8s %2d threads: insert %6.2f Mops/s, lookup %6.2f Mops/s, ids %u names %d, errors %d %s\n",
+			shared? "shared": "disjoint", n_threads, n_ins/t_insert*1e-6, 4.0*N_NAMES*n_threads/t_lookup*1e-6,
+			atomic_load(&qt->count) - 1, N_NAMES, errors, errors? "fail": "ok");
+		fail += errors;
+		free(used);
+		free(ids);
+		pthread_barrier_destroy(&barrier);
+		_quark_free(qt);
+	}
+	free(names);
+	return fail != 0;
+}
+#endif
@@ -20,9 +20,22 @@
  *   - Copyright (C) 2012-2023 Yann Collet
 
     \sa https://datatracker.ietf.org/doc/html/rfc4418
+
+    Потоковый режим xxh64_init(), xxh64_update(), xxh64_final() дает тот же результат, что и xxh64(),
+    данные можно подавать частями произвольной длины, например при чтении файла блоками.
+
+    Древовидный режим xxh64_tree() для контрольных сумм файлов моделей: данные делятся на листья
+    фиксированного размера, листья хешируются параллельно в пуле потоков qnn_pool, затем хешируется
+    массив хешей листьев. Результат отличается от xxh64() и зависит от размера листа, 
+    см. LLaMa.md "Контрольная сумма в GPU".
+
+    gcc -DTEST_XXH64 -O3 -march=native -o test xxh64.c qnn_pool.c `pkgconf --cflags --libs glib-2.0` -lpthread
 */
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include "xxh64.h"
+#include "qnn_pool.h"// xxh64_tree()
 static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
 static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
 static const uint64_t Prime3 = 0x165667B19E3779F9ULL;
@@ -31,13 +44,6 @@ static const uint64_t Prime5 = 0x27D4EB2F165667C5ULL;
 
 typedef uint64_t uint64x4_t __attribute__((__vector_size__(32)));
 
-typedef struct _HashCtx HashCtx_t;
-struct _HashCtx {
-    uint64_t state[4];
-    uint8_t  block[32];
-    int offset;
-};
-
 #define ROTL64(x, n) ((x)<<n | (x)>>(64-n))
 static inline uint64_t ROUND64(uint64_t x){
     return ROTL64(x*Prime2,31)*Prime1;
@@ -45,32 +51,28 @@ static inline uint64_t ROUND64(uint64_t x){
 static inline uint64_t MERGE64(uint64_t hash, uint64_t x){
     return (hash ^ ROUND64(x))*Prime1 + Prime4;
 }
-uint64_t xxh64(uint64_t hash, uint8_t* data, size_t data_len)
-{
-    if (data_len>=32){
-        uint64x4_t state = (uint64x4_t){Prime1 + Prime2, Prime2, 0, -Prime1};
-        state+=hash;
-        int blocks = data_len>>5;
-        int  i;
-        for (i=0; i<blocks; i++) {// вектор 256 бит
-            uint64x4_t block;
-            __builtin_memcpy(&block, data, 32); data+=32;
-            state = ROTL64(state + block*Prime2, 31) * Prime1;
-        }
-        hash  = ROTL64(state[0],  1) +
-                ROTL64(state[1],  7) +
-                ROTL64(state[2], 12) +
-                ROTL64(state[3], 18);
-        hash  = MERGE64(hash, state[0]);
-        hash  = MERGE64(hash, state[1]);
-        hash  = MERGE64(hash, state[2]);
-        hash  = MERGE64(hash, state[3]);
-    } else {
-        hash = hash + Prime5;
+static inline uint64x4_t _xxh64_stripes(uint64x4_t state, const uint8_t* data, size_t blocks){
+    for (size_t i=0; i<blocks; i++) {// вектор 256 бит
+        uint64x4_t block;
+        __builtin_memcpy(&block, data, 32); data+=32;
+        state = ROTL64(state + block*Prime2, 31) * Prime1;
     }
-    hash += data_len;
-	// finalize()
-    data_len &= 0x1F;
+    return state;
+}
+static inline uint64_t _xxh64_merge(uint64x4_t state){
+    uint64_t hash;
+    hash  = ROTL64(state[0],  1) +
+            ROTL64(state[1],  7) +
+            ROTL64(state[2], 12) +
+            ROTL64(state[3], 18);
+    hash  = MERGE64(hash, state[0]);
+    hash  = MERGE64(hash, state[1]);
+    hash  = MERGE64(hash, state[2]);
+    hash  = MERGE64(hash, state[3]);
+    return hash;
+}
+//! finalize() и avalanche(), data_len - остаток меньше 32 байт
+static inline uint64_t _xxh64_tail(uint64_t hash, const uint8_t* data, size_t data_len){
     int i;
     for (i=0; i < data_len>>3; i++, data+=8)
         hash = ROTL64(hash ^ ROUND64(*(uint64_t*)data), 27) * Prime1 + Prime4;
@@ -86,6 +88,103 @@ uint64_t xxh64(uint64_t hash, uint8_t* data, size_t data_len)
     hash ^= hash >> 32;
     return hash;
 }
+uint64_t xxh64(uint64_t hash, uint8_t* data, size_t data_len)
+{
+    if (data_len>=32){
+        uint64x4_t state = (uint64x4_t){Prime1 + Prime2, Prime2, 0, -Prime1};
+        state+=hash;
+        state = _xxh64_stripes(state, data, data_len>>5);
+        data += data_len & ~(size_t)0x1F;
+        hash  = _xxh64_merge(state);
+    } else {
+        hash = hash + Prime5;
+    }
+    hash += data_len;
+    return _xxh64_tail(hash, data, data_len & 0x1F);
+}
+/*! \brief Начало потокового хеширования */
+HashCtx_t* xxh64_init(HashCtx_t* ctx, uint64_t seed)
+{
+    uint64x4_t state = (uint64x4_t){Prime1 + Prime2, Prime2, 0, -Prime1};
+    state += seed;
+    __builtin_memcpy(ctx->state, &state, 32);
+    ctx->offset = 0;
+    ctx->seed   = seed;
+    ctx->length = 0;
+    return ctx;
+}
+/*! \brief Добавление данных, неполный блок 32 байта сохраняется в контексте */
+void xxh64_update(HashCtx_t* ctx, const uint8_t* data, size_t data_len)
+{
+    uint64x4_t state;
+    __builtin_memcpy(&state, ctx->state, 32);
+    ctx->length += data_len;
+    if (ctx->offset>0) {
+        size_t n = 32 - ctx->offset;
+        if (n > data_len) n = data_len;
+        __builtin_memcpy(ctx->block + ctx->offset, data, n);
+        ctx->offset += n;
+        data += n, data_len -= n;
+        if (ctx->offset<32) return;
+        state = _xxh64_stripes(state, ctx->block, 1);
+        ctx->offset = 0;
+    }
+    state = _xxh64_stripes(state, data, data_len>>5);
+    data += data_len & ~(size_t)0x1F;
+    ctx->offset = data_len & 0x1F;
+    __builtin_memcpy(ctx->block, data, ctx->offset);
+    __builtin_memcpy(ctx->state, &state, 32);
+}
+/*! \brief Завершение, результат совпадает с xxh64(seed, data, length) */
+uint64_t xxh64_final(HashCtx_t* ctx)
+{
+    uint64_t hash;
+    if (ctx->length>=32) {
+        uint64x4_t state;
+        __builtin_memcpy(&state, ctx->state, 32);
+        hash = _xxh64_merge(state);
+    } else {
+        hash = ctx->seed + Prime5;
+    }
+    hash += ctx->length;
+    return _xxh64_tail(hash, ctx->block, ctx->offset);
+}
+struct _xxh64_tree_task {
+    const uint8_t* data;
+    size_t data_len;
+    size_t leaf_size;
+    uint64_t seed;
+    uint64_t* leaf;
+};
+static void _xxh64_leaf(void * arg, int64_t i0, int64_t i1, int ith){
+    struct _xxh64_tree_task *t = arg;
+    for (int64_t i=i0; i<i1; i++){
+        size_t offs = i*t->leaf_size;
+        size_t len  = t->data_len - offs;
+        if (len > t->leaf_size) len = t->leaf_size;
+        t->leaf[i] = xxh64(t->seed + i, (uint8_t*)t->data + offs, len);
+    }
+}
+/*! \brief Древовидный хеш: xxh64 листьев размером leaf_size вычисляется параллельно,
+    результат - xxh64 от массива хешей листьев (uint64_t little-endian).
+    Лист i хешируется с затравкой seed+i, чтобы перестановка листьев меняла результат.
+    Если данные помещаются в один лист, результат совпадает с xxh64(seed, data, data_len).
+    \param leaf_size размер листа, 0 - XXH64_LEAF_SIZE
+ */
+uint64_t xxh64_tree(uint64_t seed, const uint8_t* data, size_t data_len, size_t leaf_size)
+{
+    if (leaf_size==0) leaf_size = XXH64_LEAF_SIZE;
+    if (data_len <= leaf_size)
+        return xxh64(seed, (uint8_t*)data, data_len);
+    const int64_t n = (data_len + leaf_size - 1)/leaf_size;
+    uint64_t leaf_buf[256];
+    uint64_t* leaf = n<=256? leaf_buf: malloc(n*sizeof(uint64_t));
+    struct _xxh64_tree_task task = {.data = data, .data_len = data_len, .leaf_size = leaf_size, .seed = seed, .leaf = leaf};
+    qnn_pool_parallel_for(qnn_pool_default(), n, 1, _xxh64_leaf, &task);
+    uint64_t hash = xxh64(seed, (uint8_t*)leaf, n*sizeof(uint64_t));
+    if (leaf!=leaf_buf) free(leaf);
+    return hash;
+}
 
 #define MWC_A0 0xfffeb81bULL
 uint64_t mwc64_hash(uint64_t hash, uint8_t* data, size_t data_len){
@@ -182,4 +281,51 @@ int main() {
 	}
 	return 0;
 }
+#endif
+#ifdef TEST_XXH64
+#include <stdio.h>
+#include <time.h>
+static double _now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+int main(int argc, char** argv)
+{
+    uint8_t str[] = "abc";
+    printf("xxh64(\"\")    = %016llx ..%s\n", (unsigned long long)xxh64(0, str, 0), xxh64(0, str, 0)==0xEF46DB3751D8E999ULL? "ok": "fail");
+    printf("xxh64(\"abc\") = %016llx ..%s\n", (unsigned long long)xxh64(0, str, 3), xxh64(0, str, 3)==0x44BC2CF5AD770999ULL? "ok": "fail");
+    // потоковый режим: все длины до 300 байт, разбиение на части разной длины
+    uint8_t buf[300];
+    for (int i=0; i<sizeof(buf); i++) buf[i] = i*131 + 7;
+    int res = 1;
+    for (size_t len=0; len<=sizeof(buf); len++)
+    for (size_t step=1; step<=67; step+=11) {
+        HashCtx_t ctx;
+        xxh64_init(&ctx, len);
+        for (size_t offs=0; offs<len; offs+=step)
+            xxh64_update(&ctx, buf+offs, (len-offs)<step? len-offs: step);
+        res = res && xxh64_final(&ctx)==xxh64(len, buf, len);
+    }
+    printf("xxh64 streaming ..%s\n", res? "ok": "fail");
+    // древовидный режим
+    const size_t size = (size_t)(argc>1? atoi(argv[1]): 256)<<20;
+    uint8_t *data = malloc(size);
+    for (size_t i=0; i<size; i+=8) *(uint64_t*)(data+i) = i*Prime1;
+    const size_t leaf_size = 1u<<20;
+    uint64_t leaf[4];
+    for (int i=0; i<4; i++) leaf[i] = xxh64(5+i, data + i*leaf_size, i<3? leaf_size: 1000);
+    res = xxh64_tree(5, data, 3*leaf_size+1000, leaf_size)==xxh64(5, (uint8_t*)leaf, sizeof(leaf))
+       && xxh64_tree(5, data, leaf_size, leaf_size)==xxh64(5, data, leaf_size);
+    printf("xxh64_tree ..%s\n", res? "ok": "fail");
+    double t0 = _now();
+    uint64_t h1 = xxh64(0, data, size);
+    double t1 = _now();
+    uint64_t h2 = xxh64_tree(0, data, size, 0);
+    double t2 = _now();
+    printf("%zu MiB: xxh64 %016llx %.2f GB/s, xxh64_tree %016llx %.2f GB/s\n", size>>20,
+        (unsigned long long)h1, size/(t1-t0)*1e-9, (unsigned long long)h2, size/(t2-t1)*1e-9);
+    free(data);
+    return 0;
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+/*! Контекст потокового хеширования xxh64, \see xxh64_init() */
+typedef struct _HashCtx HashCtx_t;
+struct _HashCtx {
+    uint64_t state[4];
+    uint8_t  block[32];
+    int offset;         // число байт в block
+    uint64_t seed;
+    uint64_t length;    // общая длина данных
+};
+#define XXH64_LEAF_SIZE (4u<<20) // размер листа для xxh64_tree() по умолчанию
+
+extern uint64_t   xxh64(uint64_t hash, uint8_t* data, size_t data_len);
+extern HashCtx_t* xxh64_init  (HashCtx_t* ctx, uint64_t seed);
+extern void       xxh64_update(HashCtx_t* ctx, const uint8_t* data, size_t data_len);
+extern uint64_t   xxh64_final (HashCtx_t* ctx);
+extern uint64_t   xxh64_tree  (uint64_t seed, const uint8_t* data, size_t data_len, size_t leaf_size);
+extern uint64_t   mwc64_hash(uint64_t hash, uint8_t* data, size_t data_len);